@@ -1,11 +1,30 @@
 #include <vsynth/vsynth.h>
 #include <vsynth/stdframe.h>
+#include <stdlib.h>
+#include <string.h>
 #include <stdint.h>
+#include <math.h>
 #include <assert.h>
 
 
+/*
+
+Blankclip produces a clip of frames filled with a single colour.
+
+The frame is rendered once at activation, and every requested frame is a
+view of it with its own timestamp, so a blank clip of any length costs the
+memory and fill time of a single frame.
+
+The colour is given as 0xAARRGGBB with gamma corrected 8 bit channels, and
+converted to the output pixel format: linear gamma for the 16 bit RGB and
+mono formats, and limited range BT.601 for the YCrCb formats.
+
+*/
+
+
 struct BlankclipFilter {
-	struct Vs_Filter base;
+	struct TAG_Vs_Filter base;
+	Vs_Library vsynth;
 	size_t refcount;
 	size_t width, height;
 	uint32_t color;
@@ -13,7 +32,16 @@ struct BlankclipFilter {
 	Vs_FrameNumber length;
 };
 
-extern struct Vs_FilterVirtual blankclip_vtable;
+struct BlankclipActive {
+	struct TAG_Vs_ActiveFilter base;
+	/// The one frame all returned frames are views of
+	Vs_Frame frame;
+	Vs_Timestamp frame_duration;
+	Vs_FrameNumber length;
+};
+
+extern struct TAG_Vs_FilterVirtual blankclip_vtable;
+extern struct TAG_Vs_ActiveFilterVirtual blankclip_active_vtable;
 
 static __inline struct BlankclipFilter * GetBlankclip(Vs_Filter filter)
 {
@@ -23,12 +51,21 @@ static __inline struct BlankclipFilter * GetBlankclip(Vs_Filter filter)
 		return NULL;
 }
 
+static __inline struct BlankclipActive * GetBlankclipActive(Vs_ActiveFilter filter)
+{
+	if (filter->methods == &blankclip_active_vtable)
+		return (struct BlankclipActive *)filter;
+	else
+		return NULL;
+}
+
 
 
-VSYNTH_IMPLEMENT_METHOD(Vs_Filter, blankclip_new)(void)
+VSYNTH_IMPLEMENT_METHOD(Vs_Filter, blankclip_new)(Vs_Library vsynth)
 {
 	struct BlankclipFilter *f = (struct BlankclipFilter *)malloc(sizeof(struct BlankclipFilter));
 	f->base.methods = &blankclip_vtable;
+	f->vsynth = vsynth;
 	f->refcount = 1;
 	f->width = 0;
 	f->height = 0;
@@ -38,7 +75,7 @@ VSYNTH_IMPLEMENT_METHOD(Vs_Filter, blankclip_new)(void)
 	return &f->base;
 }
 
-struct Vs_FilterFactory blankclip_factory = {
+Vs_FilterFactory blankclip_factory = {
 	"blankclip",
 	"Blank frame source",
 	"Public domain",
@@ -67,111 +104,273 @@ VSYNTH_IMPLEMENT_METHOD(void, blankclip_unref)(Vs_Filter filter)
 VSYNTH_IMPLEMENT_METHOD(Vs_Filter, blankclip_clone)(Vs_Filter filter)
 {
 	struct BlankclipFilter *bf = GetBlankclip(filter);
-	struct BlankclipFilter *nf = GetBlankclip(blankclip_new());
+	struct BlankclipFilter *nf = GetBlankclip(blankclip_new(bf->vsynth));
 	nf->width = bf->width;
-	nf->height = bf->width;
+	nf->height = bf->height;
 	nf->color = bf->color;
 	nf->frame_duration = bf->frame_duration;
 	nf->length = bf->length;
 	return &nf->base;
 }
 
-static Vs_ActiveFilter FailActivate(Vs_String *error, const char *msg)
+
+VSYNTH_IMPLEMENT_METHOD(void, blankclip_active_destroy)(Vs_ActiveFilter filter)
 {
-	*error = Vs_MakeString(msg);
+	struct BlankclipActive *af = GetBlankclipActive(filter);
+	af->frame->methods->unref(af->frame);
+	af->base.filter->methods->unref(af->base.filter);
+	free(af);
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Frame, blankclip_active_get_frame)(Vs_ActiveFilter filter, Vs_FrameNumber n)
+{
+	struct BlankclipActive *af = GetBlankclipActive(filter);
+	Vs_Frame frame;
+
+	if (n >= af->length)
+		return NULL;
+
+	frame = af->frame->methods->view(af->frame);
+	if (frame != NULL)
+		frame->timestamp = n * af->frame_duration;
+	return frame;
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_FrameNumber, blankclip_active_get_frame_count)(Vs_ActiveFilter filter)
+{
+	return GetBlankclipActive(filter)->length;
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Timestamp, blankclip_active_get_duration)(Vs_ActiveFilter filter)
+{
+	struct BlankclipActive *af = GetBlankclipActive(filter);
+	return af->length * af->frame_duration;
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_FrameNumber, blankclip_active_frame_at_timestamp)(Vs_ActiveFilter filter, Vs_Timestamp t)
+{
+	struct BlankclipActive *af = GetBlankclipActive(filter);
+
+	// a zero frame duration gives a zero duration, so it never gets to the division
+	if (t >= af->length * af->frame_duration)
+		return FRAMENUMBER_NONE;
+	return t / af->frame_duration;
+}
+
+struct TAG_Vs_ActiveFilterVirtual blankclip_active_vtable = {
+	blankclip_active_destroy,
+	blankclip_active_get_frame,
+	blankclip_active_get_frame_count,
+	blankclip_active_get_duration,
+	NULL,
+	blankclip_active_frame_at_timestamp
+};
+
+
+/// Convert a gamma corrected 8 bit channel to linear 16 bit, using the sRGB curve
+static uint16_t LinearChannel(unsigned int c)
+{
+	double v = c / 255.0;
+	v = v <= 0.04045 ? v / 12.92 : pow((v + 0.055) / 1.055, 2.4);
+	return (uint16_t)(v * 65535.0 + 0.5);
+}
+
+/// Render the colour as one pixel for each plane of the pixel format
+///
+/// Pixels are stored in memory order, at most 8 bytes for each plane.
+static void MakePixels(enum Vs_StdframePixelFormat pixfmt, uint32_t color, unsigned char pixels[4][8])
+{
+	unsigned int a = (color >> 24) & 0xFF;
+	unsigned int r = (color >> 16) & 0xFF;
+	unsigned int g = (color >> 8) & 0xFF;
+	unsigned int b = color & 0xFF;
+	uint16_t lin[4];
+	uint16_t ycrcb[4];
+	size_t i;
+
+	// linear light, for the 16 bit RGB and mono formats
+	lin[0] = (uint16_t)(a * 257);
+	lin[1] = LinearChannel(r);
+	lin[2] = LinearChannel(g);
+	lin[3] = LinearChannel(b);
+
+	// limited range BT.601, in plane order
+	ycrcb[0] = (uint16_t)((( 66*r + 129*g +  25*b + 128) >> 8) + 16);
+	ycrcb[1] = (uint16_t)(((112*r -  94*g -  18*b + 128 + (128 << 8)) >> 8));
+	ycrcb[2] = (uint16_t)(((-38*(int)r -  74*(int)g + 112*(int)b + 128 + (128 << 8)) >> 8));
+	ycrcb[3] = (uint16_t)a;
+
+	memset(pixels, 0, 4 * 8);
+
+	switch (pixfmt)
+	{
+	case STDPIXFMT_MONO8:
+		pixels[0][0] = (unsigned char)((77*r + 150*g + 29*b + 128) >> 8);
+		break;
+	case STDPIXFMT_MONO16:
+		*(uint16_t *)pixels[0] = (uint16_t)(0.2126*lin[1] + 0.7152*lin[2] + 0.0722*lin[3] + 0.5);
+		break;
+	case STDPIXFMT_XRGB8:
+	case STDPIXFMT_ARGB8:
+		pixels[0][0] = pixfmt == STDPIXFMT_ARGB8 ? (unsigned char)a : 0;
+		pixels[0][1] = (unsigned char)r;
+		pixels[0][2] = (unsigned char)g;
+		pixels[0][3] = (unsigned char)b;
+		break;
+	case STDPIXFMT_XRGB16:
+	case STDPIXFMT_ARGB16:
+		if (pixfmt == STDPIXFMT_XRGB16)
+			lin[0] = 0;
+		memcpy(pixels[0], lin, sizeof(lin));
+		break;
+	case STDPIXFMT_YCrCb8_444:
+	case STDPIXFMT_YCrCbA8_444:
+	case STDPIXFMT_YCrCb8_422:
+	case STDPIXFMT_YCrCbA8_422:
+	case STDPIXFMT_YCrCb8_420:
+	case STDPIXFMT_YCrCbA8_420:
+		for (i = 0; i < 4; i++)
+			pixels[i][0] = (unsigned char)ycrcb[i];
+		break;
+	case STDPIXFMT_YCrCb16_444:
+	case STDPIXFMT_YCrCbA16_444:
+	case STDPIXFMT_YCrCb16_422:
+	case STDPIXFMT_YCrCbA16_422:
+	case STDPIXFMT_YCrCb16_420:
+	case STDPIXFMT_YCrCbA16_420:
+		for (i = 0; i < 3; i++)
+			*(uint16_t *)pixels[i] = (uint16_t)(ycrcb[i] << 8);
+		*(uint16_t *)pixels[3] = (uint16_t)(a * 257);
+		break;
+	default:
+		break;
+	}
+}
+
+static Vs_ActiveFilter FailActivate(struct BlankclipFilter *f, Vs_String *error, const char *msg)
+{
+	*error = f->vsynth->String->Make(msg);
 	return NULL;
 }
-VSYNTH_IMPLEMENT_METHOD(Vs_ActiveFilter, blankclip_activate)(Vs_Filter filter, Vs_String *error, struct Vs_FrameTypeDescription **frametypes)
+VSYNTH_IMPLEMENT_METHOD(Vs_ActiveFilter, blankclip_activate)(Vs_Filter filter, Vs_String *error, Vs_FrameTypeDescription **frametypes)
 {
 	struct Vs_StandardFrameTypeDescription *sfd;
-	enum Vs_StdframePixelFormat *pf;
-
-	int allow_xrgb8 = 0, allow_argb8 = 0, allow_xrgb16 = 0, allow_argb16 = 0;
+	struct Vs_StandardFrameTypeDescription *chosen = NULL;
+	enum Vs_StdframePixelFormat pixfmt, chosen_pixfmt = STDPIXFMT_MAX;
+	struct BlankclipActive *af;
+	Vs_StandardFrame frame;
+	unsigned char pixels[4][8];
+	size_t i;
 
 	struct BlankclipFilter *f = GetBlankclip(filter);
-	if (f->width < 1) return FailActivate(error, "Width is less than 1");
-	if (f->height < 1) return FailActivate(error, "Height is less than 1");
-	if (f->frame_duration == 0) return FailActivate(error, "No frame duration is set");
-	if (f->length == 0) return FailActivate(error, "No output length given");
+	if (f->width < 1) return FailActivate(f, error, "Width is less than 1");
+	if (f->height < 1) return FailActivate(f, error, "Height is less than 1");
+	if (f->frame_duration == 0) return FailActivate(f, error, "No frame duration is set");
+	if (f->length == 0) return FailActivate(f, error, "No output length given");
 
 	for (; *frametypes; frametypes++)
 	{
-		if ((*frametypes)->frame_type == (struct FrameVirtual *)&Vs_stdframe_vtable)
+		sfd = Vs_Stdframe_CheckFTD(*frametypes);
+		if (sfd == NULL)
 		{
-			sfd = (struct Vs_StandardFrameTypeDescription *)*frametypes;
-			sfd->base.out_supported = 1;
-			if (sfd->minwidth > f->width  || sfd->maxwidth < f->width || sfd->minheight > f->height || sfd->maxheight < f->height)
-			{
-				sfd->base.out_supported = 0;
-			}
-			else if (sfd->width_modulo && (f->width % sfd->width_modulo != 0))
-			{
-				sfd->base.out_supported = 0;
-			}
-			else if (sfd->height_modulo && (f->height % sfd->height_modulo != 0))
-			{
-				sfd->base.out_supported = 0;
-			}
-			else if (sfd->pixfmts)
-			{
-				for (pf = sfd->pixfmts; *pf != STDPIXFMT_MAX; pf++)
-				{
-					switch (*pf)
-					{
-					case STDPIXFMT_XRGB8:
-						allow_xrgb8 = 1;
-						break;
-					case STDPIXFMT_ARGB8:
-						allow_argb8 = 1;
-						break;
-					case STDPIXFMT_XRGB16:
-						allow_xrgb16 = 1;
-						break;
-					case STDPIXFMT_ARGB16:
-						allow_argb16 = 1;
-						break;
-					}
-				}
-				if (!(allow_xrgb8 | allow_argb8 | allow_xrgb16 | allow_argb16))
-				{
-					sfd->base.out_supported = 0;
-				}
-			}
-			else
-			{
-				allow_xrgb8 = allow_argb8 = allow_xrgb16 = allow_argb16 = 1;
-			}
+			(*frametypes)->out_supported = 0;
+			continue;
+		}
 
-			if (sfd->base.out_supported)
-			{
-				sfd->minwidth = sfd->maxwidth = f->width;
-				sfd->minheight = sfd->maxheight = f->height;
-				sfd->allow_pixfmt_change = 0;
-				sfd->allow_resolution_change = 0;
-			}
+		// any pixfmt can be rendered, take the caller's first preference
+		pixfmt = STDPIXFMT_XRGB8;
+		if (sfd->pixfmts)
+			pixfmt = sfd->pixfmts[0];
+
+		sfd->base.out_supported = 1;
+		if (sfd->minwidth > f->width  || sfd->maxwidth < f->width || sfd->minheight > f->height || sfd->maxheight < f->height)
+		{
+			sfd->base.out_supported = 0;
 		}
-		else
+		else if (sfd->width_modulo && (f->width % sfd->width_modulo != 0))
 		{
-			(*frametypes)->out_supported = 0;
+			sfd->base.out_supported = 0;
+		}
+		else if (sfd->height_modulo && (f->height % sfd->height_modulo != 0))
+		{
+			sfd->base.out_supported = 0;
+		}
+		else if (sfd->alignment > VS_STDFRAME_ALIGNMENT)
+		{
+			sfd->base.out_supported = 0;
+		}
+		else if (pixfmt >= STDPIXFMT_MAX)
+		{
+			// empty pixfmt list
+			sfd->base.out_supported = 0;
+		}
+
+		if (sfd->base.out_supported)
+		{
+			sfd->minwidth = sfd->maxwidth = f->width;
+			sfd->minheight = sfd->maxheight = f->height;
+			sfd->allow_pixfmt_change = 0;
+			sfd->allow_resolution_change = 0;
+			if (chosen == NULL)
+			{
+				chosen = sfd;
+				chosen_pixfmt = pixfmt;
+			}
 		}
 	}
 
-	if (allow_xrgb8 | allow_argb8 | allow_xrgb16 | allow_argb16)
+	if (chosen == NULL)
+		return FailActivate(f, error, "None of the offered frame types can be produced");
+
+	frame = Vs_Stdframe_NewPadded(f->vsynth, chosen_pixfmt, f->width, f->height, chosen->padding_right, chosen->padding_bottom);
+	if (frame == NULL)
+		return FailActivate(f, error, "Out of memory");
+	MakePixels(chosen_pixfmt, f->color, pixels);
+	for (i = 0; i < STDPIXFMT_planecount(chosen_pixfmt); i++)
+		Vs_Stdframe_FillPlane(frame, i, pixels[i]);
+
+	af = (struct BlankclipActive *)malloc(sizeof(struct BlankclipActive));
+	if (af == NULL)
 	{
-		// found a supported pixel format
-		// todo: create the instance!
+		frame->base.methods->unref(&frame->base);
+		return FailActivate(f, error, "Out of memory");
 	}
-	
-	return NULL;
+	af->base.methods = &blankclip_active_vtable;
+	af->base.filter = filter;
+	blankclip_addref(filter);
+	af->frame = &frame->base;
+	af->frame_duration = f->frame_duration;
+	af->length = f->length;
+
+	return &af->base;
 }
 
+/// Property IDs, in the order enum_properties reports them
+enum BlankclipProperty {
+	BLANKCLIP_WIDTH,
+	BLANKCLIP_HEIGHT,
+	BLANKCLIP_COLOR,
+	BLANKCLIP_FRAMEDUR,
+	BLANKCLIP_LENGTH,
+	BLANKCLIP_PROPERTY_COUNT
+};
+
+static const struct {
+	const char *name;
+	enum Vs_PropertyType type;
+} blankclip_properties[BLANKCLIP_PROPERTY_COUNT] = {
+	{ "width", PROP_INT },
+	{ "height", PROP_INT },
+	{ "color", PROP_INT },
+	{ "framedur", PROP_TIMESTAMP },
+	{ "length", PROP_FRAMENUMBER }
+};
+
 VSYNTH_IMPLEMENT_METHOD(void, blankclip_enum_properties)(Vs_EnumPropertiesFunc callback, void *userdata)
 {
-	callback("width", PROP_INT, userdata);
-	callback("height", PROP_INT, userdata);
-	callback("color", PROP_INT, userdata);
-	callback("framedur", PROP_TIMESTAMP, userdata);
-	callback("length", PROP_FRAMENUMBER, userdata);
+	int i;
+	for (i = 0; i < BLANKCLIP_PROPERTY_COUNT; i++)
+		callback(blankclip_properties[i].name, blankclip_properties[i].type, userdata);
 }
 
 VSYNTH_IMPLEMENT_METHOD(Vs_Filter, blankclip_get_property_filter)(Vs_Filter filter, const char *name)
@@ -257,8 +456,61 @@ VSYNTH_IMPLEMENT_METHOD(void, blankclip_set_property_timestamp)(Vs_Filter filter
 		f->frame_duration = value;
 }
 
+VSYNTH_IMPLEMENT_METHOD(int, blankclip_get_property_by_id)(Vs_Filter filter, Vs_PropertyId id, Vs_PropertyValue *value)
+{
+	struct BlankclipFilter *f = GetBlankclip(filter);
+	if (id < 0 || id >= BLANKCLIP_PROPERTY_COUNT)
+		return 0;
+	value->type = blankclip_properties[id].type;
+	switch (id)
+	{
+	case BLANKCLIP_WIDTH:
+		value->v.i = f->width;
+		break;
+	case BLANKCLIP_HEIGHT:
+		value->v.i = f->height;
+		break;
+	case BLANKCLIP_COLOR:
+		value->v.i = f->color;
+		break;
+	case BLANKCLIP_FRAMEDUR:
+		value->v.ts = f->frame_duration;
+		break;
+	case BLANKCLIP_LENGTH:
+		value->v.fn = f->length;
+		break;
+	}
+	return 1;
+}
 
-struct Vs_FilterVirtual blankclip_vtable = {
+VSYNTH_IMPLEMENT_METHOD(int, blankclip_set_property_by_id)(Vs_Filter filter, Vs_PropertyId id, const Vs_PropertyValue *value)
+{
+	struct BlankclipFilter *f = GetBlankclip(filter);
+	if (id < 0 || id >= BLANKCLIP_PROPERTY_COUNT || value->type != blankclip_properties[id].type)
+		return 0;
+	switch (id)
+	{
+	case BLANKCLIP_WIDTH:
+		f->width = (size_t)value->v.i;
+		break;
+	case BLANKCLIP_HEIGHT:
+		f->height = (size_t)value->v.i;
+		break;
+	case BLANKCLIP_COLOR:
+		f->color = (uint32_t)value->v.i;
+		break;
+	case BLANKCLIP_FRAMEDUR:
+		f->frame_duration = value->v.ts;
+		break;
+	case BLANKCLIP_LENGTH:
+		f->length = value->v.fn;
+		break;
+	}
+	return 1;
+}
+
+
+struct TAG_Vs_FilterVirtual blankclip_vtable = {
 	blankclip_addref,
 	blankclip_unref,
 	blankclip_clone,
@@ -275,25 +527,13 @@ struct Vs_FilterVirtual blankclip_vtable = {
 	blankclip_set_property_double,
 	blankclip_set_property_string,
 	blankclip_set_property_framenumber,
-	blankclip_set_property_timestamp
+	blankclip_set_property_timestamp,
+	blankclip_get_property_by_id,
+	blankclip_set_property_by_id
 };
 
 
-#ifdef _WIN32
-#define WIN32_LEAN_AND_MEAN
-#include <Windows.h>
-
-BOOL WINAPI DllMain(__in  HINSTANCE hinstDLL, __in  DWORD fdwReason, __in  LPVOID lpvReserved)
+VSYNTH_API(void) Vs_PluginInit(Vs_Library vsynth)
 {
-	if (fdwReason == DLL_PROCESS_ATTACH)
-	{
-		Vs_RegisterFilter(&blankclip_factory);
-	}
-	else if (fdwReason == DLL_PROCESS_DETACH)
-	{
-		// unregister?
-	}
-
-	return TRUE;
+	vsynth->FilterRegistry->Register(vsynth, &blankclip_factory);
 }
-#endif
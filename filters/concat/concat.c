@@ -0,0 +1,692 @@
+#include <vsynth/vsynth.h>
+#include <vsynth/stdframe.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+
+/*
+
+Concat plays clip2 after clip1.
+
+Longer sequences are made by nesting concats. At activation the tree of
+nested concats is flattened into a list of segments, and each segment is
+activated on its own, so however the concats are nested, finding the segment
+of a frame is a binary search over the first frame numbers of the segments,
+O(log segments). Edit decision lists splicing hundreds of trims of the same
+source are the typical use. Finding the frame at a timestamp is the same
+search over the start times of the segments, then a seek in the segment.
+A segment whose first frame starts after its start time leaves a gap, which
+shows the last frame of the segments before it, or the first frame if there
+are none, as the output starts at time 0.
+
+Frames are passed through without touching their contents. Each segment's
+timestamps are shifted by the total duration of the segments before it; the
+first segment's frames are handed out as they are, later segments' frames
+are views of the input frames with the new timestamps.
+
+The first segment negotiates the frame type with the caller. The other
+segments are then asked for exactly the stdframe type the first promised,
+so all segments deliver the same pixfmt and size. If the first segment's
+promise leaves the pixfmt open, its first frame is requested to find out
+which one it delivers. Only the last segment may have an unknown length.
+
+*/
+
+
+struct ConcatFilter {
+	struct TAG_Vs_Filter base;
+	Vs_Library vsynth;
+	size_t refcount;
+	Vs_Filter clip1;
+	Vs_Filter clip2;
+};
+
+struct ConcatActive {
+	struct TAG_Vs_ActiveFilter base;
+	Vs_Library vsynth;
+	size_t count;
+	/// Output frame number of the first frame of each segment, ascending
+	///
+	/// Kept apart from the other segment data so the search reads as little
+	/// memory as possible.
+	Vs_FrameNumber *firsts;
+	/// Amount added to the timestamps of each segment
+	Vs_Timestamp *offsets;
+	Vs_ActiveFilter *segments;
+	/// Total frame count or FRAMECOUNT_UNKNOWN
+	Vs_FrameNumber frames;
+	/// Total duration or DURATION_UNKNOWN
+	Vs_Timestamp duration;
+};
+
+/// A forwarded asynchronous request, see concat_active_get_frame_async
+struct ConcatRequest {
+	Vs_FrameCallback callback;
+	void *userdata;
+	Vs_Timestamp offset;
+};
+
+extern struct TAG_Vs_FilterVirtual concat_vtable;
+extern struct TAG_Vs_ActiveFilterVirtual concat_active_vtable;
+
+static __inline struct ConcatFilter * GetConcat(Vs_Filter filter)
+{
+	if (filter->methods == &concat_vtable)
+		return (struct ConcatFilter *)filter;
+	else
+		return NULL;
+}
+
+static __inline struct ConcatActive * GetConcatActive(Vs_ActiveFilter filter)
+{
+	if (filter->methods == &concat_active_vtable)
+		return (struct ConcatActive *)filter;
+	else
+		return NULL;
+}
+
+
+/// Find the segment holding output frame n, which must be below the frame count
+///
+/// Empty segments share their first frame number with the next segment, so
+/// the last segment starting at or before n is the one holding it.
+static size_t FindSegment(struct ConcatActive *af, Vs_FrameNumber n)
+{
+	size_t lo = 0, hi = af->count, mid;
+
+	// firsts[lo] <= n < firsts[hi], with firsts[count] taken as infinite
+	while (hi - lo > 1)
+	{
+		mid = lo + (hi - lo) / 2;
+		if (af->firsts[mid] <= n)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/// Move a frame forward in time by offset, takes over the reference to frame
+static Vs_Frame Retime(Vs_Frame frame, Vs_Timestamp offset)
+{
+	Vs_Frame view;
+
+	if (frame == NULL || offset == 0)
+		return frame;
+	// the input frame may be shared, so the new timestamp goes on a view
+	view = frame->methods->view(frame);
+	if (view != NULL)
+		view->timestamp = frame->timestamp + offset;
+	frame->methods->unref(frame);
+	return view;
+}
+
+static void FreeSegments(struct ConcatActive *af)
+{
+	size_t i;
+
+	for (i = 0; i < af->count; i++)
+		af->segments[i]->methods->destroy(af->segments[i]);
+	free(af->firsts);
+	free(af->offsets);
+	free(af->segments);
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, concat_active_destroy)(Vs_ActiveFilter filter)
+{
+	struct ConcatActive *af = GetConcatActive(filter);
+	FreeSegments(af);
+	af->base.filter->methods->unref(af->base.filter);
+	free(af);
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Frame, concat_active_get_frame)(Vs_ActiveFilter filter, Vs_FrameNumber n)
+{
+	struct ConcatActive *af = GetConcatActive(filter);
+	Vs_ActiveFilter segment;
+	size_t i;
+
+	if (n >= af->frames)
+		return NULL;
+	i = FindSegment(af, n);
+	segment = af->segments[i];
+	return Retime(segment->methods->get_frame(segment, n - af->firsts[i]), af->offsets[i]);
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_FrameNumber, concat_active_get_frame_count)(Vs_ActiveFilter filter)
+{
+	return GetConcatActive(filter)->frames;
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Timestamp, concat_active_get_duration)(Vs_ActiveFilter filter)
+{
+	return GetConcatActive(filter)->duration;
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_FrameNumber, concat_active_frame_at_timestamp)(Vs_ActiveFilter filter, Vs_Timestamp t)
+{
+	struct ConcatActive *af = GetConcatActive(filter);
+	size_t lo = 0, hi = af->count, mid;
+	Vs_FrameNumber n;
+
+	if (af->frames == 0 || (af->duration != DURATION_UNKNOWN && t >= af->duration))
+		return FRAMENUMBER_NONE;
+	// offsets[lo] <= t < offsets[hi], the same search as FindSegment
+	while (hi - lo > 1)
+	{
+		mid = lo + (hi - lo) / 2;
+		if (af->offsets[mid] <= t)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	n = af->vsynth->Seek->FrameAtTimestamp(af->vsynth, af->segments[lo], t - af->offsets[lo]);
+	// before the segment's first frame the previous segment is still shown
+	if (n == FRAMENUMBER_NONE)
+		return af->firsts[lo] > 0 ? af->firsts[lo] - 1 : af->firsts[lo];
+	return af->firsts[lo] + n;
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, ConcatFrameReady)(Vs_Frame frame, void *userdata)
+{
+	struct ConcatRequest request = *(struct ConcatRequest *)userdata;
+	free(userdata);
+	request.callback(Retime(frame, request.offset), request.userdata);
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, concat_active_get_frame_async)(Vs_ActiveFilter filter, Vs_FrameNumber n, Vs_FrameCallback callback, void *userdata)
+{
+	struct ConcatActive *af = GetConcatActive(filter);
+	struct ConcatRequest *request;
+	size_t i;
+
+	if (n >= af->frames)
+	{
+		callback(NULL, userdata);
+		return;
+	}
+	i = FindSegment(af, n);
+	// the segment's own asynchronous path is kept, so concatenating never blocks a thread
+	if (af->offsets[i] == 0)
+	{
+		af->vsynth->Async->GetFrame(af->vsynth, af->segments[i], n - af->firsts[i], callback, userdata);
+		return;
+	}
+	request = (struct ConcatRequest *)malloc(sizeof(struct ConcatRequest));
+	if (request == NULL)
+	{
+		callback(NULL, userdata);
+		return;
+	}
+	request->callback = callback;
+	request->userdata = userdata;
+	request->offset = af->offsets[i];
+	af->vsynth->Async->GetFrame(af->vsynth, af->segments[i], n - af->firsts[i], ConcatFrameReady, request);
+}
+
+struct TAG_Vs_ActiveFilterVirtual concat_active_vtable = {
+	concat_active_destroy,
+	concat_active_get_frame,
+	concat_active_get_frame_count,
+	concat_active_get_duration,
+	concat_active_get_frame_async,
+	concat_active_frame_at_timestamp
+};
+
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Filter, concat_new)(Vs_Library vsynth)
+{
+	struct ConcatFilter *f = (struct ConcatFilter *)malloc(sizeof(struct ConcatFilter));
+	f->base.methods = &concat_vtable;
+	f->vsynth = vsynth;
+	f->refcount = 1;
+	f->clip1 = NULL;
+	f->clip2 = NULL;
+	return &f->base;
+}
+
+Vs_FilterFactory concat_factory = {
+	"concat",
+	"Clips played one after another",
+	"Public domain",
+	concat_new
+};
+
+
+VSYNTH_IMPLEMENT_METHOD(void, concat_addref)(Vs_Filter filter)
+{
+	struct ConcatFilter *cf = GetConcat(filter);
+	cf->refcount++;
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, concat_unref)(Vs_Filter filter)
+{
+	struct ConcatFilter *cf = GetConcat(filter);
+	assert(cf->refcount > 0);
+	cf->refcount--;
+
+	if (cf->refcount == 0)
+	{
+		if (cf->clip1 != NULL)
+			cf->clip1->methods->unref(cf->clip1);
+		if (cf->clip2 != NULL)
+			cf->clip2->methods->unref(cf->clip2);
+		free(cf);
+	}
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Filter, concat_clone)(Vs_Filter filter)
+{
+	struct ConcatFilter *cf = GetConcat(filter);
+	struct ConcatFilter *nf = GetConcat(concat_new(cf->vsynth));
+	nf->clip1 = cf->clip1;
+	if (nf->clip1 != NULL)
+		nf->clip1->methods->addref(nf->clip1);
+	nf->clip2 = cf->clip2;
+	if (nf->clip2 != NULL)
+		nf->clip2->methods->addref(nf->clip2);
+	return &nf->base;
+}
+
+static Vs_ActiveFilter FailActivate(struct ConcatFilter *f, Vs_String *error, const char *msg)
+{
+	*error = f->vsynth->String->Make(msg);
+	return NULL;
+}
+
+/// List the clips of a tree of nested concats in playing order
+///
+/// Done with an explicit stack, as edit decision lists can nest concats
+/// thousands deep. Returns NULL with a message in *msg on failure.
+static Vs_Filter *Flatten(struct ConcatFilter *f, size_t *count, const char **msg)
+{
+	Vs_Filter *stack = NULL, *leaves = NULL, *grown;
+	size_t depth = 0, stack_size = 0, leaf_count = 0, leaf_size = 0;
+	struct ConcatFilter *node;
+	Vs_Filter clip;
+
+	*msg = "Out of memory";
+	stack_size = 16;
+	stack = (Vs_Filter *)malloc(stack_size * sizeof(Vs_Filter));
+	if (stack == NULL)
+		return NULL;
+	stack[depth++] = &f->base;
+
+	while (depth > 0)
+	{
+		clip = stack[--depth];
+		node = GetConcat(clip);
+		if (node != NULL)
+		{
+			if (node->clip1 == NULL)
+			{
+				*msg = "No input clip given";
+				break;
+			}
+			if (depth + 2 > stack_size)
+			{
+				stack_size *= 2;
+				grown = (Vs_Filter *)realloc(stack, stack_size * sizeof(Vs_Filter));
+				if (grown == NULL)
+					break;
+				stack = grown;
+			}
+			// clip1 is popped first
+			if (node->clip2 != NULL)
+				stack[depth++] = node->clip2;
+			stack[depth++] = node->clip1;
+			continue;
+		}
+
+		if (leaf_count == leaf_size)
+		{
+			leaf_size = leaf_size ? leaf_size * 2 : 16;
+			grown = (Vs_Filter *)realloc(leaves, leaf_size * sizeof(Vs_Filter));
+			if (grown == NULL)
+				break;
+			leaves = grown;
+		}
+		leaves[leaf_count++] = clip;
+	}
+
+	free(stack);
+	if (depth > 0)
+	{
+		free(leaves);
+		return NULL;
+	}
+	*count = leaf_count;
+	*msg = NULL;
+	return leaves;
+}
+
+/// Make the stdframe type the first segment promised exact, for the others
+///
+/// Returns zero if the first segment's frames can't be found out.
+static int PinFrameType(Vs_ActiveFilter first, struct Vs_StandardFrameTypeDescription *sfd, enum Vs_StdframePixelFormat pinned[2])
+{
+	Vs_Frame frame;
+	Vs_StandardFrame sf;
+
+	if (sfd->allow_pixfmt_change || sfd->allow_resolution_change)
+		return 1;
+	if (sfd->pixfmts != NULL && sfd->pixfmts[0] != STDPIXFMT_MAX && sfd->pixfmts[1] == STDPIXFMT_MAX && sfd->minwidth == sfd->maxwidth && sfd->minheight == sfd->maxheight)
+		return 1;
+
+	frame = first->methods->get_frame(first, 0);
+	if (frame == NULL)
+		return 1;
+	sf = Vs_Stdframe_Get(frame);
+	if (sf == NULL)
+	{
+		frame->methods->unref(frame);
+		return 0;
+	}
+	pinned[0] = sf->pixfmt;
+	pinned[1] = STDPIXFMT_MAX;
+	sfd->pixfmts = pinned;
+	sfd->minwidth = sfd->maxwidth = sf->width;
+	sfd->minheight = sfd->maxheight = sf->height;
+	frame->methods->unref(frame);
+	return 1;
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_ActiveFilter, concat_activate)(Vs_Filter filter, Vs_String *error, Vs_FrameTypeDescription **frametypes)
+{
+	struct ConcatFilter *f = GetConcat(filter);
+	struct Vs_StandardFrameTypeDescription *sfd;
+	struct Vs_StandardFrameTypeDescription *chosen = NULL;
+	struct Vs_StandardFrameTypeDescription pinned, upsfd;
+	enum Vs_StdframePixelFormat pinned_pixfmts[2];
+	Vs_FrameTypeDescription *upftds[2];
+	Vs_FrameTypeDescription **ft;
+	struct ConcatActive *af;
+	Vs_Filter *clips;
+	Vs_FrameNumber frames;
+	Vs_Timestamp duration;
+	const char *msg;
+	size_t count, i;
+
+	clips = Flatten(f, &count, &msg);
+	if (clips == NULL)
+		return FailActivate(f, error, msg);
+
+	af = (struct ConcatActive *)malloc(sizeof(struct ConcatActive));
+	if (af != NULL)
+	{
+		af->count = 0;
+		af->firsts = (Vs_FrameNumber *)malloc(count * sizeof(Vs_FrameNumber));
+		af->offsets = (Vs_Timestamp *)malloc(count * sizeof(Vs_Timestamp));
+		af->segments = (Vs_ActiveFilter *)malloc(count * sizeof(Vs_ActiveFilter));
+	}
+	if (af == NULL || af->firsts == NULL || af->offsets == NULL || af->segments == NULL)
+	{
+		if (af != NULL)
+			FreeSegments(af);
+		free(af);
+		free(clips);
+		return FailActivate(f, error, "Out of memory");
+	}
+
+	// the first segment chooses the frame type
+	msg = NULL;
+	af->segments[0] = f->vsynth->Graph->Activate(f->vsynth, clips[0], error, frametypes);
+	if (af->segments[0] == NULL)
+		msg = "";
+	else
+		af->count = 1;
+
+	if (msg == NULL && count > 1)
+	{
+		for (ft = frametypes; *ft; ft++)
+		{
+			sfd = Vs_Stdframe_CheckFTD(*ft);
+			if (sfd != NULL && sfd->base.out_supported && chosen == NULL)
+				chosen = sfd;
+			else
+				(*ft)->out_supported = 0;
+		}
+		if (chosen == NULL)
+			msg = "Only clips of stdframes can be concatenated";
+		else
+		{
+			pinned = *chosen;
+			if (!PinFrameType(af->segments[0], &pinned, pinned_pixfmts))
+				msg = "The first clip does not deliver stdframes";
+		}
+	}
+
+	// the others must deliver the same
+	for (i = 1; msg == NULL && i < count; i++)
+	{
+		upsfd = pinned;
+		upsfd.base.out_supported = 0;
+		upftds[0] = &upsfd.base;
+		upftds[1] = NULL;
+		af->segments[i] = f->vsynth->Graph->Activate(f->vsynth, clips[i], error, upftds);
+		if (af->segments[i] == NULL)
+		{
+			msg = "";
+			break;
+		}
+		af->count++;
+		if (!upsfd.base.out_supported)
+			msg = "A clip does not deliver the pixfmt and size of the first clip";
+		else
+		{
+			chosen->allow_resolution_change |= upsfd.allow_resolution_change;
+			chosen->allow_pixfmt_change |= upsfd.allow_pixfmt_change;
+		}
+	}
+	free(clips);
+
+	// prefix sums of the segment lengths
+	frames = 0;
+	duration = 0;
+	for (i = 0; msg == NULL && i < count; i++)
+	{
+		af->firsts[i] = frames;
+		af->offsets[i] = duration;
+		frames = af->segments[i]->methods->get_frame_count(af->segments[i]);
+		duration = af->segments[i]->methods->get_duration(af->segments[i]);
+		if (frames == FRAMECOUNT_UNKNOWN || duration == DURATION_UNKNOWN)
+		{
+			if (i + 1 < count)
+				msg = "Only the last clip may have an unknown length";
+			frames = frames == FRAMECOUNT_UNKNOWN ? FRAMECOUNT_UNKNOWN : af->firsts[i] + frames;
+			duration = duration == DURATION_UNKNOWN ? DURATION_UNKNOWN : af->offsets[i] + duration;
+		}
+		else
+		{
+			frames += af->firsts[i];
+			duration += af->offsets[i];
+		}
+	}
+
+	if (msg != NULL)
+	{
+		FreeSegments(af);
+		free(af);
+		// an empty message means a segment's activation has set the error
+		return msg[0] != '\0' ? FailActivate(f, error, msg) : NULL;
+	}
+
+	af->base.methods = &concat_active_vtable;
+	af->base.filter = filter;
+	concat_addref(filter);
+	af->vsynth = f->vsynth;
+	af->frames = frames;
+	af->duration = duration;
+	return &af->base;
+}
+
+
+/// Property IDs, in the order enum_properties reports them
+enum ConcatProperty {
+	CONCAT_CLIP1,
+	CONCAT_CLIP2,
+	CONCAT_PROPERTY_COUNT
+};
+
+static const struct {
+	const char *name;
+	enum Vs_PropertyType type;
+} concat_properties[CONCAT_PROPERTY_COUNT] = {
+	{ "clip1", PROP_FILTER },
+	{ "clip2", PROP_FILTER }
+};
+
+VSYNTH_IMPLEMENT_METHOD(void, concat_enum_properties)(Vs_EnumPropertiesFunc callback, void *userdata)
+{
+	int i;
+	for (i = 0; i < CONCAT_PROPERTY_COUNT; i++)
+		callback(concat_properties[i].name, concat_properties[i].type, userdata);
+}
+
+static void SetClip(Vs_Filter *field, Vs_Filter value)
+{
+	if (value != NULL)
+		value->methods->addref(value);
+	if (*field != NULL)
+		(*field)->methods->unref(*field);
+	*field = value;
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Filter, concat_get_property_filter)(Vs_Filter filter, const char *name)
+{
+	struct ConcatFilter *f = GetConcat(filter);
+	Vs_Filter clip = NULL;
+	if (strcmp(name, "clip1") == 0)
+		clip = f->clip1;
+	else if (strcmp(name, "clip2") == 0)
+		clip = f->clip2;
+	if (clip != NULL)
+		clip->methods->addref(clip);
+	return clip;
+}
+
+VSYNTH_IMPLEMENT_METHOD(long long, concat_get_property_int)(Vs_Filter filter, const char *name)
+{
+	return 0; // no int properties
+}
+
+VSYNTH_IMPLEMENT_METHOD(double, concat_get_property_double)(Vs_Filter filter, const char *name)
+{
+	return 0; // no double properties
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_String, concat_get_property_string)(Vs_Filter filter, const char *name)
+{
+	return NULL; // no string properties
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_FrameNumber, concat_get_property_framenumber)(Vs_Filter filter, const char *name)
+{
+	return 0; // no framenumber properties
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Timestamp, concat_get_property_timestamp)(Vs_Filter filter, const char *name)
+{
+	return 0; // no timestamp properties
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, concat_set_property_filter)(Vs_Filter filter, const char *name, Vs_Filter value)
+{
+	struct ConcatFilter *f = GetConcat(filter);
+	if (strcmp(name, "clip1") == 0)
+		SetClip(&f->clip1, value);
+	else if (strcmp(name, "clip2") == 0)
+		SetClip(&f->clip2, value);
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, concat_set_property_int)(Vs_Filter filter, const char *name, long long value)
+{
+	// no int properties
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, concat_set_property_double)(Vs_Filter filter, const char *name, double value)
+{
+	// no double properties
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, concat_set_property_string)(Vs_Filter filter, const char *name, Vs_String value)
+{
+	// no string properties
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, concat_set_property_framenumber)(Vs_Filter filter, const char *name, Vs_FrameNumber value)
+{
+	// no framenumber properties
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, concat_set_property_timestamp)(Vs_Filter filter, const char *name, Vs_Timestamp value)
+{
+	// no timestamp properties
+}
+
+VSYNTH_IMPLEMENT_METHOD(int, concat_get_property_by_id)(Vs_Filter filter, Vs_PropertyId id, Vs_PropertyValue *value)
+{
+	struct ConcatFilter *f = GetConcat(filter);
+	if (id < 0 || id >= CONCAT_PROPERTY_COUNT)
+		return 0;
+	value->type = concat_properties[id].type;
+	switch (id)
+	{
+	case CONCAT_CLIP1:
+		value->v.f = f->clip1;
+		break;
+	case CONCAT_CLIP2:
+		value->v.f = f->clip2;
+		break;
+	}
+	if (value->v.f != NULL)
+		value->v.f->methods->addref(value->v.f);
+	return 1;
+}
+
+VSYNTH_IMPLEMENT_METHOD(int, concat_set_property_by_id)(Vs_Filter filter, Vs_PropertyId id, const Vs_PropertyValue *value)
+{
+	struct ConcatFilter *f = GetConcat(filter);
+	if (id < 0 || id >= CONCAT_PROPERTY_COUNT || value->type != concat_properties[id].type)
+		return 0;
+	switch (id)
+	{
+	case CONCAT_CLIP1:
+		SetClip(&f->clip1, value->v.f);
+		break;
+	case CONCAT_CLIP2:
+		SetClip(&f->clip2, value->v.f);
+		break;
+	}
+	return 1;
+}
+
+
+struct TAG_Vs_FilterVirtual concat_vtable = {
+	concat_addref,
+	concat_unref,
+	concat_clone,
+	concat_activate,
+	concat_enum_properties,
+	concat_get_property_filter,
+	concat_get_property_int,
+	concat_get_property_double,
+	concat_get_property_string,
+	concat_get_property_framenumber,
+	concat_get_property_timestamp,
+	concat_set_property_filter,
+	concat_set_property_int,
+	concat_set_property_double,
+	concat_set_property_string,
+	concat_set_property_framenumber,
+	concat_set_property_timestamp,
+	concat_get_property_by_id,
+	concat_set_property_by_id
+};
+
+
+VSYNTH_API(void) Vs_PluginInit(Vs_Library vsynth)
+{
+	vsynth->FilterRegistry->Register(vsynth, &concat_factory);
+}
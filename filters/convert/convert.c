@@ -0,0 +1,1190 @@
+#include <vsynth/vsynth.h>
+#include <vsynth/stdframe.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <assert.h>
+#if VSYNTH_SSE2
+# include <emmintrin.h>
+#endif
+
+
+/*
+
+Convert changes the pixel format of stdframes, between any two stdpixfmts.
+
+Frames are split into slices of even height, converted in parallel on the
+library's worker threads. Within a slice, frames are converted two
+scanlines at a time, so 4:2:0 chroma lines can be handled as a unit. Each
+group of lines goes through three stages, all working on small line
+buffers that stay in the cache:
+
+ 1. Unpack the source lines into four 16 bit working channels at full
+    resolution. Subsampled chroma is upsampled by repeating samples. Missing
+    alpha becomes opaque.
+ 2. If the source and destination are in different colour families, apply
+    the RGB <-> YCrCb matrix.
+ 3. Pack the working channels into the destination lines. Chroma is
+    downsampled by averaging, and alpha is dropped if there is nowhere to put
+    it.
+
+The working channels are R, G, B, A for RGB and mono formats, and Y, Cr, Cb,
+A for YCrCb formats, in 16 bit precision. RGB values are gamma corrected
+full range, so the linear 16 bit formats are run through a transfer curve
+lookup table on the way in and out. YCrCb values are limited range, 8 bit
+levels shifted up by 8 bits.
+
+The input is asked for pixfmts in order of the cost of converting them, see
+Vs_Stdframe_RankPixfmts. Filters between a source and a convert pass the
+pixfmts they can handle on in the same order, so the source delivers the
+cheapest pixfmt the whole chain can work with, and never one losing
+information the output could hold while another would do.
+
+Frames already in the output pixfmt are passed through. Before activation, a
+convert of a convert to the same pixfmt is dropped, as it would only ever
+pass frames through.
+
+*/
+
+
+/// YCrCb matrices, selected by the "matrix" property
+enum ConvertMatrix {
+	MATRIX_BT601 = 601,
+	MATRIX_BT709 = 709,
+	MATRIX_BT2020 = 2020
+};
+
+/// Limited range scale factors for 16 bit luma and chroma
+#define LUMA_SCALE (219.0f * 256.0f / 65535.0f)
+#define CHROMA_SCALE (224.0f * 256.0f / 65535.0f)
+
+/// An affine colour transform: out = out_off + m * (in - in_off)
+struct Matrix {
+	float m[3][3];
+	float in_off[3];
+	float out_off[3];
+};
+
+struct ConvertFilter {
+	struct TAG_Vs_Filter base;
+	Vs_Library vsynth;
+	size_t refcount;
+	Vs_Filter clip;
+	long long pixfmt;
+	long long matrix;
+};
+
+struct ConvertActive {
+	struct TAG_Vs_ActiveFilter base;
+	Vs_Library vsynth;
+	Vs_ActiveFilter upstream;
+	enum Vs_StdframePixelFormat pixfmt;
+	size_t padding_right;
+	size_t padding_bottom;
+	/// Alignment the caller requires, 0 if none
+	size_t alignment;
+	/// Luma coefficients of the matrix
+	float kr, kg, kb;
+	struct Matrix to_ycrcb;
+	struct Matrix to_rgb;
+	/// Linear to gamma corrected transfer curve, 65536 entries
+	uint16_t *lin2gam;
+	/// Gamma corrected to linear transfer curve, 65536 entries
+	uint16_t *gam2lin;
+};
+
+extern struct TAG_Vs_FilterVirtual convert_vtable;
+extern struct TAG_Vs_ActiveFilterVirtual convert_active_vtable;
+
+static __inline struct ConvertFilter * GetConvert(Vs_Filter filter)
+{
+	if (filter->methods == &convert_vtable)
+		return (struct ConvertFilter *)filter;
+	else
+		return NULL;
+}
+
+static __inline struct ConvertActive * GetConvertActive(Vs_ActiveFilter filter)
+{
+	if (filter->methods == &convert_active_vtable)
+		return (struct ConvertActive *)filter;
+	else
+		return NULL;
+}
+
+
+/// Ways of storing pixels, each with its own pack and unpack routines
+enum Layout {
+	LAYOUT_PACKED8,
+	LAYOUT_PACKED16,
+	LAYOUT_MONO8,
+	LAYOUT_MONO16,
+	LAYOUT_PLANAR8,
+	LAYOUT_PLANAR16
+};
+
+static enum Layout GetLayout(enum Vs_StdframePixelFormat pixfmt)
+{
+	switch (pixfmt)
+	{
+	case STDPIXFMT_MONO8:
+		return LAYOUT_MONO8;
+	case STDPIXFMT_MONO16:
+		return LAYOUT_MONO16;
+	case STDPIXFMT_XRGB8:
+	case STDPIXFMT_ARGB8:
+		return LAYOUT_PACKED8;
+	case STDPIXFMT_XRGB16:
+	case STDPIXFMT_ARGB16:
+		return LAYOUT_PACKED16;
+	default:
+		return STDPIXFMT_pixelsize(pixfmt) == 1 ? LAYOUT_PLANAR8 : LAYOUT_PLANAR16;
+	}
+}
+
+static int HasAlpha(enum Vs_StdframePixelFormat pixfmt)
+{
+	return pixfmt == STDPIXFMT_ARGB8 || pixfmt == STDPIXFMT_ARGB16 || STDPIXFMT_planecount(pixfmt) == 4;
+}
+
+static int IsYCrCb(enum Vs_StdframePixelFormat pixfmt)
+{
+	return STDPIXFMT_planecount(pixfmt) >= 3;
+}
+
+
+/*
+	Line kernels
+
+	All take a count of pixels and work on whole lines. The SSE2 versions
+	handle blocks of 8 pixels and leave the rest to the C loop.
+*/
+
+/// 16 bit value to 8 bit with rounding, exact for values of the form v*257
+#define TO8(v) ((uint8_t)(((v) - ((v) >> 8) + 128) >> 8))
+/// 16 bit limited range value to 8 bit with rounding
+#define TO8_LIMITED(v) ((uint8_t)((v) >= 0xFF80 ? 0xFF : ((v) + 128) >> 8))
+
+/// Split <alpha><red><green><blue> bytes into four channels, scaling to 16 bit
+static void UnpackPacked8(const uint8_t *src, uint16_t *c0, uint16_t *c1, uint16_t *c2, uint16_t *c3, size_t n, int alpha)
+{
+	size_t x = 0;
+#if VSYNTH_SSE2
+	const __m128i mask = _mm_set1_epi32(0xFF);
+	const __m128i opaque = _mm_set1_epi16(-1);
+	for (; x + 8 <= n; x += 8)
+	{
+		__m128i lo = _mm_loadu_si128((const __m128i *)(src + 4*x));
+		__m128i hi = _mm_loadu_si128((const __m128i *)(src + 4*x + 16));
+		__m128i a = _mm_packs_epi32(_mm_and_si128(lo, mask), _mm_and_si128(hi, mask));
+		__m128i r = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(lo, 8), mask), _mm_and_si128(_mm_srli_epi32(hi, 8), mask));
+		__m128i g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(lo, 16), mask), _mm_and_si128(_mm_srli_epi32(hi, 16), mask));
+		__m128i b = _mm_packs_epi32(_mm_srli_epi32(lo, 24), _mm_srli_epi32(hi, 24));
+		_mm_storeu_si128((__m128i *)(c0 + x), _mm_or_si128(r, _mm_slli_epi16(r, 8)));
+		_mm_storeu_si128((__m128i *)(c1 + x), _mm_or_si128(g, _mm_slli_epi16(g, 8)));
+		_mm_storeu_si128((__m128i *)(c2 + x), _mm_or_si128(b, _mm_slli_epi16(b, 8)));
+		_mm_storeu_si128((__m128i *)(c3 + x), alpha ? _mm_or_si128(a, _mm_slli_epi16(a, 8)) : opaque);
+	}
+#endif
+	for (; x < n; x++)
+	{
+		c0[x] = (uint16_t)(src[4*x+1] * 257);
+		c1[x] = (uint16_t)(src[4*x+2] * 257);
+		c2[x] = (uint16_t)(src[4*x+3] * 257);
+		c3[x] = alpha ? (uint16_t)(src[4*x] * 257) : 0xFFFF;
+	}
+}
+
+/// Interleave four channels into <alpha><red><green><blue> bytes
+static void PackPacked8(const uint16_t *c0, const uint16_t *c1, const uint16_t *c2, const uint16_t *c3, uint8_t *dst, size_t n, int alpha)
+{
+	size_t x = 0;
+#if VSYNTH_SSE2
+	const __m128i round = _mm_set1_epi16(128);
+	const __m128i zero = _mm_setzero_si128();
+	for (; x + 8 <= n; x += 8)
+	{
+		__m128i r = _mm_loadu_si128((const __m128i *)(c0 + x));
+		__m128i g = _mm_loadu_si128((const __m128i *)(c1 + x));
+		__m128i b = _mm_loadu_si128((const __m128i *)(c2 + x));
+		__m128i a = alpha ? _mm_loadu_si128((const __m128i *)(c3 + x)) : zero;
+		__m128i ar, gb;
+		// TO8 on each lane, the intermediate can't overflow
+		r = _mm_srli_epi16(_mm_add_epi16(_mm_sub_epi16(r, _mm_srli_epi16(r, 8)), round), 8);
+		g = _mm_srli_epi16(_mm_add_epi16(_mm_sub_epi16(g, _mm_srli_epi16(g, 8)), round), 8);
+		b = _mm_srli_epi16(_mm_add_epi16(_mm_sub_epi16(b, _mm_srli_epi16(b, 8)), round), 8);
+		a = _mm_srli_epi16(_mm_add_epi16(_mm_sub_epi16(a, _mm_srli_epi16(a, 8)), round), 8);
+		// bytes a,r in each 16 bit lane, then lanes a|r, g|b interleaved
+		ar = _mm_or_si128(a, _mm_slli_epi16(r, 8));
+		gb = _mm_or_si128(g, _mm_slli_epi16(b, 8));
+		_mm_storeu_si128((__m128i *)(dst + 4*x), _mm_unpacklo_epi16(ar, gb));
+		_mm_storeu_si128((__m128i *)(dst + 4*x + 16), _mm_unpackhi_epi16(ar, gb));
+	}
+#endif
+	for (; x < n; x++)
+	{
+		dst[4*x] = alpha ? TO8(c3[x]) : 0;
+		dst[4*x+1] = TO8(c0[x]);
+		dst[4*x+2] = TO8(c1[x]);
+		dst[4*x+3] = TO8(c2[x]);
+	}
+}
+
+/// Scale 8 bit samples to 16 bit, either full range (v*257) or limited range (v<<8)
+static void Unpack8(const uint8_t *src, uint16_t *dst, size_t n, int limited)
+{
+	size_t x = 0;
+#if VSYNTH_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	for (; x + 16 <= n; x += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + x));
+		__m128i lo = _mm_unpacklo_epi8(zero, v);
+		__m128i hi = _mm_unpackhi_epi8(zero, v);
+		if (!limited)
+		{
+			lo = _mm_or_si128(lo, _mm_srli_epi16(lo, 8));
+			hi = _mm_or_si128(hi, _mm_srli_epi16(hi, 8));
+		}
+		_mm_storeu_si128((__m128i *)(dst + x), lo);
+		_mm_storeu_si128((__m128i *)(dst + x + 8), hi);
+	}
+#endif
+	for (; x < n; x++)
+		dst[x] = limited ? (uint16_t)(src[x] << 8) : (uint16_t)(src[x] * 257);
+}
+
+/// Reduce 16 bit samples to 8 bit, the inverse of Unpack8
+static void Pack8(const uint16_t *src, uint8_t *dst, size_t n, int limited)
+{
+	size_t x = 0;
+#if VSYNTH_SSE2
+	const __m128i round = _mm_set1_epi16(128);
+	for (; x + 16 <= n; x += 16)
+	{
+		__m128i lo = _mm_loadu_si128((const __m128i *)(src + x));
+		__m128i hi = _mm_loadu_si128((const __m128i *)(src + x + 8));
+		if (limited)
+		{
+			lo = _mm_srli_epi16(_mm_adds_epu16(lo, round), 8);
+			hi = _mm_srli_epi16(_mm_adds_epu16(hi, round), 8);
+		}
+		else
+		{
+			lo = _mm_srli_epi16(_mm_add_epi16(_mm_sub_epi16(lo, _mm_srli_epi16(lo, 8)), round), 8);
+			hi = _mm_srli_epi16(_mm_add_epi16(_mm_sub_epi16(hi, _mm_srli_epi16(hi, 8)), round), 8);
+		}
+		_mm_storeu_si128((__m128i *)(dst + x), _mm_packus_epi16(lo, hi));
+	}
+#endif
+	for (; x < n; x++)
+		dst[x] = limited ? TO8_LIMITED(src[x]) : TO8(src[x]);
+}
+
+/// Apply a colour matrix to three channels in place
+static void TransformLine(const struct Matrix *mat, uint16_t *c0, uint16_t *c1, uint16_t *c2, size_t n)
+{
+	size_t x = 0;
+	float in[3], out[3];
+	int i, j;
+#if VSYNTH_SSE2
+	__m128 m[3][3], in_off[3], out_off[3];
+	const __m128 maxval = _mm_set1_ps(65535.0f);
+	const __m128 minval = _mm_setzero_ps();
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i bias32 = _mm_set1_epi32(32768);
+	const __m128i bias16 = _mm_set1_epi16(-32768);
+	uint16_t *c[3];
+	__m128i v[3];
+	__m128 f[3][2], o[2];
+	int h;
+
+	c[0] = c0; c[1] = c1; c[2] = c2;
+	for (i = 0; i < 3; i++)
+	{
+		in_off[i] = _mm_set1_ps(mat->in_off[i]);
+		out_off[i] = _mm_set1_ps(mat->out_off[i]);
+		for (j = 0; j < 3; j++)
+			m[i][j] = _mm_set1_ps(mat->m[i][j]);
+	}
+
+	for (; x + 8 <= n; x += 8)
+	{
+		for (j = 0; j < 3; j++)
+		{
+			v[j] = _mm_loadu_si128((const __m128i *)(c[j] + x));
+			f[j][0] = _mm_sub_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(v[j], zero)), in_off[j]);
+			f[j][1] = _mm_sub_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(v[j], zero)), in_off[j]);
+		}
+		for (i = 0; i < 3; i++)
+		{
+			for (h = 0; h < 2; h++)
+			{
+				o[h] = _mm_add_ps(out_off[i], _mm_mul_ps(m[i][0], f[0][h]));
+				o[h] = _mm_add_ps(o[h], _mm_mul_ps(m[i][1], f[1][h]));
+				o[h] = _mm_add_ps(o[h], _mm_mul_ps(m[i][2], f[2][h]));
+				// round the same way as the C loop, not to even
+				o[h] = _mm_add_ps(_mm_min_ps(_mm_max_ps(o[h], minval), maxval), half);
+			}
+			// no unsigned saturating 32 to 16 bit pack in SSE2, go through signed
+			v[i] = _mm_packs_epi32(_mm_sub_epi32(_mm_cvttps_epi32(o[0]), bias32), _mm_sub_epi32(_mm_cvttps_epi32(o[1]), bias32));
+			v[i] = _mm_xor_si128(v[i], bias16);
+		}
+		for (i = 0; i < 3; i++)
+			_mm_storeu_si128((__m128i *)(c[i] + x), v[i]);
+	}
+#endif
+	for (; x < n; x++)
+	{
+		in[0] = c0[x] - mat->in_off[0];
+		in[1] = c1[x] - mat->in_off[1];
+		in[2] = c2[x] - mat->in_off[2];
+		for (i = 0; i < 3; i++)
+		{
+			out[i] = mat->out_off[i];
+			for (j = 0; j < 3; j++)
+				out[i] += mat->m[i][j] * in[j];
+			if (out[i] < 0.0f)
+				out[i] = 0.0f;
+			if (out[i] > 65535.0f)
+				out[i] = 65535.0f;
+		}
+		c0[x] = (uint16_t)(out[0] + 0.5f);
+		c1[x] = (uint16_t)(out[1] + 0.5f);
+		c2[x] = (uint16_t)(out[2] + 0.5f);
+	}
+}
+
+
+/*
+	Frame level stages
+*/
+
+/// Line buffers for one group of scanlines
+struct WorkLines {
+	size_t width;
+	/// Working channels for each of the two lines
+	uint16_t *c[2][4];
+	/// Scratch line for resampled chroma
+	uint16_t *scratch;
+};
+
+static int WorkLines_Init(struct WorkLines *w, size_t width)
+{
+	// round up so the vector loops may run over the end
+	size_t line = (width + 15) & ~(size_t)15;
+	uint16_t *mem = (uint16_t *)malloc(9 * line * sizeof(uint16_t));
+	size_t l, c;
+
+	if (mem == NULL)
+		return 0;
+	w->width = width;
+	for (l = 0; l < 2; l++)
+		for (c = 0; c < 4; c++)
+			w->c[l][c] = mem + (l*4 + c) * line;
+	w->scratch = mem + 8 * line;
+	return 1;
+}
+
+static void WorkLines_Free(struct WorkLines *w)
+{
+	free(w->c[0][0]);
+}
+
+#define LINE(frame, plane, y) ((char *)(frame)->data[plane] + (ptrdiff_t)(y) * (frame)->stride[plane])
+
+/// Stage 1, fill the working channels from source lines y0 .. y0+lines-1
+static void UnpackLines(struct ConvertActive *af, Vs_StandardFrame src, size_t y0, size_t lines, struct WorkLines *w)
+{
+	enum Vs_StdframePixelFormat pixfmt = src->pixfmt;
+	int alpha = HasAlpha(pixfmt);
+	size_t n = w->width;
+	size_t l, x, p, wscale, hscale;
+	uint16_t **c;
+
+	for (l = 0; l < lines; l++)
+	{
+		size_t y = y0 + l;
+		c = w->c[l];
+
+		switch (GetLayout(pixfmt))
+		{
+		case LAYOUT_PACKED8:
+			UnpackPacked8((const uint8_t *)LINE(src, 0, y), c[0], c[1], c[2], c[3], n, alpha);
+			break;
+		case LAYOUT_PACKED16:
+		{
+			const uint16_t *s = (const uint16_t *)LINE(src, 0, y);
+			for (x = 0; x < n; x++)
+			{
+				c[0][x] = af->lin2gam[s[4*x+1]];
+				c[1][x] = af->lin2gam[s[4*x+2]];
+				c[2][x] = af->lin2gam[s[4*x+3]];
+				c[3][x] = alpha ? s[4*x] : 0xFFFF;
+			}
+			break;
+		}
+		case LAYOUT_MONO8:
+			Unpack8((const uint8_t *)LINE(src, 0, y), c[0], n, 0);
+			memcpy(c[1], c[0], n * sizeof(uint16_t));
+			memcpy(c[2], c[0], n * sizeof(uint16_t));
+			for (x = 0; x < n; x++)
+				c[3][x] = 0xFFFF;
+			break;
+		case LAYOUT_MONO16:
+		{
+			const uint16_t *s = (const uint16_t *)LINE(src, 0, y);
+			for (x = 0; x < n; x++)
+			{
+				c[0][x] = c[1][x] = c[2][x] = af->lin2gam[s[x]];
+				c[3][x] = 0xFFFF;
+			}
+			break;
+		}
+		case LAYOUT_PLANAR8:
+		case LAYOUT_PLANAR16:
+			for (p = 0; p < STDPIXFMT_planecount(pixfmt); p++)
+			{
+				const char *line;
+				wscale = STDPIXFMT_planewidthscale(pixfmt, p);
+				hscale = STDPIXFMT_planeheightscale(pixfmt, p);
+				line = LINE(src, p, y / hscale);
+				// alpha is full range, the rest limited range
+				if (GetLayout(pixfmt) == LAYOUT_PLANAR8)
+				{
+					if (wscale == 1)
+					{
+						Unpack8((const uint8_t *)line, c[p], n, p != 3);
+					}
+					else
+					{
+						Unpack8((const uint8_t *)line, w->scratch, (n + 1) / 2, 1);
+						for (x = 0; x < n; x++)
+							c[p][x] = w->scratch[x / 2];
+					}
+				}
+				else
+				{
+					const uint16_t *s = (const uint16_t *)line;
+					if (wscale == 1)
+						memcpy(c[p], s, n * sizeof(uint16_t));
+					else
+						for (x = 0; x < n; x++)
+							c[p][x] = s[x / 2];
+				}
+			}
+			if (!alpha)
+				for (x = 0; x < n; x++)
+					c[3][x] = 0xFFFF;
+			break;
+		}
+	}
+}
+
+/// Average a line of chroma down to half width into dst
+static void HalveLine(const uint16_t *a, const uint16_t *b, uint16_t *dst, size_t n)
+{
+	size_t x;
+	if (b == NULL)
+	{
+		for (x = 0; x + 1 < n; x += 2)
+			dst[x / 2] = (uint16_t)((a[x] + a[x+1] + 1) >> 1);
+		if (x < n)
+			dst[x / 2] = a[x];
+	}
+	else
+	{
+		for (x = 0; x + 1 < n; x += 2)
+			dst[x / 2] = (uint16_t)((a[x] + a[x+1] + b[x] + b[x+1] + 2) >> 2);
+		if (x < n)
+			dst[x / 2] = (uint16_t)((a[x] + b[x] + 1) >> 1);
+	}
+}
+
+/// Average two lines of chroma at full width into dst
+static void AverageLines(const uint16_t *a, const uint16_t *b, uint16_t *dst, size_t n)
+{
+	size_t x;
+	for (x = 0; x < n; x++)
+		dst[x] = (uint16_t)((a[x] + b[x] + 1) >> 1);
+}
+
+/// Luma of gamma corrected RGB, full range
+static uint16_t Luma(struct ConvertActive *af, uint16_t r, uint16_t g, uint16_t b)
+{
+	return (uint16_t)(af->kr * r + af->kg * g + af->kb * b + 0.5f);
+}
+
+/// Stage 3, store the working channels to destination lines y0 .. y0+lines-1
+static void PackLines(struct ConvertActive *af, Vs_StandardFrame dst, size_t y0, size_t lines, struct WorkLines *w)
+{
+	enum Vs_StdframePixelFormat pixfmt = dst->pixfmt;
+	int alpha = HasAlpha(pixfmt);
+	size_t n = w->width;
+	size_t l, x, p, wscale, hscale;
+	uint16_t **c;
+
+	switch (GetLayout(pixfmt))
+	{
+	case LAYOUT_PACKED8:
+		for (l = 0; l < lines; l++)
+		{
+			c = w->c[l];
+			PackPacked8(c[0], c[1], c[2], c[3], (uint8_t *)LINE(dst, 0, y0 + l), n, alpha);
+		}
+		break;
+	case LAYOUT_PACKED16:
+		for (l = 0; l < lines; l++)
+		{
+			uint16_t *d = (uint16_t *)LINE(dst, 0, y0 + l);
+			c = w->c[l];
+			for (x = 0; x < n; x++)
+			{
+				d[4*x] = alpha ? c[3][x] : 0;
+				d[4*x+1] = af->gam2lin[c[0][x]];
+				d[4*x+2] = af->gam2lin[c[1][x]];
+				d[4*x+3] = af->gam2lin[c[2][x]];
+			}
+		}
+		break;
+	case LAYOUT_MONO8:
+		for (l = 0; l < lines; l++)
+		{
+			c = w->c[l];
+			for (x = 0; x < n; x++)
+				w->scratch[x] = Luma(af, c[0][x], c[1][x], c[2][x]);
+			Pack8(w->scratch, (uint8_t *)LINE(dst, 0, y0 + l), n, 0);
+		}
+		break;
+	case LAYOUT_MONO16:
+		for (l = 0; l < lines; l++)
+		{
+			uint16_t *d = (uint16_t *)LINE(dst, 0, y0 + l);
+			c = w->c[l];
+			// luma of linear light, as the format is linear
+			for (x = 0; x < n; x++)
+				d[x] = (uint16_t)(af->kr * af->gam2lin[c[0][x]] + af->kg * af->gam2lin[c[1][x]] + af->kb * af->gam2lin[c[2][x]] + 0.5f);
+		}
+		break;
+	case LAYOUT_PLANAR8:
+	case LAYOUT_PLANAR16:
+		for (p = 0; p < STDPIXFMT_planecount(pixfmt); p++)
+		{
+			int limited = p != 3;
+			wscale = STDPIXFMT_planewidthscale(pixfmt, p);
+			hscale = STDPIXFMT_planeheightscale(pixfmt, p);
+			for (l = 0; l < lines; l += hscale)
+			{
+				const uint16_t *out;
+				size_t count = (n + wscale-1) / wscale;
+				const uint16_t *next = (hscale == 2 && l + 1 < lines) ? w->c[l+1][p] : NULL;
+
+				if (wscale == 2)
+				{
+					HalveLine(w->c[l][p], next, w->scratch, n);
+					out = w->scratch;
+				}
+				else if (next != NULL)
+				{
+					AverageLines(w->c[l][p], next, w->scratch, n);
+					out = w->scratch;
+				}
+				else
+				{
+					out = w->c[l][p];
+				}
+
+				if (GetLayout(pixfmt) == LAYOUT_PLANAR8)
+					Pack8(out, (uint8_t *)LINE(dst, p, (y0 + l) / hscale), count, limited);
+				else
+					memcpy(LINE(dst, p, (y0 + l) / hscale), out, count * sizeof(uint16_t));
+			}
+		}
+		break;
+	}
+}
+
+/// One frame being converted, shared by all its slices
+struct ConvertJob {
+	struct ConvertActive *af;
+	Vs_StandardFrame src;
+	/// Set if any slice ran out of memory
+	int failed;
+};
+
+/// Convert one slice of a frame
+VSYNTH_IMPLEMENT_METHOD(void, ConvertSlice)(Vs_StandardFrame dst, const struct Vs_StdframeSlice *slice, void *userdata)
+{
+	struct ConvertJob *job = (struct ConvertJob *)userdata;
+	struct ConvertActive *af = job->af;
+	Vs_StandardFrame src = job->src;
+	struct WorkLines w;
+	int src_ycrcb = IsYCrCb(src->pixfmt);
+	int dst_ycrcb = IsYCrCb(dst->pixfmt);
+	size_t y, bottom, lines, l;
+
+	if (!WorkLines_Init(&w, src->width))
+	{
+		job->failed = 1;
+		return;
+	}
+
+	// two lines at a time, starting at even lines, so 4:2:0 chroma lines line up
+	bottom = slice->top + slice->height;
+	for (y = slice->top; y < bottom; y += 2)
+	{
+		lines = bottom - y < 2 ? 1 : 2;
+		UnpackLines(af, src, y, lines, &w);
+		if (src_ycrcb != dst_ycrcb)
+		{
+			for (l = 0; l < lines; l++)
+				TransformLine(dst_ycrcb ? &af->to_ycrcb : &af->to_rgb, w.c[l][0], w.c[l][1], w.c[l][2], w.width);
+		}
+		PackLines(af, dst, y, lines, &w);
+	}
+
+	WorkLines_Free(&w);
+}
+
+/// Convert a whole frame, both must have the same dimensions
+///
+/// The frame is split into slices of even height, converted in parallel.
+/// Returns zero if out of memory.
+static int ConvertFrame(struct ConvertActive *af, Vs_StandardFrame src, Vs_StandardFrame dst)
+{
+	struct ConvertJob job;
+
+	job.af = af;
+	job.src = src;
+	job.failed = 0;
+	Vs_Stdframe_RunSlices(af->vsynth, dst, 2, ConvertSlice, &job);
+	return !job.failed;
+}
+
+
+/*
+	Active filter
+*/
+
+VSYNTH_IMPLEMENT_METHOD(void, convert_active_destroy)(Vs_ActiveFilter filter)
+{
+	struct ConvertActive *af = GetConvertActive(filter);
+	af->upstream->methods->destroy(af->upstream);
+	af->base.filter->methods->unref(af->base.filter);
+	free(af->lin2gam);
+	free(af);
+}
+
+/// Check whether a frame can be passed through as it is
+static int CanPassThrough(struct ConvertActive *af, Vs_StandardFrame src)
+{
+	size_t planes = STDPIXFMT_planecount(src->pixfmt);
+	size_t i;
+
+	if (src->pixfmt != af->pixfmt || src->padding_right < af->padding_right || src->padding_bottom < af->padding_bottom)
+		return 0;
+	// the input may have been cropped
+	for (i = 0; af->alignment > 1 && i < planes; i++)
+	{
+		if (((uintptr_t)src->data[i] | (uintptr_t)src->stride[i]) & (af->alignment - 1))
+			return 0;
+	}
+	return 1;
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Frame, convert_active_get_frame)(Vs_ActiveFilter filter, Vs_FrameNumber n)
+{
+	struct ConvertActive *af = GetConvertActive(filter);
+	Vs_Frame in = af->upstream->methods->get_frame(af->upstream, n);
+	Vs_StandardFrame src, dst;
+
+	if (in == NULL)
+		return NULL;
+	src = Vs_Stdframe_Get(in);
+	if (src == NULL)
+	{
+		in->methods->unref(in);
+		return NULL;
+	}
+
+	// nothing to do
+	if (CanPassThrough(af, src))
+		return in;
+
+	dst = Vs_Stdframe_NewPadded(af->vsynth, af->pixfmt, src->width, src->height, af->padding_right, af->padding_bottom);
+	if (dst != NULL)
+	{
+		if (src->pixfmt == af->pixfmt)
+			Vs_Stdframe_CopyRegion(dst, 0, 0, src, 0, 0, src->width, src->height);
+		else if (!ConvertFrame(af, src, dst))
+		{
+			dst->base.methods->unref(&dst->base);
+			dst = NULL;
+		}
+	}
+	if (dst != NULL)
+		dst->base.timestamp = in->timestamp;
+
+	in->methods->unref(in);
+	return dst != NULL ? &dst->base : NULL;
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_FrameNumber, convert_active_get_frame_count)(Vs_ActiveFilter filter)
+{
+	struct ConvertActive *af = GetConvertActive(filter);
+	return af->upstream->methods->get_frame_count(af->upstream);
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Timestamp, convert_active_get_duration)(Vs_ActiveFilter filter)
+{
+	struct ConvertActive *af = GetConvertActive(filter);
+	return af->upstream->methods->get_duration(af->upstream);
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_FrameNumber, convert_active_frame_at_timestamp)(Vs_ActiveFilter filter, Vs_Timestamp t)
+{
+	struct ConvertActive *af = GetConvertActive(filter);
+	return af->vsynth->Seek->FrameAtTimestamp(af->vsynth, af->upstream, t);
+}
+
+struct TAG_Vs_ActiveFilterVirtual convert_active_vtable = {
+	convert_active_destroy,
+	convert_active_get_frame,
+	convert_active_get_frame_count,
+	convert_active_get_duration,
+	NULL,
+	convert_active_frame_at_timestamp
+};
+
+
+/// Set up the colour matrices for the given luma coefficients
+static void InitMatrices(struct ConvertActive *af, float kr, float kb)
+{
+	float kg = 1.0f - kr - kb;
+	struct Matrix *m;
+	int i;
+
+	af->kr = kr;
+	af->kg = kg;
+	af->kb = kb;
+
+	// RGB -> Y, Cr, Cb in plane order
+	m = &af->to_ycrcb;
+	m->m[0][0] = LUMA_SCALE * kr;
+	m->m[0][1] = LUMA_SCALE * kg;
+	m->m[0][2] = LUMA_SCALE * kb;
+	m->m[1][0] = CHROMA_SCALE * 0.5f;
+	m->m[1][1] = CHROMA_SCALE * -kg / (2.0f * (1.0f - kr));
+	m->m[1][2] = CHROMA_SCALE * -kb / (2.0f * (1.0f - kr));
+	m->m[2][0] = CHROMA_SCALE * -kr / (2.0f * (1.0f - kb));
+	m->m[2][1] = CHROMA_SCALE * -kg / (2.0f * (1.0f - kb));
+	m->m[2][2] = CHROMA_SCALE * 0.5f;
+	for (i = 0; i < 3; i++)
+		m->in_off[i] = 0.0f;
+	m->out_off[0] = 4096.0f;
+	m->out_off[1] = 32768.0f;
+	m->out_off[2] = 32768.0f;
+
+	// Y, Cr, Cb -> RGB
+	m = &af->to_rgb;
+	m->m[0][0] = 1.0f / LUMA_SCALE;
+	m->m[0][1] = 2.0f * (1.0f - kr) / CHROMA_SCALE;
+	m->m[0][2] = 0.0f;
+	m->m[1][0] = 1.0f / LUMA_SCALE;
+	m->m[1][1] = -2.0f * kr * (1.0f - kr) / kg / CHROMA_SCALE;
+	m->m[1][2] = -2.0f * kb * (1.0f - kb) / kg / CHROMA_SCALE;
+	m->m[2][0] = 1.0f / LUMA_SCALE;
+	m->m[2][1] = 0.0f;
+	m->m[2][2] = 2.0f * (1.0f - kb) / CHROMA_SCALE;
+	m->in_off[0] = 4096.0f;
+	m->in_off[1] = 32768.0f;
+	m->in_off[2] = 32768.0f;
+	for (i = 0; i < 3; i++)
+		m->out_off[i] = 0.0f;
+}
+
+/// Build the sRGB transfer curve tables, returns zero if out of memory
+static int InitTransfer(struct ConvertActive *af)
+{
+	size_t i;
+	double v;
+
+	af->lin2gam = (uint16_t *)malloc(2 * 65536 * sizeof(uint16_t));
+	if (af->lin2gam == NULL)
+		return 0;
+	af->gam2lin = af->lin2gam + 65536;
+
+	for (i = 0; i < 65536; i++)
+	{
+		v = i / 65535.0;
+		v = v <= 0.0031308 ? v * 12.92 : 1.055 * pow(v, 1.0 / 2.4) - 0.055;
+		af->lin2gam[i] = (uint16_t)(v * 65535.0 + 0.5);
+
+		v = i / 65535.0;
+		v = v <= 0.04045 ? v / 12.92 : pow((v + 0.055) / 1.055, 2.4);
+		af->gam2lin[i] = (uint16_t)(v * 65535.0 + 0.5);
+	}
+	return 1;
+}
+
+
+/*
+	Filter
+*/
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Filter, convert_new)(Vs_Library vsynth)
+{
+	struct ConvertFilter *f = (struct ConvertFilter *)malloc(sizeof(struct ConvertFilter));
+	f->base.methods = &convert_vtable;
+	f->vsynth = vsynth;
+	f->refcount = 1;
+	f->clip = NULL;
+	f->pixfmt = -1;
+	f->matrix = MATRIX_BT601;
+	return &f->base;
+}
+
+Vs_FilterFactory convert_factory = {
+	"convert",
+	"Pixel format conversion",
+	"Public domain",
+	convert_new
+};
+
+
+VSYNTH_IMPLEMENT_METHOD(void, convert_addref)(Vs_Filter filter)
+{
+	struct ConvertFilter *cf = GetConvert(filter);
+	cf->refcount++;
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, convert_unref)(Vs_Filter filter)
+{
+	struct ConvertFilter *cf = GetConvert(filter);
+	assert(cf->refcount > 0);
+	cf->refcount--;
+
+	if (cf->refcount == 0)
+	{
+		if (cf->clip != NULL)
+			cf->clip->methods->unref(cf->clip);
+		free(cf);
+	}
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Filter, convert_clone)(Vs_Filter filter)
+{
+	struct ConvertFilter *cf = GetConvert(filter);
+	struct ConvertFilter *nf = GetConvert(convert_new(cf->vsynth));
+	nf->clip = cf->clip;
+	if (nf->clip != NULL)
+		nf->clip->methods->addref(nf->clip);
+	nf->pixfmt = cf->pixfmt;
+	nf->matrix = cf->matrix;
+	return &nf->base;
+}
+
+static Vs_ActiveFilter FailActivate(struct ConvertFilter *f, Vs_String *error, const char *msg)
+{
+	*error = f->vsynth->String->Make(msg);
+	return NULL;
+}
+VSYNTH_IMPLEMENT_METHOD(Vs_ActiveFilter, convert_activate)(Vs_Filter filter, Vs_String *error, Vs_FrameTypeDescription **frametypes)
+{
+	struct ConvertFilter *f = GetConvert(filter);
+	struct Vs_StandardFrameTypeDescription *sfd;
+	struct Vs_StandardFrameTypeDescription *chosen = NULL;
+	struct Vs_StandardFrameTypeDescription upsfd;
+	Vs_FrameTypeDescription *upftds[2];
+	enum Vs_StdframePixelFormat uppixfmts[STDPIXFMT_MAX + 1];
+	enum Vs_StdframePixelFormat *pf;
+	enum Vs_StdframePixelFormat pixfmt;
+	struct ConvertActive *af;
+	Vs_ActiveFilter upstream;
+
+	if (f->clip == NULL) return FailActivate(f, error, "No input clip given");
+	if (f->pixfmt < 0 || f->pixfmt >= STDPIXFMT_MAX) return FailActivate(f, error, "No valid output pixfmt given");
+	if (f->matrix != MATRIX_BT601 && f->matrix != MATRIX_BT709 && f->matrix != MATRIX_BT2020) return FailActivate(f, error, "Matrix must be one of 601, 709 or 2020");
+	pixfmt = (enum Vs_StdframePixelFormat)f->pixfmt;
+
+	// the first stdframe description accepting the output pixfmt is used
+	for (; *frametypes; frametypes++)
+	{
+		sfd = Vs_Stdframe_CheckFTD(*frametypes);
+		(*frametypes)->out_supported = 0;
+		if (sfd == NULL || chosen != NULL || sfd->alignment > VS_STDFRAME_ALIGNMENT)
+			continue;
+		if (sfd->pixfmts != NULL)
+		{
+			for (pf = sfd->pixfmts; *pf != STDPIXFMT_MAX && *pf != pixfmt; pf++)
+				;
+			if (*pf == STDPIXFMT_MAX)
+				continue;
+		}
+		chosen = sfd;
+	}
+	if (chosen == NULL)
+		return FailActivate(f, error, "The output pixfmt is not accepted");
+
+	// pass the size constraints on, any input pixfmt will do, but the
+	// cheapest to convert is asked for first, the output pixfmt itself
+	// saves converting altogether
+	Vs_Stdframe_RankPixfmts(pixfmt, NULL, uppixfmts);
+	upsfd = *chosen;
+	upsfd.base.out_supported = 0;
+	upsfd.pixfmts = uppixfmts;
+	upsfd.allow_pixfmt_change = 1;
+	upsfd.alignment = 0;
+	upsfd.padding_right = 0;
+	upsfd.padding_bottom = 0;
+	upftds[0] = &upsfd.base;
+	upftds[1] = NULL;
+	upstream = f->vsynth->Graph->Activate(f->vsynth, f->clip, error, upftds);
+	if (upstream == NULL)
+		return NULL;
+	if (!upsfd.base.out_supported)
+	{
+		upstream->methods->destroy(upstream);
+		return FailActivate(f, error, "Input clip does not deliver stdframes");
+	}
+
+	chosen->base.out_supported = 1;
+	chosen->allow_resolution_change = upsfd.allow_resolution_change;
+	chosen->allow_pixfmt_change = 0;
+	chosen->minwidth = upsfd.minwidth;
+	chosen->maxwidth = upsfd.maxwidth;
+	chosen->minheight = upsfd.minheight;
+	chosen->maxheight = upsfd.maxheight;
+
+	af = (struct ConvertActive *)malloc(sizeof(struct ConvertActive));
+	if (af == NULL || !InitTransfer(af))
+	{
+		free(af);
+		upstream->methods->destroy(upstream);
+		return FailActivate(f, error, "Out of memory");
+	}
+	af->base.methods = &convert_active_vtable;
+	af->base.filter = filter;
+	convert_addref(filter);
+	af->vsynth = f->vsynth;
+	af->upstream = upstream;
+	af->pixfmt = pixfmt;
+	af->padding_right = chosen->padding_right;
+	af->padding_bottom = chosen->padding_bottom;
+	af->alignment = chosen->alignment;
+	switch (f->matrix)
+	{
+	case MATRIX_BT709:
+		InitMatrices(af, 0.2126f, 0.0722f);
+		break;
+	case MATRIX_BT2020:
+		InitMatrices(af, 0.2627f, 0.0593f);
+		break;
+	default:
+		InitMatrices(af, 0.299f, 0.114f);
+		break;
+	}
+
+	return &af->base;
+}
+
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Filter, convert_optimize)(Vs_Filter filter)
+{
+	struct ConvertFilter *f = GetConvert(filter);
+	struct ConvertFilter *inner = f->clip != NULL ? GetConvert(f->clip) : NULL;
+
+	// the input is already in the output pixfmt, whatever the matrix
+	if (inner != NULL && inner->pixfmt == f->pixfmt)
+	{
+		f->clip->methods->addref(f->clip);
+		return f->clip;
+	}
+	return NULL;
+}
+
+
+/// Property IDs, in the order enum_properties reports them
+enum ConvertProperty {
+	CONVERT_CLIP,
+	CONVERT_PIXFMT,
+	CONVERT_MATRIX,
+	CONVERT_PROPERTY_COUNT
+};
+
+static const struct {
+	const char *name;
+	enum Vs_PropertyType type;
+} convert_properties[CONVERT_PROPERTY_COUNT] = {
+	{ "clip", PROP_FILTER },
+	{ "pixfmt", PROP_INT },
+	{ "matrix", PROP_INT }
+};
+
+VSYNTH_IMPLEMENT_METHOD(void, convert_enum_properties)(Vs_EnumPropertiesFunc callback, void *userdata)
+{
+	int i;
+	for (i = 0; i < CONVERT_PROPERTY_COUNT; i++)
+		callback(convert_properties[i].name, convert_properties[i].type, userdata);
+}
+
+static void SetClip(struct ConvertFilter *f, Vs_Filter value)
+{
+	if (value != NULL)
+		value->methods->addref(value);
+	if (f->clip != NULL)
+		f->clip->methods->unref(f->clip);
+	f->clip = value;
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Filter, convert_get_property_filter)(Vs_Filter filter, const char *name)
+{
+	struct ConvertFilter *f = GetConvert(filter);
+	if (strcmp(name, "clip") == 0 && f->clip != NULL)
+	{
+		f->clip->methods->addref(f->clip);
+		return f->clip;
+	}
+	return NULL;
+}
+
+VSYNTH_IMPLEMENT_METHOD(long long, convert_get_property_int)(Vs_Filter filter, const char *name)
+{
+	struct ConvertFilter *f = GetConvert(filter);
+	if (strcmp(name, "pixfmt") == 0)
+		return f->pixfmt;
+	if (strcmp(name, "matrix") == 0)
+		return f->matrix;
+	return 0;
+}
+
+VSYNTH_IMPLEMENT_METHOD(double, convert_get_property_double)(Vs_Filter filter, const char *name)
+{
+	return 0; // no double properties
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_String, convert_get_property_string)(Vs_Filter filter, const char *name)
+{
+	return NULL; // no string properties
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_FrameNumber, convert_get_property_framenumber)(Vs_Filter filter, const char *name)
+{
+	return 0; // no framenumber properties
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Timestamp, convert_get_property_timestamp)(Vs_Filter filter, const char *name)
+{
+	return 0; // no timestamp properties
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, convert_set_property_filter)(Vs_Filter filter, const char *name, Vs_Filter value)
+{
+	struct ConvertFilter *f = GetConvert(filter);
+	if (strcmp(name, "clip") == 0)
+		SetClip(f, value);
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, convert_set_property_int)(Vs_Filter filter, const char *name, long long value)
+{
+	struct ConvertFilter *f = GetConvert(filter);
+	if (strcmp(name, "pixfmt") == 0)
+		f->pixfmt = value;
+	else if (strcmp(name, "matrix") == 0)
+		f->matrix = value;
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, convert_set_property_double)(Vs_Filter filter, const char *name, double value)
+{
+	// no double properties
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, convert_set_property_string)(Vs_Filter filter, const char *name, Vs_String value)
+{
+	// no string properties
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, convert_set_property_framenumber)(Vs_Filter filter, const char *name, Vs_FrameNumber value)
+{
+	// no framenumber properties
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, convert_set_property_timestamp)(Vs_Filter filter, const char *name, Vs_Timestamp value)
+{
+	// no timestamp properties
+}
+
+VSYNTH_IMPLEMENT_METHOD(int, convert_get_property_by_id)(Vs_Filter filter, Vs_PropertyId id, Vs_PropertyValue *value)
+{
+	struct ConvertFilter *f = GetConvert(filter);
+	if (id < 0 || id >= CONVERT_PROPERTY_COUNT)
+		return 0;
+	value->type = convert_properties[id].type;
+	switch (id)
+	{
+	case CONVERT_CLIP:
+		value->v.f = f->clip;
+		if (f->clip != NULL)
+			f->clip->methods->addref(f->clip);
+		break;
+	case CONVERT_PIXFMT:
+		value->v.i = f->pixfmt;
+		break;
+	case CONVERT_MATRIX:
+		value->v.i = f->matrix;
+		break;
+	}
+	return 1;
+}
+
+VSYNTH_IMPLEMENT_METHOD(int, convert_set_property_by_id)(Vs_Filter filter, Vs_PropertyId id, const Vs_PropertyValue *value)
+{
+	struct ConvertFilter *f = GetConvert(filter);
+	if (id < 0 || id >= CONVERT_PROPERTY_COUNT || value->type != convert_properties[id].type)
+		return 0;
+	switch (id)
+	{
+	case CONVERT_CLIP:
+		SetClip(f, value->v.f);
+		break;
+	case CONVERT_PIXFMT:
+		f->pixfmt = value->v.i;
+		break;
+	case CONVERT_MATRIX:
+		f->matrix = value->v.i;
+		break;
+	}
+	return 1;
+}
+
+
+struct TAG_Vs_FilterVirtual convert_vtable = {
+	convert_addref,
+	convert_unref,
+	convert_clone,
+	convert_activate,
+	convert_enum_properties,
+	convert_get_property_filter,
+	convert_get_property_int,
+	convert_get_property_double,
+	convert_get_property_string,
+	convert_get_property_framenumber,
+	convert_get_property_timestamp,
+	convert_set_property_filter,
+	convert_set_property_int,
+	convert_set_property_double,
+	convert_set_property_string,
+	convert_set_property_framenumber,
+	convert_set_property_timestamp,
+	convert_get_property_by_id,
+	convert_set_property_by_id,
+	convert_optimize
+};
+
+
+VSYNTH_API(void) Vs_PluginInit(Vs_Library vsynth)
+{
+	vsynth->FilterRegistry->Register(vsynth, &convert_factory);
+}
@@ -0,0 +1,707 @@
+#include <vsynth/vsynth.h>
+#include <vsynth/stdframe.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <assert.h>
+
+
+/*
+
+Crop cuts margins off the edges of stdframes.
+
+No pixels are copied: each output frame is a view of the input frame, with
+the plane pointers moved to the top left corner of the remaining picture
+and the size reduced. The view holds a reference to the input frame, so
+the input's pixel buffer lives as long as any cropped frame does.
+
+The left and top margins must land on whole samples of every plane, so
+only pixfmts whose chroma subsampling divides them are accepted from the
+input; a crop by an odd number of columns rules out 4:2:2 and 4:2:0. The
+size limits and modulo requirements of the caller are moved onto the
+input's frame size.
+
+Before activation, a crop of a crop is folded into a single crop, and a crop
+by margins that suit every pixfmt is moved ahead of a convert, so the
+convert has fewer pixels to work on. Convert works on each pixel on its own,
+and chroma is resampled in aligned pairs, so the frames come out the same,
+except that an odd sized input gets a last chroma sample of one pixel. As the
+input size isn't known yet, the crop is only moved if it has no right or
+bottom margin along the axes the convert subsamples.
+
+Moving the plane pointers breaks their alignment. If the caller requires
+an alignment and a cropped frame misses it, that frame is copied into a
+new aligned frame instead.
+
+*/
+
+
+struct CropFilter {
+	struct TAG_Vs_Filter base;
+	Vs_Library vsynth;
+	size_t refcount;
+	Vs_Filter clip;
+	long long left;
+	long long top;
+	long long right;
+	long long bottom;
+};
+
+struct CropActive {
+	struct TAG_Vs_ActiveFilter base;
+	Vs_Library vsynth;
+	Vs_ActiveFilter upstream;
+	size_t left;
+	size_t top;
+	size_t right;
+	size_t bottom;
+	/// Alignment the caller requires, 0 if none
+	size_t alignment;
+};
+
+/// A forwarded asynchronous request, see crop_active_get_frame_async
+struct CropRequest {
+	Vs_FrameCallback callback;
+	void *userdata;
+	struct CropActive *af;
+};
+
+extern struct TAG_Vs_FilterVirtual crop_vtable;
+extern struct TAG_Vs_ActiveFilterVirtual crop_active_vtable;
+
+static __inline struct CropFilter * GetCrop(Vs_Filter filter)
+{
+	if (filter->methods == &crop_vtable)
+		return (struct CropFilter *)filter;
+	else
+		return NULL;
+}
+
+static __inline struct CropActive * GetCropActive(Vs_ActiveFilter filter)
+{
+	if (filter->methods == &crop_active_vtable)
+		return (struct CropActive *)filter;
+	else
+		return NULL;
+}
+
+
+/// Check whether the margins start on whole samples of every plane of a pixfmt
+static int FitsSubsampling(enum Vs_StdframePixelFormat pixfmt, size_t left, size_t top)
+{
+	size_t planes = STDPIXFMT_planecount(pixfmt);
+	size_t i;
+
+	for (i = 0; i < planes; i++)
+	{
+		if (left % STDPIXFMT_planewidthscale(pixfmt, i) != 0)
+			return 0;
+		if (top % STDPIXFMT_planeheightscale(pixfmt, i) != 0)
+			return 0;
+	}
+	return 1;
+}
+
+static int IsAligned(Vs_StandardFrame sf, size_t alignment)
+{
+	size_t planes = STDPIXFMT_planecount(sf->pixfmt);
+	size_t i;
+
+	for (i = 0; i < planes; i++)
+	{
+		if ((uintptr_t)sf->data[i] & (alignment - 1))
+			return 0;
+	}
+	return 1;
+}
+
+/// Crop an input frame, takes over the reference to frame
+static Vs_Frame CropFrame(struct CropActive *af, Vs_Frame frame)
+{
+	Vs_StandardFrame sf, cropped;
+	Vs_Frame view;
+	size_t width, height;
+
+	if (frame == NULL)
+		return NULL;
+	sf = Vs_Stdframe_Get(frame);
+	// the input promised stdframes larger than the margins
+	if (sf == NULL || sf->width <= af->left + af->right || sf->height <= af->top + af->bottom)
+	{
+		frame->methods->unref(frame);
+		return NULL;
+	}
+	width = sf->width - af->left - af->right;
+	height = sf->height - af->top - af->bottom;
+
+	// the input frame may be shared, so the crop goes on a view, which only we hold
+	view = frame->methods->view(frame);
+	if (view == NULL)
+	{
+		frame->methods->unref(frame);
+		return NULL;
+	}
+	cropped = Vs_Stdframe_Get(view);
+	((struct Vs_StandardFrameVirtual *)view->methods)->crop(cropped, af->left, af->top, width, height);
+
+	if (af->alignment > 1 && !IsAligned(cropped, af->alignment))
+	{
+		view->methods->unref(view);
+		cropped = Vs_Stdframe_NewPadded(af->vsynth, sf->pixfmt, width, height, sf->padding_right, sf->padding_bottom);
+		view = NULL;
+		if (cropped != NULL)
+		{
+			Vs_Stdframe_CopyRegion(cropped, 0, 0, sf, af->left, af->top, width, height);
+			cropped->base.timestamp = frame->timestamp;
+			view = &cropped->base;
+		}
+	}
+	frame->methods->unref(frame);
+	return view;
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, crop_active_destroy)(Vs_ActiveFilter filter)
+{
+	struct CropActive *af = GetCropActive(filter);
+	af->upstream->methods->destroy(af->upstream);
+	af->base.filter->methods->unref(af->base.filter);
+	free(af);
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Frame, crop_active_get_frame)(Vs_ActiveFilter filter, Vs_FrameNumber n)
+{
+	struct CropActive *af = GetCropActive(filter);
+	return CropFrame(af, af->upstream->methods->get_frame(af->upstream, n));
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_FrameNumber, crop_active_get_frame_count)(Vs_ActiveFilter filter)
+{
+	struct CropActive *af = GetCropActive(filter);
+	return af->upstream->methods->get_frame_count(af->upstream);
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Timestamp, crop_active_get_duration)(Vs_ActiveFilter filter)
+{
+	struct CropActive *af = GetCropActive(filter);
+	return af->upstream->methods->get_duration(af->upstream);
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_FrameNumber, crop_active_frame_at_timestamp)(Vs_ActiveFilter filter, Vs_Timestamp t)
+{
+	struct CropActive *af = GetCropActive(filter);
+	return af->vsynth->Seek->FrameAtTimestamp(af->vsynth, af->upstream, t);
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, CropFrameReady)(Vs_Frame frame, void *userdata)
+{
+	struct CropRequest request = *(struct CropRequest *)userdata;
+	free(userdata);
+	request.callback(CropFrame(request.af, frame), request.userdata);
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, crop_active_get_frame_async)(Vs_ActiveFilter filter, Vs_FrameNumber n, Vs_FrameCallback callback, void *userdata)
+{
+	struct CropActive *af = GetCropActive(filter);
+	struct CropRequest *request;
+
+	request = (struct CropRequest *)malloc(sizeof(struct CropRequest));
+	if (request == NULL)
+	{
+		callback(NULL, userdata);
+		return;
+	}
+	request->callback = callback;
+	request->userdata = userdata;
+	request->af = af;
+	// the input's own asynchronous path is kept, so cropping never blocks a thread
+	af->vsynth->Async->GetFrame(af->vsynth, af->upstream, n, CropFrameReady, request);
+}
+
+struct TAG_Vs_ActiveFilterVirtual crop_active_vtable = {
+	crop_active_destroy,
+	crop_active_get_frame,
+	crop_active_get_frame_count,
+	crop_active_get_duration,
+	crop_active_get_frame_async,
+	crop_active_frame_at_timestamp
+};
+
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Filter, crop_new)(Vs_Library vsynth)
+{
+	struct CropFilter *f = (struct CropFilter *)malloc(sizeof(struct CropFilter));
+	f->base.methods = &crop_vtable;
+	f->vsynth = vsynth;
+	f->refcount = 1;
+	f->clip = NULL;
+	f->left = 0;
+	f->top = 0;
+	f->right = 0;
+	f->bottom = 0;
+	return &f->base;
+}
+
+Vs_FilterFactory crop_factory = {
+	"crop",
+	"Cut margins off the edges of frames without copying",
+	"Public domain",
+	crop_new
+};
+
+
+VSYNTH_IMPLEMENT_METHOD(void, crop_addref)(Vs_Filter filter)
+{
+	struct CropFilter *cf = GetCrop(filter);
+	cf->refcount++;
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, crop_unref)(Vs_Filter filter)
+{
+	struct CropFilter *cf = GetCrop(filter);
+	assert(cf->refcount > 0);
+	cf->refcount--;
+
+	if (cf->refcount == 0)
+	{
+		if (cf->clip != NULL)
+			cf->clip->methods->unref(cf->clip);
+		free(cf);
+	}
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Filter, crop_clone)(Vs_Filter filter)
+{
+	struct CropFilter *cf = GetCrop(filter);
+	struct CropFilter *nf = GetCrop(crop_new(cf->vsynth));
+	nf->clip = cf->clip;
+	if (nf->clip != NULL)
+		nf->clip->methods->addref(nf->clip);
+	nf->left = cf->left;
+	nf->top = cf->top;
+	nf->right = cf->right;
+	nf->bottom = cf->bottom;
+	return &nf->base;
+}
+
+static Vs_ActiveFilter FailActivate(struct CropFilter *f, Vs_String *error, const char *msg)
+{
+	*error = f->vsynth->String->Make(msg);
+	return NULL;
+}
+
+static size_t AddSize(size_t a, size_t b)
+{
+	return a > SIZE_MAX - b ? SIZE_MAX : a + b;
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_ActiveFilter, crop_activate)(Vs_Filter filter, Vs_String *error, Vs_FrameTypeDescription **frametypes)
+{
+	struct CropFilter *f = GetCrop(filter);
+	struct Vs_StandardFrameTypeDescription *sfd;
+	struct Vs_StandardFrameTypeDescription *chosen = NULL;
+	struct Vs_StandardFrameTypeDescription upsfd;
+	enum Vs_StdframePixelFormat uppixfmts[STDPIXFMT_MAX + 1];
+	enum Vs_StdframePixelFormat pixfmt;
+	Vs_FrameTypeDescription *upftds[2];
+	struct CropActive *af;
+	Vs_ActiveFilter upstream;
+	size_t left, top, hmargin, vmargin, i, j;
+	int fixed;
+
+	if (f->clip == NULL) return FailActivate(f, error, "No input clip given");
+	if (f->left < 0 || f->top < 0 || f->right < 0 || f->bottom < 0) return FailActivate(f, error, "Margins must not be negative");
+	left = (size_t)f->left;
+	top = (size_t)f->top;
+	hmargin = AddSize(left, (size_t)f->right);
+	vmargin = AddSize(top, (size_t)f->bottom);
+	if (hmargin == SIZE_MAX || vmargin == SIZE_MAX) return FailActivate(f, error, "Margins are too large");
+
+	// the first stdframe description is used
+	for (; *frametypes; frametypes++)
+	{
+		sfd = Vs_Stdframe_CheckFTD(*frametypes);
+		(*frametypes)->out_supported = 0;
+		if (sfd == NULL || chosen != NULL || sfd->alignment > VS_STDFRAME_ALIGNMENT)
+			continue;
+		chosen = sfd;
+	}
+	if (chosen == NULL)
+		return FailActivate(f, error, "Stdframes are not accepted");
+
+	// only pixfmts whose planes can be cut at the left and top margins
+	for (i = 0, j = 0; i < STDPIXFMT_MAX; i++)
+	{
+		pixfmt = chosen->pixfmts != NULL ? chosen->pixfmts[i] : (enum Vs_StdframePixelFormat)i;
+		if (pixfmt == STDPIXFMT_MAX)
+			break;
+		if (FitsSubsampling(pixfmt, left, top))
+			uppixfmts[j++] = pixfmt;
+	}
+	uppixfmts[j] = STDPIXFMT_MAX;
+	if (j == 0)
+		return FailActivate(f, error, "The margins don't fit the chroma subsampling of any accepted pixfmt");
+
+	// the caller's size limits apply to the input less the margins
+	upsfd = *chosen;
+	upsfd.base.out_supported = 0;
+	upsfd.pixfmts = uppixfmts;
+	upsfd.minwidth = AddSize(chosen->minwidth > 0 ? chosen->minwidth : 1, hmargin);
+	upsfd.maxwidth = AddSize(chosen->maxwidth, hmargin);
+	upsfd.minheight = AddSize(chosen->minheight > 0 ? chosen->minheight : 1, vmargin);
+	upsfd.maxheight = AddSize(chosen->maxheight, vmargin);
+	// a modulo carries over if the margins keep it, otherwise the size is checked once known
+	if (chosen->width_modulo != 0 && hmargin % chosen->width_modulo != 0)
+		upsfd.width_modulo = 0;
+	if (chosen->height_modulo != 0 && vmargin % chosen->height_modulo != 0)
+		upsfd.height_modulo = 0;
+	upftds[0] = &upsfd.base;
+	upftds[1] = NULL;
+	upstream = f->vsynth->Graph->Activate(f->vsynth, f->clip, error, upftds);
+	if (upstream == NULL)
+		return NULL;
+	if (!upsfd.base.out_supported)
+	{
+		upstream->methods->destroy(upstream);
+		return FailActivate(f, error, "Input clip does not deliver stdframes");
+	}
+
+	fixed = !upsfd.allow_resolution_change && upsfd.minwidth == upsfd.maxwidth && upsfd.minheight == upsfd.maxheight;
+	if ((upsfd.width_modulo != chosen->width_modulo || upsfd.height_modulo != chosen->height_modulo) &&
+		!(fixed &&
+		  (chosen->width_modulo == 0 || (upsfd.minwidth - hmargin) % chosen->width_modulo == 0) &&
+		  (chosen->height_modulo == 0 || (upsfd.minheight - vmargin) % chosen->height_modulo == 0)))
+	{
+		upstream->methods->destroy(upstream);
+		return FailActivate(f, error, "The cropped size does not meet the modulo requirements");
+	}
+
+	af = (struct CropActive *)malloc(sizeof(struct CropActive));
+	if (af == NULL)
+	{
+		upstream->methods->destroy(upstream);
+		return FailActivate(f, error, "Out of memory");
+	}
+
+	chosen->base.out_supported = 1;
+	chosen->allow_resolution_change = upsfd.allow_resolution_change;
+	chosen->allow_pixfmt_change = upsfd.allow_pixfmt_change;
+	chosen->minwidth = upsfd.minwidth - hmargin;
+	chosen->maxwidth = upsfd.maxwidth == SIZE_MAX ? SIZE_MAX : upsfd.maxwidth - hmargin;
+	chosen->minheight = upsfd.minheight - vmargin;
+	chosen->maxheight = upsfd.maxheight == SIZE_MAX ? SIZE_MAX : upsfd.maxheight - vmargin;
+
+	af->base.methods = &crop_active_vtable;
+	af->base.filter = filter;
+	crop_addref(filter);
+	af->vsynth = f->vsynth;
+	af->upstream = upstream;
+	af->left = left;
+	af->top = top;
+	af->right = (size_t)f->right;
+	af->bottom = (size_t)f->bottom;
+	af->alignment = chosen->alignment;
+	return &af->base;
+}
+
+
+/// Check whether a filter was made by the registered filter of the given name
+static int IsFilterOf(Vs_Library vsynth, Vs_Filter filter, const char *name)
+{
+	Vs_FilterFactory *factory = vsynth->FilterRegistry->Find(vsynth, name);
+	Vs_Filter probe;
+	int same;
+
+	if (factory == NULL)
+		return 0;
+	// filters of a type share a vtable
+	probe = factory->produce(vsynth);
+	same = probe->methods == filter->methods;
+	probe->methods->unref(probe);
+	return same;
+}
+
+/// Check whether two margins can be added, a and b must not be negative
+static int SumFits(long long a, long long b)
+{
+	return a >= 0 && a <= LLONG_MAX - b;
+}
+
+/// Check whether the right and bottom margins leave the chroma of a pixfmt as it is
+///
+/// The input size isn't known before activation. On a subsampled axis of an
+/// odd sized input, the last chroma sample is made from a single pixel, so a
+/// margin there would change which pixels the remaining chroma averages.
+static int CutsWholePairs(struct CropFilter *f, long long pixfmt)
+{
+	size_t planes, i;
+
+	if (pixfmt < 0 || pixfmt >= STDPIXFMT_MAX)
+		return 0;
+	planes = STDPIXFMT_planecount((enum Vs_StdframePixelFormat)pixfmt);
+	for (i = 0; i < planes; i++)
+	{
+		if (f->right != 0 && STDPIXFMT_planewidthscale((enum Vs_StdframePixelFormat)pixfmt, i) != 1)
+			return 0;
+		if (f->bottom != 0 && STDPIXFMT_planeheightscale((enum Vs_StdframePixelFormat)pixfmt, i) != 1)
+			return 0;
+	}
+	return 1;
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Filter, crop_optimize)(Vs_Filter filter)
+{
+	struct CropFilter *f = GetCrop(filter);
+	struct CropFilter *inner, *nf;
+	enum Vs_StdframePixelFormat pixfmt;
+	Vs_Filter convert, source;
+	int anywhere = 1;
+
+	if (f->clip == NULL || f->left < 0 || f->top < 0 || f->right < 0 || f->bottom < 0)
+		return NULL;
+	if (f->left == 0 && f->top == 0 && f->right == 0 && f->bottom == 0)
+	{
+		f->clip->methods->addref(f->clip);
+		return f->clip;
+	}
+
+	inner = GetCrop(f->clip);
+	if (inner != NULL && SumFits(inner->left, f->left) && SumFits(inner->top, f->top) && SumFits(inner->right, f->right) && SumFits(inner->bottom, f->bottom))
+	{
+		nf = GetCrop(crop_clone(f->clip));
+		nf->left += f->left;
+		nf->top += f->top;
+		nf->right += f->right;
+		nf->bottom += f->bottom;
+		return &nf->base;
+	}
+
+	for (pixfmt = 0; pixfmt < STDPIXFMT_MAX; pixfmt++)
+	{
+		if (!FitsSubsampling(pixfmt, (size_t)f->left, (size_t)f->top) || !FitsSubsampling(pixfmt, (size_t)f->right, (size_t)f->bottom))
+			anywhere = 0;
+	}
+	if (anywhere && IsFilterOf(f->vsynth, f->clip, "convert") && CutsWholePairs(f, f->clip->methods->get_property_int(f->clip, "pixfmt")))
+	{
+		source = f->clip->methods->get_property_filter(f->clip, "clip");
+		if (source == NULL)
+			return NULL;
+		// source | convert | crop becomes source | crop | convert
+		nf = GetCrop(crop_clone(filter));
+		nf->clip->methods->unref(nf->clip);
+		nf->clip = source;
+		convert = f->clip->methods->clone(f->clip);
+		convert->methods->set_property_filter(convert, "clip", &nf->base);
+		crop_unref(&nf->base);
+		return convert;
+	}
+	return NULL;
+}
+
+
+/// Property IDs, in the order enum_properties reports them
+enum CropProperty {
+	CROP_CLIP,
+	CROP_LEFT,
+	CROP_TOP,
+	CROP_RIGHT,
+	CROP_BOTTOM,
+	CROP_PROPERTY_COUNT
+};
+
+static const struct {
+	const char *name;
+	enum Vs_PropertyType type;
+} crop_properties[CROP_PROPERTY_COUNT] = {
+	{ "clip", PROP_FILTER },
+	{ "left", PROP_INT },
+	{ "top", PROP_INT },
+	{ "right", PROP_INT },
+	{ "bottom", PROP_INT }
+};
+
+VSYNTH_IMPLEMENT_METHOD(void, crop_enum_properties)(Vs_EnumPropertiesFunc callback, void *userdata)
+{
+	int i;
+	for (i = 0; i < CROP_PROPERTY_COUNT; i++)
+		callback(crop_properties[i].name, crop_properties[i].type, userdata);
+}
+
+static void SetClip(struct CropFilter *f, Vs_Filter value)
+{
+	if (value != NULL)
+		value->methods->addref(value);
+	if (f->clip != NULL)
+		f->clip->methods->unref(f->clip);
+	f->clip = value;
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Filter, crop_get_property_filter)(Vs_Filter filter, const char *name)
+{
+	struct CropFilter *f = GetCrop(filter);
+	if (strcmp(name, "clip") == 0 && f->clip != NULL)
+	{
+		f->clip->methods->addref(f->clip);
+		return f->clip;
+	}
+	return NULL;
+}
+
+VSYNTH_IMPLEMENT_METHOD(long long, crop_get_property_int)(Vs_Filter filter, const char *name)
+{
+	struct CropFilter *f = GetCrop(filter);
+	if (strcmp(name, "left") == 0)
+		return f->left;
+	if (strcmp(name, "top") == 0)
+		return f->top;
+	if (strcmp(name, "right") == 0)
+		return f->right;
+	if (strcmp(name, "bottom") == 0)
+		return f->bottom;
+	return 0;
+}
+
+VSYNTH_IMPLEMENT_METHOD(double, crop_get_property_double)(Vs_Filter filter, const char *name)
+{
+	return 0; // no double properties
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_String, crop_get_property_string)(Vs_Filter filter, const char *name)
+{
+	return NULL; // no string properties
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_FrameNumber, crop_get_property_framenumber)(Vs_Filter filter, const char *name)
+{
+	return 0; // no framenumber properties
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Timestamp, crop_get_property_timestamp)(Vs_Filter filter, const char *name)
+{
+	return 0; // no timestamp properties
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, crop_set_property_filter)(Vs_Filter filter, const char *name, Vs_Filter value)
+{
+	struct CropFilter *f = GetCrop(filter);
+	if (strcmp(name, "clip") == 0)
+		SetClip(f, value);
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, crop_set_property_int)(Vs_Filter filter, const char *name, long long value)
+{
+	struct CropFilter *f = GetCrop(filter);
+	if (strcmp(name, "left") == 0)
+		f->left = value;
+	else if (strcmp(name, "top") == 0)
+		f->top = value;
+	else if (strcmp(name, "right") == 0)
+		f->right = value;
+	else if (strcmp(name, "bottom") == 0)
+		f->bottom = value;
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, crop_set_property_double)(Vs_Filter filter, const char *name, double value)
+{
+	// no double properties
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, crop_set_property_string)(Vs_Filter filter, const char *name, Vs_String value)
+{
+	// no string properties
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, crop_set_property_framenumber)(Vs_Filter filter, const char *name, Vs_FrameNumber value)
+{
+	// no framenumber properties
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, crop_set_property_timestamp)(Vs_Filter filter, const char *name, Vs_Timestamp value)
+{
+	// no timestamp properties
+}
+
+VSYNTH_IMPLEMENT_METHOD(int, crop_get_property_by_id)(Vs_Filter filter, Vs_PropertyId id, Vs_PropertyValue *value)
+{
+	struct CropFilter *f = GetCrop(filter);
+	if (id < 0 || id >= CROP_PROPERTY_COUNT)
+		return 0;
+	value->type = crop_properties[id].type;
+	switch (id)
+	{
+	case CROP_CLIP:
+		value->v.f = f->clip;
+		if (f->clip != NULL)
+			f->clip->methods->addref(f->clip);
+		break;
+	case CROP_LEFT:
+		value->v.i = f->left;
+		break;
+	case CROP_TOP:
+		value->v.i = f->top;
+		break;
+	case CROP_RIGHT:
+		value->v.i = f->right;
+		break;
+	case CROP_BOTTOM:
+		value->v.i = f->bottom;
+		break;
+	}
+	return 1;
+}
+
+VSYNTH_IMPLEMENT_METHOD(int, crop_set_property_by_id)(Vs_Filter filter, Vs_PropertyId id, const Vs_PropertyValue *value)
+{
+	struct CropFilter *f = GetCrop(filter);
+	if (id < 0 || id >= CROP_PROPERTY_COUNT || value->type != crop_properties[id].type)
+		return 0;
+	switch (id)
+	{
+	case CROP_CLIP:
+		SetClip(f, value->v.f);
+		break;
+	case CROP_LEFT:
+		f->left = value->v.i;
+		break;
+	case CROP_TOP:
+		f->top = value->v.i;
+		break;
+	case CROP_RIGHT:
+		f->right = value->v.i;
+		break;
+	case CROP_BOTTOM:
+		f->bottom = value->v.i;
+		break;
+	}
+	return 1;
+}
+
+
+struct TAG_Vs_FilterVirtual crop_vtable = {
+	crop_addref,
+	crop_unref,
+	crop_clone,
+	crop_activate,
+	crop_enum_properties,
+	crop_get_property_filter,
+	crop_get_property_int,
+	crop_get_property_double,
+	crop_get_property_string,
+	crop_get_property_framenumber,
+	crop_get_property_timestamp,
+	crop_set_property_filter,
+	crop_set_property_int,
+	crop_set_property_double,
+	crop_set_property_string,
+	crop_set_property_framenumber,
+	crop_set_property_timestamp,
+	crop_get_property_by_id,
+	crop_set_property_by_id,
+	crop_optimize
+};
+
+
+VSYNTH_API(void) Vs_PluginInit(Vs_Library vsynth)
+{
+	vsynth->FilterRegistry->Register(vsynth, &crop_factory);
+}
@@ -0,0 +1,1259 @@
+#ifndef _WIN32
+# define _POSIX_C_SOURCE 200112L
+# define _FILE_OFFSET_BITS 64
+#endif
+
+#include <vsynth/vsynth.h>
+#include <vsynth/stdframe.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#if VSYNTH_SSE2
+# include <emmintrin.h>
+#endif
+
+#ifdef _WIN32
+# define WIN32_LEAN_AND_MEAN
+# include <Windows.h>
+#else
+# include <sys/types.h>
+# include <sys/stat.h>
+# include <sys/mman.h>
+# include <fcntl.h>
+# include <unistd.h>
+#endif
+
+
+/*
+
+Rawsource reads uncompressed video from Y4M files or raw planar files.
+
+The whole file is memory mapped at activation, and the offset of every frame
+is found up front, so any frame can be fetched directly. Raw files hold
+frames of a fixed size back to back, so their offsets are computed. Y4M
+frames each have a header of their own, which may vary in length, so the
+headers are scanned once and the offsets stored.
+
+Planes are stored one after another in each frame: Y, Cb, Cr and alpha for
+YCrCb formats, the order used by Y4M and most raw YUV files, and a single
+plane for the mono and packed RGB formats. Samples wider than 8 bits are
+16 bit little endian.
+
+Where the stored frame has the layout of a stdframe, frames are returned as
+stdframes wrapping the mapping, with no copying at all. The mapping is
+reference counted and stays alive until the last such frame is destroyed,
+even after the filter is. Frames are copied into pooled frames instead when
+the samples need converting, that is for 9 to 15 bit samples, which are
+scaled up to 16 bits, and for 16 bit samples on big endian machines, or when
+the downstream filter asks for alignment or padding the mapping can't
+provide. Copies are done in slices on the worker threads, which also keeps
+several page faults in flight when the file isn't cached.
+
+While a frame is fetched, the operating system is told the next frame will
+be needed, so reading ahead overlaps with processing the current frame.
+
+Timestamps are n * framedur, or for Y4M files without a framedur set, the
+frame rate from the header in units of timescale ticks per second, computed
+per frame so that rates like 24000:1001 don't drift. Variable frame rate
+files are read with a Matroska v2 timecodes file giving the time of every
+frame in milliseconds, converted to timescale ticks and kept in a timestamp
+index built at activation, which also answers frame_at_timestamp. A line
+after the last frame's gives the end of the stream, without one the last
+frame lasts as long as the one before.
+
+*/
+
+
+/// Default ticks per second for timestamps derived from Y4M frame rates
+///
+/// The 90 kHz clock of MPEG presentation timestamps, which represents the
+/// common NTSC rates exactly.
+#define DEFAULT_TIMESCALE 90000
+/// Longest Y4M stream or frame header accepted
+#define MAX_HEADER 4096
+
+#define Y4M_SIGNATURE "YUV4MPEG2 "
+#define Y4M_FRAME "FRAME"
+#define TIMECODES_SIGNATURE "# timecode format v2"
+
+enum SourceFormat {
+	FORMAT_DETECT,
+	FORMAT_RAW,
+	FORMAT_Y4M
+};
+
+/// A read-only mapping of a whole file, shared by the filter and its frames
+struct Mapping {
+	Vs_AtomicCount refcount;
+	const unsigned char *data;
+	unsigned long long size;
+};
+
+struct RawsourceFilter {
+	struct TAG_Vs_Filter base;
+	Vs_Library vsynth;
+	size_t refcount;
+	Vs_String path;
+	Vs_String format;
+	Vs_String timecodes;
+	long long width, height;
+	long long pixfmt;
+	long long bitdepth;
+	long long timescale;
+	Vs_Timestamp frame_duration;
+};
+
+struct RawsourceActive {
+	struct TAG_Vs_ActiveFilter base;
+	Vs_Library vsynth;
+	struct Mapping *mapping;
+	enum Vs_StdframePixelFormat pixfmt;
+	size_t width, height;
+	size_t planes;
+	/// Bytes per sample in the file
+	size_t samplesize;
+	/// Bits to shift samples left by to scale them to 16 bits
+	int shift;
+	/// Offset of each stored plane from the start of the frame data, in stdframe plane order
+	size_t plane_offset[4];
+	/// Bytes per line of each plane, in stdframe plane order
+	size_t line_bytes[4];
+	/// Bytes of pixel data per frame
+	size_t frame_bytes;
+	Vs_FrameNumber count;
+	/// File offset of the first frame's data, and the distance between frames
+	///
+	/// Used when offsets is NULL.
+	unsigned long long first_offset;
+	unsigned long long frame_stride;
+	/// File offset of every frame's data, for Y4M files
+	unsigned long long *offsets;
+	/// Timestamp of frame n is n * ts_num / ts_den
+	///
+	/// Used when index is NULL.
+	unsigned long long ts_num;
+	unsigned long long ts_den;
+	/// Timestamp of every frame, read from a timecodes file
+	Vs_TimestampIndex index;
+	/// End of the last frame, when timestamps come from the index
+	Vs_Timestamp duration;
+	/// Non-zero if frames can be returned wrapping the mapping
+	int can_wrap;
+	size_t alignment;
+	size_t padding_right;
+	size_t padding_bottom;
+};
+
+extern struct TAG_Vs_FilterVirtual rawsource_vtable;
+extern struct TAG_Vs_ActiveFilterVirtual rawsource_active_vtable;
+
+static __inline struct RawsourceFilter * GetRawsource(Vs_Filter filter)
+{
+	if (filter->methods == &rawsource_vtable)
+		return (struct RawsourceFilter *)filter;
+	else
+		return NULL;
+}
+
+static __inline struct RawsourceActive * GetRawsourceActive(Vs_ActiveFilter filter)
+{
+	if (filter->methods == &rawsource_active_vtable)
+		return (struct RawsourceActive *)filter;
+	else
+		return NULL;
+}
+
+
+/*
+	File mapping
+*/
+
+/// Map a whole file read-only, returns NULL on failure
+static struct Mapping *Mapping_Open(const char *path)
+{
+	struct Mapping *m = (struct Mapping *)malloc(sizeof(struct Mapping));
+	void *data = NULL;
+#ifdef _WIN32
+	HANDLE file, section;
+	LARGE_INTEGER size;
+#else
+	struct stat st;
+	int fd;
+#endif
+
+	if (m == NULL)
+		return NULL;
+	m->refcount = 1;
+
+#ifdef _WIN32
+	file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file != INVALID_HANDLE_VALUE)
+	{
+		if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+		{
+			m->size = (unsigned long long)size.QuadPart;
+			section = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+			if (section != NULL)
+			{
+				// the view keeps the section and the file open
+				data = MapViewOfFile(section, FILE_MAP_READ, 0, 0, 0);
+				CloseHandle(section);
+			}
+		}
+		CloseHandle(file);
+	}
+#else
+	fd = open(path, O_RDONLY);
+	if (fd >= 0)
+	{
+		if (fstat(fd, &st) == 0 && st.st_size > 0 && (unsigned long long)st.st_size <= (size_t)-1)
+		{
+			m->size = (unsigned long long)st.st_size;
+			// the mapping keeps the file open
+			data = mmap(NULL, (size_t)m->size, PROT_READ, MAP_SHARED, fd, 0);
+			if (data == MAP_FAILED)
+				data = NULL;
+		}
+		close(fd);
+	}
+#endif
+
+	if (data == NULL)
+	{
+		free(m);
+		return NULL;
+	}
+	m->data = (const unsigned char *)data;
+	return m;
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, Mapping_Release)(void *userdata)
+{
+	struct Mapping *m = (struct Mapping *)userdata;
+
+	if (Vs_AtomicDecrement(&m->refcount) > 0)
+		return;
+#ifdef _WIN32
+	UnmapViewOfFile((void *)m->data);
+#else
+	munmap((void *)m->data, (size_t)m->size);
+#endif
+	free(m);
+}
+
+/// Tell the operating system a range of the mapping will be read soon
+static void Mapping_Prefetch(struct Mapping *m, unsigned long long offset, size_t bytes)
+{
+#ifdef _WIN32
+	// PrefetchVirtualMemory needs Windows 8, leave it to the page fault handler
+	(void)m; (void)offset; (void)bytes;
+#else
+	long page = sysconf(_SC_PAGESIZE);
+	unsigned long long start = offset - offset % (unsigned long long)(page > 0 ? page : 4096);
+
+	if (offset >= m->size)
+		return;
+	if (bytes > m->size - offset)
+		bytes = (size_t)(m->size - offset);
+	posix_madvise((void *)(m->data + start), (size_t)(offset - start) + bytes, POSIX_MADV_WILLNEED);
+#endif
+}
+
+
+/*
+	Sample copying
+*/
+
+/// Copy a line of 16 bit little endian samples, scaling them up by shift bits
+static void CopySamples16(uint16_t *dst, const unsigned char *src, size_t count, int shift)
+{
+	size_t x = 0;
+#if VSYNTH_SSE2
+	// x86 is little endian, so the samples load as they are
+	__m128i s = _mm_cvtsi32_si128(shift);
+	for (; x + 8 <= count; x += 8)
+		_mm_storeu_si128((__m128i *)(dst + x), _mm_sll_epi16(_mm_loadu_si128((const __m128i *)(src + 2*x)), s));
+#endif
+	for (; x < count; x++)
+		dst[x] = (uint16_t)((src[2*x] | (src[2*x + 1] << 8)) << shift);
+}
+
+/// Copy of one stored frame into a stdframe
+struct CopyJob {
+	struct RawsourceActive *af;
+	const unsigned char *src;
+	Vs_StandardFrame dst;
+	/// Samples need converting to native 16 bit
+	int convert;
+};
+
+VSYNTH_IMPLEMENT_METHOD(void, CopySlice)(Vs_StandardFrame frame, const struct Vs_StdframeSlice *slice, void *userdata)
+{
+	struct CopyJob *job = (struct CopyJob *)userdata;
+	struct RawsourceActive *af = job->af;
+	const unsigned char *src;
+	char *dst;
+	size_t p, y;
+
+	for (p = 0; p < af->planes; p++)
+	{
+		src = job->src + af->plane_offset[p] + slice->plane_top[p] * af->line_bytes[p];
+		dst = (char *)job->dst->data[p] + (ptrdiff_t)slice->plane_top[p] * job->dst->stride[p];
+		for (y = 0; y < slice->plane_height[p]; y++)
+		{
+			if (job->convert)
+				CopySamples16((uint16_t *)dst, src, af->line_bytes[p] / 2, af->shift);
+			else
+				memcpy(dst, src, af->line_bytes[p]);
+			src += af->line_bytes[p];
+			dst += job->dst->stride[p];
+		}
+	}
+}
+
+
+/*
+	Active filter
+*/
+
+VSYNTH_IMPLEMENT_METHOD(void, rawsource_active_destroy)(Vs_ActiveFilter filter)
+{
+	struct RawsourceActive *af = GetRawsourceActive(filter);
+	// frames still alive keep the mapping
+	Mapping_Release(af->mapping);
+	free(af->offsets);
+	af->vsynth->Seek->FreeIndex(af->index);
+	af->base.filter->methods->unref(af->base.filter);
+	free(af);
+}
+
+static int LittleEndian(void)
+{
+	const uint16_t one = 1;
+	return *(const unsigned char *)&one == 1;
+}
+
+static __inline unsigned long long FrameOffset(struct RawsourceActive *af, Vs_FrameNumber n)
+{
+	if (af->offsets != NULL)
+		return af->offsets[n];
+	return af->first_offset + n * af->frame_stride;
+}
+
+static __inline Vs_Timestamp FrameTimestamp(struct RawsourceActive *af, Vs_FrameNumber n)
+{
+	if (af->index != NULL)
+		return n < af->count ? af->vsynth->Seek->IndexGet(af->index, n) : af->duration;
+	return n * af->ts_num / af->ts_den;
+}
+
+/// Check the planes of a stored frame meet the alignment asked for downstream
+static int IsAligned(struct RawsourceActive *af, const unsigned char *src)
+{
+	size_t p;
+
+	if (af->alignment == 0)
+		return 1;
+	for (p = 0; p < af->planes; p++)
+	{
+		if ((((uintptr_t)(src + af->plane_offset[p])) | af->line_bytes[p]) & (af->alignment - 1))
+			return 0;
+	}
+	return 1;
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Frame, rawsource_active_get_frame)(Vs_ActiveFilter filter, Vs_FrameNumber n)
+{
+	struct RawsourceActive *af = GetRawsourceActive(filter);
+	const unsigned char *src;
+	void *data[4];
+	ptrdiff_t stride[4];
+	Vs_StandardFrame frame;
+	struct CopyJob job;
+	size_t p;
+
+	if (n >= af->count)
+		return NULL;
+
+	src = af->mapping->data + FrameOffset(af, n);
+	if (n + 1 < af->count)
+		Mapping_Prefetch(af->mapping, FrameOffset(af, n + 1), af->frame_bytes);
+
+	if (af->can_wrap && IsAligned(af, src))
+	{
+		for (p = 0; p < 4; p++)
+		{
+			data[p] = p < af->planes ? (void *)(src + af->plane_offset[p]) : NULL;
+			stride[p] = p < af->planes ? (ptrdiff_t)af->line_bytes[p] : 0;
+		}
+		// every wrapping frame holds a reference to the mapping
+		Vs_AtomicIncrement(&af->mapping->refcount);
+		frame = Vs_Stdframe_Wrap(af->vsynth, af->pixfmt, af->width, af->height, data, stride, Mapping_Release, af->mapping);
+		if (frame == NULL)
+			Mapping_Release(af->mapping);
+	}
+	else
+	{
+		frame = Vs_Stdframe_NewPadded(af->vsynth, af->pixfmt, af->width, af->height, af->padding_right, af->padding_bottom);
+		if (frame != NULL)
+		{
+			job.af = af;
+			job.src = src;
+			job.dst = frame;
+			job.convert = af->samplesize == 2 && (af->shift != 0 || !LittleEndian());
+			Vs_Stdframe_RunSlices(af->vsynth, frame, 1, CopySlice, &job);
+		}
+	}
+	if (frame == NULL)
+		return NULL;
+
+	frame->base.timestamp = FrameTimestamp(af, n);
+	return &frame->base;
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_FrameNumber, rawsource_active_get_frame_count)(Vs_ActiveFilter filter)
+{
+	return GetRawsourceActive(filter)->count;
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Timestamp, rawsource_active_get_duration)(Vs_ActiveFilter filter)
+{
+	struct RawsourceActive *af = GetRawsourceActive(filter);
+	return FrameTimestamp(af, af->count);
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_FrameNumber, rawsource_active_frame_at_timestamp)(Vs_ActiveFilter filter, Vs_Timestamp t)
+{
+	struct RawsourceActive *af = GetRawsourceActive(filter);
+
+	if (t >= FrameTimestamp(af, af->count))
+		return FRAMENUMBER_NONE;
+	if (af->index != NULL)
+		return af->vsynth->Seek->IndexFind(af->index, t);
+	// the last n with n * ts_num / ts_den <= t, that is n * ts_num < (t + 1) * ts_den
+	return ((t + 1) * af->ts_den - 1) / af->ts_num;
+}
+
+struct TAG_Vs_ActiveFilterVirtual rawsource_active_vtable = {
+	rawsource_active_destroy,
+	rawsource_active_get_frame,
+	rawsource_active_get_frame_count,
+	rawsource_active_get_duration,
+	NULL,
+	rawsource_active_frame_at_timestamp
+};
+
+
+/*
+	File formats
+*/
+
+/// What is known about a stream before its frames are indexed
+struct StreamInfo {
+	enum Vs_StdframePixelFormat pixfmt;
+	size_t width, height;
+	/// Significant bits per sample
+	int bits;
+	/// Frame rate, zero if unknown
+	unsigned long long rate_num, rate_den;
+	/// Offset of the first frame, or its header for Y4M
+	unsigned long long start;
+};
+
+/// Parse a Y4M colourspace tag, returns zero if it isn't supported
+///
+/// The 4:2:0 chroma siting variants are all read the same way.
+static int ParseColorspace(const char *tag, struct StreamInfo *info)
+{
+	static const struct {
+		const char *prefix;
+		enum Vs_StdframePixelFormat pixfmt8;
+		enum Vs_StdframePixelFormat pixfmt16;
+	} families[] = {
+		{ "mono", STDPIXFMT_MONO8, STDPIXFMT_MONO16 },
+		{ "420", STDPIXFMT_YCrCb8_420, STDPIXFMT_YCrCb16_420 },
+		{ "422", STDPIXFMT_YCrCb8_422, STDPIXFMT_YCrCb16_422 },
+		{ "444", STDPIXFMT_YCrCb8_444, STDPIXFMT_YCrCb16_444 }
+	};
+	const char *rest;
+	char *end;
+	unsigned long bits;
+	size_t i, len;
+
+	for (i = 0; i < sizeof(families) / sizeof(families[0]); i++)
+	{
+		len = strlen(families[i].prefix);
+		if (strncmp(tag, families[i].prefix, len) != 0)
+			continue;
+		rest = tag + len;
+
+		if (*rest == '\0' || strcmp(rest, "jpeg") == 0 || strcmp(rest, "paldv") == 0 || strcmp(rest, "mpeg2") == 0)
+		{
+			info->pixfmt = families[i].pixfmt8;
+			info->bits = 8;
+			return 1;
+		}
+		if (strcmp(rest, "alpha") == 0 && families[i].pixfmt8 == STDPIXFMT_YCrCb8_444)
+		{
+			info->pixfmt = STDPIXFMT_YCrCbA8_444;
+			info->bits = 8;
+			return 1;
+		}
+		// deep formats are 420p10, 444p16, mono16 and so on
+		if (*rest == 'p')
+			rest++;
+		bits = strtoul(rest, &end, 10);
+		if (end == rest || *end != '\0' || bits < 9 || bits > 16)
+			return 0;
+		info->pixfmt = families[i].pixfmt16;
+		info->bits = (int)bits;
+		return 1;
+	}
+	return 0;
+}
+
+/// Parse the Y4M stream header, returns an error message or NULL
+static const char *ParseY4M(const struct Mapping *m, struct StreamInfo *info)
+{
+	const char *data = (const char *)m->data;
+	size_t limit = m->size < MAX_HEADER ? (size_t)m->size : MAX_HEADER;
+	const char *p = data + strlen(Y4M_SIGNATURE);
+	const char *nl = (const char *)memchr(p, '\n', limit - (p - data));
+	const char *token;
+	char value[64];
+	char *end;
+	size_t len;
+
+	if (nl == NULL)
+		return "Bad Y4M header";
+
+	info->width = 0;
+	info->height = 0;
+	info->pixfmt = STDPIXFMT_YCrCb8_420;
+	info->bits = 8;
+	info->rate_num = 0;
+	info->rate_den = 0;
+
+	while (p < nl)
+	{
+		if (*p == ' ')
+		{
+			p++;
+			continue;
+		}
+		token = p;
+		while (p < nl && *p != ' ')
+			p++;
+		len = (size_t)(p - token) - 1;
+		if (len >= sizeof(value))
+			continue;
+		memcpy(value, token + 1, len);
+		value[len] = '\0';
+
+		switch (token[0])
+		{
+		case 'W':
+			info->width = (size_t)strtoul(value, NULL, 10);
+			break;
+		case 'H':
+			info->height = (size_t)strtoul(value, NULL, 10);
+			break;
+		case 'F':
+			info->rate_num = strtoull(value, &end, 10);
+			info->rate_den = *end == ':' ? strtoull(end + 1, NULL, 10) : 0;
+			if (info->rate_den == 0)
+				info->rate_num = 0;
+			break;
+		case 'C':
+			if (!ParseColorspace(value, info))
+				return "Unsupported Y4M colourspace";
+			break;
+		default:
+			// interlacing, aspect ratio and extensions don't matter here
+			break;
+		}
+	}
+
+	if (info->width < 1 || info->height < 1)
+		return "Y4M header has no frame size";
+	info->start = (unsigned long long)(nl + 1 - data);
+	return NULL;
+}
+
+/// Find the frames of a Y4M file
+///
+/// If every frame header has the same length, the frames are evenly spaced
+/// and no offset table is kept.
+static int IndexY4M(struct RawsourceActive *af, unsigned long long start)
+{
+	const unsigned char *data = af->mapping->data;
+	unsigned long long size = af->mapping->size;
+	unsigned long long pos = start, offset;
+	unsigned long long *offsets = NULL, *grown;
+	size_t capacity = 0, limit;
+	const unsigned char *nl;
+	Vs_FrameNumber n = 0;
+	int even = 1;
+
+	while (size - pos > strlen(Y4M_FRAME) && memcmp(data + pos, Y4M_FRAME, strlen(Y4M_FRAME)) == 0)
+	{
+		limit = size - pos < MAX_HEADER ? (size_t)(size - pos) : MAX_HEADER;
+		nl = (const unsigned char *)memchr(data + pos, '\n', limit);
+		if (nl == NULL)
+			break;
+		offset = (unsigned long long)(nl + 1 - data);
+		// a truncated last frame is left out
+		if (size - offset < af->frame_bytes)
+			break;
+
+		if (n == capacity)
+		{
+			capacity = capacity ? capacity * 2 : 1024;
+			grown = (unsigned long long *)realloc(offsets, capacity * sizeof(unsigned long long));
+			if (grown == NULL)
+			{
+				free(offsets);
+				return 0;
+			}
+			offsets = grown;
+		}
+		offsets[n] = offset;
+		if (n >= 2 && offset - offsets[n - 1] != offsets[1] - offsets[0])
+			even = 0;
+		n++;
+		pos = offset + af->frame_bytes;
+	}
+
+	af->count = n;
+	af->offsets = NULL;
+	af->first_offset = n > 0 ? offsets[0] : 0;
+	af->frame_stride = n > 1 ? offsets[1] - offsets[0] : 0;
+	if (even)
+		free(offsets);
+	else
+		af->offsets = offsets;
+	return 1;
+}
+
+/// Read the timestamps of the frames from a Matroska v2 timecodes file into a new index
+///
+/// The file has a header line, then the time of each frame in milliseconds
+/// on a line of its own. Returns NULL on success, or an error message.
+static const char *ReadTimecodes(struct RawsourceActive *af, const char *path, long long timescale)
+{
+	Vs_SeekAPI seek = af->vsynth->Seek;
+	char line[256];
+	char *p, *end;
+	double ms;
+	Vs_Timestamp t, last = 0, previous = 0;
+	Vs_FrameNumber n = 0;
+	int have_end = 0;
+	FILE *file;
+
+	file = fopen(path, "r");
+	if (file == NULL)
+		return "Cannot open the timecodes file";
+	if (fgets(line, sizeof(line), file) == NULL || strncmp(line, TIMECODES_SIGNATURE, strlen(TIMECODES_SIGNATURE)) != 0)
+	{
+		fclose(file);
+		return "Not a v2 timecodes file";
+	}
+	af->index = seek->NewIndex(af->vsynth);
+	if (af->index == NULL)
+	{
+		fclose(file);
+		return "Out of memory";
+	}
+
+	while (!have_end && fgets(line, sizeof(line), file) != NULL)
+	{
+		for (p = line; *p == ' ' || *p == '\t'; p++);
+		if (*p == '#' || *p == '\r' || *p == '\n' || *p == '\0')
+			continue;
+		ms = strtod(p, &end);
+		for (; *end == ' ' || *end == '\t' || *end == '\r' || *end == '\n'; end++);
+		if (end == p || *end != '\0' || !(ms >= 0))
+		{
+			fclose(file);
+			return "Invalid time in the timecodes file";
+		}
+		t = (Vs_Timestamp)(ms * timescale / 1000 + 0.5);
+		if (n > 0 && t <= last)
+		{
+			fclose(file);
+			return "Times in the timecodes file are not increasing";
+		}
+		if (n == af->count)
+		{
+			// the line after the last frame is the end of the stream
+			have_end = 1;
+		}
+		else if (!seek->IndexAppend(af->index, t))
+		{
+			fclose(file);
+			return "Out of memory";
+		}
+		previous = last;
+		last = t;
+		n++;
+	}
+	fclose(file);
+
+	if (n < af->count)
+		return "The timecodes file has fewer times than the file has frames";
+	if (have_end)
+		af->duration = last;
+	else if (n >= 2)
+		af->duration = last + (last - previous);
+	else
+		return "The timecodes file doesn't give the duration of the only frame";
+	return NULL;
+}
+
+/// Work out where the planes of a frame are stored
+static void SetLayout(struct RawsourceActive *af, int bits)
+{
+	// file order is Y, Cb, Cr, A, stdframe order is Y, Cr, Cb, A
+	static const size_t file_order[4] = { 0, 2, 1, 3 };
+	size_t pixelsize = STDPIXFMT_pixelsize(af->pixfmt);
+	size_t wscale, hscale, p, i;
+	size_t offset = 0;
+
+	af->planes = STDPIXFMT_planecount(af->pixfmt);
+	af->samplesize = pixelsize == 2 || pixelsize == 8 ? 2 : 1;
+	af->shift = af->samplesize == 2 ? 16 - bits : 0;
+	for (i = 0; i < af->planes; i++)
+	{
+		p = af->planes == 1 ? 0 : file_order[i];
+		wscale = STDPIXFMT_planewidthscale(af->pixfmt, p);
+		hscale = STDPIXFMT_planeheightscale(af->pixfmt, p);
+		af->plane_offset[p] = offset;
+		af->line_bytes[p] = (af->width + wscale-1) / wscale * pixelsize;
+		offset += af->line_bytes[p] * ((af->height + hscale-1) / hscale);
+	}
+	af->frame_bytes = offset;
+}
+
+
+/*
+	Filter
+*/
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Filter, rawsource_new)(Vs_Library vsynth)
+{
+	struct RawsourceFilter *f = (struct RawsourceFilter *)malloc(sizeof(struct RawsourceFilter));
+	f->base.methods = &rawsource_vtable;
+	f->vsynth = vsynth;
+	f->refcount = 1;
+	f->path = NULL;
+	f->format = NULL;
+	f->timecodes = NULL;
+	f->width = 0;
+	f->height = 0;
+	f->pixfmt = -1;
+	f->bitdepth = 0;
+	f->timescale = DEFAULT_TIMESCALE;
+	f->frame_duration = 0;
+	return &f->base;
+}
+
+Vs_FilterFactory rawsource_factory = {
+	"rawsource",
+	"Y4M and raw video file source",
+	"Public domain",
+	rawsource_new
+};
+
+
+VSYNTH_IMPLEMENT_METHOD(void, rawsource_addref)(Vs_Filter filter)
+{
+	struct RawsourceFilter *rf = GetRawsource(filter);
+	rf->refcount++;
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, rawsource_unref)(Vs_Filter filter)
+{
+	struct RawsourceFilter *rf = GetRawsource(filter);
+	assert(rf->refcount > 0);
+	rf->refcount--;
+
+	if (rf->refcount == 0)
+	{
+		if (rf->path != NULL)
+			rf->vsynth->String->Free(rf->path);
+		if (rf->format != NULL)
+			rf->vsynth->String->Free(rf->format);
+		if (rf->timecodes != NULL)
+			rf->vsynth->String->Free(rf->timecodes);
+		free(rf);
+	}
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Filter, rawsource_clone)(Vs_Filter filter)
+{
+	struct RawsourceFilter *rf = GetRawsource(filter);
+	struct RawsourceFilter *nf = GetRawsource(rawsource_new(rf->vsynth));
+	if (rf->path != NULL)
+		nf->path = rf->vsynth->String->Copy(rf->path);
+	if (rf->format != NULL)
+		nf->format = rf->vsynth->String->Copy(rf->format);
+	if (rf->timecodes != NULL)
+		nf->timecodes = rf->vsynth->String->Copy(rf->timecodes);
+	nf->width = rf->width;
+	nf->height = rf->height;
+	nf->pixfmt = rf->pixfmt;
+	nf->bitdepth = rf->bitdepth;
+	nf->timescale = rf->timescale;
+	nf->frame_duration = rf->frame_duration;
+	return &nf->base;
+}
+
+static Vs_ActiveFilter FailActivate(struct RawsourceFilter *f, Vs_String *error, const char *msg)
+{
+	*error = f->vsynth->String->Make(msg);
+	return NULL;
+}
+
+/// Fail activation after the file has been mapped
+static Vs_ActiveFilter FailMapped(struct RawsourceFilter *f, struct RawsourceActive *af, Vs_String *error, const char *msg)
+{
+	Mapping_Release(af->mapping);
+	free(af->offsets);
+	f->vsynth->Seek->FreeIndex(af->index);
+	free(af);
+	return FailActivate(f, error, msg);
+}
+
+static int AcceptsPixfmt(const struct Vs_StandardFrameTypeDescription *sfd, enum Vs_StdframePixelFormat pixfmt)
+{
+	const enum Vs_StdframePixelFormat *pf;
+
+	if (sfd->pixfmts == NULL)
+		return 1;
+	for (pf = sfd->pixfmts; *pf < STDPIXFMT_MAX; pf++)
+	{
+		if (*pf == pixfmt)
+			return 1;
+	}
+	return 0;
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_ActiveFilter, rawsource_activate)(Vs_Filter filter, Vs_String *error, Vs_FrameTypeDescription **frametypes)
+{
+	struct RawsourceFilter *f = GetRawsource(filter);
+	struct Vs_StandardFrameTypeDescription *sfd;
+	struct Vs_StandardFrameTypeDescription *chosen = NULL;
+	struct RawsourceActive *af;
+	struct StreamInfo info;
+	enum SourceFormat format;
+	const char *msg;
+	int natural_bits;
+
+	if (f->path == NULL || f->path->len == 0) return FailActivate(f, error, "No file given");
+	if (f->format == NULL || f->format->len == 0)
+		format = FORMAT_DETECT;
+	else if (strcmp(f->format->str, "raw") == 0)
+		format = FORMAT_RAW;
+	else if (strcmp(f->format->str, "y4m") == 0)
+		format = FORMAT_Y4M;
+	else
+		return FailActivate(f, error, "Unknown format, must be raw or y4m");
+
+	af = (struct RawsourceActive *)calloc(1, sizeof(struct RawsourceActive));
+	if (af == NULL)
+		return FailActivate(f, error, "Out of memory");
+	af->mapping = Mapping_Open(f->path->str);
+	if (af->mapping == NULL)
+	{
+		free(af);
+		return FailActivate(f, error, "Cannot open the file");
+	}
+
+	if (format == FORMAT_DETECT)
+	{
+		format = FORMAT_RAW;
+		if (af->mapping->size >= strlen(Y4M_SIGNATURE) && memcmp(af->mapping->data, Y4M_SIGNATURE, strlen(Y4M_SIGNATURE)) == 0)
+			format = FORMAT_Y4M;
+	}
+
+	if (format == FORMAT_Y4M)
+	{
+		if (af->mapping->size < strlen(Y4M_SIGNATURE) || memcmp(af->mapping->data, Y4M_SIGNATURE, strlen(Y4M_SIGNATURE)) != 0)
+			return FailMapped(f, af, error, "Not a Y4M file");
+		msg = ParseY4M(af->mapping, &info);
+		if (msg != NULL)
+			return FailMapped(f, af, error, msg);
+	}
+	else
+	{
+		if (f->width < 1) return FailMapped(f, af, error, "Width is less than 1");
+		if (f->height < 1) return FailMapped(f, af, error, "Height is less than 1");
+		if (f->pixfmt < 0 || f->pixfmt >= STDPIXFMT_MAX) return FailMapped(f, af, error, "Invalid pixfmt");
+		info.pixfmt = (enum Vs_StdframePixelFormat)f->pixfmt;
+		info.width = (size_t)f->width;
+		info.height = (size_t)f->height;
+		natural_bits = STDPIXFMT_pixelsize(info.pixfmt) == 2 || STDPIXFMT_pixelsize(info.pixfmt) == 8 ? 16 : 8;
+		info.bits = f->bitdepth == 0 ? natural_bits : (int)f->bitdepth;
+		if (info.bits != natural_bits && (natural_bits == 8 || info.bits < 9 || info.bits > 16))
+			return FailMapped(f, af, error, "Bit depth does not fit the pixfmt");
+		info.rate_num = 0;
+		info.rate_den = 0;
+		info.start = 0;
+	}
+
+	af->pixfmt = info.pixfmt;
+	af->width = info.width;
+	af->height = info.height;
+	SetLayout(af, info.bits);
+
+	if (format == FORMAT_Y4M)
+	{
+		if (!IndexY4M(af, info.start))
+			return FailMapped(f, af, error, "Out of memory");
+	}
+	else
+	{
+		af->count = af->mapping->size / af->frame_bytes;
+		af->first_offset = 0;
+		af->frame_stride = af->frame_bytes;
+	}
+	if (af->count == 0)
+		return FailMapped(f, af, error, "The file holds no complete frame");
+
+	if (f->timecodes != NULL && f->timecodes->len > 0)
+	{
+		if (f->timescale < 1)
+			return FailMapped(f, af, error, "Timescale is less than 1");
+		af->vsynth = f->vsynth;
+		msg = ReadTimecodes(af, f->timecodes->str, f->timescale);
+		if (msg != NULL)
+			return FailMapped(f, af, error, msg);
+	}
+	else if (f->frame_duration != 0)
+	{
+		af->ts_num = f->frame_duration;
+		af->ts_den = 1;
+	}
+	else if (info.rate_num != 0)
+	{
+		if (f->timescale < 1)
+			return FailMapped(f, af, error, "Timescale is less than 1");
+		af->ts_num = (unsigned long long)f->timescale * info.rate_den;
+		af->ts_den = info.rate_num;
+		if (af->ts_num < af->ts_den)
+			return FailMapped(f, af, error, "Timescale is too small for the frame rate");
+	}
+	else
+		return FailMapped(f, af, error, "No frame duration is set");
+
+	for (; *frametypes; frametypes++)
+	{
+		sfd = Vs_Stdframe_CheckFTD(*frametypes);
+		if (sfd == NULL)
+		{
+			(*frametypes)->out_supported = 0;
+			continue;
+		}
+
+		// the file is delivered as it is, conversions are up to other filters
+		sfd->base.out_supported = 1;
+		if (!AcceptsPixfmt(sfd, af->pixfmt))
+		{
+			sfd->base.out_supported = 0;
+		}
+		else if (sfd->minwidth > af->width || sfd->maxwidth < af->width || sfd->minheight > af->height || sfd->maxheight < af->height)
+		{
+			sfd->base.out_supported = 0;
+		}
+		else if (sfd->width_modulo && (af->width % sfd->width_modulo != 0))
+		{
+			sfd->base.out_supported = 0;
+		}
+		else if (sfd->height_modulo && (af->height % sfd->height_modulo != 0))
+		{
+			sfd->base.out_supported = 0;
+		}
+		else if (sfd->alignment > VS_STDFRAME_ALIGNMENT)
+		{
+			sfd->base.out_supported = 0;
+		}
+
+		if (sfd->base.out_supported)
+		{
+			sfd->minwidth = sfd->maxwidth = af->width;
+			sfd->minheight = sfd->maxheight = af->height;
+			sfd->allow_pixfmt_change = 0;
+			sfd->allow_resolution_change = 0;
+			if (chosen == NULL)
+				chosen = sfd;
+		}
+	}
+
+	if (chosen == NULL)
+		return FailMapped(f, af, error, "None of the offered frame types match the file");
+
+	af->base.methods = &rawsource_active_vtable;
+	af->base.filter = filter;
+	rawsource_addref(filter);
+	af->vsynth = f->vsynth;
+	af->alignment = chosen->alignment;
+	af->padding_right = chosen->padding_right;
+	af->padding_bottom = chosen->padding_bottom;
+	af->can_wrap = af->padding_right == 0 && af->padding_bottom == 0 &&
+		!(af->samplesize == 2 && (af->shift != 0 || !LittleEndian()));
+
+	return &af->base;
+}
+
+
+/// Property IDs, in the order enum_properties reports them
+enum RawsourceProperty {
+	RAWSOURCE_PATH,
+	RAWSOURCE_FORMAT,
+	RAWSOURCE_WIDTH,
+	RAWSOURCE_HEIGHT,
+	RAWSOURCE_PIXFMT,
+	RAWSOURCE_BITDEPTH,
+	RAWSOURCE_FRAMEDUR,
+	RAWSOURCE_TIMESCALE,
+	RAWSOURCE_TIMECODES,
+	RAWSOURCE_PROPERTY_COUNT
+};
+
+static const struct {
+	const char *name;
+	enum Vs_PropertyType type;
+} rawsource_properties[RAWSOURCE_PROPERTY_COUNT] = {
+	{ "path", PROP_STRING },
+	{ "format", PROP_STRING },
+	{ "width", PROP_INT },
+	{ "height", PROP_INT },
+	{ "pixfmt", PROP_INT },
+	{ "bitdepth", PROP_INT },
+	{ "framedur", PROP_TIMESTAMP },
+	{ "timescale", PROP_INT },
+	{ "timecodes", PROP_STRING }
+};
+
+VSYNTH_IMPLEMENT_METHOD(void, rawsource_enum_properties)(Vs_EnumPropertiesFunc callback, void *userdata)
+{
+	int i;
+	for (i = 0; i < RAWSOURCE_PROPERTY_COUNT; i++)
+		callback(rawsource_properties[i].name, rawsource_properties[i].type, userdata);
+}
+
+static void SetString(struct RawsourceFilter *f, Vs_String *field, Vs_String value)
+{
+	if (value != NULL)
+		value = f->vsynth->String->Copy(value);
+	if (*field != NULL)
+		f->vsynth->String->Free(*field);
+	*field = value;
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Filter, rawsource_get_property_filter)(Vs_Filter filter, const char *name)
+{
+	return NULL; // no filter properties
+}
+
+VSYNTH_IMPLEMENT_METHOD(long long, rawsource_get_property_int)(Vs_Filter filter, const char *name)
+{
+	struct RawsourceFilter *f = GetRawsource(filter);
+	if (strcmp(name, "width") == 0)
+		return f->width;
+	if (strcmp(name, "height") == 0)
+		return f->height;
+	if (strcmp(name, "pixfmt") == 0)
+		return f->pixfmt;
+	if (strcmp(name, "bitdepth") == 0)
+		return f->bitdepth;
+	if (strcmp(name, "timescale") == 0)
+		return f->timescale;
+	return 0;
+}
+
+VSYNTH_IMPLEMENT_METHOD(double, rawsource_get_property_double)(Vs_Filter filter, const char *name)
+{
+	return 0; // no double properties
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_String, rawsource_get_property_string)(Vs_Filter filter, const char *name)
+{
+	struct RawsourceFilter *f = GetRawsource(filter);
+	if (strcmp(name, "path") == 0)
+		return f->path;
+	if (strcmp(name, "format") == 0)
+		return f->format;
+	if (strcmp(name, "timecodes") == 0)
+		return f->timecodes;
+	return NULL;
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_FrameNumber, rawsource_get_property_framenumber)(Vs_Filter filter, const char *name)
+{
+	return 0; // no framenumber properties
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Timestamp, rawsource_get_property_timestamp)(Vs_Filter filter, const char *name)
+{
+	struct RawsourceFilter *f = GetRawsource(filter);
+	if (strcmp(name, "framedur") == 0)
+		return f->frame_duration;
+	return 0;
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, rawsource_set_property_filter)(Vs_Filter filter, const char *name, Vs_Filter value)
+{
+	// no filter properties
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, rawsource_set_property_int)(Vs_Filter filter, const char *name, long long value)
+{
+	struct RawsourceFilter *f = GetRawsource(filter);
+	if (strcmp(name, "width") == 0)
+		f->width = value;
+	else if (strcmp(name, "height") == 0)
+		f->height = value;
+	else if (strcmp(name, "pixfmt") == 0)
+		f->pixfmt = value;
+	else if (strcmp(name, "bitdepth") == 0)
+		f->bitdepth = value;
+	else if (strcmp(name, "timescale") == 0)
+		f->timescale = value;
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, rawsource_set_property_double)(Vs_Filter filter, const char *name, double value)
+{
+	// no double properties
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, rawsource_set_property_string)(Vs_Filter filter, const char *name, Vs_String value)
+{
+	struct RawsourceFilter *f = GetRawsource(filter);
+	if (strcmp(name, "path") == 0)
+		SetString(f, &f->path, value);
+	else if (strcmp(name, "format") == 0)
+		SetString(f, &f->format, value);
+	else if (strcmp(name, "timecodes") == 0)
+		SetString(f, &f->timecodes, value);
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, rawsource_set_property_framenumber)(Vs_Filter filter, const char *name, Vs_FrameNumber value)
+{
+	// no framenumber properties
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, rawsource_set_property_timestamp)(Vs_Filter filter, const char *name, Vs_Timestamp value)
+{
+	struct RawsourceFilter *f = GetRawsource(filter);
+	if (strcmp(name, "framedur") == 0)
+		f->frame_duration = value;
+}
+
+VSYNTH_IMPLEMENT_METHOD(int, rawsource_get_property_by_id)(Vs_Filter filter, Vs_PropertyId id, Vs_PropertyValue *value)
+{
+	struct RawsourceFilter *f = GetRawsource(filter);
+	if (id < 0 || id >= RAWSOURCE_PROPERTY_COUNT)
+		return 0;
+	value->type = rawsource_properties[id].type;
+	switch (id)
+	{
+	case RAWSOURCE_PATH:
+		value->v.s = f->path;
+		break;
+	case RAWSOURCE_FORMAT:
+		value->v.s = f->format;
+		break;
+	case RAWSOURCE_WIDTH:
+		value->v.i = f->width;
+		break;
+	case RAWSOURCE_HEIGHT:
+		value->v.i = f->height;
+		break;
+	case RAWSOURCE_PIXFMT:
+		value->v.i = f->pixfmt;
+		break;
+	case RAWSOURCE_BITDEPTH:
+		value->v.i = f->bitdepth;
+		break;
+	case RAWSOURCE_FRAMEDUR:
+		value->v.ts = f->frame_duration;
+		break;
+	case RAWSOURCE_TIMESCALE:
+		value->v.i = f->timescale;
+		break;
+	case RAWSOURCE_TIMECODES:
+		value->v.s = f->timecodes;
+		break;
+	}
+	return 1;
+}
+
+VSYNTH_IMPLEMENT_METHOD(int, rawsource_set_property_by_id)(Vs_Filter filter, Vs_PropertyId id, const Vs_PropertyValue *value)
+{
+	struct RawsourceFilter *f = GetRawsource(filter);
+	if (id < 0 || id >= RAWSOURCE_PROPERTY_COUNT || value->type != rawsource_properties[id].type)
+		return 0;
+	switch (id)
+	{
+	case RAWSOURCE_PATH:
+		SetString(f, &f->path, value->v.s);
+		break;
+	case RAWSOURCE_FORMAT:
+		SetString(f, &f->format, value->v.s);
+		break;
+	case RAWSOURCE_WIDTH:
+		f->width = value->v.i;
+		break;
+	case RAWSOURCE_HEIGHT:
+		f->height = value->v.i;
+		break;
+	case RAWSOURCE_PIXFMT:
+		f->pixfmt = value->v.i;
+		break;
+	case RAWSOURCE_BITDEPTH:
+		f->bitdepth = value->v.i;
+		break;
+	case RAWSOURCE_FRAMEDUR:
+		f->frame_duration = value->v.ts;
+		break;
+	case RAWSOURCE_TIMESCALE:
+		f->timescale = value->v.i;
+		break;
+	case RAWSOURCE_TIMECODES:
+		SetString(f, &f->timecodes, value->v.s);
+		break;
+	}
+	return 1;
+}
+
+
+struct TAG_Vs_FilterVirtual rawsource_vtable = {
+	rawsource_addref,
+	rawsource_unref,
+	rawsource_clone,
+	rawsource_activate,
+	rawsource_enum_properties,
+	rawsource_get_property_filter,
+	rawsource_get_property_int,
+	rawsource_get_property_double,
+	rawsource_get_property_string,
+	rawsource_get_property_framenumber,
+	rawsource_get_property_timestamp,
+	rawsource_set_property_filter,
+	rawsource_set_property_int,
+	rawsource_set_property_double,
+	rawsource_set_property_string,
+	rawsource_set_property_framenumber,
+	rawsource_set_property_timestamp,
+	rawsource_get_property_by_id,
+	rawsource_set_property_by_id
+};
+
+
+VSYNTH_API(void) Vs_PluginInit(Vs_Library vsynth)
+{
+	vsynth->FilterRegistry->Register(vsynth, &rawsource_factory);
+}
@@ -0,0 +1,1102 @@
+#include <vsynth/vsynth.h>
+#include <vsynth/stdframe.h>
+#include <vsynth/platform.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <assert.h>
+#if VSYNTH_SSE2
+# include <emmintrin.h>
+#endif
+
+
+/*
+
+Resize scales stdframes to a new size, keeping the pixel format.
+
+Scaling is separable: a horizontal pass filters each input scanline into a
+16 bit intermediate buffer, and a vertical pass filters the intermediate
+scanlines into the output. Both passes are driven by coefficient tables
+holding, for every output sample, the first input sample used and one
+fixed point weight per tap. Taps falling outside the picture are folded
+onto the edge samples when the tables are built, so the passes never have
+to check for edges.
+
+The tables only depend on the plane sizes, so they are built once at
+activation when the input promises a fixed size, for both full resolution
+and subsampled planes.
+
+The output frame is cut into slices, which are scaled in parallel on the
+library's worker threads. Every slice runs the horizontal pass for just
+the input lines it needs, so slices share nothing but the tables.
+
+Frames already at the output size are passed through, unless their planes
+miss the padding or alignment the caller asked for, as cropped frames may;
+those are copied into a new frame instead.
+
+*/
+
+
+#ifndef M_PI
+# define M_PI 3.14159265358979323846
+#endif
+
+/// Weights are fixed point with this many fraction bits
+#define WEIGHT_BITS 14
+/// Extra fraction bits kept in the intermediate buffer for 8 bit samples
+#define INTER8_BITS 6
+
+/// Horizontal taps are padded to a multiple of this, one vector of weights
+#define HTAP_MULTIPLE 8
+/// Vertical taps are padded to a multiple of this, pairs of lines
+#define VTAP_MULTIPLE 2
+
+enum ResizeKernel {
+	KERNEL_BILINEAR,
+	KERNEL_BICUBIC,
+	KERNEL_LANCZOS
+};
+
+/// Filter taps for one direction of one plane size
+struct Coefficients {
+	/// Number of output samples
+	size_t count;
+	/// Number of weights per output sample
+	size_t taps;
+	/// First input sample for each output sample
+	size_t *offset;
+	/// Weights for each output sample, taps apiece, 16 byte aligned
+	int16_t *weights;
+};
+
+/// Coefficients for all planes of one input size
+///
+/// Indexed by plane subsampling factor minus one.
+struct ResizeTables {
+	size_t src_width;
+	size_t src_height;
+	struct Coefficients h[2];
+	struct Coefficients v[2];
+};
+
+struct ResizeFilter {
+	struct TAG_Vs_Filter base;
+	Vs_Library vsynth;
+	size_t refcount;
+	Vs_Filter clip;
+	long long width;
+	long long height;
+	Vs_String kernel;
+	long long taps;
+};
+
+struct ResizeActive {
+	struct TAG_Vs_ActiveFilter base;
+	Vs_Library vsynth;
+	Vs_ActiveFilter upstream;
+	size_t width;
+	size_t height;
+	enum ResizeKernel kernel;
+	/// Lobes of the Lanczos kernel
+	int lobes;
+	size_t padding_right;
+	size_t padding_bottom;
+	/// Plane alignment asked for downstream, 0 if any will do
+	size_t alignment;
+	/// Tables for the input size, NULL if the input may change size
+	struct ResizeTables *tables;
+};
+
+extern struct TAG_Vs_FilterVirtual resize_vtable;
+extern struct TAG_Vs_ActiveFilterVirtual resize_active_vtable;
+
+static __inline struct ResizeFilter * GetResize(Vs_Filter filter)
+{
+	if (filter->methods == &resize_vtable)
+		return (struct ResizeFilter *)filter;
+	else
+		return NULL;
+}
+
+static __inline struct ResizeActive * GetResizeActive(Vs_ActiveFilter filter)
+{
+	if (filter->methods == &resize_active_vtable)
+		return (struct ResizeActive *)filter;
+	else
+		return NULL;
+}
+
+
+/*
+	Coefficient tables
+*/
+
+static double Sinc(double x)
+{
+	if (x == 0.0)
+		return 1.0;
+	x *= M_PI;
+	return sin(x) / x;
+}
+
+/// Radius of a kernel's support, in input samples when not downscaling
+static double KernelRadius(enum ResizeKernel kernel, int lobes)
+{
+	switch (kernel)
+	{
+	case KERNEL_BILINEAR:
+		return 1.0;
+	case KERNEL_BICUBIC:
+		return 2.0;
+	default:
+		return lobes;
+	}
+}
+
+static double KernelValue(enum ResizeKernel kernel, int lobes, double x)
+{
+	x = fabs(x);
+	switch (kernel)
+	{
+	case KERNEL_BILINEAR:
+		return x < 1.0 ? 1.0 - x : 0.0;
+	case KERNEL_BICUBIC:
+		// Keys cubic with a = -0.5, aka Catmull-Rom
+		if (x < 1.0)
+			return (1.5 * x - 2.5) * x * x + 1.0;
+		if (x < 2.0)
+			return ((-0.5 * x + 2.5) * x - 4.0) * x + 2.0;
+		return 0.0;
+	default:
+		return x < lobes ? Sinc(x) * Sinc(x / lobes) : 0.0;
+	}
+}
+
+static void Coefficients_Free(struct Coefficients *c)
+{
+	free(c->offset);
+	Vs_AlignedFree(c->weights);
+	c->offset = NULL;
+	c->weights = NULL;
+}
+
+/// Build the taps for scaling srcsize samples to dstsize, returns zero if out of memory
+static int Coefficients_Init(struct Coefficients *c, size_t srcsize, size_t dstsize, enum ResizeKernel kernel, int lobes, size_t multiple)
+{
+	double scale = (double)dstsize / srcsize;
+	// when downscaling the kernel is stretched to cover every input sample
+	double stretch = scale < 1.0 ? scale : 1.0;
+	double radius = KernelRadius(kernel, lobes) / stretch;
+	size_t support = (size_t)ceil(2.0 * radius);
+	double *w;
+	double center, sum;
+	ptrdiff_t left, pos;
+	size_t i, k, start, largest;
+	int total;
+
+	c->count = dstsize;
+	c->taps = (support + multiple - 1) / multiple * multiple;
+	c->offset = (size_t *)malloc(dstsize * sizeof(size_t));
+	c->weights = (int16_t *)Vs_AlignedAlloc(dstsize * c->taps * sizeof(int16_t), 16);
+	w = (double *)malloc(c->taps * sizeof(double));
+	if (c->offset == NULL || c->weights == NULL || w == NULL)
+	{
+		Coefficients_Free(c);
+		free(w);
+		return 0;
+	}
+
+	for (i = 0; i < dstsize; i++)
+	{
+		// sample centers are at half integer positions in both sizes
+		center = (i + 0.5) / scale - 0.5;
+		left = (ptrdiff_t)floor(center - radius) + 1;
+		start = left < 0 ? 0 : (size_t)left;
+		if (start > srcsize - 1)
+			start = srcsize - 1;
+
+		// fold taps outside the picture onto the edge samples
+		for (k = 0; k < c->taps; k++)
+			w[k] = 0.0;
+		for (k = 0; k < support; k++)
+		{
+			pos = left + (ptrdiff_t)k;
+			if (pos < 0)
+				pos = 0;
+			if (pos > (ptrdiff_t)srcsize - 1)
+				pos = (ptrdiff_t)srcsize - 1;
+			w[pos - start] += KernelValue(kernel, lobes, (left + (ptrdiff_t)k - center) * stretch);
+		}
+
+		sum = 0.0;
+		for (k = 0; k < c->taps; k++)
+			sum += w[k];
+
+		// quantise, and put the rounding error on the largest tap so the sum is exact
+		total = 0;
+		largest = 0;
+		for (k = 0; k < c->taps; k++)
+		{
+			c->weights[i * c->taps + k] = (int16_t)floor(w[k] / sum * (1 << WEIGHT_BITS) + 0.5);
+			total += c->weights[i * c->taps + k];
+			if (w[k] > w[largest])
+				largest = k;
+		}
+		c->weights[i * c->taps + largest] += (int16_t)((1 << WEIGHT_BITS) - total);
+		c->offset[i] = start;
+	}
+
+	free(w);
+	return 1;
+}
+
+static void ResizeTables_Free(struct ResizeTables *t)
+{
+	int i;
+	for (i = 0; i < 2; i++)
+	{
+		Coefficients_Free(&t->h[i]);
+		Coefficients_Free(&t->v[i]);
+	}
+	free(t);
+}
+
+/// Build the tables for all plane sizes of an input size, returns NULL if out of memory
+static struct ResizeTables *ResizeTables_New(struct ResizeActive *af, size_t src_width, size_t src_height)
+{
+	struct ResizeTables *t = (struct ResizeTables *)calloc(1, sizeof(struct ResizeTables));
+	int ok = 1;
+	size_t s;
+
+	if (t == NULL)
+		return NULL;
+	t->src_width = src_width;
+	t->src_height = src_height;
+	for (s = 1; s <= 2; s++)
+	{
+		ok = ok && Coefficients_Init(&t->h[s-1], (src_width + s-1) / s, (af->width + s-1) / s, af->kernel, af->lobes, HTAP_MULTIPLE);
+		ok = ok && Coefficients_Init(&t->v[s-1], (src_height + s-1) / s, (af->height + s-1) / s, af->kernel, af->lobes, VTAP_MULTIPLE);
+	}
+	if (!ok)
+	{
+		ResizeTables_Free(t);
+		return NULL;
+	}
+	return t;
+}
+
+
+/*
+	Line kernels
+
+	Samples are handled as signed 16 bit values in the line and
+	intermediate buffers. 8 bit samples are stored as they are in the line
+	buffer and with INTER8_BITS extra fraction bits in the intermediate
+	buffer; 16 bit samples have 32768 subtracted, which lets the signed
+	multiply-add work on them.
+*/
+
+/// Weighted sum of taps samples, taps is a multiple of HTAP_MULTIPLE
+static __inline int32_t HorizontalTap(const int16_t *src, const int16_t *weights, size_t taps)
+{
+	size_t k = 0;
+	int32_t sum = 0;
+#if VSYNTH_SSE2
+	__m128i acc = _mm_setzero_si128();
+	for (; k < taps; k += 8)
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_loadu_si128((const __m128i *)(src + k)), _mm_load_si128((const __m128i *)(weights + k))));
+	acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+	acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+	sum = _mm_cvtsi128_si32(acc);
+#endif
+	for (; k < taps; k++)
+		sum += src[k] * weights[k];
+	return sum;
+}
+
+static __inline int16_t Saturate16(int32_t v)
+{
+	return (int16_t)(v < -32768 ? -32768 : v > 32767 ? 32767 : v);
+}
+
+/// Filter one line buffer into every comps'th sample of an intermediate line
+static void HorizontalLine(const struct Coefficients *c, const int16_t *line, int16_t *dst, size_t comps, int shift)
+{
+	const int32_t round = 1 << (shift - 1);
+	size_t x;
+
+	for (x = 0; x < c->count; x++)
+		dst[x * comps] = Saturate16((HorizontalTap(line + c->offset[x], c->weights + x * c->taps, c->taps) + round) >> shift);
+}
+
+/// Weighted sum of intermediate lines into 8 bit samples
+static void VerticalLine8(const int16_t **rows, const int16_t *weights, size_t taps, uint8_t *dst, size_t n)
+{
+	const int shift = WEIGHT_BITS + INTER8_BITS;
+	size_t x = 0, k;
+	int32_t sum;
+#if VSYNTH_SSE2
+	const __m128i round = _mm_set1_epi32(1 << (shift - 1));
+	__m128i lo, hi, a, b, w;
+	for (; x + 8 <= n; x += 8)
+	{
+		lo = round;
+		hi = round;
+		for (k = 0; k < taps; k += 2)
+		{
+			// interleave two lines, so each multiply-add does a pair of taps
+			a = _mm_loadu_si128((const __m128i *)(rows[k] + x));
+			b = _mm_loadu_si128((const __m128i *)(rows[k+1] + x));
+			w = _mm_set1_epi32((int)(((uint32_t)(uint16_t)weights[k+1] << 16) | (uint16_t)weights[k]));
+			lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), w));
+			hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), w));
+		}
+		lo = _mm_packs_epi32(_mm_srai_epi32(lo, shift), _mm_srai_epi32(hi, shift));
+		_mm_storel_epi64((__m128i *)(dst + x), _mm_packus_epi16(lo, lo));
+	}
+#endif
+	for (; x < n; x++)
+	{
+		sum = 1 << (shift - 1);
+		for (k = 0; k < taps; k++)
+			sum += rows[k][x] * weights[k];
+		sum >>= shift;
+		dst[x] = (uint8_t)(sum < 0 ? 0 : sum > 255 ? 255 : sum);
+	}
+}
+
+/// Weighted sum of intermediate lines into 16 bit samples
+static void VerticalLine16(const int16_t **rows, const int16_t *weights, size_t taps, uint16_t *dst, size_t n)
+{
+	const int shift = WEIGHT_BITS;
+	size_t x = 0, k;
+	int32_t sum;
+#if VSYNTH_SSE2
+	const __m128i round = _mm_set1_epi32(1 << (shift - 1));
+	const __m128i bias = _mm_set1_epi16(-32768);
+	__m128i lo, hi, a, b, w;
+	for (; x + 8 <= n; x += 8)
+	{
+		lo = round;
+		hi = round;
+		for (k = 0; k < taps; k += 2)
+		{
+			a = _mm_loadu_si128((const __m128i *)(rows[k] + x));
+			b = _mm_loadu_si128((const __m128i *)(rows[k+1] + x));
+			w = _mm_set1_epi32((int)(((uint32_t)(uint16_t)weights[k+1] << 16) | (uint16_t)weights[k]));
+			lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), w));
+			hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), w));
+		}
+		lo = _mm_packs_epi32(_mm_srai_epi32(lo, shift), _mm_srai_epi32(hi, shift));
+		_mm_storeu_si128((__m128i *)(dst + x), _mm_xor_si128(lo, bias));
+	}
+#endif
+	for (; x < n; x++)
+	{
+		sum = 1 << (shift - 1);
+		for (k = 0; k < taps; k++)
+			sum += rows[k][x] * weights[k];
+		dst[x] = (uint16_t)(Saturate16(sum >> shift) + 32768);
+	}
+}
+
+/// Copy one component of a scanline into a line buffer, repeating the last sample taps times
+static void LoadLine(const void *src, int16_t *line, size_t width, size_t comps, size_t comp, int wide, size_t taps)
+{
+	size_t x;
+
+	if (wide)
+	{
+		const uint16_t *s = (const uint16_t *)src + comp;
+		for (x = 0; x < width; x++)
+			line[x] = (int16_t)(s[x * comps] - 32768);
+	}
+	else
+	{
+		const uint8_t *s = (const uint8_t *)src + comp;
+		for (x = 0; x < width; x++)
+			line[x] = s[x * comps];
+	}
+	for (; x < width + taps; x++)
+		line[x] = line[width - 1];
+}
+
+
+/*
+	Frame level
+*/
+
+/// One frame being resized, shared by all its slices
+struct ResizeJob {
+	struct ResizeTables *tables;
+	Vs_StandardFrame src;
+	/// Samples per pixel, more than one for the packed RGB formats
+	size_t comps;
+	/// Nonzero for 16 bit samples
+	int wide;
+	/// Set if any slice ran out of memory
+	int failed;
+};
+
+/// Resize the scanlines y0 to y1 of one plane
+static void ResizeLines(struct ResizeJob *job, Vs_StandardFrame dst, size_t plane, size_t y0, size_t y1)
+{
+	Vs_StandardFrame src = job->src;
+	size_t wscale = STDPIXFMT_planewidthscale(src->pixfmt, plane);
+	size_t hscale = STDPIXFMT_planeheightscale(src->pixfmt, plane);
+	const struct Coefficients *h = &job->tables->h[wscale - 1];
+	const struct Coefficients *v = &job->tables->v[hscale - 1];
+	size_t src_width = (src->width + wscale-1) / wscale;
+	size_t src_height = (src->height + hscale-1) / hscale;
+	size_t samples = h->count * job->comps;
+	// intermediate lines are padded so vector loads never cross into the next one
+	size_t pitch = (samples + 7) & ~(size_t)7;
+	size_t first, last, y, k, c, row;
+	int16_t *line, *inter;
+	const int16_t *rows[64];
+	const int16_t **rowp = rows;
+
+	if (y0 == y1)
+		return;
+
+	// input lines used by these lines, offsets never decrease
+	first = v->offset[y0];
+	last = v->offset[y1 - 1] + v->taps - 1;
+	if (last > src_height - 1)
+		last = src_height - 1;
+
+	line = (int16_t *)Vs_AlignedAlloc((src_width + h->taps) * sizeof(int16_t), 16);
+	inter = (int16_t *)Vs_AlignedAlloc((last - first + 1) * pitch * sizeof(int16_t), 16);
+	if (v->taps > sizeof(rows) / sizeof(rows[0]))
+		rowp = (const int16_t **)malloc(v->taps * sizeof(const int16_t *));
+	if (line == NULL || inter == NULL || rowp == NULL)
+	{
+		job->failed = 1;
+		Vs_AlignedFree(line);
+		Vs_AlignedFree(inter);
+		if (rowp != rows)
+			free((void *)rowp);
+		return;
+	}
+
+	for (y = first; y <= last; y++)
+	{
+		for (c = 0; c < job->comps; c++)
+		{
+			LoadLine((const uint8_t *)src->data[plane] + (ptrdiff_t)y * src->stride[plane], line, src_width, job->comps, c, job->wide, h->taps);
+			HorizontalLine(h, line, inter + (y - first) * pitch + c, job->comps, job->wide ? WEIGHT_BITS : WEIGHT_BITS - INTER8_BITS);
+		}
+	}
+
+	for (y = y0; y < y1; y++)
+	{
+		// padding taps have zero weight, any line in range will do for them
+		for (k = 0; k < v->taps; k++)
+		{
+			row = v->offset[y] + k;
+			if (row > last)
+				row = last;
+			rowp[k] = inter + (row - first) * pitch;
+		}
+		if (job->wide)
+			VerticalLine16(rowp, v->weights + y * v->taps, v->taps, (uint16_t *)((uint8_t *)dst->data[plane] + (ptrdiff_t)y * dst->stride[plane]), samples);
+		else
+			VerticalLine8(rowp, v->weights + y * v->taps, v->taps, (uint8_t *)dst->data[plane] + (ptrdiff_t)y * dst->stride[plane], samples);
+	}
+
+	Vs_AlignedFree(line);
+	Vs_AlignedFree(inter);
+	if (rowp != rows)
+		free((void *)rowp);
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, ResizeSlice)(Vs_StandardFrame dst, const struct Vs_StdframeSlice *slice, void *userdata)
+{
+	struct ResizeJob *job = (struct ResizeJob *)userdata;
+	size_t planes = STDPIXFMT_planecount(dst->pixfmt);
+	size_t i;
+
+	for (i = 0; i < planes; i++)
+		ResizeLines(job, dst, i, slice->plane_top[i], slice->plane_top[i] + slice->plane_height[i]);
+}
+
+/// Resize a whole frame, returns zero if out of memory
+static int ResizeFrame(struct ResizeActive *af, struct ResizeTables *tables, Vs_StandardFrame src, Vs_StandardFrame dst)
+{
+	struct ResizeJob job;
+
+	job.tables = tables;
+	job.src = src;
+	job.failed = 0;
+	switch (src->pixfmt)
+	{
+	case STDPIXFMT_XRGB8:
+	case STDPIXFMT_ARGB8:
+		job.comps = 4;
+		job.wide = 0;
+		break;
+	case STDPIXFMT_XRGB16:
+	case STDPIXFMT_ARGB16:
+		job.comps = 4;
+		job.wide = 1;
+		break;
+	default:
+		job.comps = 1;
+		job.wide = STDPIXFMT_pixelsize(src->pixfmt) == 2;
+		break;
+	}
+
+	Vs_Stdframe_RunSlices(af->vsynth, dst, 1, ResizeSlice, &job);
+	return !job.failed;
+}
+
+
+/*
+	Active filter
+*/
+
+VSYNTH_IMPLEMENT_METHOD(void, resize_active_destroy)(Vs_ActiveFilter filter)
+{
+	struct ResizeActive *af = GetResizeActive(filter);
+	af->upstream->methods->destroy(af->upstream);
+	af->base.filter->methods->unref(af->base.filter);
+	if (af->tables != NULL)
+		ResizeTables_Free(af->tables);
+	free(af);
+}
+
+/// Check whether a frame can be passed through as it is
+static int CanPassThrough(struct ResizeActive *af, Vs_StandardFrame src)
+{
+	size_t planes = STDPIXFMT_planecount(src->pixfmt);
+	size_t i;
+
+	if (src->width != af->width || src->height != af->height || src->padding_right < af->padding_right || src->padding_bottom < af->padding_bottom)
+		return 0;
+	// the input may have been cropped
+	for (i = 0; af->alignment > 1 && i < planes; i++)
+	{
+		if (((uintptr_t)src->data[i] | (uintptr_t)src->stride[i]) & (af->alignment - 1))
+			return 0;
+	}
+	return 1;
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Frame, resize_active_get_frame)(Vs_ActiveFilter filter, Vs_FrameNumber n)
+{
+	struct ResizeActive *af = GetResizeActive(filter);
+	Vs_Frame in = af->upstream->methods->get_frame(af->upstream, n);
+	Vs_StandardFrame src, dst;
+	struct ResizeTables *tables;
+
+	if (in == NULL)
+		return NULL;
+	src = Vs_Stdframe_Get(in);
+	if (src == NULL)
+	{
+		in->methods->unref(in);
+		return NULL;
+	}
+
+	// nothing to do
+	if (CanPassThrough(af, src))
+		return in;
+
+	// same size but the wrong layout, a copy does
+	if (src->width == af->width && src->height == af->height)
+	{
+		dst = Vs_Stdframe_NewPadded(af->vsynth, src->pixfmt, af->width, af->height, af->padding_right, af->padding_bottom);
+		if (dst != NULL)
+		{
+			Vs_Stdframe_CopyRegion(dst, 0, 0, src, 0, 0, src->width, src->height);
+			dst->base.timestamp = in->timestamp;
+		}
+		in->methods->unref(in);
+		return dst != NULL ? &dst->base : NULL;
+	}
+
+	// an input changing size mid-stream gets tables just for the frame
+	tables = af->tables;
+	if (tables == NULL || tables->src_width != src->width || tables->src_height != src->height)
+		tables = ResizeTables_New(af, src->width, src->height);
+
+	dst = NULL;
+	if (tables != NULL)
+		dst = Vs_Stdframe_NewPadded(af->vsynth, src->pixfmt, af->width, af->height, af->padding_right, af->padding_bottom);
+	if (dst != NULL)
+	{
+		if (!ResizeFrame(af, tables, src, dst))
+		{
+			dst->base.methods->unref(&dst->base);
+			dst = NULL;
+		}
+	}
+	if (dst != NULL)
+		dst->base.timestamp = in->timestamp;
+
+	if (tables != NULL && tables != af->tables)
+		ResizeTables_Free(tables);
+	in->methods->unref(in);
+	return dst != NULL ? &dst->base : NULL;
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_FrameNumber, resize_active_get_frame_count)(Vs_ActiveFilter filter)
+{
+	struct ResizeActive *af = GetResizeActive(filter);
+	return af->upstream->methods->get_frame_count(af->upstream);
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Timestamp, resize_active_get_duration)(Vs_ActiveFilter filter)
+{
+	struct ResizeActive *af = GetResizeActive(filter);
+	return af->upstream->methods->get_duration(af->upstream);
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_FrameNumber, resize_active_frame_at_timestamp)(Vs_ActiveFilter filter, Vs_Timestamp t)
+{
+	struct ResizeActive *af = GetResizeActive(filter);
+	return af->vsynth->Seek->FrameAtTimestamp(af->vsynth, af->upstream, t);
+}
+
+struct TAG_Vs_ActiveFilterVirtual resize_active_vtable = {
+	resize_active_destroy,
+	resize_active_get_frame,
+	resize_active_get_frame_count,
+	resize_active_get_duration,
+	NULL,
+	resize_active_frame_at_timestamp
+};
+
+
+/*
+	Filter
+*/
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Filter, resize_new)(Vs_Library vsynth)
+{
+	struct ResizeFilter *f = (struct ResizeFilter *)malloc(sizeof(struct ResizeFilter));
+	f->base.methods = &resize_vtable;
+	f->vsynth = vsynth;
+	f->refcount = 1;
+	f->clip = NULL;
+	f->width = 0;
+	f->height = 0;
+	f->kernel = NULL;
+	f->taps = 3;
+	return &f->base;
+}
+
+Vs_FilterFactory resize_factory = {
+	"resize",
+	"Resize frames with bilinear, bicubic or Lanczos filtering",
+	"Public domain",
+	resize_new
+};
+
+
+VSYNTH_IMPLEMENT_METHOD(void, resize_addref)(Vs_Filter filter)
+{
+	struct ResizeFilter *rf = GetResize(filter);
+	rf->refcount++;
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, resize_unref)(Vs_Filter filter)
+{
+	struct ResizeFilter *rf = GetResize(filter);
+	assert(rf->refcount > 0);
+	rf->refcount--;
+
+	if (rf->refcount == 0)
+	{
+		if (rf->clip != NULL)
+			rf->clip->methods->unref(rf->clip);
+		if (rf->kernel != NULL)
+			rf->vsynth->String->Free(rf->kernel);
+		free(rf);
+	}
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Filter, resize_clone)(Vs_Filter filter)
+{
+	struct ResizeFilter *rf = GetResize(filter);
+	struct ResizeFilter *nf = GetResize(resize_new(rf->vsynth));
+	nf->clip = rf->clip;
+	if (nf->clip != NULL)
+		nf->clip->methods->addref(nf->clip);
+	nf->width = rf->width;
+	nf->height = rf->height;
+	if (rf->kernel != NULL)
+		nf->kernel = rf->vsynth->String->Copy(rf->kernel);
+	nf->taps = rf->taps;
+	return &nf->base;
+}
+
+/// Move a size to the nearest one meeting the constraints, returns zero if there is none
+static size_t FitSize(size_t size, size_t minsize, size_t maxsize, unsigned short modulo)
+{
+	if (modulo > 1)
+	{
+		size = (size + modulo/2) / modulo * modulo;
+		if (size < minsize)
+			size = (minsize + modulo-1) / modulo * modulo;
+		if (size > maxsize)
+			size = maxsize / modulo * modulo;
+	}
+	else
+	{
+		if (size < minsize)
+			size = minsize;
+		if (size > maxsize)
+			size = maxsize;
+	}
+	if (size == 0 || size < minsize || size > maxsize)
+		return 0;
+	return size;
+}
+
+static Vs_ActiveFilter FailActivate(struct ResizeFilter *f, Vs_String *error, const char *msg)
+{
+	*error = f->vsynth->String->Make(msg);
+	return NULL;
+}
+VSYNTH_IMPLEMENT_METHOD(Vs_ActiveFilter, resize_activate)(Vs_Filter filter, Vs_String *error, Vs_FrameTypeDescription **frametypes)
+{
+	struct ResizeFilter *f = GetResize(filter);
+	struct Vs_StandardFrameTypeDescription *sfd;
+	struct Vs_StandardFrameTypeDescription *chosen = NULL;
+	struct Vs_StandardFrameTypeDescription upsfd;
+	Vs_FrameTypeDescription *upftds[2];
+	enum ResizeKernel kernel;
+	struct ResizeActive *af;
+	Vs_ActiveFilter upstream;
+	size_t width, height;
+	int fixed;
+
+	if (f->clip == NULL) return FailActivate(f, error, "No input clip given");
+	if (f->width < 0 || f->height < 0) return FailActivate(f, error, "Width and height must not be negative");
+	if (f->kernel == NULL || f->kernel->len == 0 || strcmp(f->kernel->str, "bicubic") == 0)
+		kernel = KERNEL_BICUBIC;
+	else if (strcmp(f->kernel->str, "bilinear") == 0)
+		kernel = KERNEL_BILINEAR;
+	else if (strcmp(f->kernel->str, "lanczos") == 0)
+		kernel = KERNEL_LANCZOS;
+	else
+		return FailActivate(f, error, "Kernel must be one of bilinear, bicubic or lanczos");
+	if (kernel == KERNEL_LANCZOS && (f->taps < 1 || f->taps > 8)) return FailActivate(f, error, "Taps must be between 1 and 8");
+
+	// the first stdframe description is used
+	for (; *frametypes; frametypes++)
+	{
+		sfd = Vs_Stdframe_CheckFTD(*frametypes);
+		(*frametypes)->out_supported = 0;
+		if (sfd == NULL || chosen != NULL || sfd->alignment > VS_STDFRAME_ALIGNMENT)
+			continue;
+		chosen = sfd;
+	}
+	if (chosen == NULL)
+		return FailActivate(f, error, "Stdframes are not accepted");
+
+	// any input size will do, the pixfmt constraints pass straight through
+	upsfd = *chosen;
+	upsfd.base.out_supported = 0;
+	upsfd.allow_resolution_change = 1;
+	upsfd.minwidth = 1;
+	upsfd.maxwidth = SIZE_MAX;
+	upsfd.minheight = 1;
+	upsfd.maxheight = SIZE_MAX;
+	upsfd.width_modulo = 0;
+	upsfd.height_modulo = 0;
+	upsfd.alignment = 0;
+	upsfd.padding_right = 0;
+	upsfd.padding_bottom = 0;
+	upftds[0] = &upsfd.base;
+	upftds[1] = NULL;
+	upstream = f->vsynth->Graph->Activate(f->vsynth, f->clip, error, upftds);
+	if (upstream == NULL)
+		return NULL;
+	if (!upsfd.base.out_supported)
+	{
+		upstream->methods->destroy(upstream);
+		return FailActivate(f, error, "Input clip does not deliver stdframes");
+	}
+
+	fixed = !upsfd.allow_resolution_change && upsfd.minwidth == upsfd.maxwidth && upsfd.minheight == upsfd.maxheight;
+	width = (size_t)f->width;
+	height = (size_t)f->height;
+	// a missing dimension keeps the input size
+	if ((width == 0 || height == 0) && !fixed)
+	{
+		upstream->methods->destroy(upstream);
+		return FailActivate(f, error, "Width and height must be given when the input size may change");
+	}
+	if (width == 0)
+		width = upsfd.minwidth;
+	if (height == 0)
+		height = upsfd.minheight;
+
+	width = FitSize(width, chosen->minwidth, chosen->maxwidth, chosen->width_modulo);
+	height = FitSize(height, chosen->minheight, chosen->maxheight, chosen->height_modulo);
+	if (width == 0 || height == 0)
+	{
+		upstream->methods->destroy(upstream);
+		return FailActivate(f, error, "No output size meets the frame type constraints");
+	}
+
+	chosen->base.out_supported = 1;
+	chosen->allow_resolution_change = 0;
+	chosen->allow_pixfmt_change = upsfd.allow_pixfmt_change;
+	chosen->minwidth = width;
+	chosen->maxwidth = width;
+	chosen->minheight = height;
+	chosen->maxheight = height;
+
+	af = (struct ResizeActive *)malloc(sizeof(struct ResizeActive));
+	if (af == NULL)
+	{
+		upstream->methods->destroy(upstream);
+		return FailActivate(f, error, "Out of memory");
+	}
+	af->base.methods = &resize_active_vtable;
+	af->base.filter = filter;
+	af->vsynth = f->vsynth;
+	af->upstream = upstream;
+	af->width = width;
+	af->height = height;
+	af->kernel = kernel;
+	af->lobes = (int)f->taps;
+	af->padding_right = chosen->padding_right;
+	af->padding_bottom = chosen->padding_bottom;
+	af->alignment = chosen->alignment;
+	af->tables = NULL;
+	if (fixed)
+	{
+		af->tables = ResizeTables_New(af, upsfd.minwidth, upsfd.minheight);
+		if (af->tables == NULL)
+		{
+			free(af);
+			upstream->methods->destroy(upstream);
+			return FailActivate(f, error, "Out of memory");
+		}
+	}
+	resize_addref(filter);
+
+	return &af->base;
+}
+
+
+/// Property IDs, in the order enum_properties reports them
+enum ResizeProperty {
+	RESIZE_CLIP,
+	RESIZE_WIDTH,
+	RESIZE_HEIGHT,
+	RESIZE_KERNEL,
+	RESIZE_TAPS,
+	RESIZE_PROPERTY_COUNT
+};
+
+static const struct {
+	const char *name;
+	enum Vs_PropertyType type;
+} resize_properties[RESIZE_PROPERTY_COUNT] = {
+	{ "clip", PROP_FILTER },
+	{ "width", PROP_INT },
+	{ "height", PROP_INT },
+	{ "kernel", PROP_STRING },
+	{ "taps", PROP_INT }
+};
+
+VSYNTH_IMPLEMENT_METHOD(void, resize_enum_properties)(Vs_EnumPropertiesFunc callback, void *userdata)
+{
+	int i;
+	for (i = 0; i < RESIZE_PROPERTY_COUNT; i++)
+		callback(resize_properties[i].name, resize_properties[i].type, userdata);
+}
+
+static void SetClip(struct ResizeFilter *f, Vs_Filter value)
+{
+	if (value != NULL)
+		value->methods->addref(value);
+	if (f->clip != NULL)
+		f->clip->methods->unref(f->clip);
+	f->clip = value;
+}
+
+static void SetKernel(struct ResizeFilter *f, Vs_String value)
+{
+	if (value != NULL)
+		value = f->vsynth->String->Copy(value);
+	if (f->kernel != NULL)
+		f->vsynth->String->Free(f->kernel);
+	f->kernel = value;
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Filter, resize_get_property_filter)(Vs_Filter filter, const char *name)
+{
+	struct ResizeFilter *f = GetResize(filter);
+	if (strcmp(name, "clip") == 0 && f->clip != NULL)
+	{
+		f->clip->methods->addref(f->clip);
+		return f->clip;
+	}
+	return NULL;
+}
+
+VSYNTH_IMPLEMENT_METHOD(long long, resize_get_property_int)(Vs_Filter filter, const char *name)
+{
+	struct ResizeFilter *f = GetResize(filter);
+	if (strcmp(name, "width") == 0)
+		return f->width;
+	if (strcmp(name, "height") == 0)
+		return f->height;
+	if (strcmp(name, "taps") == 0)
+		return f->taps;
+	return 0;
+}
+
+VSYNTH_IMPLEMENT_METHOD(double, resize_get_property_double)(Vs_Filter filter, const char *name)
+{
+	return 0; // no double properties
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_String, resize_get_property_string)(Vs_Filter filter, const char *name)
+{
+	struct ResizeFilter *f = GetResize(filter);
+	if (strcmp(name, "kernel") == 0)
+		return f->kernel;
+	return NULL;
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_FrameNumber, resize_get_property_framenumber)(Vs_Filter filter, const char *name)
+{
+	return 0; // no framenumber properties
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Timestamp, resize_get_property_timestamp)(Vs_Filter filter, const char *name)
+{
+	return 0; // no timestamp properties
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, resize_set_property_filter)(Vs_Filter filter, const char *name, Vs_Filter value)
+{
+	struct ResizeFilter *f = GetResize(filter);
+	if (strcmp(name, "clip") == 0)
+		SetClip(f, value);
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, resize_set_property_int)(Vs_Filter filter, const char *name, long long value)
+{
+	struct ResizeFilter *f = GetResize(filter);
+	if (strcmp(name, "width") == 0)
+		f->width = value;
+	else if (strcmp(name, "height") == 0)
+		f->height = value;
+	else if (strcmp(name, "taps") == 0)
+		f->taps = value;
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, resize_set_property_double)(Vs_Filter filter, const char *name, double value)
+{
+	// no double properties
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, resize_set_property_string)(Vs_Filter filter, const char *name, Vs_String value)
+{
+	struct ResizeFilter *f = GetResize(filter);
+	if (strcmp(name, "kernel") == 0)
+		SetKernel(f, value);
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, resize_set_property_framenumber)(Vs_Filter filter, const char *name, Vs_FrameNumber value)
+{
+	// no framenumber properties
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, resize_set_property_timestamp)(Vs_Filter filter, const char *name, Vs_Timestamp value)
+{
+	// no timestamp properties
+}
+
+VSYNTH_IMPLEMENT_METHOD(int, resize_get_property_by_id)(Vs_Filter filter, Vs_PropertyId id, Vs_PropertyValue *value)
+{
+	struct ResizeFilter *f = GetResize(filter);
+	if (id < 0 || id >= RESIZE_PROPERTY_COUNT)
+		return 0;
+	value->type = resize_properties[id].type;
+	switch (id)
+	{
+	case RESIZE_CLIP:
+		value->v.f = f->clip;
+		if (f->clip != NULL)
+			f->clip->methods->addref(f->clip);
+		break;
+	case RESIZE_WIDTH:
+		value->v.i = f->width;
+		break;
+	case RESIZE_HEIGHT:
+		value->v.i = f->height;
+		break;
+	case RESIZE_KERNEL:
+		value->v.s = f->kernel;
+		break;
+	case RESIZE_TAPS:
+		value->v.i = f->taps;
+		break;
+	}
+	return 1;
+}
+
+VSYNTH_IMPLEMENT_METHOD(int, resize_set_property_by_id)(Vs_Filter filter, Vs_PropertyId id, const Vs_PropertyValue *value)
+{
+	struct ResizeFilter *f = GetResize(filter);
+	if (id < 0 || id >= RESIZE_PROPERTY_COUNT || value->type != resize_properties[id].type)
+		return 0;
+	switch (id)
+	{
+	case RESIZE_CLIP:
+		SetClip(f, value->v.f);
+		break;
+	case RESIZE_WIDTH:
+		f->width = value->v.i;
+		break;
+	case RESIZE_HEIGHT:
+		f->height = value->v.i;
+		break;
+	case RESIZE_KERNEL:
+		SetKernel(f, value->v.s);
+		break;
+	case RESIZE_TAPS:
+		f->taps = value->v.i;
+		break;
+	}
+	return 1;
+}
+
+
+struct TAG_Vs_FilterVirtual resize_vtable = {
+	resize_addref,
+	resize_unref,
+	resize_clone,
+	resize_activate,
+	resize_enum_properties,
+	resize_get_property_filter,
+	resize_get_property_int,
+	resize_get_property_double,
+	resize_get_property_string,
+	resize_get_property_framenumber,
+	resize_get_property_timestamp,
+	resize_set_property_filter,
+	resize_set_property_int,
+	resize_set_property_double,
+	resize_set_property_string,
+	resize_set_property_framenumber,
+	resize_set_property_timestamp,
+	resize_get_property_by_id,
+	resize_set_property_by_id
+};
+
+
+VSYNTH_API(void) Vs_PluginInit(Vs_Library vsynth)
+{
+	vsynth->FilterRegistry->Register(vsynth, &resize_factory);
+}
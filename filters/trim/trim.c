@@ -0,0 +1,535 @@
+#include <vsynth/vsynth.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+
+/*
+
+Trim passes on a range of frames of its input clip, starting at frame start
+and holding length frames, or running to the end if length is 0.
+
+Frames are passed through without touching their contents. A trim starting
+at a later frame moves the timestamps back by the timestamp of frame start,
+so its output starts at 0, and each frame is a view of the input frame with
+the new timestamp. A trim starting at frame 0 hands out the input frames
+themselves, keeping the input's own first timestamp.
+
+The timestamps of the first frame of the range and of the frame after it are
+needed to know the offset and the duration, so those frames are requested
+from the input during activation, unless frame counts and durations of the
+input make it unnecessary.
+
+Any frame type is accepted, the frame types are negotiated with the input.
+
+Before activation, a trim of a trim is folded into a single trim of the inner
+trim's input, and a trim of everything is dropped. Offsets only depend on
+the first frame of the range, so the timestamps come out the same.
+
+*/
+
+
+struct TrimFilter {
+	struct TAG_Vs_Filter base;
+	Vs_Library vsynth;
+	size_t refcount;
+	Vs_Filter clip;
+	Vs_FrameNumber start;
+	Vs_FrameNumber length;
+};
+
+struct TrimActive {
+	struct TAG_Vs_ActiveFilter base;
+	Vs_Library vsynth;
+	Vs_ActiveFilter upstream;
+	/// Input frame number of output frame 0
+	Vs_FrameNumber start;
+	/// Number of output frames, or FRAMECOUNT_UNKNOWN
+	Vs_FrameNumber count;
+	/// Input timestamp of output frame 0, subtracted from all timestamps
+	Vs_Timestamp offset;
+	/// Output duration, or DURATION_UNKNOWN
+	Vs_Timestamp duration;
+};
+
+/// A forwarded asynchronous request, see trim_active_get_frame_async
+struct TrimRequest {
+	Vs_FrameCallback callback;
+	void *userdata;
+	Vs_Timestamp offset;
+};
+
+extern struct TAG_Vs_FilterVirtual trim_vtable;
+extern struct TAG_Vs_ActiveFilterVirtual trim_active_vtable;
+
+static __inline struct TrimFilter * GetTrim(Vs_Filter filter)
+{
+	if (filter->methods == &trim_vtable)
+		return (struct TrimFilter *)filter;
+	else
+		return NULL;
+}
+
+static __inline struct TrimActive * GetTrimActive(Vs_ActiveFilter filter)
+{
+	if (filter->methods == &trim_active_vtable)
+		return (struct TrimActive *)filter;
+	else
+		return NULL;
+}
+
+
+/// Move a frame back in time by offset, takes over the reference to frame
+static Vs_Frame Retime(Vs_Frame frame, Vs_Timestamp offset)
+{
+	Vs_Frame view;
+
+	if (frame == NULL || offset == 0)
+		return frame;
+	// the input frame may be shared, so the new timestamp goes on a view
+	view = frame->methods->view(frame);
+	if (view != NULL)
+		view->timestamp = frame->timestamp - offset;
+	frame->methods->unref(frame);
+	return view;
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, trim_active_destroy)(Vs_ActiveFilter filter)
+{
+	struct TrimActive *af = GetTrimActive(filter);
+	af->upstream->methods->destroy(af->upstream);
+	af->base.filter->methods->unref(af->base.filter);
+	free(af);
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Frame, trim_active_get_frame)(Vs_ActiveFilter filter, Vs_FrameNumber n)
+{
+	struct TrimActive *af = GetTrimActive(filter);
+
+	if (n >= af->count)
+		return NULL;
+	return Retime(af->upstream->methods->get_frame(af->upstream, af->start + n), af->offset);
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_FrameNumber, trim_active_get_frame_count)(Vs_ActiveFilter filter)
+{
+	return GetTrimActive(filter)->count;
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Timestamp, trim_active_get_duration)(Vs_ActiveFilter filter)
+{
+	return GetTrimActive(filter)->duration;
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_FrameNumber, trim_active_frame_at_timestamp)(Vs_ActiveFilter filter, Vs_Timestamp t)
+{
+	struct TrimActive *af = GetTrimActive(filter);
+	Vs_FrameNumber n;
+
+	if (af->count == 0 || (af->duration != DURATION_UNKNOWN && t >= af->duration))
+		return FRAMENUMBER_NONE;
+	n = af->vsynth->Seek->FrameAtTimestamp(af->vsynth, af->upstream, t + af->offset);
+	// frames before the range start before the offset, so they can't turn up
+	if (n == FRAMENUMBER_NONE || n < af->start || n - af->start >= af->count)
+		return FRAMENUMBER_NONE;
+	return n - af->start;
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, TrimFrameReady)(Vs_Frame frame, void *userdata)
+{
+	struct TrimRequest request = *(struct TrimRequest *)userdata;
+	free(userdata);
+	request.callback(Retime(frame, request.offset), request.userdata);
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, trim_active_get_frame_async)(Vs_ActiveFilter filter, Vs_FrameNumber n, Vs_FrameCallback callback, void *userdata)
+{
+	struct TrimActive *af = GetTrimActive(filter);
+	struct TrimRequest *request;
+
+	if (n >= af->count)
+	{
+		callback(NULL, userdata);
+		return;
+	}
+	// the input's own asynchronous path is kept, so trimming never blocks a thread
+	if (af->offset == 0)
+	{
+		af->vsynth->Async->GetFrame(af->vsynth, af->upstream, af->start + n, callback, userdata);
+		return;
+	}
+	request = (struct TrimRequest *)malloc(sizeof(struct TrimRequest));
+	if (request == NULL)
+	{
+		callback(NULL, userdata);
+		return;
+	}
+	request->callback = callback;
+	request->userdata = userdata;
+	request->offset = af->offset;
+	af->vsynth->Async->GetFrame(af->vsynth, af->upstream, af->start + n, TrimFrameReady, request);
+}
+
+struct TAG_Vs_ActiveFilterVirtual trim_active_vtable = {
+	trim_active_destroy,
+	trim_active_get_frame,
+	trim_active_get_frame_count,
+	trim_active_get_duration,
+	trim_active_get_frame_async,
+	trim_active_frame_at_timestamp
+};
+
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Filter, trim_new)(Vs_Library vsynth)
+{
+	struct TrimFilter *f = (struct TrimFilter *)malloc(sizeof(struct TrimFilter));
+	f->base.methods = &trim_vtable;
+	f->vsynth = vsynth;
+	f->refcount = 1;
+	f->clip = NULL;
+	f->start = 0;
+	f->length = 0;
+	return &f->base;
+}
+
+Vs_FilterFactory trim_factory = {
+	"trim",
+	"Range of frames of a clip",
+	"Public domain",
+	trim_new
+};
+
+
+VSYNTH_IMPLEMENT_METHOD(void, trim_addref)(Vs_Filter filter)
+{
+	struct TrimFilter *tf = GetTrim(filter);
+	tf->refcount++;
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, trim_unref)(Vs_Filter filter)
+{
+	struct TrimFilter *tf = GetTrim(filter);
+	assert(tf->refcount > 0);
+	tf->refcount--;
+
+	if (tf->refcount == 0)
+	{
+		if (tf->clip != NULL)
+			tf->clip->methods->unref(tf->clip);
+		free(tf);
+	}
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Filter, trim_clone)(Vs_Filter filter)
+{
+	struct TrimFilter *tf = GetTrim(filter);
+	struct TrimFilter *nf = GetTrim(trim_new(tf->vsynth));
+	nf->clip = tf->clip;
+	if (nf->clip != NULL)
+		nf->clip->methods->addref(nf->clip);
+	nf->start = tf->start;
+	nf->length = tf->length;
+	return &nf->base;
+}
+
+static Vs_ActiveFilter FailActivate(struct TrimFilter *f, Vs_String *error, const char *msg)
+{
+	*error = f->vsynth->String->Make(msg);
+	return NULL;
+}
+
+/// Get the input timestamp of a frame, returns zero if there is no such frame
+static int InputTimestamp(Vs_ActiveFilter upstream, Vs_FrameNumber n, Vs_Timestamp *timestamp)
+{
+	Vs_Frame frame = upstream->methods->get_frame(upstream, n);
+
+	if (frame == NULL)
+		return 0;
+	*timestamp = frame->timestamp;
+	frame->methods->unref(frame);
+	return 1;
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_ActiveFilter, trim_activate)(Vs_Filter filter, Vs_String *error, Vs_FrameTypeDescription **frametypes)
+{
+	struct TrimFilter *f = GetTrim(filter);
+	struct TrimActive *af;
+	Vs_ActiveFilter upstream;
+	Vs_FrameNumber upcount, end;
+	Vs_Timestamp upduration, endtime;
+
+	if (f->clip == NULL) return FailActivate(f, error, "No input clip given");
+
+	upstream = f->vsynth->Graph->Activate(f->vsynth, f->clip, error, frametypes);
+	if (upstream == NULL)
+		return NULL;
+	upcount = upstream->methods->get_frame_count(upstream);
+	upduration = upstream->methods->get_duration(upstream);
+
+	af = (struct TrimActive *)malloc(sizeof(struct TrimActive));
+	if (af == NULL)
+	{
+		upstream->methods->destroy(upstream);
+		return FailActivate(f, error, "Out of memory");
+	}
+	af->start = f->start;
+	af->offset = 0;
+
+	// the range ends at the end of the input, at frame end, or wherever the input runs out first
+	end = FRAMECOUNT_UNKNOWN;
+	if (f->length != 0 && f->start + f->length > f->start)
+		end = f->start + f->length;
+	if (upcount != FRAMECOUNT_UNKNOWN && (end == FRAMECOUNT_UNKNOWN || end > upcount))
+		end = upcount;
+
+	if (f->start > 0 && !(end != FRAMECOUNT_UNKNOWN && f->start >= end))
+	{
+		if (!InputTimestamp(upstream, f->start, &af->offset))
+			end = f->start;
+	}
+
+	if (end != FRAMECOUNT_UNKNOWN && f->start >= end)
+	{
+		// nothing left of the input
+		af->count = 0;
+		af->duration = 0;
+	}
+	else if (end == FRAMECOUNT_UNKNOWN || end == upcount)
+	{
+		af->count = end == FRAMECOUNT_UNKNOWN ? FRAMECOUNT_UNKNOWN : end - f->start;
+		af->duration = upduration == DURATION_UNKNOWN ? DURATION_UNKNOWN : upduration - af->offset;
+	}
+	else
+	{
+		af->count = end - f->start;
+		if (InputTimestamp(upstream, end, &endtime))
+			af->duration = endtime - af->offset;
+		else
+			af->duration = upduration == DURATION_UNKNOWN ? DURATION_UNKNOWN : upduration - af->offset;
+	}
+
+	af->base.methods = &trim_active_vtable;
+	af->base.filter = filter;
+	trim_addref(filter);
+	af->vsynth = f->vsynth;
+	af->upstream = upstream;
+	return &af->base;
+}
+
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Filter, trim_optimize)(Vs_Filter filter)
+{
+	struct TrimFilter *f = GetTrim(filter);
+	struct TrimFilter *inner, *nf;
+	Vs_FrameNumber length;
+
+	if (f->clip == NULL)
+		return NULL;
+	if (f->start == 0 && f->length == 0)
+	{
+		f->clip->methods->addref(f->clip);
+		return f->clip;
+	}
+
+	inner = GetTrim(f->clip);
+	if (inner == NULL || inner->start + f->start < inner->start)
+		return NULL;
+	// frames of the inner range left after the outer start
+	length = f->length;
+	if (inner->length != 0)
+	{
+		// an empty range can't be expressed, a length of 0 runs to the end
+		if (inner->length <= f->start)
+			return NULL;
+		if (length == 0 || length > inner->length - f->start)
+			length = inner->length - f->start;
+	}
+	nf = GetTrim(trim_clone(f->clip));
+	nf->start = inner->start + f->start;
+	nf->length = length;
+	return &nf->base;
+}
+
+
+/// Property IDs, in the order enum_properties reports them
+enum TrimProperty {
+	TRIM_CLIP,
+	TRIM_START,
+	TRIM_LENGTH,
+	TRIM_PROPERTY_COUNT
+};
+
+static const struct {
+	const char *name;
+	enum Vs_PropertyType type;
+} trim_properties[TRIM_PROPERTY_COUNT] = {
+	{ "clip", PROP_FILTER },
+	{ "start", PROP_FRAMENUMBER },
+	{ "length", PROP_FRAMENUMBER }
+};
+
+VSYNTH_IMPLEMENT_METHOD(void, trim_enum_properties)(Vs_EnumPropertiesFunc callback, void *userdata)
+{
+	int i;
+	for (i = 0; i < TRIM_PROPERTY_COUNT; i++)
+		callback(trim_properties[i].name, trim_properties[i].type, userdata);
+}
+
+static void SetClip(struct TrimFilter *f, Vs_Filter value)
+{
+	if (value != NULL)
+		value->methods->addref(value);
+	if (f->clip != NULL)
+		f->clip->methods->unref(f->clip);
+	f->clip = value;
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Filter, trim_get_property_filter)(Vs_Filter filter, const char *name)
+{
+	struct TrimFilter *f = GetTrim(filter);
+	if (strcmp(name, "clip") == 0 && f->clip != NULL)
+	{
+		f->clip->methods->addref(f->clip);
+		return f->clip;
+	}
+	return NULL;
+}
+
+VSYNTH_IMPLEMENT_METHOD(long long, trim_get_property_int)(Vs_Filter filter, const char *name)
+{
+	return 0; // no int properties
+}
+
+VSYNTH_IMPLEMENT_METHOD(double, trim_get_property_double)(Vs_Filter filter, const char *name)
+{
+	return 0; // no double properties
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_String, trim_get_property_string)(Vs_Filter filter, const char *name)
+{
+	return NULL; // no string properties
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_FrameNumber, trim_get_property_framenumber)(Vs_Filter filter, const char *name)
+{
+	struct TrimFilter *f = GetTrim(filter);
+	if (strcmp(name, "start") == 0)
+		return f->start;
+	if (strcmp(name, "length") == 0)
+		return f->length;
+	return 0;
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Timestamp, trim_get_property_timestamp)(Vs_Filter filter, const char *name)
+{
+	return 0; // no timestamp properties
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, trim_set_property_filter)(Vs_Filter filter, const char *name, Vs_Filter value)
+{
+	struct TrimFilter *f = GetTrim(filter);
+	if (strcmp(name, "clip") == 0)
+		SetClip(f, value);
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, trim_set_property_int)(Vs_Filter filter, const char *name, long long value)
+{
+	// no int properties
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, trim_set_property_double)(Vs_Filter filter, const char *name, double value)
+{
+	// no double properties
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, trim_set_property_string)(Vs_Filter filter, const char *name, Vs_String value)
+{
+	// no string properties
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, trim_set_property_framenumber)(Vs_Filter filter, const char *name, Vs_FrameNumber value)
+{
+	struct TrimFilter *f = GetTrim(filter);
+	if (strcmp(name, "start") == 0)
+		f->start = value;
+	else if (strcmp(name, "length") == 0)
+		f->length = value;
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, trim_set_property_timestamp)(Vs_Filter filter, const char *name, Vs_Timestamp value)
+{
+	// no timestamp properties
+}
+
+VSYNTH_IMPLEMENT_METHOD(int, trim_get_property_by_id)(Vs_Filter filter, Vs_PropertyId id, Vs_PropertyValue *value)
+{
+	struct TrimFilter *f = GetTrim(filter);
+	if (id < 0 || id >= TRIM_PROPERTY_COUNT)
+		return 0;
+	value->type = trim_properties[id].type;
+	switch (id)
+	{
+	case TRIM_CLIP:
+		value->v.f = f->clip;
+		if (f->clip != NULL)
+			f->clip->methods->addref(f->clip);
+		break;
+	case TRIM_START:
+		value->v.fn = f->start;
+		break;
+	case TRIM_LENGTH:
+		value->v.fn = f->length;
+		break;
+	}
+	return 1;
+}
+
+VSYNTH_IMPLEMENT_METHOD(int, trim_set_property_by_id)(Vs_Filter filter, Vs_PropertyId id, const Vs_PropertyValue *value)
+{
+	struct TrimFilter *f = GetTrim(filter);
+	if (id < 0 || id >= TRIM_PROPERTY_COUNT || value->type != trim_properties[id].type)
+		return 0;
+	switch (id)
+	{
+	case TRIM_CLIP:
+		SetClip(f, value->v.f);
+		break;
+	case TRIM_START:
+		f->start = value->v.fn;
+		break;
+	case TRIM_LENGTH:
+		f->length = value->v.fn;
+		break;
+	}
+	return 1;
+}
+
+
+struct TAG_Vs_FilterVirtual trim_vtable = {
+	trim_addref,
+	trim_unref,
+	trim_clone,
+	trim_activate,
+	trim_enum_properties,
+	trim_get_property_filter,
+	trim_get_property_int,
+	trim_get_property_double,
+	trim_get_property_string,
+	trim_get_property_framenumber,
+	trim_get_property_timestamp,
+	trim_set_property_filter,
+	trim_set_property_int,
+	trim_set_property_double,
+	trim_set_property_string,
+	trim_set_property_framenumber,
+	trim_set_property_timestamp,
+	trim_get_property_by_id,
+	trim_set_property_by_id,
+	trim_optimize
+};
+
+
+VSYNTH_API(void) Vs_PluginInit(Vs_Library vsynth)
+{
+	vsynth->FilterRegistry->Register(vsynth, &trim_factory);
+}
@@ -0,0 +1,116 @@
+// This file is C99
+
+#pragma once
+
+/*
+
+Portability helpers for implementing Vsynth objects.
+
+Objects in Vsynth may be shared between threads, so anything reference counted
+must update its counter atomically. These helpers wrap the compiler specific
+intrinsics so the rest of the code does not have to care. Memory handed to
+vector code must be aligned, which the C runtimes disagree on how to do.
+
+*/
+
+#include <stdlib.h>
+#include <stdint.h>
+#ifdef _MSC_VER
+# include <intrin.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#ifdef _MSC_VER
+/// Inline declaration for helper functions defined in headers
+# define VSYNTH_INLINE __inline
+#else
+# define VSYNTH_INLINE __inline__
+#endif
+
+
+/// Defined to 1 when SSE2 intrinsics may be used unconditionally
+///
+/// Vector code must always have a plain C fallback for when this is 0.
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+# define VSYNTH_SSE2 1
+#else
+# define VSYNTH_SSE2 0
+#endif
+
+
+/// Type of reference counters and other atomically updated counters
+typedef volatile long Vs_AtomicCount;
+
+#if defined(_MSC_VER)
+
+/// Atomically increment a counter and return the new value
+static VSYNTH_INLINE long Vs_AtomicIncrement(Vs_AtomicCount *count)
+{
+	return _InterlockedIncrement(count);
+}
+/// Atomically decrement a counter and return the new value
+static VSYNTH_INLINE long Vs_AtomicDecrement(Vs_AtomicCount *count)
+{
+	return _InterlockedDecrement(count);
+}
+/// Read the value of a counter
+static VSYNTH_INLINE long Vs_AtomicRead(Vs_AtomicCount *count)
+{
+	return *count;
+}
+
+#elif defined(__GNUC__)
+
+static VSYNTH_INLINE long Vs_AtomicIncrement(Vs_AtomicCount *count)
+{
+	return __atomic_add_fetch(count, 1, __ATOMIC_ACQ_REL);
+}
+static VSYNTH_INLINE long Vs_AtomicDecrement(Vs_AtomicCount *count)
+{
+	return __atomic_sub_fetch(count, 1, __ATOMIC_ACQ_REL);
+}
+static VSYNTH_INLINE long Vs_AtomicRead(Vs_AtomicCount *count)
+{
+	return __atomic_load_n(count, __ATOMIC_ACQUIRE);
+}
+
+#else
+# error Please define the atomic counter helpers for your compiler
+#endif
+
+
+/// Allocate memory with the start address aligned to a power of two
+///
+/// The original allocation is stored just in front of the returned address,
+/// so this works with any C runtime. Memory must be freed with
+/// Vs_AlignedFree.
+static VSYNTH_INLINE void *Vs_AlignedAlloc(size_t size, size_t alignment)
+{
+	char *raw;
+	char *aligned;
+
+	if (alignment < sizeof(void *))
+		alignment = sizeof(void *);
+	raw = (char *)malloc(size + alignment + sizeof(void *));
+	if (raw == NULL)
+		return NULL;
+	aligned = (char *)(((uintptr_t)raw + sizeof(void *) + alignment - 1) & ~(uintptr_t)(alignment - 1));
+	((void **)aligned)[-1] = raw;
+	return aligned;
+}
+
+/// Free memory allocated by Vs_AlignedAlloc
+static VSYNTH_INLINE void Vs_AlignedFree(void *ptr)
+{
+	if (ptr != NULL)
+		free(((void **)ptr)[-1]);
+}
+
+
+#ifdef __cplusplus
+};
+#endif
@@ -1,6 +1,8 @@
 #pragma once
 
+#include <stddef.h>
 #include <vsynth/vsynth.h>
+#include <vsynth/platform.h>
 
 /*
 
@@ -76,14 +78,159 @@ enum Vs_StdframePixelFormat {
 };
 
 
+/// Size in bytes of one pixel of any plane of a pixfmt, 0 for invalid pixfmts
+static VSYNTH_INLINE size_t STDPIXFMT_pixelsize(enum Vs_StdframePixelFormat pixfmt)
+{
+	switch (pixfmt)
+	{
+	case STDPIXFMT_MONO8:
+	case STDPIXFMT_YCrCb8_444:
+	case STDPIXFMT_YCrCbA8_444:
+	case STDPIXFMT_YCrCb8_422:
+	case STDPIXFMT_YCrCbA8_422:
+	case STDPIXFMT_YCrCb8_420:
+	case STDPIXFMT_YCrCbA8_420:
+		return 1;
+	case STDPIXFMT_MONO16:
+	case STDPIXFMT_YCrCb16_444:
+	case STDPIXFMT_YCrCbA16_444:
+	case STDPIXFMT_YCrCb16_422:
+	case STDPIXFMT_YCrCbA16_422:
+	case STDPIXFMT_YCrCb16_420:
+	case STDPIXFMT_YCrCbA16_420:
+		return 2;
+	case STDPIXFMT_XRGB8:
+	case STDPIXFMT_ARGB8:
+		return 4;
+	case STDPIXFMT_XRGB16:
+	case STDPIXFMT_ARGB16:
+		return 8;
+	default:
+		return 0;
+	}
+}
+
+/// Number of planes used by a pixfmt
+static VSYNTH_INLINE size_t STDPIXFMT_planecount(enum Vs_StdframePixelFormat pixfmt)
+{
+	switch (pixfmt)
+	{
+	case STDPIXFMT_MONO8:
+	case STDPIXFMT_MONO16:
+	case STDPIXFMT_XRGB8:
+	case STDPIXFMT_ARGB8:
+	case STDPIXFMT_XRGB16:
+	case STDPIXFMT_ARGB16:
+		return 1;
+	case STDPIXFMT_YCrCb8_444:
+	case STDPIXFMT_YCrCb8_422:
+	case STDPIXFMT_YCrCb8_420:
+	case STDPIXFMT_YCrCb16_444:
+	case STDPIXFMT_YCrCb16_422:
+	case STDPIXFMT_YCrCb16_420:
+		return 3;
+	case STDPIXFMT_YCrCbA8_444:
+	case STDPIXFMT_YCrCbA8_422:
+	case STDPIXFMT_YCrCbA8_420:
+	case STDPIXFMT_YCrCbA16_444:
+	case STDPIXFMT_YCrCbA16_422:
+	case STDPIXFMT_YCrCbA16_420:
+		return 4;
+	default:
+		return 0;
+	}
+}
+
+/// Horizontal subsampling factor of a plane, 1 for full resolution
+static VSYNTH_INLINE size_t STDPIXFMT_planewidthscale(enum Vs_StdframePixelFormat pixfmt, size_t plane)
+{
+	switch (pixfmt)
+	{
+	case STDPIXFMT_MONO8:
+	case STDPIXFMT_MONO16:
+	case STDPIXFMT_XRGB8:
+	case STDPIXFMT_ARGB8:
+	case STDPIXFMT_XRGB16:
+	case STDPIXFMT_ARGB16:
+	case STDPIXFMT_YCrCb8_444:
+	case STDPIXFMT_YCrCb16_444:
+	case STDPIXFMT_YCrCbA8_444:
+	case STDPIXFMT_YCrCbA16_444:
+		return 1;
+	case STDPIXFMT_YCrCb8_422:
+	case STDPIXFMT_YCrCb8_420:
+	case STDPIXFMT_YCrCb16_422:
+	case STDPIXFMT_YCrCb16_420:
+	case STDPIXFMT_YCrCbA8_422:
+	case STDPIXFMT_YCrCbA8_420:
+	case STDPIXFMT_YCrCbA16_422:
+	case STDPIXFMT_YCrCbA16_420:
+		if (plane == 0 || plane == 3)
+			return 1;
+		else
+			return 2;
+	default:
+		return 0;
+	}
+}
+
+/// Vertical subsampling factor of a plane, 1 for full resolution
+static VSYNTH_INLINE size_t STDPIXFMT_planeheightscale(enum Vs_StdframePixelFormat pixfmt, size_t plane)
+{
+	switch (pixfmt)
+	{
+	case STDPIXFMT_MONO8:
+	case STDPIXFMT_MONO16:
+	case STDPIXFMT_XRGB8:
+	case STDPIXFMT_ARGB8:
+	case STDPIXFMT_XRGB16:
+	case STDPIXFMT_ARGB16:
+	case STDPIXFMT_YCrCb8_444:
+	case STDPIXFMT_YCrCb16_444:
+	case STDPIXFMT_YCrCbA8_444:
+	case STDPIXFMT_YCrCbA16_444:
+	case STDPIXFMT_YCrCb8_422:
+	case STDPIXFMT_YCrCb16_422:
+	case STDPIXFMT_YCrCbA8_422:
+	case STDPIXFMT_YCrCbA16_422:
+		return 1;
+	case STDPIXFMT_YCrCb8_420:
+	case STDPIXFMT_YCrCb16_420:
+	case STDPIXFMT_YCrCbA8_420:
+	case STDPIXFMT_YCrCbA16_420:
+		if (plane == 0 || plane == 3)
+			return 1;
+		else
+			return 2;
+	default:
+		return 0;
+	}
+}
+
+
+/// Alignment in bytes of plane pointers and strides in allocated stdframes
+///
+/// Frames allocated by the Vs_Stdframe_New functions always have every plane
+/// and every scanline starting at a multiple of this alignment, so vector
+/// code can use aligned loads and stores. Frames that have been cropped do
+/// not keep this guarantee for the plane pointers.
+#define VS_STDFRAME_ALIGNMENT 64
+
+
 /// Type of stdframe objects
 typedef struct Vs_StandardFrame *Vs_StandardFrame;
 
+/// Type of functions releasing memory wrapped by Vs_Stdframe_Wrap
+typedef VSYNTH_DECLARE_METHOD(void, Vs_StdframeReleaseFunc)(void *userdata);
+
 /// Vtable for stdframe objects
 struct Vs_StandardFrameVirtual {
 	struct TAG_Vs_FrameVirtual base;
 
 	/// Crop the frame without reallocating or blitting
+	///
+	/// This changes the frame object itself, so the caller must hold the
+	/// only reference to the frame, see make_writable.
 	VSYNTH_DECLARE_METHOD(void, crop)(Vs_StandardFrame frame, size_t left, size_t top, size_t width, size_t height);
 };
 
@@ -106,10 +253,33 @@ struct Vs_StandardFrame {
 	/// Pixel format of the frame
 	enum Vs_StdframePixelFormat pixfmt;
 
+	/// Number of pixels past the right edge of each scanline that may be read
+	///
+	/// The contents of the padding are undefined and must not be written.
+	/// On subsampled planes the padding is rounded up to whole pixels.
+	size_t padding_right;
+	/// Number of scanlines past the bottom edge of each plane that may be read
+	///
+	/// The contents of the padding are undefined and must not be written.
+	/// On subsampled planes the padding is rounded up to whole pixels.
+	size_t padding_bottom;
+
 	/// Internal: Pointer to raw memory allocation for the frame
+	///
+	/// NULL if the frame wraps memory it doesn't own.
 	void *data_baseptr;
 	/// Internal: Number of bytes allocated for the frame
 	size_t data_rawsize;
+	/// Internal: Number of references held to the frame
+	Vs_AtomicCount refcount;
+	/// Internal: Library whose frame pool the frame was allocated from, or NULL
+	Vs_Library pool;
+	/// Internal: Frame owning the pixel data if this frame is a view, or NULL
+	Vs_StandardFrame parent;
+	/// Internal: Called when a frame wrapping memory it doesn't own is destroyed, or NULL
+	Vs_StdframeReleaseFunc release;
+	/// Internal: Argument for release
+	void *release_userdata;
 };
 
 /// Description of a supported stdframe format for use in filter activation
@@ -162,14 +332,123 @@ struct Vs_StandardFrameTypeDescription {
 	///
 	/// Array must be terminated by a STDPIXFMT_MAX value.
 	enum Vs_StdframePixelFormat *pixfmts;
+	/// Required alignment in bytes of plane pointers and strides
+	///
+	/// 0 means no requirement. Otherwise must be a power of two. Frames
+	/// allocated with the Vs_Stdframe_New functions satisfy any alignment up
+	/// to VS_STDFRAME_ALIGNMENT.
+	size_t alignment;
+	/// Minimum number of pixels required to be readable past the right edge
+	///
+	/// See Vs_StandardFrame::padding_right.
+	size_t padding_right;
+	/// Minimum number of scanlines required to be readable past the bottom edge
+	///
+	/// See Vs_StandardFrame::padding_bottom.
+	size_t padding_bottom;
 };
 
 
 /// Allocate a new stdframe with given properties
 VSYNTH_API(Vs_StandardFrame) Vs_Stdframe_New(enum Vs_StdframePixelFormat pixfmt, size_t width, size_t height);
+/// Allocate a new stdframe with given properties from a library's frame pool
+///
+/// The memory is returned to the pool when the frame is destroyed, so filters
+/// producing a stream of frames should prefer this over Vs_Stdframe_New.
+/// If vsynth is NULL this is the same as Vs_Stdframe_New.
+VSYNTH_API(Vs_StandardFrame) Vs_Stdframe_NewPooled(Vs_Library vsynth, enum Vs_StdframePixelFormat pixfmt, size_t width, size_t height);
+/// Allocate a new stdframe with guard padding on the right and bottom edges
+///
+/// Use this to satisfy the padding requirements of a
+/// Vs_StandardFrameTypeDescription. The vsynth parameter may be NULL to not
+/// allocate from a frame pool.
+VSYNTH_API(Vs_StandardFrame) Vs_Stdframe_NewPadded(Vs_Library vsynth, enum Vs_StdframePixelFormat pixfmt, size_t width, size_t height, size_t pad_right, size_t pad_bottom);
+/// Create a stdframe on pixel data owned by someone else
+///
+/// No pixel data is copied, the planes of the frame point at data with the
+/// given strides; unused planes are ignored. When the frame and all views of
+/// it have been destroyed, release is called with userdata so the owner
+/// knows the memory is no longer used. release may be NULL.
+///
+/// The memory is treated as read-only, make_writable always copies. Copies
+/// are allocated from the frame pool of vsynth, which may be NULL. The frame
+/// has no padding, and its memory_size only counts the frame header.
+VSYNTH_API(Vs_StandardFrame) Vs_Stdframe_Wrap(Vs_Library vsynth, enum Vs_StdframePixelFormat pixfmt, size_t width, size_t height, void *const data[4], const ptrdiff_t stride[4], Vs_StdframeReleaseFunc release, void *userdata);
+/// Fill a plane of a stdframe with a single pixel value
+///
+/// The pixel is given as the bytes of one pixel in memory order, so its size
+/// must be the pixel size of the plane. Only the visible area of the plane
+/// is filled. The caller must hold the only reference to the frame, see
+/// make_writable.
+VSYNTH_API(void) Vs_Stdframe_FillPlane(Vs_StandardFrame frame, size_t plane, const void *pixel);
+/// Copy a rectangle of pixels from one stdframe to another
+///
+/// Both frames must have the same pixfmt, and the rectangle must lie within
+/// the visible area of both. Only the visible pixels of the rectangle are
+/// copied, row by row, so cropped frames and frames with padded or negative
+/// strides are handled. On subsampled planes every chroma sample touching
+/// the rectangle is copied. Large copies use non-temporal stores.
+///
+/// The caller must hold the only reference to dst, see make_writable.
+/// Returns zero, copying nothing, if the arguments are invalid.
+VSYNTH_API(int) Vs_Stdframe_CopyRegion(Vs_StandardFrame dst, size_t dst_x, size_t dst_y, Vs_StandardFrame src, size_t src_x, size_t src_y, size_t width, size_t height);
 /// Check if a Frame is a stdframe, and return a StandardFrame pointer if it is
 VSYNTH_API(Vs_StandardFrame) Vs_Stdframe_Get(Vs_Frame frame);
 
+/// A band of scanlines of a stdframe, see Vs_Stdframe_RunSlices
+struct Vs_StdframeSlice {
+	/// Number of the slice, counting from 0 at the top of the frame
+	size_t index;
+	/// First scanline of the slice, at full resolution
+	size_t top;
+	/// Number of scanlines in the slice, at full resolution
+	size_t height;
+	/// First scanline of the slice in each plane
+	size_t plane_top[4];
+	/// Number of scanlines of the slice in each plane
+	size_t plane_height[4];
+};
+
+/// Type of functions processing one slice of a frame
+typedef VSYNTH_DECLARE_METHOD(void, Vs_StdframeSliceFunc)(Vs_StandardFrame frame, const struct Vs_StdframeSlice *slice, void *userdata);
+
+/// Split the work on a frame into horizontal slices run in parallel
+///
+/// The frame is cut into bands of whole scanlines, and func is called for
+/// every band on the library's worker threads and the calling thread. Returns
+/// when all calls have finished. The number of slices depends on the number
+/// of worker threads and the frame height, and may be one.
+///
+/// Slice boundaries fall on multiples of granularity scanlines, and always
+/// on whole lines of subsampled planes, so every scanline of every plane
+/// belongs to exactly one slice. Use a granularity larger than 1 for work
+/// that handles groups of lines together; 0 is the same as 1.
+///
+/// The frame is only used for its geometry, func may write to any frame of
+/// the same geometry. If vsynth is NULL the whole frame is done as a single
+/// slice on the calling thread.
+VSYNTH_API(void) Vs_Stdframe_RunSlices(Vs_Library vsynth, Vs_StandardFrame frame, size_t granularity, Vs_StdframeSliceFunc func, void *userdata);
+
+/// Estimate the cost of converting a frame from one pixfmt to another
+///
+/// The cost is relative, counting the bytes per pixel read and written, in
+/// quarter bytes, and a fixed amount for each matrix, transfer curve or
+/// chroma resampling step. Converting to a pixfmt holding information the
+/// source pixfmt doesn't have, such as colour, alpha, precision or chroma
+/// resolution, costs more than any conversion that keeps everything.
+/// Returns 0 if the pixfmts are the same.
+VSYNTH_API(unsigned int) Vs_Stdframe_ConversionCost(enum Vs_StdframePixelFormat from, enum Vs_StdframePixelFormat to);
+/// Order pixfmts by the cost of converting them to a target pixfmt
+///
+/// Writes the pixfmts of the accepted list, or all pixfmts if accepted is
+/// NULL, to out, cheapest to convert to target first, and terminates it by
+/// STDPIXFMT_MAX. Pixfmts of equal cost keep their order. out must have
+/// room for STDPIXFMT_MAX + 1 entries. Returns the number of pixfmts.
+///
+/// Filters converting their input should ask for their input pixfmts in
+/// this order, as sources deliver the first pixfmt they can.
+VSYNTH_API(size_t) Vs_Stdframe_RankPixfmts(enum Vs_StdframePixelFormat target, const enum Vs_StdframePixelFormat *accepted, enum Vs_StdframePixelFormat *out);
+
 /// Initialise a Vs_StandardFrameTypeDescription struct
 ///
 /// Sets the 4CID to the stdframe tag and clears out the remaining fields.
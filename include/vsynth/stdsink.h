@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stddef.h>
+#include <vsynth/vsynth.h>
+#include <vsynth/stdframe.h>
+
+/*
+
+This header defines a sink writing the stdframes of an active filter to a
+file, as Y4M or as raw planar video.
+
+Frames are pulled through a frame server, so they are computed on the
+library's worker threads ahead of the writer. They are serialised into one of
+two large buffers while a writer thread writes the other one out, so disk
+writes overlap with frame computation and serialisation.
+
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/// File formats written by Vs_Stdsink_Write
+enum Vs_StdsinkFormat {
+	/// YUV4MPEG2, for mono and YCrCb pixfmts without subsampled alpha, the default
+	STDSINK_Y4M,
+	/// Planes back to back with no headers, in the order Y, Cb, Cr, alpha
+	///
+	/// Packed RGB pixfmts are written as they are stored in a stdframe.
+	STDSINK_RAW
+};
+
+/// Options for Vs_Stdsink_Write
+///
+/// Zero in any field picks the default, and NULL options are all zero.
+struct Vs_StdsinkOptions {
+	enum Vs_StdsinkFormat format;
+	/// First frame to write
+	Vs_FrameNumber start;
+	/// Number of frames to write, 0 writes to the end of the stream
+	Vs_FrameNumber count;
+	/// Frames requested ahead of the writer, see Vs_FrameServerAPI::Create
+	size_t lookahead;
+	/// Size in bytes of each of the two write buffers, default 4 MiB
+	size_t buffer_size;
+	/// Timestamp ticks per second, for the Y4M frame rate, default 90000
+	unsigned long long timescale;
+	/// Frame rate for the Y4M header, default derived from the duration
+	unsigned long long rate_num, rate_den;
+	/// Non-zero to bypass the operating system's file cache if possible
+	///
+	/// Uses O_DIRECT or FILE_FLAG_NO_BUFFERING, falling back to ordinary
+	/// writes where the file system doesn't support it.
+	int direct;
+};
+
+/// Counters of a finished Vs_Stdsink_Write
+///
+/// Sustained throughput is bytes / elapsed_ns. If frame_wait_ns is most of
+/// elapsed_ns, computing frames is the bottleneck; if write_wait_ns is, the
+/// disk is.
+struct Vs_StdsinkStats {
+	/// Frames written
+	Vs_FrameNumber frames;
+	/// Bytes written, including headers
+	unsigned long long bytes;
+	/// Time from opening the file until the last write finished
+	unsigned long long elapsed_ns;
+	/// Time spent waiting for frames to be computed
+	unsigned long long frame_wait_ns;
+	/// Time spent waiting for a write buffer to become free
+	unsigned long long write_wait_ns;
+};
+
+/// Write the frames of an active filter to a file
+///
+/// The file is created or truncated. All frames must be stdframes of the
+/// same pixfmt and size. The active filter must be safe to use from several
+/// threads at once, as for a frame server.
+///
+/// Returns non-zero on success. On failure *error receives a message, which
+/// the caller must free, and the file may hold the frames written so far.
+/// options and stats may be NULL.
+VSYNTH_API(int) Vs_Stdsink_Write(Vs_Library vsynth, Vs_ActiveFilter filter, const char *path, const struct Vs_StdsinkOptions *options, struct Vs_StdsinkStats *stats, Vs_String *error);
+
+
+#ifdef __cplusplus
+}
+#endif
@@ -13,6 +13,18 @@
 # define VSYNTH_DECLARE_METHOD(rettype, name) rettype (__stdcall *name)
 /// Declaration helper for implementing class member functions
 # define VSYNTH_IMPLEMENT_METHOD(rettype, name) static rettype __stdcall name
+#elif defined(__GNUC__)
+// only 32 bit x86 has a separate stdcall convention, elsewhere it is the default
+# if defined(__i386__)
+#  define VSYNTH_CALL __attribute__((stdcall))
+# else
+#  define VSYNTH_CALL
+# endif
+// exported the way the .def files export them on Windows, build with hidden visibility
+# define VSYNTH_API(rettype) __attribute__((visibility("default"))) rettype VSYNTH_CALL
+# define VSYNTH_EXTERN(type) extern type
+# define VSYNTH_DECLARE_METHOD(rettype, name) rettype (VSYNTH_CALL *name)
+# define VSYNTH_IMPLEMENT_METHOD(rettype, name) static rettype VSYNTH_CALL name
 #else
 # error Please define VSYNTH_API, VSYNTH_EXTERN, VSYNTH_DECLARE_METHOD and VSYNTH_IMPLEMENT_METHOD for your compiler
 // Make sure definitions for new compilers are ABI compatible with existing compilers' definitions on the platform
@@ -28,6 +40,8 @@ extern "C" {
 typedef unsigned long long int Vs_FrameNumber;
 /// FrameNumber value specifying an unbounded count of frames
 #define FRAMECOUNT_UNKNOWN ((Vs_FrameNumber)-1)
+/// FrameNumber value specifying that there is no such frame
+#define FRAMENUMBER_NONE ((Vs_FrameNumber)-1)
 
 /// The type of natural times
 ///
@@ -43,8 +57,12 @@ typedef struct TAG_Vs_Frame *Vs_Frame;
 typedef struct TAG_Vs_ActiveFilter *Vs_ActiveFilter;
 /// Type of a Vsynth filter
 typedef struct TAG_Vs_Filter *Vs_Filter;
+/// A timestamp index, mapping frame numbers to timestamps and back
+typedef struct TAG_Vs_TimestampIndex *Vs_TimestampIndex;
 /// A Vsynth core library instance
 typedef struct TAG_Vs_Library *Vs_Library;
+/// A frame server delivering frames from an active filter in parallel
+typedef struct TAG_Vs_FrameServer *Vs_FrameServer;
 
 
 /// Four-character ID for classifying various objects
@@ -57,14 +75,52 @@ typedef struct {
 
 
 /// Vtable for Frame objects
+///
+/// Frames are reference counted. A frame with more than one reference is
+/// shared and must be treated as read-only by everyone holding a reference,
+/// use make_writable to get a frame that can be modified.
 typedef struct TAG_Vs_FrameVirtual {
-	/// Deinitialise and deallocate a frame
+	/// Increase the reference count to the Frame object
+	///
+	/// Must be safe to call from multiple threads at once.
+	VSYNTH_DECLARE_METHOD(void, addref)(Vs_Frame frame);
+	/// Decrease the reference count to the Frame object
 	///
-	/// This should possibly be changed to reference counting.
-	VSYNTH_DECLARE_METHOD(void, destroy)(Vs_Frame frame);
+	/// If the reference count reaches zero the object must be deinitialised
+	/// and deallocated. Must be safe to call from multiple threads at once.
+	VSYNTH_DECLARE_METHOD(void, unref)(Vs_Frame frame);
 	/// Create a complete copy of the frame that can be safely written to
 	/// without affecting the original
+	///
+	/// The returned clone must have a reference count of 1. The caller keeps
+	/// its reference to the original frame.
 	VSYNTH_DECLARE_METHOD(Vs_Frame, clone)(Vs_Frame frame);
+	/// Create a new frame object sharing the contents of the frame
+	///
+	/// The view has its own timestamp and reference count, and keeps the
+	/// contents alive for as long as it exists, but no pixel data is copied.
+	/// This makes it cheap to hand out the same picture under different
+	/// timestamps. The contents are shared, so make_writable on a view
+	/// always makes a copy.
+	///
+	/// The returned view must have a reference count of 1. The caller keeps
+	/// its reference to the original frame. May return NULL on failure.
+	VSYNTH_DECLARE_METHOD(Vs_Frame, view)(Vs_Frame frame);
+	/// Get a frame with the same contents which the caller may write to
+	///
+	/// Takes over the caller's reference to the frame. If the caller holds
+	/// the only reference, the same frame is returned unchanged. Otherwise
+	/// a clone is returned and the reference to the original is released.
+	///
+	/// May return NULL if a copy was needed but could not be made, in which
+	/// case the caller's reference to the original is still released.
+	VSYNTH_DECLARE_METHOD(Vs_Frame, make_writable)(Vs_Frame frame);
+	/// Return the number of bytes of memory held by the frame
+	///
+	/// Used for memory budgeting, such as by frame caches. Should include
+	/// the frame object itself and all data it keeps alive, except data
+	/// shared with the frame a view was made from.
+	VSYNTH_DECLARE_METHOD(size_t, memory_size)(Vs_Frame frame);
 } *Vs_FrameVirtual;
 /// Represents a video frame
 ///
@@ -79,6 +135,12 @@ typedef struct TAG_Vs_Frame {
 	Vs_Timestamp timestamp;
 } *Vs_Frame;
 
+/// Type of callback functions receiving frames from asynchronous requests
+///
+/// The callee owns one reference to the frame, which may be NULL if the
+/// requested frame number is past the end of the stream.
+typedef VSYNTH_DECLARE_METHOD(void, Vs_FrameCallback)(Vs_Frame frame, void *userdata);
+
 /// Structure for describing supported frame types during filter activation
 ///
 /// Frame types may extend this structure with other relevant fields to describe
@@ -95,12 +157,16 @@ typedef struct TAG_Vs_FrameTypeDescription {
 
 
 /// A character string or blob with memory managed by Vsynth
+///
+/// Strings are reference counted and immutable once shared. Only the creator
+/// of a string may write to it, and only before passing it on or copying it.
 typedef struct TAG_Vs_String {
 	/// Length of string in bytes
 	size_t len;
 	/// Pointer to string character data
 	///
-	/// If len==0 then this pointer is NULL.
+	/// If len==0 then this pointer is NULL. Otherwise the data is followed by
+	/// a NUL character not counted in len, so it can be used as a C string.
 	char *str;
 } *Vs_String;
 
@@ -112,10 +178,19 @@ typedef struct TAG_Vs_StringAPI {
 	VSYNTH_DECLARE_METHOD(Vs_String, Make)(const char *str);
 	/// Allocate a new Vs_String and initialise it from the given C string with known length
 	VSYNTH_DECLARE_METHOD(Vs_String, MakeN)(const char *str, size_t len);
-	/// Duplicate an existing Vs_String
+	/// Get another reference to an existing Vs_String
+	///
+	/// The returned String must be freed separately.
 	VSYNTH_DECLARE_METHOD(Vs_String, Copy)(const Vs_String str);
-	/// Deallocate a Vs_String
+	/// Release a reference to a Vs_String, deallocating it with the last
 	VSYNTH_DECLARE_METHOD(void, Free)(Vs_String str);
+	/// Get the library's shared String with the given contents
+	///
+	/// Interning the same contents again returns the same String object, so
+	/// interned strings can be compared by pointer. Useful for identifiers
+	/// that are repeated many times. The returned String must be freed as
+	/// usual, and must never be written to.
+	VSYNTH_DECLARE_METHOD(Vs_String, Intern)(Vs_Library vsynth, const char *str, size_t len);
 } *Vs_StringAPI;
 
 
@@ -136,7 +211,9 @@ typedef struct TAG_Vs_ActiveFilterVirtual {
 	/// identical frames every time, or return NULL every time. The same
 	/// active filter instance may be used in multiple threads at one time.
 	///
-	/// The caller is responsible for destroying the returned Frame object.
+	/// The caller owns one reference to the returned Frame object and must
+	/// unref it when done. The filter may keep other references to the same
+	/// frame, so the caller must call make_writable before modifying it.
 	VSYNTH_DECLARE_METHOD(Vs_Frame, get_frame)(Vs_ActiveFilter filter, Vs_FrameNumber n);
 	/// Return the maximum number of frames this filter can produce
 	///
@@ -154,6 +231,31 @@ typedef struct TAG_Vs_ActiveFilterVirtual {
 	/// DURATION_UNKNOWN constant, in which case the duration of the
 	/// video stream is not known.
 	VSYNTH_DECLARE_METHOD(Vs_Timestamp, get_duration)(Vs_ActiveFilter filter);
+	/// Request a numbered frame asynchronously
+	///
+	/// Optional, may be NULL. Filters that can produce frames without
+	/// blocking a thread while waiting for their input, such as temporal
+	/// filters needing several input frames, should implement this. Use
+	/// the library's Async functions to request frames, they fall back on
+	/// get_frame when this is NULL.
+	///
+	/// Starts producing frame n and returns without waiting for it. The
+	/// callback is called exactly once with the same frame get_frame would
+	/// have returned. It may be called on any thread, and may be called
+	/// before this function returns.
+	VSYNTH_DECLARE_METHOD(void, get_frame_async)(Vs_ActiveFilter filter, Vs_FrameNumber n, Vs_FrameCallback callback, void *userdata);
+	/// Find the frame shown at a moment in time
+	///
+	/// Optional, may be NULL. Use the library's Seek functions to find
+	/// frames by time, they fall back on a binary search requesting frames
+	/// when this is NULL. Sources and filters that know their timestamps
+	/// without producing frames should implement this, filters passing
+	/// frames through by forwarding to their input.
+	///
+	/// Returns the number of the last frame whose timestamp is not after t,
+	/// or FRAMENUMBER_NONE if t is before the first frame or not before the
+	/// duration of the stream. No frame may be produced to find it.
+	VSYNTH_DECLARE_METHOD(Vs_FrameNumber, frame_at_timestamp)(Vs_ActiveFilter filter, Vs_Timestamp t);
 } *Vs_ActiveFilterVirtual;
 /// An activated filter from which frames can be requested
 typedef struct TAG_Vs_ActiveFilter {
@@ -177,6 +279,29 @@ enum Vs_PropertyType {
 	// array types too?
 };
 
+/// Handle for a property of a filter type
+///
+/// Property IDs are the index of the property in the order enum_properties
+/// reports them, and are the same for all filters sharing a vtable. Obtain
+/// them by name with Property::Resolve.
+typedef int Vs_PropertyId;
+/// PropertyId value for properties that don't exist
+#define PROPERTY_INVALID ((Vs_PropertyId)-1)
+
+/// A property value of any type
+typedef struct TAG_Vs_PropertyValue {
+	/// Type of the value, selects the union member used
+	enum Vs_PropertyType type;
+	union {
+		Vs_Filter f;
+		long long i;
+		double d;
+		Vs_String s;
+		Vs_FrameNumber fn;
+		Vs_Timestamp ts;
+	} v;
+} Vs_PropertyValue;
+
 /// Type of callback function for enumerating all properties on a filter
 typedef VSYNTH_DECLARE_METHOD(void, Vs_EnumPropertiesFunc)(const char *name, enum Vs_PropertyType type, void *userdata);
 /// Vtable for Filter objects
@@ -233,10 +358,10 @@ typedef struct TAG_Vs_FilterVirtual {
 	/// May return NULL if the property is not of String type, it doesn't exist,
 	/// or the string is empty.
 	///
-	/// Returns the actual String object held, the caller must not modify the
-	/// returned object. The caller must copy the String if it wants to
-	/// manipulate it. (This is for performance reasons, to avoid risking
-	/// copying huge strings.)
+	/// The returned String is borrowed from the filter, no reference is added
+	/// and the caller must not modify or free it. It is only valid until the
+	/// property is changed or the filter is destroyed; to keep it longer, take
+	/// a reference of your own with Vs_StringAPI::Copy.
 	VSYNTH_DECLARE_METHOD(Vs_String, get_property_string)(Vs_Filter filter, const char *name);
 	/// Get a property value of FrameNumber type
 	///
@@ -287,6 +412,37 @@ typedef struct TAG_Vs_FilterVirtual {
 	/// The call may be ignored if the property doesn't exist or is not of
 	/// Timestamp type.
 	VSYNTH_DECLARE_METHOD(void, set_property_timestamp)(Vs_Filter filter, const char *name, Vs_Timestamp value);
+	/// Get a property value by property ID
+	///
+	/// Optional, may be NULL. Use the library's Property functions to access
+	/// properties by ID, they fall back on the name based methods when this
+	/// is NULL.
+	///
+	/// Sets value->type and the matching union member, following the same
+	/// ownership rules as the name based getter for the type. Returns zero
+	/// if the ID is not valid for the filter.
+	VSYNTH_DECLARE_METHOD(int, get_property_by_id)(Vs_Filter filter, Vs_PropertyId id, Vs_PropertyValue *value);
+	/// Set a property value by property ID
+	///
+	/// Optional, may be NULL, see get_property_by_id.
+	///
+	/// Follows the same ownership rules as the name based setter for the
+	/// type. Returns zero, ignoring the call, if the ID is not valid for the
+	/// filter or value->type doesn't match the property's type.
+	VSYNTH_DECLARE_METHOD(int, set_property_by_id)(Vs_Filter filter, Vs_PropertyId id, const Vs_PropertyValue *value);
+	/// Rewrite the filter into a cheaper filter graph producing the same frames
+	///
+	/// Optional, may be NULL. Called by Graph::Optimize, after the input
+	/// clips of the filter have been optimized. Typical rewrites fold the
+	/// filter into an input clip of the same type, or drop it if it would
+	/// pass frames through unchanged.
+	///
+	/// Returns a new reference to the replacement, which is optimized in
+	/// turn, or NULL if there is nothing to rewrite. Every rewrite must make
+	/// the graph simpler, so rewriting ends. The filter and its input clips
+	/// may be shared and must not be changed, build the replacement from
+	/// clones.
+	VSYNTH_DECLARE_METHOD(Vs_Filter, optimize)(Vs_Filter filter);
 } *Vs_FilterVirtual;
 /// A prototype filter which can be configured and activate instances
 ///
@@ -323,23 +479,452 @@ typedef VSYNTH_DECLARE_METHOD(void, Vs_EnumFiltersFunc)(Vs_FilterFactory *factor
 /// Filter registry interface, registering and looking up filters
 typedef struct TAG_Vs_FilterRegistry {
 	/// Register a new filter with the factory
+	///
+	/// Registering the same factory again does nothing. A different factory
+	/// with the identifier of an existing one shadows it for Find.
 	VSYNTH_DECLARE_METHOD(void, Register)(Vs_Library vsynth, Vs_FilterFactory *factory);
 	/// Look up a filter by identifier
 	VSYNTH_DECLARE_METHOD(Vs_FilterFactory *, Find)(Vs_Library vsynth, const char *identifier);
 	/// Enumerate all filters through a callback function
+	///
+	/// Filters are enumerated most recently registered first.
 	VSYNTH_DECLARE_METHOD(void, Enumerate)(Vs_Library vsynth, Vs_EnumFiltersFunc callback, void *userdata);
 } *Vs_FilterRegistry;
 
 
+/// Key identifying interchangeable memory blocks in the frame pool
+///
+/// Blocks are only recycled between frames with identical keys and sizes.
+typedef struct TAG_Vs_FramePoolKey {
+	/// 4CID of the frame type the block is used for
+	Vs_FourCharId frame_type;
+	/// Frame type specific format code, such as the pixfmt of a stdframe
+	int format;
+	/// Width of the frame in pixels
+	size_t width;
+	/// Height of the frame in pixels
+	size_t height;
+} Vs_FramePoolKey;
+
+/// Statistics about a frame pool
+typedef struct TAG_Vs_FramePoolStats {
+	/// Number of allocations satisfied from a recycled block
+	unsigned long long hits;
+	/// Number of allocations that had to go to the system allocator
+	unsigned long long misses;
+	/// Number of blocks currently held by the pool, not in use by any frame
+	size_t blocks_held;
+	/// Number of bytes currently held by the pool, not in use by any frame
+	size_t bytes_held;
+	/// Maximum number of bytes the pool will hold
+	size_t retention_limit;
+} Vs_FramePoolStats;
+
+/// Frame memory pool, recycling frame allocations of commonly used sizes
+///
+/// Frame types should allocate their memory through the pool to avoid putting
+/// large allocations through the system allocator for every frame. Each
+/// library instance has its own pool. All functions are thread safe.
+typedef struct TAG_Vs_FramePoolAPI {
+	/// Allocate a block of memory of at least size bytes
+	///
+	/// Returns a recycled block if one with the same key and size is held by
+	/// the pool, otherwise allocates a new block. Returns NULL if out of
+	/// memory. Blocks are always aligned to 64 bytes.
+	VSYNTH_DECLARE_METHOD(void *, Alloc)(Vs_Library vsynth, const Vs_FramePoolKey *key, size_t size);
+	/// Return a block allocated by Alloc to the pool
+	///
+	/// The block is kept for reuse unless that would make the pool hold
+	/// more memory than the retention limit, then it is freed.
+	VSYNTH_DECLARE_METHOD(void, Release)(Vs_Library vsynth, void *block);
+	/// Set the maximum number of bytes the pool may hold for reuse
+	///
+	/// If the pool holds more than the new limit, blocks are freed until it
+	/// fits. A limit of zero disables recycling.
+	VSYNTH_DECLARE_METHOD(void, SetRetention)(Vs_Library vsynth, size_t max_bytes);
+	/// Free all blocks held by the pool
+	VSYNTH_DECLARE_METHOD(void, Flush)(Vs_Library vsynth);
+	/// Get statistics for the pool
+	VSYNTH_DECLARE_METHOD(void, GetStats)(Vs_Library vsynth, Vs_FramePoolStats *stats);
+} *Vs_FramePoolAPI;
+
+
+/// Statistics about frame caching
+typedef struct TAG_Vs_CacheStats {
+	/// Number of frame requests answered from the cache
+	unsigned long long hits;
+	/// Number of frame requests that had to be passed upstream
+	unsigned long long misses;
+	/// Number of frames dropped from the cache to stay within the budget
+	unsigned long long evictions;
+	/// Number of frames currently held
+	size_t frames_held;
+	/// Number of bytes of frames currently held
+	size_t bytes_held;
+	/// Maximum number of bytes of frames held, across all caches
+	size_t budget;
+	/// Number of hits answered by decompressing a frame, included in hits
+	unsigned long long compressed_hits;
+	/// Number of evicted frames compressed
+	unsigned long long frames_compressed;
+	/// Number of compressed frames currently held
+	size_t compressed_frames_held;
+	/// Number of bytes of compressed frames currently held
+	size_t compressed_bytes_held;
+	/// Number of bytes the compressed frames held take uncompressed
+	///
+	/// Divide by compressed_bytes_held for the compression ratio.
+	size_t compressed_source_bytes;
+	/// Maximum number of bytes of compressed frames held, across all caches
+	size_t compressed_budget;
+	/// Total time spent compressing frames, in nanoseconds
+	unsigned long long compress_ns;
+	/// Total time spent decompressing frames, in nanoseconds
+	unsigned long long decompress_ns;
+} Vs_CacheStats;
+
+/// Frame caching, memoizing frames produced by active filters
+///
+/// All caches created from a library share one memory budget. When the
+/// budget is exceeded the least recently used frames are evicted, no matter
+/// which cache they belong to. All functions are thread safe.
+///
+/// Caches have a second, compressed tier with a budget of its own. Evicted
+/// stdframes are compressed losslessly into it instead of being dropped,
+/// and decompressed when requested again, which is much cheaper than
+/// producing most frames again. Frames that don't own their pixels, such as
+/// views, are never compressed. The compressed tier is disabled until it is
+/// given a budget.
+typedef struct TAG_Vs_CacheAPI {
+	/// Wrap an active filter in a cache
+	///
+	/// Returns an active filter which produces the same frames as the
+	/// upstream filter, but remembers frames it has produced and returns
+	/// them again if they are requested again. This relies on get_frame
+	/// being idempotent.
+	///
+	/// The cache takes ownership of the upstream filter, destroying the
+	/// returned filter also destroys the upstream filter.
+	VSYNTH_DECLARE_METHOD(Vs_ActiveFilter, Wrap)(Vs_Library vsynth, Vs_ActiveFilter upstream);
+	/// Set the maximum number of bytes of frames held by all caches
+	///
+	/// Frames are evicted immediately if the new budget is exceeded. A
+	/// budget of zero disables caching.
+	VSYNTH_DECLARE_METHOD(void, SetBudget)(Vs_Library vsynth, size_t max_bytes);
+	/// Drop all frames held by all caches
+	VSYNTH_DECLARE_METHOD(void, Flush)(Vs_Library vsynth);
+	/// Get statistics for all caches together
+	VSYNTH_DECLARE_METHOD(void, GetStats)(Vs_Library vsynth, Vs_CacheStats *stats);
+	/// Get statistics for a single cache
+	///
+	/// The filter must have been returned from Wrap. The budget field is
+	/// set to the global budget.
+	VSYNTH_DECLARE_METHOD(void, GetFilterStats)(Vs_Library vsynth, Vs_ActiveFilter cache, Vs_CacheStats *stats);
+	/// Set the maximum number of bytes of compressed frames held by all caches
+	///
+	/// Compressed frames are evicted immediately if the new budget is
+	/// exceeded. A budget of zero, the default, disables the compressed tier.
+	VSYNTH_DECLARE_METHOD(void, SetCompressedBudget)(Vs_Library vsynth, size_t max_bytes);
+} *Vs_CacheAPI;
+
+
+/// Type of functions run by ThreadPool::Run
+///
+/// Called once for each index of the run, possibly on several threads at
+/// once.
+typedef VSYNTH_DECLARE_METHOD(void, Vs_ParallelFunc)(size_t index, void *userdata);
+
+/// Control of the library's worker threads
+///
+/// Each library instance has one pool of worker threads, shared by all
+/// parallel processing done through the library. The pool is started the
+/// first time it is needed.
+typedef struct TAG_Vs_ThreadPoolAPI {
+	/// Set the number of worker threads
+	///
+	/// Zero means one thread per logical processor, which is the default.
+	/// Only has effect if called before the pool has been started.
+	VSYNTH_DECLARE_METHOD(void, SetThreadCount)(Vs_Library vsynth, unsigned int threads);
+	/// Get the number of worker threads
+	///
+	/// Returns the actual number of threads if the pool has been started,
+	/// otherwise the number that will be started.
+	VSYNTH_DECLARE_METHOD(unsigned int, GetThreadCount)(Vs_Library vsynth);
+	/// Run a function for a number of indices in parallel
+	///
+	/// Calls func once for every index from 0 to count-1, spread over the
+	/// worker threads and the calling thread, and returns when all calls
+	/// have finished. The order of the calls is unspecified.
+	///
+	/// This may be called from inside get_frame, which lets filters split
+	/// the work on a single frame over several cores.
+	VSYNTH_DECLARE_METHOD(void, Run)(Vs_Library vsynth, size_t count, Vs_ParallelFunc func, void *userdata);
+} *Vs_ThreadPoolAPI;
+
+/// Type of callback functions receiving the frames from Async::RequestFrames
+///
+/// The frames array has the frames in the order they were requested. The
+/// callee owns one reference to each frame, frames may be NULL. The array
+/// itself is only valid during the call.
+typedef VSYNTH_DECLARE_METHOD(void, Vs_FramesReadyFunc)(Vs_Frame *frames, size_t count, void *userdata);
+
+/// Asynchronous frame requests
+///
+/// These work with any active filter. Filters implementing get_frame_async
+/// are called directly, for other filters get_frame is run on the library's
+/// worker threads.
+typedef struct TAG_Vs_AsyncAPI {
+	/// Request a frame from an active filter asynchronously
+	///
+	/// The callback is called exactly once when the frame is ready, see
+	/// Vs_ActiveFilterVirtual::get_frame_async.
+	VSYNTH_DECLARE_METHOD(void, GetFrame)(Vs_Library vsynth, Vs_ActiveFilter filter, Vs_FrameNumber n, Vs_FrameCallback callback, void *userdata);
+	/// Request several frames, possibly from several filters, at once
+	///
+	/// Frame numbers[i] is requested from filters[i]. The callback is called
+	/// once, when all the frames are ready. Both arrays are copied, so they
+	/// need not stay valid after the call.
+	///
+	/// If there is not enough memory to make the requests, the callback is
+	/// still called once, with a NULL frames array and a count of zero, and
+	/// no frames are requested.
+	VSYNTH_DECLARE_METHOD(void, RequestFrames)(Vs_Library vsynth, size_t count, const Vs_ActiveFilter *filters, const Vs_FrameNumber *numbers, Vs_FramesReadyFunc callback, void *userdata);
+	/// Request a frame and wait for it
+	///
+	/// Filters implementing get_frame_async can use this to implement
+	/// get_frame. The calling thread helps with queued work while waiting.
+	VSYNTH_DECLARE_METHOD(Vs_Frame, WaitFrame)(Vs_Library vsynth, Vs_ActiveFilter filter, Vs_FrameNumber n);
+} *Vs_AsyncAPI;
+
+/// Property access by pre-resolved IDs
+///
+/// Resolving a property name is done once per filter type, the resulting ID
+/// is valid for every filter sharing the same vtable. Getting and setting by
+/// ID avoids looking up the name on each access.
+typedef struct TAG_Vs_PropertyAPI {
+	/// Look up the ID of a property by name
+	///
+	/// Returns PROPERTY_INVALID if the filter has no such property. If type
+	/// is not NULL it receives the property's type.
+	VSYNTH_DECLARE_METHOD(Vs_PropertyId, Resolve)(Vs_Library vsynth, Vs_Filter filter, const char *name, enum Vs_PropertyType *type);
+	/// Get a property value by ID
+	///
+	/// Returns zero if the ID is not valid for the filter.
+	VSYNTH_DECLARE_METHOD(int, Get)(Vs_Library vsynth, Vs_Filter filter, Vs_PropertyId id, Vs_PropertyValue *value);
+	/// Set a property value by ID
+	///
+	/// Returns zero if the ID is not valid for the filter or the value is of
+	/// the wrong type.
+	VSYNTH_DECLARE_METHOD(int, Set)(Vs_Library vsynth, Vs_Filter filter, Vs_PropertyId id, const Vs_PropertyValue *value);
+	/// Set several property values in one call
+	///
+	/// Sets property ids[i] to values[i]. Returns the number of properties
+	/// that were set.
+	VSYNTH_DECLARE_METHOD(size_t, SetMany)(Vs_Library vsynth, Vs_Filter filter, size_t count, const Vs_PropertyId *ids, const Vs_PropertyValue *values);
+} *Vs_PropertyAPI;
+
+/// Seeking by timestamp
+///
+/// Streams may have variable frame rates, so the frame shown at a time can't
+/// in general be computed from a frame rate. Sources with irregular
+/// timestamps keep them in a timestamp index built at activation, which
+/// stores them delta encoded in blocks, a few bytes per frame, and finds
+/// frames by binary search.
+typedef struct TAG_Vs_SeekAPI {
+	/// Find the frame of an active filter shown at a moment in time
+	///
+	/// Calls the filter's frame_at_timestamp method, or if it has none,
+	/// searches for the frame requesting a logarithmic number of frames.
+	/// Returns FRAMENUMBER_NONE if no frame is shown at t.
+	VSYNTH_DECLARE_METHOD(Vs_FrameNumber, FrameAtTimestamp)(Vs_Library vsynth, Vs_ActiveFilter filter, Vs_Timestamp t);
+	/// Create an empty timestamp index
+	///
+	/// Returns NULL if out of memory.
+	VSYNTH_DECLARE_METHOD(Vs_TimestampIndex, NewIndex)(Vs_Library vsynth);
+	/// Add the timestamp of the next frame to an index
+	///
+	/// Timestamps must be added in frame order, and each must be larger
+	/// than the one before. Returns zero if the timestamp is not larger or
+	/// out of memory, leaving the index as it was.
+	VSYNTH_DECLARE_METHOD(int, IndexAppend)(Vs_TimestampIndex index, Vs_Timestamp t);
+	/// Find the last frame in an index whose timestamp is not after t
+	///
+	/// Returns FRAMENUMBER_NONE if t is before the first frame. The index
+	/// doesn't know when the last frame ends, check against the duration.
+	VSYNTH_DECLARE_METHOD(Vs_FrameNumber, IndexFind)(Vs_TimestampIndex index, Vs_Timestamp t);
+	/// Get the timestamp of a frame, n must be less than the count
+	VSYNTH_DECLARE_METHOD(Vs_Timestamp, IndexGet)(Vs_TimestampIndex index, Vs_FrameNumber n);
+	/// Get the number of frames in an index
+	VSYNTH_DECLARE_METHOD(Vs_FrameNumber, IndexCount)(Vs_TimestampIndex index);
+	/// Free a timestamp index
+	///
+	/// An index may be read from several threads at once, but must not be
+	/// appended to while it is being read.
+	VSYNTH_DECLARE_METHOD(void, FreeIndex)(Vs_TimestampIndex index);
+} *Vs_SeekAPI;
+
+/// Parallel frame serving
+///
+/// A frame server requests frames from an active filter on the library's
+/// worker threads, keeping a window of frames ahead of the consumer in
+/// flight, and hands them out in frame number order. This relies on the
+/// active filter being safe to use from multiple threads at once.
+///
+/// A single frame server must only be used from one thread at a time.
+typedef struct TAG_Vs_FrameServerAPI {
+	/// Create a frame server for an active filter
+	///
+	/// Frames are served starting at frame number start. Up to lookahead
+	/// frames are requested ahead of the consumer; zero picks a window
+	/// large enough to keep all worker threads busy.
+	///
+	/// The frame server does not take ownership of the active filter, but
+	/// the filter must stay alive until the server is destroyed.
+	VSYNTH_DECLARE_METHOD(Vs_FrameServer, Create)(Vs_Library vsynth, Vs_ActiveFilter filter, Vs_FrameNumber start, size_t lookahead);
+	/// Get the next frame in order, waiting for it if necessary
+	///
+	/// Returns NULL when the end of the stream has been reached. If n is
+	/// not NULL it receives the number of the returned frame. The caller
+	/// owns one reference to the returned frame.
+	VSYNTH_DECLARE_METHOD(Vs_Frame, Next)(Vs_FrameServer server, Vs_FrameNumber *n);
+	/// Continue serving from another frame number
+	///
+	/// Frames prefetched for the old position are discarded.
+	VSYNTH_DECLARE_METHOD(void, Seek)(Vs_FrameServer server, Vs_FrameNumber n);
+	/// Stop serving frames and free the frame server
+	///
+	/// Waits for requests in flight to finish.
+	VSYNTH_DECLARE_METHOD(void, Destroy)(Vs_FrameServer server);
+} *Vs_FrameServerAPI;
+
+
+/// Graph functions, activating filters through the library
+typedef struct TAG_Vs_GraphAPI {
+	/// Activate a filter
+	///
+	/// Same as calling the filter's activate method, but lets the library
+	/// add its own services to the active filter, such as profiling. Hosts
+	/// and filters activating their input clips should use this rather than
+	/// calling activate directly.
+	///
+	/// If an identical subgraph, asked for the same frame types, is already
+	/// active, the returned filter shares that active instance, and the
+	/// frame type descriptions are filled in as they were for it. Subgraphs
+	/// are identical if their filters are of the same types with the same
+	/// property values. Only activations asking for stdframes are shared.
+	VSYNTH_DECLARE_METHOD(Vs_ActiveFilter, Activate)(Vs_Library vsynth, Vs_Filter filter, Vs_String *error, Vs_FrameTypeDescription **frametypes);
+	/// Rewrite a filter graph into a cheaper one producing the same frames
+	///
+	/// Walks the graph through the properties of Filter type, from the
+	/// sources down, and gives each filter's optimize method the chance to
+	/// replace it. Filters whose input clips were replaced are cloned, the
+	/// graph passed in is never changed. Filters shared by several others
+	/// stay shared.
+	///
+	/// Hosts should call this on the graph built by a script before
+	/// activating it. Returns a new reference to the optimized graph, which
+	/// is the filter itself if nothing could be rewritten.
+	VSYNTH_DECLARE_METHOD(Vs_Filter, Optimize)(Vs_Library vsynth, Vs_Filter filter);
+	/// Enable or disable sharing active filters between identical subgraphs
+	///
+	/// Only affects filters activated from now on. Sharing is enabled by
+	/// default, it relies on get_frame being idempotent.
+	VSYNTH_DECLARE_METHOD(void, SetSharing)(Vs_Library vsynth, int enabled);
+} *Vs_GraphAPI;
+
+
+/// Performance counters of a single active filter
+///
+/// Times are wall clock nanoseconds. Self time excludes time spent in
+/// profiled filters called on the same thread, normally the filter's input
+/// clips. Work a filter hands off to other threads is not counted as its own,
+/// but the time it waits for that work is.
+typedef struct TAG_Vs_FilterProfile {
+	/// The profiled active filter, NULL once it has been destroyed
+	Vs_ActiveFilter filter;
+	/// The filter it was activated from
+	///
+	/// Only for identifying the filter, it is not referenced and may already
+	/// have been freed.
+	Vs_Filter prototype;
+	/// Number of frame requests
+	unsigned long long calls;
+	/// Number of frames returned
+	unsigned long long frames;
+	/// Number of requests that returned NULL
+	unsigned long long null_frames;
+	/// Time spent in get_frame, including input clips
+	///
+	/// For asynchronous requests, the time until the callback is made.
+	unsigned long long total_ns;
+	/// Time spent in get_frame, excluding input clips
+	///
+	/// Not measured for asynchronous requests.
+	unsigned long long self_ns;
+	/// Bytes of frame memory allocated from the frame pool in get_frame
+	unsigned long long bytes_allocated;
+} Vs_FilterProfile;
+
+/// Type of callback functions for enumerating profiled filters
+typedef VSYNTH_DECLARE_METHOD(void, Vs_EnumProfilesFunc)(const Vs_FilterProfile *profile, void *userdata);
+
+/// Per-filter performance counters
+///
+/// While profiling is enabled, filters activated through Graph::Activate are
+/// wrapped so calls to them are counted and timed. Counters are kept per
+/// thread and only added up when read, so profiling is cheap enough to leave
+/// on. All functions are thread safe.
+typedef struct TAG_Vs_ProfileAPI {
+	/// Enable or disable profiling of filters activated from now on
+	///
+	/// Filters already activated stay as they are. Profiling is disabled by
+	/// default.
+	VSYNTH_DECLARE_METHOD(void, SetEnabled)(Vs_Library vsynth, int enabled);
+	/// Enumerate the counters of all profiled filters through a callback
+	///
+	/// Filters are enumerated in activation order, including filters that
+	/// have been destroyed since the last Reset. Counters of filters still
+	/// in use may be slightly behind.
+	VSYNTH_DECLARE_METHOD(void, Enumerate)(Vs_Library vsynth, Vs_EnumProfilesFunc callback, void *userdata);
+	/// Set all counters to zero and forget filters that have been destroyed
+	VSYNTH_DECLARE_METHOD(void, Reset)(Vs_Library vsynth);
+} *Vs_ProfileAPI;
+
+
 /// Vsynth library instance
 typedef struct TAG_Vs_Library {
 	/// Pointer to filter registry functions
 	Vs_FilterRegistry FilterRegistry;
 	/// Pointer to string functions
 	Vs_StringAPI String;
+	/// Pointer to frame pool functions
+	Vs_FramePoolAPI FramePool;
+	/// Pointer to frame cache functions
+	Vs_CacheAPI Cache;
+	/// Pointer to worker thread functions
+	Vs_ThreadPoolAPI ThreadPool;
+	/// Pointer to frame server functions
+	Vs_FrameServerAPI FrameServer;
+	/// Pointer to asynchronous frame request functions
+	Vs_AsyncAPI Async;
+	/// Pointer to property functions
+	Vs_PropertyAPI Property;
+	/// Pointer to graph functions
+	Vs_GraphAPI Graph;
+	/// Pointer to profiling functions
+	Vs_ProfileAPI Profile;
+	/// Pointer to seeking functions
+	Vs_SeekAPI Seek;
 } *Vs_Library;
 
 
+/// Type of the entry point of plugin modules
+///
+/// Plugin modules export a function of this type named Vs_PluginInit. The
+/// host calls it once for each library instance the plugin is loaded into,
+/// and the plugin registers its filters with that library.
+typedef VSYNTH_DECLARE_METHOD(void, Vs_PluginInitFunc)(Vs_Library vsynth);
+
 /// Create a new Vsynth library instance
 VSYNTH_API(Vs_Library) Vs_InitLibrary(void);
 /// Free a Vsynth library instance
@@ -0,0 +1,125 @@
+// This file is C99
+
+/*
+
+Async::RequestFrames, over several filters, with frames coming in from the
+worker threads in any order, and its degenerate requests.
+
+*/
+
+#include "testutil.h"
+#include <pthread.h>
+
+
+#define REQUEST_COUNT 32
+
+/// Collects the result of one RequestFrames call
+struct Delivery {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int calls;
+	size_t count;
+	Vs_Frame frames[REQUEST_COUNT];
+	int got_null_array;
+};
+
+VSYNTH_IMPLEMENT_METHOD(void, FramesReady)(Vs_Frame *frames, size_t count, void *userdata)
+{
+	struct Delivery *d = (struct Delivery *)userdata;
+	size_t i;
+
+	pthread_mutex_lock(&d->lock);
+	d->calls++;
+	d->count = count;
+	d->got_null_array = (frames == NULL);
+	for (i = 0; i < count && i < REQUEST_COUNT; i++)
+		d->frames[i] = frames[i];
+	pthread_cond_broadcast(&d->cond);
+	pthread_mutex_unlock(&d->lock);
+}
+
+static void InitDelivery(struct Delivery *d)
+{
+	memset(d, 0, sizeof(*d));
+	pthread_mutex_init(&d->lock, NULL);
+	pthread_cond_init(&d->cond, NULL);
+}
+
+static void WaitDelivery(struct Delivery *d)
+{
+	pthread_mutex_lock(&d->lock);
+	while (d->calls == 0)
+		pthread_cond_wait(&d->cond, &d->lock);
+	pthread_mutex_unlock(&d->lock);
+}
+
+static void FreeDelivery(struct Delivery *d)
+{
+	pthread_mutex_destroy(&d->lock);
+	pthread_cond_destroy(&d->cond);
+}
+
+int main(void)
+{
+	Vs_Library vsynth = TestInit();
+	Vs_Filter clips[3];
+	Vs_ActiveFilter active[3];
+	Vs_ActiveFilter filters[REQUEST_COUNT];
+	Vs_FrameNumber numbers[REQUEST_COUNT];
+	struct Delivery d;
+	Vs_Frame expected;
+	size_t i;
+
+	vsynth->ThreadPool->SetThreadCount(vsynth, 4);
+
+	// convert has no get_frame_async, so every request runs on the pool
+	for (i = 0; i < 3; i++)
+	{
+		clips[i] = TestChain(vsynth, "convert", TestBlankclip(vsynth, 32 + 16 * i, 24, 20));
+		clips[i]->methods->set_property_int(clips[i], "pixfmt", STDPIXFMT_YCrCb16_420);
+		active[i] = TestActivate(vsynth, clips[i]);
+	}
+
+	for (i = 0; i < REQUEST_COUNT; i++)
+	{
+		filters[i] = active[i % 3];
+		numbers[i] = (Vs_FrameNumber)((i * 7) % 20);
+	}
+	// past the end, delivered as NULL in its place
+	numbers[REQUEST_COUNT - 1] = 25;
+
+	InitDelivery(&d);
+	vsynth->Async->RequestFrames(vsynth, REQUEST_COUNT, filters, numbers, FramesReady, &d);
+	WaitDelivery(&d);
+	CHECK(d.count == REQUEST_COUNT);
+	for (i = 0; i < REQUEST_COUNT - 1; i++)
+	{
+		expected = filters[i]->methods->get_frame(filters[i], numbers[i]);
+		CHECK(d.frames[i] != NULL && TestSameFrame(d.frames[i], expected));
+		expected->methods->unref(expected);
+		if (d.frames[i] != NULL)
+			d.frames[i]->methods->unref(d.frames[i]);
+	}
+	CHECK(d.frames[REQUEST_COUNT - 1] == NULL);
+	FreeDelivery(&d);
+
+	// nothing to wait for, delivered right away
+	InitDelivery(&d);
+	vsynth->Async->RequestFrames(vsynth, 0, NULL, NULL, FramesReady, &d);
+	CHECK(d.calls == 1 && d.count == 0);
+	FreeDelivery(&d);
+
+	// too large to allocate, the callback must still run
+	InitDelivery(&d);
+	vsynth->Async->RequestFrames(vsynth, (size_t)-1 / 2, filters, numbers, FramesReady, &d);
+	CHECK(d.calls == 1 && d.count == 0 && d.got_null_array);
+	FreeDelivery(&d);
+
+	for (i = 0; i < 3; i++)
+	{
+		active[i]->methods->destroy(active[i]);
+		clips[i]->methods->unref(clips[i]);
+	}
+	Vs_FreeLibrary(vsynth);
+	return TestResult();
+}
@@ -0,0 +1,120 @@
+// This file is C99
+
+/*
+
+Frame caching: hits, misses and LRU eviction under a budget shared by two
+caches, and that cached frames are the frames the upstream filter produces.
+
+*/
+
+#include "testutil.h"
+
+
+#define LENGTH 12
+
+/// Get frame n from a cache and check it against the uncached filter
+static void Fetch(Vs_ActiveFilter cache, Vs_ActiveFilter reference, Vs_FrameNumber n)
+{
+	Vs_Frame got = cache->methods->get_frame(cache, n);
+	Vs_Frame expected = reference->methods->get_frame(reference, n);
+
+	CHECK(got != NULL && TestSameFrame(got, expected));
+	if (got != NULL)
+		got->methods->unref(got);
+	expected->methods->unref(expected);
+}
+
+static Vs_Filter NewClip(Vs_Library vsynth, long long width)
+{
+	// convert produces frames of its own, which is what caches usually hold
+	Vs_Filter clip = TestChain(vsynth, "convert", TestBlankclip(vsynth, width, 24, LENGTH));
+	clip->methods->set_property_int(clip, "pixfmt", STDPIXFMT_YCrCb8_420);
+	return clip;
+}
+
+int main(void)
+{
+	Vs_Library vsynth = TestInit();
+	Vs_Filter clips[2];
+	Vs_ActiveFilter reference[2], caches[2];
+	Vs_CacheStats stats, stats0, stats1;
+	Vs_Frame frame;
+	size_t frame_size;
+	Vs_FrameNumber n;
+	int i;
+
+	for (i = 0; i < 2; i++)
+	{
+		clips[i] = NewClip(vsynth, 32);
+		reference[i] = TestActivate(vsynth, clips[i]);
+		caches[i] = vsynth->Cache->Wrap(vsynth, TestActivate(vsynth, clips[i]));
+	}
+	frame = reference[0]->methods->get_frame(reference[0], 0);
+	frame_size = frame->methods->memory_size(frame);
+	frame->methods->unref(frame);
+
+	// room for three frames
+	vsynth->Cache->SetBudget(vsynth, frame_size * 3 + frame_size / 2);
+
+	// a miss, then hits
+	Fetch(caches[0], reference[0], 0);
+	Fetch(caches[0], reference[0], 0);
+	Fetch(caches[0], reference[0], 0);
+	vsynth->Cache->GetFilterStats(vsynth, caches[0], &stats);
+	CHECK(stats.misses == 1 && stats.hits == 2 && stats.frames_held == 1);
+	CHECK(stats.bytes_held == frame_size);
+
+	// filling up evicts the least recently used, from either cache
+	Fetch(caches[0], reference[0], 1);
+	Fetch(caches[1], reference[1], 0);
+	Fetch(caches[0], reference[0], 0);
+	Fetch(caches[1], reference[1], 1);
+	vsynth->Cache->GetStats(vsynth, &stats);
+	CHECK(stats.frames_held == 3 && stats.evictions == 1);
+	CHECK(stats.bytes_held <= stats.budget);
+	vsynth->Cache->GetFilterStats(vsynth, caches[0], &stats0);
+	vsynth->Cache->GetFilterStats(vsynth, caches[1], &stats1);
+	CHECK(stats0.evictions == 1 && stats1.evictions == 0);
+	CHECK(stats0.frames_held + stats1.frames_held == stats.frames_held);
+
+	// frame 1 of the first cache was the one to go, frame 0 was used since
+	Fetch(caches[0], reference[0], 0);
+	vsynth->Cache->GetFilterStats(vsynth, caches[0], &stats);
+	CHECK(stats.hits == 4);
+	Fetch(caches[0], reference[0], 1);
+	vsynth->Cache->GetFilterStats(vsynth, caches[0], &stats);
+	CHECK(stats.misses == 3);
+
+	// a pass over everything never goes over budget, and returns the right frames
+	for (n = 0; n < LENGTH; n++)
+	{
+		Fetch(caches[n % 2], reference[n % 2], n);
+		vsynth->Cache->GetStats(vsynth, &stats);
+		CHECK(stats.bytes_held <= stats.budget && stats.frames_held <= 3);
+	}
+
+	// past the end is not cached
+	frame = caches[0]->methods->get_frame(caches[0], LENGTH);
+	CHECK(frame == NULL);
+
+	vsynth->Cache->Flush(vsynth);
+	vsynth->Cache->GetStats(vsynth, &stats);
+	CHECK(stats.frames_held == 0 && stats.bytes_held == 0);
+
+	// a zero budget disables caching
+	vsynth->Cache->SetBudget(vsynth, 0);
+	vsynth->Cache->GetFilterStats(vsynth, caches[1], &stats0);
+	Fetch(caches[1], reference[1], 3);
+	Fetch(caches[1], reference[1], 3);
+	vsynth->Cache->GetFilterStats(vsynth, caches[1], &stats1);
+	CHECK(stats1.misses == stats0.misses + 2 && stats1.hits == stats0.hits);
+
+	for (i = 0; i < 2; i++)
+	{
+		caches[i]->methods->destroy(caches[i]);
+		reference[i]->methods->destroy(reference[i]);
+		clips[i]->methods->unref(clips[i]);
+	}
+	Vs_FreeLibrary(vsynth);
+	return TestResult();
+}
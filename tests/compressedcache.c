@@ -0,0 +1,146 @@
+// This file is C99
+
+/*
+
+The compressed cache tier: frames evicted from a small cache budget are
+compressed, and frames decompressed on later hits must be the frames the
+upstream filter produces, byte for byte, for every kind of plane layout.
+Frames that don't own their pixels must never be compressed.
+
+*/
+
+#include "testutil.h"
+
+
+#define RAW_PATH "test-compressedcache.raw"
+#define RAW_SIZE (2 * 1024 * 1024)
+#define FRAMES 12
+#define PASSES 3
+
+/// A rawsource, through resize if the frames would otherwise wrap the file
+static Vs_Filter NewSource(Vs_Library vsynth, enum Vs_StdframePixelFormat pixfmt, long long width, long long height, long long bitdepth, int resize)
+{
+	Vs_Filter raw = TestNewFilter(vsynth, "rawsource");
+	Vs_Filter resized;
+
+	TestSetString(vsynth, raw, "path", RAW_PATH);
+	TestSetString(vsynth, raw, "format", "raw");
+	raw->methods->set_property_int(raw, "width", resize ? width + 2 : width);
+	raw->methods->set_property_int(raw, "height", height);
+	raw->methods->set_property_int(raw, "pixfmt", pixfmt);
+	raw->methods->set_property_timestamp(raw, "framedur", 1);
+	// other than 8 and 16 bits, samples are converted into frames of their own
+	if (bitdepth != 0)
+		raw->methods->set_property_int(raw, "bitdepth", bitdepth);
+	if (!resize)
+		return raw;
+
+	resized = TestChain(vsynth, "resize", raw);
+	resized->methods->set_property_int(resized, "width", width);
+	resized->methods->set_property_int(resized, "height", height);
+	return resized;
+}
+
+/// Run passes over a clip through a cache with room for two and a half frames
+///
+/// Returns the statistics of the cache.
+static Vs_CacheStats RunCase(Vs_Library vsynth, Vs_Filter clip, size_t compressed_frames)
+{
+	Vs_ActiveFilter reference = TestActivate(vsynth, clip);
+	Vs_ActiveFilter cache = vsynth->Cache->Wrap(vsynth, TestActivate(vsynth, clip));
+	Vs_CacheStats stats;
+	Vs_Frame expected, got;
+	size_t frame_size;
+	Vs_FrameNumber n;
+	int pass;
+
+	expected = reference->methods->get_frame(reference, 0);
+	frame_size = expected->methods->memory_size(expected);
+	expected->methods->unref(expected);
+	vsynth->Cache->Flush(vsynth);
+	vsynth->Cache->SetBudget(vsynth, frame_size * 2 + frame_size / 2);
+	vsynth->Cache->SetCompressedBudget(vsynth, frame_size * compressed_frames);
+
+	// forwards, backwards, forwards, so frames come back from both tiers
+	for (pass = 0; pass < PASSES; pass++)
+	{
+		for (n = 0; n < FRAMES; n++)
+		{
+			Vs_FrameNumber i = pass == 1 ? FRAMES - 1 - n : n;
+			expected = reference->methods->get_frame(reference, i);
+			got = cache->methods->get_frame(cache, i);
+			CHECK(got != NULL && TestSameFrame(got, expected));
+			expected->methods->unref(expected);
+			if (got != NULL)
+				got->methods->unref(got);
+		}
+	}
+
+	vsynth->Cache->GetFilterStats(vsynth, cache, &stats);
+	cache->methods->destroy(cache);
+	reference->methods->destroy(reference);
+	return stats;
+}
+
+int main(void)
+{
+	static const struct {
+		enum Vs_StdframePixelFormat pixfmt;
+		long long width, height, bitdepth;
+		int resize;
+	} cases[] = {
+		{ STDPIXFMT_MONO8, 64, 48, 0, 1 },
+		{ STDPIXFMT_XRGB8, 37, 23, 0, 1 },
+		{ STDPIXFMT_YCrCb8_420, 37, 23, 0, 1 },
+		{ STDPIXFMT_YCrCbA8_422, 100, 31, 0, 1 },
+		{ STDPIXFMT_YCrCb16_420, 45, 33, 10, 0 },
+		{ STDPIXFMT_ARGB16, 21, 70, 12, 0 },
+		{ STDPIXFMT_MONO16, 1, 1, 10, 0 },
+	};
+	Vs_Library vsynth = TestInit();
+	Vs_CacheStats stats;
+	Vs_Filter clip;
+	size_t i;
+
+	TestWriteNoise(RAW_PATH, RAW_SIZE);
+
+	for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+	{
+		clip = NewSource(vsynth, cases[i].pixfmt, cases[i].width, cases[i].height, cases[i].bitdepth, cases[i].resize);
+		stats = RunCase(vsynth, clip, 2 * FRAMES);
+		if (!CHECK(stats.frames_compressed > 0 && stats.compressed_hits > 0))
+			fprintf(stderr, "  case %u: nothing came from the compressed tier\n", (unsigned int)i);
+		CHECK(stats.compressed_hits <= stats.hits);
+		CHECK(stats.compressed_bytes_held < stats.compressed_source_bytes);
+		clip->methods->unref(clip);
+
+		// a destroyed cache leaves nothing behind in either tier
+		vsynth->Cache->GetStats(vsynth, &stats);
+		CHECK(stats.frames_held == 0 && stats.bytes_held == 0);
+		CHECK(stats.compressed_frames_held == 0 && stats.compressed_bytes_held == 0);
+	}
+
+	// the 444p16 case a converting filter produces from 8 bit frames
+	clip = NewSource(vsynth, STDPIXFMT_YCrCb8_444, 40, 30, 0, 0);
+	clip = TestChain(vsynth, "convert", clip);
+	clip->methods->set_property_int(clip, "pixfmt", STDPIXFMT_YCrCb16_444);
+	stats = RunCase(vsynth, clip, 2 * FRAMES);
+	CHECK(stats.frames_compressed > 0 && stats.compressed_hits > 0);
+	clip->methods->unref(clip);
+
+	// frames wrapping the mapped file are dropped, not compressed
+	clip = NewSource(vsynth, STDPIXFMT_YCrCb8_444, 64, 48, 0, 0);
+	stats = RunCase(vsynth, clip, 2 * FRAMES);
+	CHECK(stats.evictions > 0 && stats.frames_compressed == 0 && stats.compressed_hits == 0);
+	clip->methods->unref(clip);
+
+	// a zero compressed budget, the default, disables the tier
+	clip = NewSource(vsynth, STDPIXFMT_MONO16, 64, 48, 10, 0);
+	stats = RunCase(vsynth, clip, 0);
+	CHECK(stats.compressed_hits == 0 && stats.compressed_frames_held == 0);
+	clip->methods->unref(clip);
+
+	remove(RAW_PATH);
+	Vs_FreeLibrary(vsynth);
+	return TestResult();
+}
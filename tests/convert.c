@@ -0,0 +1,213 @@
+// This file is C99
+
+/*
+
+Convert between RGB and YCrCb: primary colours must land on the standard
+limited range values of each matrix, and the SSE2 code must give the same
+results as the C loops. The vector loops handle blocks of 8 or 16 pixels and
+leave the rest of a line to the C loops, so every line of the source repeats
+its first pixels past the last whole block, and the two copies must convert
+to the same values.
+
+*/
+
+#include "testutil.h"
+
+
+#define RAW_PATH "test-convert.raw"
+/// Pixels of each line handled by the vector loops, and the tail after them
+#define BLOCK 16
+#define TAIL 7
+#define WIDTH (BLOCK + TAIL)
+#define HEIGHT 48
+
+enum { BLACK, WHITE, RED, GREEN, BLUE, KNOWN_COLOURS };
+
+static const uint32_t known_rgb[KNOWN_COLOURS] = { 0x000000, 0xFFFFFF, 0xFF0000, 0x00FF00, 0x0000FF };
+
+/// Expected 8 bit Y, Cr, Cb of the known colours for each matrix
+static const struct {
+	long long matrix;
+	uint8_t ycrcb[KNOWN_COLOURS][3];
+} known_ycrcb[] = {
+	{ 601, { { 16, 128, 128 }, { 235, 128, 128 }, { 81, 240, 90 }, { 145, 34, 54 }, { 41, 110, 240 } } },
+	{ 709, { { 16, 128, 128 }, { 235, 128, 128 }, { 63, 240, 102 }, { 173, 26, 42 }, { 32, 118, 240 } } },
+	{ 2020, { { 16, 128, 128 }, { 235, 128, 128 }, { 74, 240, 97 }, { 164, 25, 47 }, { 29, 119, 240 } } }
+};
+
+/// XRGB8 lines of noise, the known colours at the start of the first line,
+/// and the first TAIL pixels of each line repeated after the first BLOCK
+static void WriteSource(void)
+{
+	FILE *f = fopen(RAW_PATH, "wb");
+	unsigned int seed = 777;
+	uint32_t line[WIDTH];
+	int x, y;
+
+	for (y = 0; y < HEIGHT; y++)
+	{
+		for (x = 0; x < BLOCK; x++)
+		{
+			seed = seed * 1103515245u + 12345u;
+			line[x] = (seed >> 8) & 0xFFFFFF;
+		}
+		if (y == 0)
+		{
+			for (x = 0; x < KNOWN_COLOURS; x++)
+				line[x] = known_rgb[x];
+		}
+		for (x = 0; x < TAIL; x++)
+			line[BLOCK + x] = line[x];
+		for (x = 0; x < WIDTH; x++)
+		{
+			fputc(0, f);
+			fputc((int)(line[x] >> 16) & 0xFF, f);
+			fputc((int)(line[x] >> 8) & 0xFF, f);
+			fputc((int)line[x] & 0xFF, f);
+		}
+	}
+	fclose(f);
+}
+
+/// Convert a clip to pixfmt with a matrix, taking over the reference to it
+static Vs_Filter NewConvert(Vs_Library vsynth, Vs_Filter clip, enum Vs_StdframePixelFormat pixfmt, long long matrix)
+{
+	Vs_Filter convert = TestChain(vsynth, "convert", clip);
+
+	convert->methods->set_property_int(convert, "pixfmt", pixfmt);
+	convert->methods->set_property_int(convert, "matrix", matrix);
+	return convert;
+}
+
+/// First frame of a clip, exits on failure
+static Vs_Frame FirstFrame(Vs_Library vsynth, Vs_Filter clip)
+{
+	Vs_ActiveFilter active = TestActivate(vsynth, clip);
+	Vs_Frame frame = active->methods->get_frame(active, 0);
+
+	active->methods->destroy(active);
+	if (frame == NULL)
+	{
+		fprintf(stderr, "no frame\n");
+		exit(EXIT_FAILURE);
+	}
+	return frame;
+}
+
+/// Check the repeated pixels of every line came out the same as the originals
+static void CheckTail(Vs_Frame frame, const char *what)
+{
+	Vs_StandardFrame sf = Vs_Stdframe_Get(frame);
+	size_t pixelsize = STDPIXFMT_pixelsize(sf->pixfmt);
+	size_t plane, y;
+
+	for (plane = 0; plane < STDPIXFMT_planecount(sf->pixfmt); plane++)
+	{
+		for (y = 0; y < sf->height; y++)
+		{
+			const unsigned char *line = (const unsigned char *)sf->data[plane] + (ptrdiff_t)y * sf->stride[plane];
+			if (!CHECK(memcmp(line, line + BLOCK * pixelsize, TAIL * pixelsize) == 0))
+			{
+				fprintf(stderr, "  %s, plane %d, line %d\n", what, (int)plane, (int)y);
+				return;
+			}
+		}
+	}
+}
+
+/// Non-zero if two samples differ by at most one
+static int Near(int a, int b)
+{
+	return a - b <= 1 && b - a <= 1;
+}
+
+/// Check the known colours in the vector and the C part of the first line of a YCrCb8_444 frame
+static void CheckKnownYCrCb(Vs_Frame frame, const uint8_t expected[KNOWN_COLOURS][3], long long matrix)
+{
+	Vs_StandardFrame sf = Vs_Stdframe_Get(frame);
+	int c, plane, x;
+
+	for (c = 0; c < KNOWN_COLOURS; c++)
+	for (plane = 0; plane < 3; plane++)
+	for (x = c; x < WIDTH; x += BLOCK)
+	{
+		int got = ((const uint8_t *)sf->data[plane])[x];
+		if (!CHECK(Near(got, expected[c][plane])))
+			fprintf(stderr, "  BT.%lld colour %06x plane %d at %d: %d, expected %d\n", matrix, (unsigned)known_rgb[c], plane, x, got, expected[c][plane]);
+	}
+}
+
+/// Check the known colours come back from YCrCb in the first line of an XRGB8 frame
+static void CheckKnownRgb(Vs_Frame frame, long long matrix)
+{
+	Vs_StandardFrame sf = Vs_Stdframe_Get(frame);
+	const uint8_t *line = (const uint8_t *)sf->data[0];
+	int c, i, x;
+
+	for (c = 0; c < KNOWN_COLOURS; c++)
+	for (x = c; x < WIDTH; x += BLOCK)
+	for (i = 0; i < 3; i++)
+	{
+		int expected = (int)(known_rgb[c] >> (16 - 8 * i)) & 0xFF;
+		if (!CHECK(Near(line[4 * x + 1 + i], expected)))
+			fprintf(stderr, "  BT.%lld colour %06x channel %d at %d: %d\n", matrix, (unsigned)known_rgb[c], i, x, line[4 * x + 1 + i]);
+	}
+}
+
+static Vs_Filter NewSource(Vs_Library vsynth)
+{
+	Vs_Filter raw = TestNewFilter(vsynth, "rawsource");
+
+	TestSetString(vsynth, raw, "path", RAW_PATH);
+	TestSetString(vsynth, raw, "format", "raw");
+	raw->methods->set_property_int(raw, "width", WIDTH);
+	raw->methods->set_property_int(raw, "height", HEIGHT);
+	raw->methods->set_property_int(raw, "pixfmt", STDPIXFMT_XRGB8);
+	raw->methods->set_property_timestamp(raw, "framedur", 1);
+	return raw;
+}
+
+int main(void)
+{
+	static const enum Vs_StdframePixelFormat wide[] = { STDPIXFMT_YCrCb16_444, STDPIXFMT_XRGB16, STDPIXFMT_MONO8 };
+	Vs_Library vsynth = TestInit();
+	Vs_Filter ycrcb, rgb, other;
+	Vs_Frame frame;
+	size_t m, i;
+
+	WriteSource();
+	for (m = 0; m < sizeof(known_ycrcb) / sizeof(known_ycrcb[0]); m++)
+	{
+		long long matrix = known_ycrcb[m].matrix;
+
+		ycrcb = NewConvert(vsynth, NewSource(vsynth), STDPIXFMT_YCrCb8_444, matrix);
+		frame = FirstFrame(vsynth, ycrcb);
+		CheckKnownYCrCb(frame, known_ycrcb[m].ycrcb, matrix);
+		CheckTail(frame, "to YCrCb8_444");
+		frame->methods->unref(frame);
+
+		// and back, from values that went through the vector and C loops alike
+		ycrcb->methods->addref(ycrcb);
+		rgb = NewConvert(vsynth, ycrcb, STDPIXFMT_XRGB8, matrix);
+		frame = FirstFrame(vsynth, rgb);
+		CheckKnownRgb(frame, matrix);
+		CheckTail(frame, "back to XRGB8");
+		frame->methods->unref(frame);
+		rgb->methods->unref(rgb);
+
+		for (i = 0; i < sizeof(wide) / sizeof(wide[0]); i++)
+		{
+			ycrcb->methods->addref(ycrcb);
+			other = NewConvert(vsynth, ycrcb, wide[i], matrix);
+			frame = FirstFrame(vsynth, other);
+			CheckTail(frame, "to other pixfmts");
+			frame->methods->unref(frame);
+			other->methods->unref(other);
+		}
+		ycrcb->methods->unref(ycrcb);
+	}
+
+	Vs_FreeLibrary(vsynth);
+	remove(RAW_PATH);
+	return TestResult();
+}
@@ -0,0 +1,95 @@
+// This file is C99
+
+/*
+
+Crop moved ahead of a convert by the optimizer. Wherever it is moved, the
+frames must come out the same as from the graph as it was built, for even
+and odd input sizes and every kind of chroma subsampling of the output.
+
+*/
+
+#include "testutil.h"
+
+
+#define RAW_PATH "test-crop.raw"
+#define RAW_SIZE (512 * 1024)
+#define FRAMES 3
+
+/// A rawsource of noise, converted to pixfmt and cropped by the margins
+static Vs_Filter NewCroppedConvert(Vs_Library vsynth, long long width, long long height, enum Vs_StdframePixelFormat pixfmt, const long long margins[4])
+{
+	Vs_Filter raw = TestNewFilter(vsynth, "rawsource");
+	Vs_Filter convert, crop;
+
+	TestSetString(vsynth, raw, "path", RAW_PATH);
+	TestSetString(vsynth, raw, "format", "raw");
+	raw->methods->set_property_int(raw, "width", width);
+	raw->methods->set_property_int(raw, "height", height);
+	raw->methods->set_property_int(raw, "pixfmt", STDPIXFMT_YCrCb8_444);
+	raw->methods->set_property_timestamp(raw, "framedur", 1);
+	convert = TestChain(vsynth, "convert", raw);
+	convert->methods->set_property_int(convert, "pixfmt", pixfmt);
+	crop = TestChain(vsynth, "crop", convert);
+	crop->methods->set_property_int(crop, "left", margins[0]);
+	crop->methods->set_property_int(crop, "top", margins[1]);
+	crop->methods->set_property_int(crop, "right", margins[2]);
+	crop->methods->set_property_int(crop, "bottom", margins[3]);
+	return crop;
+}
+
+/// Compare the optimized graph with the graph as built
+///
+/// Returns non-zero if the crop was moved.
+static int CheckHoist(Vs_Library vsynth, long long width, long long height, enum Vs_StdframePixelFormat pixfmt, const long long margins[4])
+{
+	Vs_Filter crop = NewCroppedConvert(vsynth, width, height, pixfmt, margins);
+	Vs_Filter optimized = vsynth->Graph->Optimize(vsynth, crop);
+	Vs_ActiveFilter built = TestActivate(vsynth, crop);
+	Vs_ActiveFilter hoisted = TestActivate(vsynth, optimized);
+	int moved = optimized->methods != crop->methods;
+	Vs_FrameNumber n;
+
+	for (n = 0; n < FRAMES; n++)
+	{
+		Vs_Frame expected = built->methods->get_frame(built, n);
+		Vs_Frame got = hoisted->methods->get_frame(hoisted, n);
+
+		if (!CHECK(got != NULL && expected != NULL && TestSameFrame(got, expected)))
+			fprintf(stderr, "  %lldx%lld to pixfmt %d, margins %lld %lld %lld %lld\n", width, height, (int)pixfmt, margins[0], margins[1], margins[2], margins[3]);
+		if (got != NULL)
+			got->methods->unref(got);
+		if (expected != NULL)
+			expected->methods->unref(expected);
+	}
+
+	built->methods->destroy(built);
+	hoisted->methods->destroy(hoisted);
+	optimized->methods->unref(optimized);
+	crop->methods->unref(crop);
+	return moved;
+}
+
+int main(void)
+{
+	static const enum Vs_StdframePixelFormat pixfmts[] = { STDPIXFMT_YCrCb8_420, STDPIXFMT_YCrCb8_422, STDPIXFMT_YCrCb8_444, STDPIXFMT_XRGB8 };
+	static const long long sizes[][2] = { { 66, 40 }, { 67, 41 }, { 66, 41 }, { 67, 40 } };
+	static const long long margins[][4] = { { 2, 2, 2, 2 }, { 4, 2, 0, 0 }, { 0, 0, 2, 0 }, { 0, 0, 0, 2 } };
+	Vs_Library vsynth = TestInit();
+	size_t p, s, m;
+
+	TestWriteNoise(RAW_PATH, RAW_SIZE);
+	for (p = 0; p < sizeof(pixfmts) / sizeof(pixfmts[0]); p++)
+	for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+	for (m = 0; m < sizeof(margins) / sizeof(margins[0]); m++)
+	{
+		int moved = CheckHoist(vsynth, sizes[s][0], sizes[s][1], pixfmts[p], margins[m]);
+
+		// moving it is still worth it where it's safe for any size
+		if (pixfmts[p] == STDPIXFMT_YCrCb8_444 || pixfmts[p] == STDPIXFMT_XRGB8 || (margins[m][2] == 0 && margins[m][3] == 0))
+			CHECK(moved);
+	}
+
+	Vs_FreeLibrary(vsynth);
+	remove(RAW_PATH);
+	return TestResult();
+}
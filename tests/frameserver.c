@@ -0,0 +1,91 @@
+// This file is C99
+
+/*
+
+The frame server serving a source of unknown length, which it finds the end
+of by running into it, through seeks back and past the end, and recovering
+from a frame that failed once.
+
+*/
+
+#include "testutil.h"
+
+
+#define LENGTH 10
+#define FLAKY_FRAME 5
+
+
+/// Proxy failing FLAKY_FRAME the first time it is requested
+static int flaky_failed;
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Frame, Flaky_get_frame)(Vs_ActiveFilter filter, Vs_FrameNumber n)
+{
+	if (n == FLAKY_FRAME && !flaky_failed)
+	{
+		flaky_failed = 1;
+		return NULL;
+	}
+	return TestProxy_get_frame(filter, n);
+}
+
+/// Take frames from the server until it ends, returns the number taken
+static Vs_FrameNumber Drain(Vs_Library vsynth, Vs_FrameServer server, Vs_FrameNumber first)
+{
+	Vs_FrameNumber taken = 0, n;
+	Vs_Frame frame;
+
+	while ((frame = vsynth->FrameServer->Next(server, &n)) != NULL)
+	{
+		CHECK(n == first + taken);
+		CHECK(frame->timestamp == (Vs_Timestamp)n);
+		frame->methods->unref(frame);
+		taken++;
+	}
+	return taken;
+}
+
+int main(void)
+{
+	Vs_Library vsynth = TestInit();
+	Vs_Filter clip = TestBlankclip(vsynth, 16, 16, LENGTH);
+	Vs_ActiveFilter active = TestActivate(vsynth, clip);
+	Vs_ActiveFilter unknown = TestNewProxy(active, 1);
+	struct TAG_Vs_ActiveFilterVirtual flaky_vtable;
+	Vs_ActiveFilter flaky;
+	Vs_FrameServer server;
+	Vs_Frame frame;
+
+	server = vsynth->FrameServer->Create(vsynth, unknown, 0, 4);
+	CHECK(Drain(vsynth, server, 0) == LENGTH);
+
+	// the end found above must not stick after seeking back
+	vsynth->FrameServer->Seek(server, 2);
+	CHECK(Drain(vsynth, server, 2) == LENGTH - 2);
+
+	// nor one found past the end
+	vsynth->FrameServer->Seek(server, LENGTH + 5);
+	frame = vsynth->FrameServer->Next(server, NULL);
+	CHECK(frame == NULL);
+	vsynth->FrameServer->Seek(server, 0);
+	CHECK(Drain(vsynth, server, 0) == LENGTH);
+
+	vsynth->FrameServer->Destroy(server);
+
+	// the failed frame ends the stream there, but only until seeking back
+	flaky_vtable = TestProxy_vtable;
+	flaky_vtable.get_frame = Flaky_get_frame;
+	flaky = TestNewProxy(active, 0);
+	flaky->methods = &flaky_vtable;
+	server = vsynth->FrameServer->Create(vsynth, flaky, 0, 1);
+	CHECK(Drain(vsynth, server, 0) == FLAKY_FRAME);
+	vsynth->FrameServer->Seek(server, 0);
+	CHECK(Drain(vsynth, server, 0) == LENGTH);
+	vsynth->FrameServer->Destroy(server);
+
+	flaky->methods->destroy(flaky);
+	unknown->methods->destroy(unknown);
+	active->methods->destroy(active);
+	clip->methods->unref(clip);
+	Vs_FreeLibrary(vsynth);
+	return TestResult();
+}
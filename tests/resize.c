@@ -0,0 +1,222 @@
+// This file is C99
+
+/*
+
+Resize: output sizes and timestamps, every kernel keeping flat frames flat,
+and frames of the requested size passed through untouched, unless the
+caller requires an alignment they miss, as cropped frames do.
+
+*/
+
+#include "testutil.h"
+
+
+#define RAW_PATH "test-resize.raw"
+#define RAW_SIZE (512 * 1024)
+#define FRAMES 4
+
+/// A rawsource of noise
+static Vs_Filter NewSource(Vs_Library vsynth, enum Vs_StdframePixelFormat pixfmt, long long width, long long height)
+{
+	Vs_Filter raw = TestNewFilter(vsynth, "rawsource");
+
+	TestSetString(vsynth, raw, "path", RAW_PATH);
+	TestSetString(vsynth, raw, "format", "raw");
+	raw->methods->set_property_int(raw, "width", width);
+	raw->methods->set_property_int(raw, "height", height);
+	raw->methods->set_property_int(raw, "pixfmt", pixfmt);
+	raw->methods->set_property_timestamp(raw, "framedur", 1);
+	return raw;
+}
+
+/// Resize a clip, taking over the reference to it
+static Vs_Filter NewResize(Vs_Library vsynth, Vs_Filter clip, long long width, long long height, const char *kernel)
+{
+	Vs_Filter resize = TestChain(vsynth, "resize", clip);
+
+	resize->methods->set_property_int(resize, "width", width);
+	resize->methods->set_property_int(resize, "height", height);
+	if (kernel != NULL)
+		TestSetString(vsynth, resize, "kernel", kernel);
+	return resize;
+}
+
+/// Non-zero if every sample of every plane matches the top left one
+static int IsFlat(Vs_Frame frame)
+{
+	Vs_StandardFrame sf = Vs_Stdframe_Get(frame);
+	size_t pixelsize = STDPIXFMT_pixelsize(sf->pixfmt);
+	size_t plane, x, y;
+
+	for (plane = 0; plane < STDPIXFMT_planecount(sf->pixfmt); plane++)
+	{
+		size_t width = (sf->width + STDPIXFMT_planewidthscale(sf->pixfmt, plane) - 1) / STDPIXFMT_planewidthscale(sf->pixfmt, plane);
+		size_t height = (sf->height + STDPIXFMT_planeheightscale(sf->pixfmt, plane) - 1) / STDPIXFMT_planeheightscale(sf->pixfmt, plane);
+		const unsigned char *first = sf->data[plane];
+
+		for (y = 0; y < height; y++)
+		{
+			const unsigned char *line = first + (ptrdiff_t)y * sf->stride[plane];
+			for (x = 0; x < width; x++)
+			{
+				if (memcmp(line + x * pixelsize, first, pixelsize) != 0)
+					return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+/// Sizes, frame counts and timestamps of scaled clips
+static void TestSizes(Vs_Library vsynth)
+{
+	static const long long sizes[][2] = { { 101, 37 }, { 7, 5 }, { 320, 3 }, { 1, 1 } };
+	Vs_Filter blank = TestBlankclip(vsynth, 64, 48, 5);
+	Vs_ActiveFilter reference = TestActivate(vsynth, blank);
+	size_t i;
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+	{
+		Vs_Filter resize = NewResize(vsynth, TestBlankclip(vsynth, 64, 48, 5), sizes[i][0], sizes[i][1], NULL);
+		Vs_ActiveFilter active = TestActivate(vsynth, resize);
+		Vs_FrameNumber n;
+
+		CHECK(active->methods->get_frame_count(active) == 5);
+		CHECK(active->methods->get_duration(active) == reference->methods->get_duration(reference));
+		for (n = 0; n < 5; n++)
+		{
+			Vs_Frame got = active->methods->get_frame(active, n);
+			Vs_Frame expected = reference->methods->get_frame(reference, n);
+
+			CHECK(got != NULL);
+			if (got == NULL)
+				break;
+			CHECK(Vs_Stdframe_Get(got)->width == (size_t)sizes[i][0]);
+			CHECK(Vs_Stdframe_Get(got)->height == (size_t)sizes[i][1]);
+			CHECK(got->timestamp == expected->timestamp);
+			got->methods->unref(got);
+			expected->methods->unref(expected);
+		}
+		active->methods->destroy(active);
+		resize->methods->unref(resize);
+	}
+	reference->methods->destroy(reference);
+	blank->methods->unref(blank);
+}
+
+/// Flat frames stay flat through every kernel, up and down, 8 and 16 bits
+static void TestFlat(Vs_Library vsynth)
+{
+	static const char *kernels[] = { "bilinear", "bicubic", "lanczos" };
+	static const enum Vs_StdframePixelFormat pixfmts[] = { STDPIXFMT_YCrCb8_420, STDPIXFMT_YCrCb16_420, STDPIXFMT_XRGB8, STDPIXFMT_ARGB16 };
+	static const long long sizes[][2] = { { 131, 77 }, { 23, 9 } };
+	size_t k, p, s;
+
+	for (k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++)
+	for (p = 0; p < sizeof(pixfmts) / sizeof(pixfmts[0]); p++)
+	for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+	{
+		Vs_Filter blank = TestBlankclip(vsynth, 64, 48, 1);
+		Vs_Filter convert, resize;
+		Vs_ActiveFilter active;
+		Vs_Frame frame;
+
+		blank->methods->set_property_int(blank, "color", 0xC0306090);
+		convert = TestChain(vsynth, "convert", blank);
+		convert->methods->set_property_int(convert, "pixfmt", pixfmts[p]);
+		resize = NewResize(vsynth, convert, sizes[s][0], sizes[s][1], kernels[k]);
+		active = TestActivate(vsynth, resize);
+		frame = active->methods->get_frame(active, 0);
+		CHECK(frame != NULL && Vs_Stdframe_Get(frame)->pixfmt == pixfmts[p]);
+		if (frame != NULL && !CHECK(IsFlat(frame)))
+			fprintf(stderr, "  kernel %s, pixfmt %d, %lldx%lld\n", kernels[k], (int)pixfmts[p], sizes[s][0], sizes[s][1]);
+		if (frame != NULL)
+			frame->methods->unref(frame);
+		active->methods->destroy(active);
+		resize->methods->unref(resize);
+	}
+}
+
+/// Frames of the output size are passed through when their layout will do
+static void TestPassThrough(Vs_Library vsynth)
+{
+	Vs_Filter raw = NewSource(vsynth, STDPIXFMT_MONO8, 64, 32);
+	Vs_ActiveFilter reference = TestActivate(vsynth, raw);
+	Vs_Filter resize = NewResize(vsynth, NewSource(vsynth, STDPIXFMT_MONO8, 64, 32), 64, 32, NULL);
+	Vs_ActiveFilter active = TestActivate(vsynth, resize);
+	Vs_FrameNumber n;
+
+	for (n = 0; n < FRAMES; n++)
+	{
+		Vs_Frame got = active->methods->get_frame(active, n);
+		Vs_Frame expected = reference->methods->get_frame(reference, n);
+
+		CHECK(got != NULL && expected != NULL);
+		if (got == NULL || expected == NULL)
+			break;
+		// still wrapping the mapped file rather than a copy of it
+		CHECK(Vs_Stdframe_Get(expected)->data_baseptr == NULL);
+		CHECK(Vs_Stdframe_Get(got)->data_baseptr == NULL);
+		CHECK(TestSameFrame(got, expected));
+		got->methods->unref(got);
+		expected->methods->unref(expected);
+	}
+	active->methods->destroy(active);
+	resize->methods->unref(resize);
+	reference->methods->destroy(reference);
+	raw->methods->unref(raw);
+}
+
+/// A crop feeding a resize to the size it already has, for a caller requiring aligned planes
+static void TestCropSameSize(Vs_Library vsynth, enum Vs_StdframePixelFormat pixfmt)
+{
+	Vs_Filter crop = TestChain(vsynth, "crop", NewSource(vsynth, pixfmt, 70, 40));
+	Vs_Filter resize;
+	Vs_ActiveFilter reference, active;
+	Vs_FrameNumber n;
+
+	crop->methods->set_property_int(crop, "left", 2);
+	crop->methods->set_property_int(crop, "top", 2);
+	crop->methods->set_property_int(crop, "right", 4);
+	reference = TestActivate(vsynth, crop);
+	crop->methods->addref(crop);
+	resize = NewResize(vsynth, crop, 64, 38, NULL);
+	active = TestActivateAligned(vsynth, resize, 64);
+
+	for (n = 0; n < FRAMES; n++)
+	{
+		Vs_Frame got = active->methods->get_frame(active, n);
+		Vs_Frame expected = reference->methods->get_frame(reference, n);
+
+		CHECK(got != NULL && expected != NULL);
+		if (got == NULL || expected == NULL)
+			break;
+		// the cropped frame itself is off alignment, so it must not come through
+		CHECK(!TestAligned(expected, 64));
+		CHECK(TestAligned(got, 64));
+		CHECK(TestSameFrame(got, expected));
+		got->methods->unref(got);
+		expected->methods->unref(expected);
+	}
+	active->methods->destroy(active);
+	resize->methods->unref(resize);
+	reference->methods->destroy(reference);
+	crop->methods->unref(crop);
+}
+
+int main(void)
+{
+	Vs_Library vsynth = TestInit();
+
+	TestWriteNoise(RAW_PATH, RAW_SIZE);
+	TestSizes(vsynth);
+	TestFlat(vsynth);
+	TestPassThrough(vsynth);
+	TestCropSameSize(vsynth, STDPIXFMT_YCrCb8_420);
+	TestCropSameSize(vsynth, STDPIXFMT_YCrCb16_420);
+	TestCropSameSize(vsynth, STDPIXFMT_MONO8);
+
+	Vs_FreeLibrary(vsynth);
+	remove(RAW_PATH);
+	return TestResult();
+}
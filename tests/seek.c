@@ -0,0 +1,294 @@
+// This file is C99
+
+/*
+
+Finding frames by timestamp. Every filter implementing frame_at_timestamp,
+and the caches forwarding it, must agree with the library's search over
+get_frame, which is what filters without the method get, and both must agree
+with a linear scan over the frames, on constant and variable frame rates and
+with the stream length known or not. Also the timestamp index on its own,
+across block boundaries and offset widths, and seeks across the joins of
+segments whose first frames start late.
+
+*/
+
+#include "testutil.h"
+
+
+#define RAW_PATH "test-seek.raw"
+#define TIMECODES_PATH "test-seek.txt"
+#define LATE_TIMECODES_PATH "test-seek-late.txt"
+#define RAW_FRAMES 70
+
+#define MAX_FRAMES 100
+
+/// Frame shown at time t by a linear scan, as Seek::FrameAtTimestamp defines it
+static Vs_FrameNumber ScanFrames(const Vs_Timestamp *stamps, Vs_FrameNumber count, Vs_Timestamp duration, Vs_Timestamp t)
+{
+	Vs_FrameNumber n, found = FRAMENUMBER_NONE;
+
+	if (t >= duration)
+		return FRAMENUMBER_NONE;
+	for (n = 0; n < count; n++)
+	{
+		if (stamps[n] <= t)
+			found = n;
+	}
+	return found;
+}
+
+/// Check a filter against the search and the scan at every tick of its duration and a bit past
+static void CheckSeek(Vs_Library vsynth, const char *name, Vs_ActiveFilter filter)
+{
+	Vs_ActiveFilter searched = TestNewProxy(filter, 0);
+	Vs_ActiveFilter unbounded = TestNewProxy(filter, 1);
+	Vs_Timestamp duration = filter->methods->get_duration(filter);
+	Vs_Timestamp stamps[MAX_FRAMES];
+	Vs_FrameNumber count, expected, got;
+	Vs_Frame frame;
+	Vs_Timestamp t;
+
+	CHECK(duration != DURATION_UNKNOWN);
+	for (count = 0; count < MAX_FRAMES && (frame = filter->methods->get_frame(filter, count)) != NULL; count++)
+	{
+		stamps[count] = frame->timestamp;
+		frame->methods->unref(frame);
+	}
+	CHECK(count > 1 && count == filter->methods->get_frame_count(filter));
+
+	for (t = 0; t < duration + 3; t++)
+	{
+		expected = ScanFrames(stamps, count, duration, t);
+		got = vsynth->Seek->FrameAtTimestamp(vsynth, filter, t);
+		if (!CHECK(got == expected))
+			fprintf(stderr, "  %s at %llu: %lld, expected %lld\n", name, t, (long long)got, (long long)expected);
+		CHECK(vsynth->Seek->FrameAtTimestamp(vsynth, searched, t) == expected);
+		// without a known end the search can't tell t is past the last frame
+		if (t < duration)
+			CHECK(vsynth->Seek->FrameAtTimestamp(vsynth, unbounded, t) == expected);
+	}
+
+	searched->methods->destroy(searched);
+	unbounded->methods->destroy(unbounded);
+}
+
+static void WriteVfrSource(void)
+{
+	FILE *f;
+	int i;
+
+	f = fopen(RAW_PATH, "wb");
+	for (i = 0; i < RAW_FRAMES * 4 * 4; i++)
+		fputc(i & 0xFF, f);
+	fclose(f);
+
+	// irregular durations, with a comment and a blank line to skip
+	f = fopen(TIMECODES_PATH, "w");
+	fprintf(f, "# timecode format v2\n# comment\n\n");
+	for (i = 0; i < RAW_FRAMES; i++)
+		fprintf(f, "%d\n", i * 10 + (i % 3) * 3 + (i / 20) * 300);
+	fclose(f);
+
+	// the first frame starting after 0
+	f = fopen(LATE_TIMECODES_PATH, "w");
+	fprintf(f, "# timecode format v2\n");
+	for (i = 0; i < RAW_FRAMES; i++)
+		fprintf(f, "%d\n", 25 + i * 10);
+	fclose(f);
+}
+
+/// Concatenate segments whose first frame starts after their start time
+///
+/// Before the first frame of a segment the frame before it is still shown,
+/// and before the first frame of all the first one.
+static void CheckLateJoins(Vs_Library vsynth, Vs_Filter late)
+{
+	Vs_Filter segment = TestNewFilter(vsynth, "trim");
+	Vs_Filter pair = TestNewFilter(vsynth, "concat");
+	Vs_Filter joined = TestNewFilter(vsynth, "concat");
+	Vs_ActiveFilter active;
+	Vs_Timestamp stamps[MAX_FRAMES];
+	Vs_Timestamp duration, t;
+	Vs_FrameNumber count, expected, got;
+	Vs_Frame frame;
+
+	// a trim from frame 0 keeps the first timestamp
+	segment->methods->set_property_filter(segment, "clip", late);
+	segment->methods->set_property_framenumber(segment, "length", 6);
+	pair->methods->set_property_filter(pair, "clip1", segment);
+	pair->methods->set_property_filter(pair, "clip2", segment);
+	joined->methods->set_property_filter(joined, "clip1", pair);
+	joined->methods->set_property_filter(joined, "clip2", segment);
+	active = TestActivate(vsynth, joined);
+
+	duration = active->methods->get_duration(active);
+	for (count = 0; count < MAX_FRAMES && (frame = active->methods->get_frame(active, count)) != NULL; count++)
+	{
+		stamps[count] = frame->timestamp;
+		frame->methods->unref(frame);
+	}
+	CHECK(count == 18 && stamps[0] == 25 && duration == 3 * 85);
+	CHECK(stamps[6] == 85 + 25 && stamps[12] == 2 * 85 + 25);
+
+	for (t = 0; t < duration + 3; t++)
+	{
+		expected = ScanFrames(stamps, count, duration, t);
+		if (expected == FRAMENUMBER_NONE && t < duration)
+			expected = 0;
+		got = vsynth->Seek->FrameAtTimestamp(vsynth, active, t);
+		if (!CHECK(got == expected))
+			fprintf(stderr, "  late joins at %llu: %lld, expected %lld\n", t, (long long)got, (long long)expected);
+	}
+
+	active->methods->destroy(active);
+	segment->methods->unref(segment);
+	pair->methods->unref(pair);
+	joined->methods->unref(joined);
+}
+
+static void CheckIndex(Vs_Library vsynth)
+{
+	Vs_TimestampIndex index = vsynth->Seek->NewIndex(vsynth);
+	Vs_Timestamp stamps[300];
+	Vs_FrameNumber n, expected;
+	Vs_Timestamp t;
+
+	// blocks needing one, two, four and eight bytes per offset
+	t = 5;
+	for (n = 0; n < 300; n++)
+	{
+		stamps[n] = t;
+		CHECK(vsynth->Seek->IndexAppend(index, t));
+		if (n < 64)
+			t += 1 + n % 3;
+		else if (n < 128)
+			t += 1000;
+		else if (n < 192)
+			t += 100000000;
+		else
+			t += (Vs_Timestamp)1 << 40;
+	}
+	CHECK(vsynth->Seek->IndexCount(index) == 300);
+	// timestamps must increase
+	CHECK(!vsynth->Seek->IndexAppend(index, stamps[299]));
+	CHECK(vsynth->Seek->IndexCount(index) == 300);
+
+	for (n = 0; n < 300; n++)
+		CHECK(vsynth->Seek->IndexGet(index, n) == stamps[n]);
+	CHECK(vsynth->Seek->IndexFind(index, 4) == FRAMENUMBER_NONE);
+	for (n = 0; n < 300; n++)
+	{
+		CHECK(vsynth->Seek->IndexFind(index, stamps[n]) == n);
+		if (n + 1 < 300 && stamps[n + 1] == stamps[n] + 1)
+			expected = n + 1;
+		else
+			expected = n;
+		CHECK(vsynth->Seek->IndexFind(index, stamps[n] + 1) == expected);
+	}
+
+	vsynth->Seek->FreeIndex(index);
+}
+
+int main(void)
+{
+	Vs_Library vsynth = TestInit();
+	Vs_Filter blank[3], joined, vfr_joined, raw, late, trimmed, resized, cropped, converted;
+	Vs_ActiveFilter active, cached;
+	struct {
+		const char *name;
+		Vs_Filter filter;
+	} cases[7];
+	size_t i, case_count = 0;
+
+	CheckIndex(vsynth);
+
+	// constant rates of different durations, concatenated into a variable one
+	blank[0] = TestBlankclip(vsynth, 8, 8, 5);
+	blank[1] = TestBlankclip(vsynth, 8, 8, 4);
+	blank[1]->methods->set_property_timestamp(blank[1], "framedur", 7);
+	blank[2] = TestBlankclip(vsynth, 8, 8, 6);
+	blank[2]->methods->set_property_timestamp(blank[2], "framedur", 3);
+	joined = TestNewFilter(vsynth, "concat");
+	joined->methods->set_property_filter(joined, "clip1", blank[0]);
+	joined->methods->set_property_filter(joined, "clip2", blank[1]);
+	vfr_joined = TestNewFilter(vsynth, "concat");
+	vfr_joined->methods->set_property_filter(vfr_joined, "clip1", joined);
+	vfr_joined->methods->set_property_filter(vfr_joined, "clip2", blank[2]);
+
+	trimmed = TestNewFilter(vsynth, "trim");
+	trimmed->methods->set_property_filter(trimmed, "clip", vfr_joined);
+	trimmed->methods->set_property_framenumber(trimmed, "start", 3);
+	trimmed->methods->set_property_framenumber(trimmed, "length", 9);
+
+	WriteVfrSource();
+	raw = TestNewFilter(vsynth, "rawsource");
+	TestSetString(vsynth, raw, "path", RAW_PATH);
+	TestSetString(vsynth, raw, "timecodes", TIMECODES_PATH);
+	raw->methods->set_property_int(raw, "width", 4);
+	raw->methods->set_property_int(raw, "height", 4);
+	raw->methods->set_property_int(raw, "pixfmt", STDPIXFMT_MONO8);
+	raw->methods->set_property_int(raw, "timescale", 1000);
+	raw->methods->addref(raw);
+	resized = TestChain(vsynth, "resize", raw);
+	resized->methods->set_property_int(resized, "width", 2);
+	resized->methods->set_property_int(resized, "height", 2);
+	raw->methods->addref(raw);
+	cropped = TestChain(vsynth, "crop", raw);
+	cropped->methods->set_property_int(cropped, "width", 2);
+	cropped->methods->set_property_int(cropped, "height", 2);
+	raw->methods->addref(raw);
+	converted = TestChain(vsynth, "convert", raw);
+	converted->methods->set_property_int(converted, "pixfmt", STDPIXFMT_YCrCb8_444);
+
+	cases[case_count].name = "blankclip";
+	cases[case_count++].filter = blank[1];
+	cases[case_count].name = "concat";
+	cases[case_count++].filter = vfr_joined;
+	cases[case_count].name = "trim";
+	cases[case_count++].filter = trimmed;
+	cases[case_count].name = "rawsource";
+	cases[case_count++].filter = raw;
+	cases[case_count].name = "resize";
+	cases[case_count++].filter = resized;
+	cases[case_count].name = "crop";
+	cases[case_count++].filter = cropped;
+	cases[case_count].name = "convert";
+	cases[case_count++].filter = converted;
+
+	for (i = 0; i < case_count; i++)
+	{
+		active = TestActivate(vsynth, cases[i].filter);
+		CheckSeek(vsynth, cases[i].name, active);
+		active->methods->destroy(active);
+	}
+
+	// caches forward it
+	cached = vsynth->Cache->Wrap(vsynth, TestActivate(vsynth, raw));
+	CheckSeek(vsynth, "cache", cached);
+	cached->methods->destroy(cached);
+
+	late = TestNewFilter(vsynth, "rawsource");
+	TestSetString(vsynth, late, "path", RAW_PATH);
+	TestSetString(vsynth, late, "timecodes", LATE_TIMECODES_PATH);
+	late->methods->set_property_int(late, "width", 4);
+	late->methods->set_property_int(late, "height", 4);
+	late->methods->set_property_int(late, "pixfmt", STDPIXFMT_MONO8);
+	late->methods->set_property_int(late, "timescale", 1000);
+	CheckLateJoins(vsynth, late);
+	late->methods->unref(late);
+
+	for (i = 0; i < 3; i++)
+		blank[i]->methods->unref(blank[i]);
+	joined->methods->unref(joined);
+	for (i = 0; i < case_count; i++)
+	{
+		if (cases[i].filter != blank[1] && cases[i].filter != vfr_joined)
+			cases[i].filter->methods->unref(cases[i].filter);
+	}
+	vfr_joined->methods->unref(vfr_joined);
+	remove(RAW_PATH);
+	remove(TIMECODES_PATH);
+	remove(LATE_TIMECODES_PATH);
+	Vs_FreeLibrary(vsynth);
+	return TestResult();
+}
@@ -0,0 +1,114 @@
+// This file is C99
+
+/*
+
+Sharing active filters between identical subgraphs: identical chains built
+separately get one active instance, which lives as long as any handle to it,
+different chains don't, nesting doesn't matter, and shared frames are the frames an unshared
+activation produces.
+
+*/
+
+#include "testutil.h"
+
+
+#define LENGTH 8
+
+VSYNTH_IMPLEMENT_METHOD(void, CountLive)(const Vs_FilterProfile *profile, void *userdata)
+{
+	if (profile->filter != NULL)
+		(*(int *)userdata)++;
+}
+
+/// Number of profiled active filters not yet destroyed
+static int LiveFilters(Vs_Library vsynth)
+{
+	int live = 0;
+	vsynth->Profile->Enumerate(vsynth, CountLive, &live);
+	return live;
+}
+
+static Vs_Filter NewChain(Vs_Library vsynth, Vs_FrameNumber length)
+{
+	Vs_Filter clip = TestChain(vsynth, "convert", TestBlankclip(vsynth, 64, 24, length));
+	clip->methods->set_property_int(clip, "pixfmt", STDPIXFMT_YCrCb16_444);
+	return clip;
+}
+
+/// Check every frame of two active filters is the same
+static void CheckSameFrames(Vs_ActiveFilter a, Vs_ActiveFilter b, Vs_FrameNumber length)
+{
+	Vs_Frame x, y;
+	Vs_FrameNumber n;
+
+	CHECK(a->methods->get_frame_count(a) == b->methods->get_frame_count(b));
+	for (n = 0; n < length; n++)
+	{
+		x = a->methods->get_frame(a, n);
+		y = b->methods->get_frame(b, n);
+		CHECK(x != NULL && y != NULL && TestSameFrame(x, y));
+		if (x != NULL)
+			x->methods->unref(x);
+		if (y != NULL)
+			y->methods->unref(y);
+	}
+}
+
+int main(void)
+{
+	Vs_Library vsynth = TestInit();
+	Vs_Filter a = NewChain(vsynth, LENGTH), b = NewChain(vsynth, LENGTH), c = NewChain(vsynth, LENGTH + 2);
+	Vs_Filter both = TestNewFilter(vsynth, "concat");
+	Vs_ActiveFilter first, second, other, joined, reference, joined_reference;
+	int live;
+
+	vsynth->Profile->SetEnabled(vsynth, 1);
+
+	// a and b are built separately but are identical, c differs in a property
+	first = TestActivate(vsynth, a);
+	live = LiveFilters(vsynth);
+	CHECK(live == 2);
+	second = TestActivate(vsynth, b);
+	CHECK(LiveFilters(vsynth) == live);
+	other = TestActivate(vsynth, c);
+	CHECK(LiveFilters(vsynth) == live + 2);
+
+	vsynth->Graph->SetSharing(vsynth, 0);
+	reference = TestActivate(vsynth, a);
+	vsynth->Graph->SetSharing(vsynth, 1);
+	CheckSameFrames(first, reference, LENGTH);
+	CheckSameFrames(second, reference, LENGTH);
+
+	// the shared instance outlives the handle it was made for
+	live = LiveFilters(vsynth);
+	first->methods->destroy(first);
+	CHECK(LiveFilters(vsynth) == live);
+	CheckSameFrames(second, reference, LENGTH);
+	second->methods->destroy(second);
+	CHECK(LiveFilters(vsynth) == live - 2);
+
+	// an input activated by another filter is shared with a top level activation
+	both->methods->set_property_filter(both, "clip1", a);
+	both->methods->set_property_filter(both, "clip2", c);
+	joined = TestActivate(vsynth, both);
+	live = LiveFilters(vsynth);
+	first = TestActivate(vsynth, b);
+	CHECK(LiveFilters(vsynth) == live);
+	CheckSameFrames(first, reference, LENGTH);
+	first->methods->destroy(first);
+	vsynth->Graph->SetSharing(vsynth, 0);
+	joined_reference = TestActivate(vsynth, both);
+	vsynth->Graph->SetSharing(vsynth, 1);
+	CheckSameFrames(joined, joined_reference, LENGTH * 2);
+
+	joined->methods->destroy(joined);
+	joined_reference->methods->destroy(joined_reference);
+	reference->methods->destroy(reference);
+	other->methods->destroy(other);
+	a->methods->unref(a);
+	b->methods->unref(b);
+	c->methods->unref(c);
+	both->methods->unref(both);
+	Vs_FreeLibrary(vsynth);
+	return TestResult();
+}
@@ -0,0 +1,252 @@
+// This file is C99
+
+/*
+
+Helpers shared by the tests. Every test is a plain program that loads the
+plugins built alongside it, runs its checks, reports each failed one on
+stderr and exits non-zero if any failed.
+
+*/
+
+#ifndef VSYNTH_TESTUTIL_H
+#define VSYNTH_TESTUTIL_H
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <vsynth/vsynth.h>
+#include <vsynth/stdframe.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+
+#include "test-plugins.h"
+
+
+static int test_failures;
+
+/// Record a failure if cond is false, and evaluate to cond
+#define CHECK(cond) TestCheck((cond) != 0, #cond, __FILE__, __LINE__)
+
+static VSYNTH_INLINE int TestCheck(int ok, const char *text, const char *file, int line)
+{
+	if (!ok)
+	{
+		fprintf(stderr, "%s:%d: check failed: %s\n", file, line, text);
+		test_failures++;
+	}
+	return ok;
+}
+
+/// Exit status for main
+static VSYNTH_INLINE int TestResult(void)
+{
+	return test_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/// Create a library with all the plugins built alongside the tests loaded
+static VSYNTH_INLINE Vs_Library TestInit(void)
+{
+	Vs_Library vsynth = Vs_InitLibrary();
+	Vs_PluginInitFunc init;
+	void *module;
+	size_t i;
+
+	for (i = 0; test_plugins[i] != NULL; i++)
+	{
+		module = dlopen(test_plugins[i], RTLD_NOW | RTLD_LOCAL);
+		if (module == NULL)
+		{
+			fprintf(stderr, "%s\n", dlerror());
+			exit(EXIT_FAILURE);
+		}
+		*(void **)&init = dlsym(module, "Vs_PluginInit");
+		if (init == NULL)
+		{
+			fprintf(stderr, "%s has no Vs_PluginInit\n", test_plugins[i]);
+			exit(EXIT_FAILURE);
+		}
+		init(vsynth);
+	}
+	return vsynth;
+}
+
+/// Create a filter of a registered type, exits if there is no such type
+static VSYNTH_INLINE Vs_Filter TestNewFilter(Vs_Library vsynth, const char *name)
+{
+	Vs_FilterFactory *factory = vsynth->FilterRegistry->Find(vsynth, name);
+
+	if (factory == NULL)
+	{
+		fprintf(stderr, "no filter named %s\n", name);
+		exit(EXIT_FAILURE);
+	}
+	return factory->produce(vsynth);
+}
+
+static VSYNTH_INLINE void TestSetString(Vs_Library vsynth, Vs_Filter filter, const char *name, const char *value)
+{
+	Vs_String str = vsynth->String->Make(value);
+	filter->methods->set_property_string(filter, name, str);
+	vsynth->String->Free(str);
+}
+
+/// A blankclip of the given size, one tick per frame
+static VSYNTH_INLINE Vs_Filter TestBlankclip(Vs_Library vsynth, long long width, long long height, Vs_FrameNumber length)
+{
+	Vs_Filter blank = TestNewFilter(vsynth, "blankclip");
+	blank->methods->set_property_int(blank, "width", width);
+	blank->methods->set_property_int(blank, "height", height);
+	blank->methods->set_property_timestamp(blank, "framedur", 1);
+	blank->methods->set_property_framenumber(blank, "length", length);
+	return blank;
+}
+
+/// Take clip, which loses a reference, through a filter with a clip property
+static VSYNTH_INLINE Vs_Filter TestChain(Vs_Library vsynth, const char *name, Vs_Filter clip)
+{
+	Vs_Filter filter = TestNewFilter(vsynth, name);
+	filter->methods->set_property_filter(filter, "clip", clip);
+	clip->methods->unref(clip);
+	return filter;
+}
+
+/// Activate a filter producing stdframes with planes aligned to alignment, exits on failure
+static VSYNTH_INLINE Vs_ActiveFilter TestActivateAligned(Vs_Library vsynth, Vs_Filter filter, size_t alignment)
+{
+	struct Vs_StandardFrameTypeDescription ftd;
+	Vs_FrameTypeDescription *ftds[2] = { &ftd.base, NULL };
+	Vs_String error = NULL;
+	Vs_ActiveFilter active;
+
+	Vs_Stdframe_InitFTD(&ftd);
+	ftd.alignment = alignment;
+	active = vsynth->Graph->Activate(vsynth, filter, &error, ftds);
+	if (active == NULL)
+	{
+		fprintf(stderr, "activation failed: %s\n", error != NULL ? error->str : "no error given");
+		exit(EXIT_FAILURE);
+	}
+	return active;
+}
+
+/// Activate a filter producing stdframes, exits on failure
+static VSYNTH_INLINE Vs_ActiveFilter TestActivate(Vs_Library vsynth, Vs_Filter filter)
+{
+	return TestActivateAligned(vsynth, filter, 0);
+}
+
+/// Active filter forwarding get_frame to another, implementing nothing optional
+///
+/// With hide_length set it also reports an unknown frame count and duration,
+/// like a source that can't tell its length up front.
+struct TestProxy {
+	struct TAG_Vs_ActiveFilter base;
+	Vs_ActiveFilter upstream;
+	int hide_length;
+};
+
+VSYNTH_IMPLEMENT_METHOD(void, TestProxy_destroy)(Vs_ActiveFilter filter)
+{
+	// the upstream filter stays with the caller
+	free(filter);
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Frame, TestProxy_get_frame)(Vs_ActiveFilter filter, Vs_FrameNumber n)
+{
+	struct TestProxy *proxy = (struct TestProxy *)filter;
+	return proxy->upstream->methods->get_frame(proxy->upstream, n);
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_FrameNumber, TestProxy_get_frame_count)(Vs_ActiveFilter filter)
+{
+	struct TestProxy *proxy = (struct TestProxy *)filter;
+	if (proxy->hide_length)
+		return FRAMECOUNT_UNKNOWN;
+	return proxy->upstream->methods->get_frame_count(proxy->upstream);
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Timestamp, TestProxy_get_duration)(Vs_ActiveFilter filter)
+{
+	struct TestProxy *proxy = (struct TestProxy *)filter;
+	if (proxy->hide_length)
+		return DURATION_UNKNOWN;
+	return proxy->upstream->methods->get_duration(proxy->upstream);
+}
+
+static struct TAG_Vs_ActiveFilterVirtual TestProxy_vtable = {
+	TestProxy_destroy,
+	TestProxy_get_frame,
+	TestProxy_get_frame_count,
+	TestProxy_get_duration,
+	NULL,
+	NULL
+};
+
+static VSYNTH_INLINE Vs_ActiveFilter TestNewProxy(Vs_ActiveFilter upstream, int hide_length)
+{
+	struct TestProxy *proxy = (struct TestProxy *)malloc(sizeof(struct TestProxy));
+	proxy->base.methods = &TestProxy_vtable;
+	proxy->upstream = upstream;
+	proxy->hide_length = hide_length;
+	return &proxy->base;
+}
+
+/// Non-zero if every plane of a stdframe starts and strides at multiples of alignment
+static VSYNTH_INLINE int TestAligned(Vs_Frame frame, size_t alignment)
+{
+	Vs_StandardFrame sf = Vs_Stdframe_Get(frame);
+	size_t plane;
+
+	for (plane = 0; plane < STDPIXFMT_planecount(sf->pixfmt); plane++)
+	{
+		if ((size_t)sf->data[plane] % alignment != 0 || (size_t)sf->stride[plane] % alignment != 0)
+			return 0;
+	}
+	return 1;
+}
+
+/// Write a file of noisy gradients with jumps, for sources with real content
+static VSYNTH_INLINE void TestWriteNoise(const char *path, long size)
+{
+	FILE *f = fopen(path, "wb");
+	unsigned int seed = 12345, v = 0;
+	long i;
+
+	for (i = 0; i < size; i++)
+	{
+		seed = seed * 1103515245u + 12345u;
+		if (i % 97 == 0)
+			v = seed >> 24;
+		v = (v + ((seed >> 16) % 7) - 3) & 0xFF;
+		fputc((int)v, f);
+	}
+	fclose(f);
+}
+
+/// Non-zero if two stdframes have the same format, timestamp and pixels
+static VSYNTH_INLINE int TestSameFrame(Vs_Frame a, Vs_Frame b)
+{
+	Vs_StandardFrame x = Vs_Stdframe_Get(a), y = Vs_Stdframe_Get(b);
+	size_t plane, row, width, height, ws, hs;
+
+	if (x == NULL || y == NULL)
+		return 0;
+	if (a->timestamp != b->timestamp || x->pixfmt != y->pixfmt || x->width != y->width || x->height != y->height)
+		return 0;
+	for (plane = 0; plane < STDPIXFMT_planecount(x->pixfmt); plane++)
+	{
+		ws = STDPIXFMT_planewidthscale(x->pixfmt, plane);
+		hs = STDPIXFMT_planeheightscale(x->pixfmt, plane);
+		width = (x->width + ws - 1) / ws * STDPIXFMT_pixelsize(x->pixfmt);
+		height = (x->height + hs - 1) / hs;
+		for (row = 0; row < height; row++)
+		{
+			if (memcmp((const char *)x->data[plane] + row * x->stride[plane], (const char *)y->data[plane] + row * y->stride[plane], width) != 0)
+				return 0;
+		}
+	}
+	return 1;
+}
+
+#endif
@@ -0,0 +1,1014 @@
+// This file is C99
+
+/*
+
+vsynth-bench times the stdframe primitives, the filter registry and whole
+filter chains, and reports the results as a table or as JSON.
+
+Every benchmark runs an operation in batches, sized so a batch takes long
+enough to time reliably, and records the time per operation of every
+batch. The statistics are over those samples. Chain benchmarks pull one
+frame per operation, so their samples are single frame times. With
+--profile, chains are activated with profiling enabled and the library's
+per-filter counters are reported along with them. With --output, each chain
+is also written to a file through the stdlib sink, one operation per frame.
+With --optimize, chains go through the library's graph optimizer before they
+are activated.
+
+Plugins are loaded from the paths given with --plugin, or from the plugins
+built alongside the tool if there are none.
+
+*/
+
+#ifndef _WIN32
+# define _POSIX_C_SOURCE 200112L
+#endif
+
+#include <vsynth/vsynth.h>
+#include <vsynth/stdframe.h>
+#include <vsynth/stdsink.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#ifdef _WIN32
+# define WIN32_LEAN_AND_MEAN
+# include <Windows.h>
+#else
+# include <dlfcn.h>
+# include <time.h>
+#endif
+
+#include "bench-plugins.h"
+
+
+#define BENCH_VERSION 1
+
+/// Minimum time of one batch of operations
+#define MIN_BATCH_NS 50000.0
+/// Maximum number of filters in a chain
+#define MAX_CHAIN_STEPS 64
+
+static const char *pixfmt_names[STDPIXFMT_MAX] = {
+	"MONO8", "MONO16",
+	"XRGB8", "ARGB8", "XRGB16", "ARGB16",
+	"YCrCb8_444", "YCrCbA8_444", "YCrCb16_444", "YCrCbA16_444",
+	"YCrCb8_422", "YCrCbA8_422", "YCrCb16_422", "YCrCbA16_422",
+	"YCrCb8_420", "YCrCbA8_420", "YCrCb16_420", "YCrCbA16_420"
+};
+
+static const struct {
+	size_t width;
+	size_t height;
+} resolutions[] = {
+	{ 640, 360 },
+	{ 1920, 1080 },
+	{ 3840, 2160 }
+};
+
+/// Chains benchmarked by default, %llu is replaced by the frame count
+static const char *default_chains[] = {
+	"blankclip width=1920 height=1080 framedur=1000 length=%llu",
+	"blankclip width=1920 height=1080 framedur=1000 length=%llu | convert pixfmt=XRGB8 | convert pixfmt=YCrCb8_420",
+	"blankclip width=3840 height=2160 framedur=1000 length=%llu | convert pixfmt=YCrCb8_420 | resize width=960 height=540 kernel=bicubic",
+	"blankclip width=3840 height=2160 framedur=1000 length=%llu | convert pixfmt=YCrCb8_420 | resize width=960 height=540 kernel=lanczos",
+	NULL
+};
+
+
+/*
+	Options and results
+*/
+
+struct Options {
+	/// Number of timed batches per benchmark
+	size_t samples;
+	/// Number of frames pulled per chain
+	unsigned long long frames;
+	/// Worker threads, 0 for the library default
+	unsigned int threads;
+	/// Only run benchmarks whose name contains this
+	const char *match;
+	/// Where to write JSON results, "-" for stdout, NULL for none
+	const char *json;
+	const char **plugins;
+	size_t plugin_count;
+	const char **chains;
+	size_t chain_count;
+	/// Report per-filter counters for chains
+	int profile;
+	/// File chains are written to by the sink benchmarks, NULL for none
+	const char *output;
+	/// Optimize chains before activating them
+	int optimize;
+};
+
+/// Profile counters of one filter of a chain
+struct FilterResult {
+	const char *name;
+	Vs_FilterProfile profile;
+};
+
+struct Result {
+	char *name;
+	unsigned long long ops;
+	double mean_ns;
+	double min_ns;
+	double p50_ns;
+	double p90_ns;
+	double p99_ns;
+	double max_ns;
+	/// Bytes of frame memory per operation, negative if not applicable
+	double bytes;
+	/// Frame pool allocations during the benchmark, for chains
+	unsigned long long pool_hits;
+	unsigned long long pool_misses;
+	/// Per-filter counters, for chains run with --profile
+	struct FilterResult *filters;
+	size_t filter_count;
+};
+
+/// Filters of a chain, for naming them in profiles
+struct ChainSteps {
+	Vs_Filter filters[MAX_CHAIN_STEPS];
+	const char *names[MAX_CHAIN_STEPS];
+	size_t count;
+};
+
+static struct Options options;
+static struct Result *results;
+static size_t result_count;
+static size_t result_capacity;
+static int table_output;
+
+
+static unsigned long long NowNs(void)
+{
+#ifdef _WIN32
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER count;
+	if (freq.QuadPart == 0)
+		QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+	return (unsigned long long)((double)count.QuadPart * 1e9 / (double)freq.QuadPart);
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ull + (unsigned long long)ts.tv_nsec;
+#endif
+}
+
+static char *CopyString(const char *str)
+{
+	size_t len = strlen(str);
+	char *copy = (char *)malloc(len + 1);
+	if (copy == NULL)
+	{
+		fprintf(stderr, "vsynth-bench: out of memory\n");
+		exit(1);
+	}
+	memcpy(copy, str, len + 1);
+	return copy;
+}
+
+static int CompareDoubles(const void *a, const void *b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
+
+/// Nearest rank percentile of sorted samples
+static double Percentile(const double *sorted, size_t count, double p)
+{
+	size_t rank = (size_t)ceil(p / 100.0 * count);
+	if (rank < 1)
+		rank = 1;
+	if (rank > count)
+		rank = count;
+	return sorted[rank - 1];
+}
+
+static int Selected(const char *name)
+{
+	return options.match == NULL || strstr(name, options.match) != NULL;
+}
+
+/// Record the result of a benchmark from its per operation samples
+static struct Result *AddResult(const char *name, double *samples, size_t count, unsigned long long ops, double total_ns, double bytes)
+{
+	struct Result *r;
+
+	if (result_count == result_capacity)
+	{
+		result_capacity = result_capacity ? result_capacity * 2 : 64;
+		results = (struct Result *)realloc(results, result_capacity * sizeof(struct Result));
+		if (results == NULL)
+		{
+			fprintf(stderr, "vsynth-bench: out of memory\n");
+			exit(1);
+		}
+	}
+	r = &results[result_count++];
+	memset(r, 0, sizeof(struct Result));
+
+	qsort(samples, count, sizeof(double), CompareDoubles);
+	r->name = CopyString(name);
+	r->ops = ops;
+	r->mean_ns = ops ? total_ns / ops : 0.0;
+	r->min_ns = count ? samples[0] : 0.0;
+	r->p50_ns = count ? Percentile(samples, count, 50) : 0.0;
+	r->p90_ns = count ? Percentile(samples, count, 90) : 0.0;
+	r->p99_ns = count ? Percentile(samples, count, 99) : 0.0;
+	r->max_ns = count ? samples[count - 1] : 0.0;
+	r->bytes = bytes;
+	return r;
+}
+
+static void PrintResult(const struct Result *r)
+{
+	const Vs_FilterProfile *fp;
+	size_t i;
+
+	if (!table_output)
+		return;
+	printf("%-72s %12.0f %12.0f %12.0f %12.1f", r->name, r->p50_ns, r->p99_ns, r->mean_ns, r->mean_ns > 0 ? 1e9 / r->mean_ns : 0.0);
+	if (r->bytes >= 0)
+		printf(" %12.0f", r->bytes);
+	printf("\n");
+	for (i = 0; i < r->filter_count; i++)
+	{
+		fp = &r->filters[i].profile;
+		printf("    %-16s calls %8llu  null %4llu  self %12.0f ns/call  total %12.0f ns/call  alloc %12.0f bytes/call\n",
+			r->filters[i].name, fp->calls, fp->null_frames,
+			fp->calls ? (double)fp->self_ns / fp->calls : 0.0,
+			fp->calls ? (double)fp->total_ns / fp->calls : 0.0,
+			fp->calls ? (double)fp->bytes_allocated / fp->calls : 0.0);
+	}
+	fflush(stdout);
+}
+
+
+/*
+	Batched operation timing
+*/
+
+/// An operation to time, i counts the operations of the benchmark
+typedef void (*BenchOp)(void *ctx, size_t i);
+
+/// Time an operation and record the result
+static void RunBench(const char *name, BenchOp op, void *ctx, double bytes)
+{
+	double *samples;
+	size_t batch = 1, i, s;
+	unsigned long long start, elapsed, total = 0;
+	size_t n = 0;
+
+	if (!Selected(name))
+		return;
+
+	// warm up, and grow the batch until it can be timed
+	for (;;)
+	{
+		start = NowNs();
+		for (i = 0; i < batch; i++)
+			op(ctx, n++);
+		elapsed = NowNs() - start;
+		if (elapsed >= MIN_BATCH_NS || batch >= ((size_t)1 << 24))
+			break;
+		batch *= 2;
+	}
+
+	samples = (double *)malloc(options.samples * sizeof(double));
+	if (samples == NULL)
+		return;
+	for (s = 0; s < options.samples; s++)
+	{
+		start = NowNs();
+		for (i = 0; i < batch; i++)
+			op(ctx, n++);
+		elapsed = NowNs() - start;
+		total += elapsed;
+		samples[s] = (double)elapsed / batch;
+	}
+
+	PrintResult(AddResult(name, samples, options.samples, (unsigned long long)options.samples * batch, (double)total, bytes));
+	free(samples);
+}
+
+
+/*
+	Stdframe primitives
+*/
+
+struct FrameBench {
+	Vs_Library vsynth;
+	enum Vs_StdframePixelFormat pixfmt;
+	size_t width;
+	size_t height;
+	Vs_StandardFrame frame;
+};
+
+static void OpNew(void *ctx, size_t i)
+{
+	struct FrameBench *b = (struct FrameBench *)ctx;
+	Vs_StandardFrame frame = Vs_Stdframe_New(b->pixfmt, b->width, b->height);
+	frame->base.methods->unref(&frame->base);
+}
+
+static void OpNewPooled(void *ctx, size_t i)
+{
+	struct FrameBench *b = (struct FrameBench *)ctx;
+	Vs_StandardFrame frame = Vs_Stdframe_NewPooled(b->vsynth, b->pixfmt, b->width, b->height);
+	frame->base.methods->unref(&frame->base);
+}
+
+static void OpClone(void *ctx, size_t i)
+{
+	struct FrameBench *b = (struct FrameBench *)ctx;
+	Vs_Frame clone = b->frame->base.methods->clone(&b->frame->base);
+	clone->methods->unref(clone);
+}
+
+static void OpCrop(void *ctx, size_t i)
+{
+	struct FrameBench *b = (struct FrameBench *)ctx;
+	Vs_Frame view = b->frame->base.methods->view(&b->frame->base);
+	((const struct Vs_StandardFrameVirtual *)view->methods)->crop(Vs_Stdframe_Get(view), 16, 16, b->width - 32, b->height - 32);
+	view->methods->unref(view);
+}
+
+static void BenchStdframe(Vs_Library vsynth)
+{
+	struct FrameBench b;
+	char name[128];
+	size_t r, frame_bytes;
+	int p;
+	Vs_Frame probe;
+
+	b.vsynth = vsynth;
+	for (p = 0; p < STDPIXFMT_MAX; p++)
+	{
+		for (r = 0; r < sizeof(resolutions) / sizeof(resolutions[0]); r++)
+		{
+			b.pixfmt = (enum Vs_StdframePixelFormat)p;
+			b.width = resolutions[r].width;
+			b.height = resolutions[r].height;
+			b.frame = Vs_Stdframe_New(b.pixfmt, b.width, b.height);
+			if (b.frame == NULL)
+				continue;
+			frame_bytes = b.frame->base.methods->memory_size(&b.frame->base);
+
+			sprintf(name, "stdframe/new/%s/%zux%zu", pixfmt_names[p], b.width, b.height);
+			RunBench(name, OpNew, &b, (double)frame_bytes);
+			sprintf(name, "stdframe/new_pooled/%s/%zux%zu", pixfmt_names[p], b.width, b.height);
+			RunBench(name, OpNewPooled, &b, (double)frame_bytes);
+			sprintf(name, "stdframe/clone/%s/%zux%zu", pixfmt_names[p], b.width, b.height);
+			RunBench(name, OpClone, &b, (double)frame_bytes);
+
+			probe = b.frame->base.methods->view(&b.frame->base);
+			sprintf(name, "stdframe/crop/%s/%zux%zu", pixfmt_names[p], b.width, b.height);
+			RunBench(name, OpCrop, &b, (double)probe->methods->memory_size(probe));
+			probe->methods->unref(probe);
+
+			b.frame->base.methods->unref(&b.frame->base);
+		}
+	}
+}
+
+
+/*
+	Filter registry
+*/
+
+struct RegistryBench {
+	Vs_Library vsynth;
+	size_t count;
+	char **names;
+	char **missing;
+};
+
+static void OpFindHit(void *ctx, size_t i)
+{
+	struct RegistryBench *b = (struct RegistryBench *)ctx;
+	if (b->vsynth->FilterRegistry->Find(b->vsynth, b->names[i % b->count]) == NULL)
+		abort();
+}
+
+static void OpFindMiss(void *ctx, size_t i)
+{
+	struct RegistryBench *b = (struct RegistryBench *)ctx;
+	if (b->vsynth->FilterRegistry->Find(b->vsynth, b->missing[i % b->count]) != NULL)
+		abort();
+}
+
+static void BenchRegistry(void)
+{
+	static const size_t sizes[] = { 16, 1024 };
+	struct RegistryBench b;
+	Vs_FilterFactory *factories;
+	char name[128];
+	size_t s, i;
+
+	for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+	{
+		// a library of its own, so the registry holds exactly the factories registered here
+		b.vsynth = Vs_InitLibrary();
+		b.count = sizes[s];
+		factories = (Vs_FilterFactory *)calloc(b.count, sizeof(Vs_FilterFactory));
+		b.names = (char **)malloc(b.count * sizeof(char *));
+		b.missing = (char **)malloc(b.count * sizeof(char *));
+		if (b.vsynth == NULL || factories == NULL || b.names == NULL || b.missing == NULL)
+		{
+			fprintf(stderr, "vsynth-bench: out of memory\n");
+			exit(1);
+		}
+		for (i = 0; i < b.count; i++)
+		{
+			sprintf(name, "benchfilter%zu", i);
+			b.names[i] = CopyString(name);
+			sprintf(name, "missingfilter%zu", i);
+			b.missing[i] = CopyString(name);
+			factories[i].identifier = b.names[i];
+			factories[i].name = b.names[i];
+			factories[i].copyright = "";
+			b.vsynth->FilterRegistry->Register(b.vsynth, &factories[i]);
+		}
+
+		sprintf(name, "registry/find_hit/%zu", b.count);
+		RunBench(name, OpFindHit, &b, -1);
+		sprintf(name, "registry/find_miss/%zu", b.count);
+		RunBench(name, OpFindMiss, &b, -1);
+
+		Vs_FreeLibrary(b.vsynth);
+		for (i = 0; i < b.count; i++)
+		{
+			free(b.names[i]);
+			free(b.missing[i]);
+		}
+		free(b.names);
+		free(b.missing);
+		free(factories);
+	}
+}
+
+
+/*
+	Filter chains
+*/
+
+/// Set a property from its text form, returns zero on failure
+static int SetProperty(Vs_Library vsynth, Vs_Filter filter, const char *name, const char *text)
+{
+	enum Vs_PropertyType type;
+	Vs_PropertyValue value;
+	Vs_PropertyId id = vsynth->Property->Resolve(vsynth, filter, name, &type);
+	char *end = NULL;
+	int i, ok;
+
+	if (id == PROPERTY_INVALID)
+		return 0;
+
+	value.type = type;
+	switch (type)
+	{
+	case PROP_INT:
+		// pixfmts may be given by name
+		for (i = 0; i < STDPIXFMT_MAX; i++)
+		{
+			if (strcmp(text, pixfmt_names[i]) == 0)
+				break;
+		}
+		if (i < STDPIXFMT_MAX)
+		{
+			value.v.i = i;
+			end = "";
+		}
+		else
+			value.v.i = strtoll(text, &end, 0);
+		break;
+	case PROP_DOUBLE:
+		value.v.d = strtod(text, &end);
+		break;
+	case PROP_FRAMENUMBER:
+		value.v.fn = strtoull(text, &end, 0);
+		break;
+	case PROP_TIMESTAMP:
+		value.v.ts = strtoull(text, &end, 0);
+		break;
+	case PROP_STRING:
+		value.v.s = vsynth->String->Make(text);
+		ok = vsynth->Property->Set(vsynth, filter, id, &value);
+		vsynth->String->Free(value.v.s);
+		return ok;
+	default:
+		return 0;
+	}
+	if (end == NULL || *end != '\0')
+		return 0;
+	return vsynth->Property->Set(vsynth, filter, id, &value);
+}
+
+/// Build a chain from its text form, "filter name=value ... | filter ..."
+///
+/// Every filter after the first gets the previous one as its clip. The
+/// filters are recorded in steps. Returns NULL and prints a message on
+/// failure.
+static Vs_Filter BuildChain(Vs_Library vsynth, const char *spec, struct ChainSteps *steps)
+{
+	char *text = CopyString(spec);
+	char *step, *next, *token, *eq;
+	Vs_FilterFactory *factory;
+	Vs_Filter filter = NULL, prev = NULL;
+	Vs_PropertyValue clip;
+	Vs_PropertyId clip_id;
+
+	steps->count = 0;
+	for (step = text; step != NULL; step = next)
+	{
+		next = strchr(step, '|');
+		if (next != NULL)
+			*next++ = '\0';
+
+		token = strtok(step, " \t");
+		if (token == NULL)
+			continue;
+		factory = vsynth->FilterRegistry->Find(vsynth, token);
+		if (factory == NULL)
+		{
+			fprintf(stderr, "vsynth-bench: no filter named '%s'\n", token);
+			break;
+		}
+		if (steps->count == MAX_CHAIN_STEPS)
+		{
+			fprintf(stderr, "vsynth-bench: chain too long\n");
+			break;
+		}
+		filter = factory->produce(vsynth);
+		steps->filters[steps->count] = filter;
+		steps->names[steps->count] = factory->identifier;
+		steps->count++;
+
+		if (prev != NULL)
+		{
+			clip_id = vsynth->Property->Resolve(vsynth, filter, "clip", NULL);
+			clip.type = PROP_FILTER;
+			clip.v.f = prev;
+			if (clip_id == PROPERTY_INVALID || !vsynth->Property->Set(vsynth, filter, clip_id, &clip))
+			{
+				fprintf(stderr, "vsynth-bench: filter '%s' takes no clip\n", token);
+				filter->methods->unref(filter);
+				filter = NULL;
+				break;
+			}
+			prev->methods->unref(prev);
+			prev = NULL;
+		}
+
+		while ((token = strtok(NULL, " \t")) != NULL)
+		{
+			eq = strchr(token, '=');
+			if (eq != NULL)
+				*eq++ = '\0';
+			if (eq == NULL || !SetProperty(vsynth, filter, token, eq))
+			{
+				fprintf(stderr, "vsynth-bench: bad property '%s'\n", token);
+				filter->methods->unref(filter);
+				filter = NULL;
+				break;
+			}
+		}
+		if (filter == NULL)
+			break;
+		prev = filter;
+	}
+
+	free(text);
+	if (filter == NULL && prev != NULL)
+		prev->methods->unref(prev);
+	return filter;
+}
+
+static Vs_ActiveFilter ActivateChain(Vs_Library vsynth, Vs_Filter chain)
+{
+	struct Vs_StandardFrameTypeDescription ftd;
+	Vs_FrameTypeDescription *ftds[2];
+	Vs_String error = NULL;
+	Vs_ActiveFilter active;
+
+	Vs_Stdframe_InitFTD(&ftd);
+	ftds[0] = &ftd.base;
+	ftds[1] = NULL;
+	if (options.optimize)
+		chain = vsynth->Graph->Optimize(vsynth, chain);
+	active = vsynth->Graph->Activate(vsynth, chain, &error, ftds);
+	if (options.optimize)
+		chain->methods->unref(chain);
+	if (active == NULL)
+	{
+		fprintf(stderr, "vsynth-bench: activation failed: %s\n", error != NULL && error->str != NULL ? error->str : "unknown error");
+		if (error != NULL)
+			vsynth->String->Free(error);
+	}
+	return active;
+}
+
+struct ProfileCollector {
+	const struct ChainSteps *steps;
+	struct Result *result;
+};
+
+VSYNTH_IMPLEMENT_METHOD(void, CollectProfile)(const Vs_FilterProfile *profile, void *userdata)
+{
+	struct ProfileCollector *pc = (struct ProfileCollector *)userdata;
+	struct Result *r = pc->result;
+	struct FilterResult *fr;
+	size_t i;
+
+	// only filters still alive belong to the chain being run
+	if (profile->filter == NULL)
+		return;
+	fr = (struct FilterResult *)realloc(r->filters, (r->filter_count + 1) * sizeof(struct FilterResult));
+	if (fr == NULL)
+		return;
+	r->filters = fr;
+	fr = &r->filters[r->filter_count++];
+	fr->name = "?";
+	for (i = 0; i < pc->steps->count; i++)
+	{
+		if (pc->steps->filters[i] == profile->prototype)
+			fr->name = pc->steps->names[i];
+	}
+	// filters rewritten by the optimizer are named by type
+	for (i = 0; i < pc->steps->count && fr->name[0] == '?'; i++)
+	{
+		if (pc->steps->filters[i]->methods == profile->prototype->methods)
+			fr->name = pc->steps->names[i];
+	}
+	fr->profile = *profile;
+}
+
+/// Pull frames through a chain, one sample per frame
+static void BenchChain(Vs_Library vsynth, const char *spec, int use_server)
+{
+	char name[512];
+	Vs_Filter chain;
+	Vs_ActiveFilter active;
+	Vs_FrameServer server = NULL;
+	Vs_FramePoolStats before, after;
+	Vs_Frame frame;
+	double *samples;
+	double bytes = 0;
+	unsigned long long start, elapsed, total = 0;
+	size_t count = 0;
+	struct Result *r;
+
+	struct ChainSteps steps;
+	struct ProfileCollector collector;
+
+	snprintf(name, sizeof(name), "chain/%s/%s", use_server ? "server" : "sync", spec);
+	if (!Selected(name))
+		return;
+
+	chain = BuildChain(vsynth, spec, &steps);
+	if (chain == NULL)
+		return;
+	// kept until the profiles are collected, the steps name its filters
+	active = ActivateChain(vsynth, chain);
+	if (active == NULL)
+	{
+		chain->methods->unref(chain);
+		return;
+	}
+
+	samples = (double *)malloc((size_t)options.frames * sizeof(double));
+	if (samples == NULL)
+	{
+		active->methods->destroy(active);
+		chain->methods->unref(chain);
+		return;
+	}
+
+	// one frame first, so the pool and the tables are warm
+	frame = active->methods->get_frame(active, 0);
+	if (frame != NULL)
+		frame->methods->unref(frame);
+
+	vsynth->FramePool->GetStats(vsynth, &before);
+	vsynth->Profile->Reset(vsynth);
+	if (use_server)
+		server = vsynth->FrameServer->Create(vsynth, active, 0, 0);
+	while (count < options.frames)
+	{
+		start = NowNs();
+		if (use_server)
+			frame = vsynth->FrameServer->Next(server, NULL);
+		else
+			frame = active->methods->get_frame(active, count);
+		if (frame == NULL)
+			break;
+		elapsed = NowNs() - start;
+		bytes += (double)frame->methods->memory_size(frame);
+		frame->methods->unref(frame);
+		samples[count++] = (double)elapsed;
+		total += elapsed;
+	}
+	if (server != NULL)
+		vsynth->FrameServer->Destroy(server);
+	vsynth->FramePool->GetStats(vsynth, &after);
+
+	r = AddResult(name, samples, count, count, (double)total, count ? bytes / count : 0);
+	r->pool_hits = after.hits - before.hits;
+	r->pool_misses = after.misses - before.misses;
+	if (options.profile)
+	{
+		collector.steps = &steps;
+		collector.result = r;
+		vsynth->Profile->Enumerate(vsynth, CollectProfile, &collector);
+	}
+	PrintResult(r);
+
+	free(samples);
+	active->methods->destroy(active);
+	chain->methods->unref(chain);
+}
+
+/// Write a chain to the output file, one operation per frame
+static void BenchSink(Vs_Library vsynth, const char *spec)
+{
+	char name[512];
+	Vs_Filter chain;
+	Vs_ActiveFilter active;
+	struct Vs_StdsinkOptions sink;
+	struct Vs_StdsinkStats stats;
+	Vs_String error = NULL;
+	struct ChainSteps steps;
+	double sample;
+
+	snprintf(name, sizeof(name), "sink/raw/%s", spec);
+	if (options.output == NULL || !Selected(name))
+		return;
+
+	chain = BuildChain(vsynth, spec, &steps);
+	if (chain == NULL)
+		return;
+	active = ActivateChain(vsynth, chain);
+	chain->methods->unref(chain);
+	if (active == NULL)
+		return;
+
+	memset(&sink, 0, sizeof(sink));
+	sink.format = STDSINK_RAW;
+	sink.count = (Vs_FrameNumber)options.frames;
+	if (!Vs_Stdsink_Write(vsynth, active, options.output, &sink, &stats, &error))
+	{
+		fprintf(stderr, "vsynth-bench: writing %s failed: %s\n", options.output, error->str);
+		vsynth->String->Free(error);
+	}
+	else if (stats.frames > 0)
+	{
+		// the sink only reports totals, so there is a single sample
+		sample = (double)stats.elapsed_ns / stats.frames;
+		PrintResult(AddResult(name, &sample, 1, stats.frames, (double)stats.elapsed_ns, (double)stats.bytes / stats.frames));
+		if (table_output)
+			printf("    %.1f MB/s  waiting for frames %.0f%%  waiting for writes %.0f%%\n",
+				stats.elapsed_ns ? stats.bytes * 1e3 / stats.elapsed_ns : 0.0,
+				stats.elapsed_ns ? 100.0 * stats.frame_wait_ns / stats.elapsed_ns : 0.0,
+				stats.elapsed_ns ? 100.0 * stats.write_wait_ns / stats.elapsed_ns : 0.0);
+	}
+	active->methods->destroy(active);
+}
+
+
+/*
+	Output
+*/
+
+static void WriteJsonString(FILE *out, const char *str)
+{
+	fputc('"', out);
+	for (; *str; str++)
+	{
+		if (*str == '"' || *str == '\\')
+			fprintf(out, "\\%c", *str);
+		else if ((unsigned char)*str < 0x20)
+			fprintf(out, "\\u%04x", (unsigned char)*str);
+		else
+			fputc(*str, out);
+	}
+	fputc('"', out);
+}
+
+static void WriteJson(FILE *out, unsigned int threads)
+{
+	size_t i;
+	const struct Result *r;
+	const Vs_FilterProfile *fp;
+	size_t j;
+
+	fprintf(out, "{\n  \"version\": %d,\n  \"threads\": %u,\n  \"samples\": %zu,\n  \"results\": [\n", BENCH_VERSION, threads, options.samples);
+	for (i = 0; i < result_count; i++)
+	{
+		r = &results[i];
+		fprintf(out, "    {\"name\": ");
+		WriteJsonString(out, r->name);
+		fprintf(out, ", \"ops\": %llu, \"ns_per_op\": %.1f, \"ops_per_s\": %.2f, \"min_ns\": %.1f, \"p50_ns\": %.1f, \"p90_ns\": %.1f, \"p99_ns\": %.1f, \"max_ns\": %.1f",
+			r->ops, r->mean_ns, r->mean_ns > 0 ? 1e9 / r->mean_ns : 0.0, r->min_ns, r->p50_ns, r->p90_ns, r->p99_ns, r->max_ns);
+		if (r->bytes >= 0)
+			fprintf(out, ", \"bytes_per_op\": %.0f", r->bytes);
+		if (strncmp(r->name, "chain/", 6) == 0)
+			fprintf(out, ", \"pool_hits\": %llu, \"pool_misses\": %llu", r->pool_hits, r->pool_misses);
+		if (r->filter_count > 0)
+		{
+			fprintf(out, ", \"filters\": [");
+			for (j = 0; j < r->filter_count; j++)
+			{
+				fp = &r->filters[j].profile;
+				fprintf(out, "%s{\"name\": ", j ? ", " : "");
+				WriteJsonString(out, r->filters[j].name);
+				fprintf(out, ", \"calls\": %llu, \"frames\": %llu, \"null_frames\": %llu, \"total_ns\": %llu, \"self_ns\": %llu, \"bytes_allocated\": %llu}",
+					fp->calls, fp->frames, fp->null_frames, fp->total_ns, fp->self_ns, fp->bytes_allocated);
+			}
+			fprintf(out, "]");
+		}
+		fprintf(out, "}%s\n", i + 1 < result_count ? "," : "");
+	}
+	fprintf(out, "  ]\n}\n");
+}
+
+
+/*
+	Setup
+*/
+
+static int LoadPlugin(Vs_Library vsynth, const char *path)
+{
+	Vs_PluginInitFunc init;
+#ifdef _WIN32
+	HMODULE module = LoadLibraryA(path);
+	if (module == NULL)
+	{
+		fprintf(stderr, "vsynth-bench: cannot load %s\n", path);
+		return 0;
+	}
+	init = (Vs_PluginInitFunc)GetProcAddress(module, "Vs_PluginInit");
+#else
+	void *module = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	if (module == NULL)
+	{
+		fprintf(stderr, "vsynth-bench: %s\n", dlerror());
+		return 0;
+	}
+	*(void **)&init = dlsym(module, "Vs_PluginInit");
+#endif
+	if (init == NULL)
+	{
+		fprintf(stderr, "vsynth-bench: %s has no Vs_PluginInit\n", path);
+		return 0;
+	}
+	// modules stay loaded, the factories live in them
+	init(vsynth);
+	return 1;
+}
+
+static void Usage(void)
+{
+	fprintf(stderr,
+		"usage: vsynth-bench [options]\n"
+		"  --json FILE        write results as JSON to FILE, - for stdout\n"
+		"  --match TEXT       only run benchmarks whose name contains TEXT\n"
+		"  --samples N        timed batches per benchmark (default 50)\n"
+		"  --frames N         frames pulled per chain (default 100)\n"
+		"  --threads N        worker threads (default one per processor)\n"
+		"  --plugin PATH      load a plugin, may be repeated\n"
+		"  --chain SPEC       benchmark a chain instead of the default ones, may be repeated\n"
+		"                     SPEC is \"filter name=value ... | filter name=value ...\"\n"
+		"  --profile          report per-filter counters for chains\n"
+		"  --output FILE      also time writing each chain to FILE as raw video\n"
+		"  --optimize         optimize chains before activating them\n"
+		"  --quick            fewer samples and frames, for smoke testing\n");
+}
+
+static void AddOption(const char ***list, size_t *count, const char *value)
+{
+	*list = (const char **)realloc((void *)*list, (*count + 1) * sizeof(const char *));
+	if (*list == NULL)
+		exit(1);
+	(*list)[(*count)++] = value;
+}
+
+int main(int argc, char **argv)
+{
+	Vs_Library vsynth;
+	char spec[512];
+	size_t i;
+	int a;
+	FILE *out;
+
+	options.samples = 50;
+	options.frames = 100;
+	for (a = 1; a < argc; a++)
+	{
+		if (strcmp(argv[a], "--quick") == 0)
+		{
+			options.samples = 5;
+			options.frames = 10;
+		}
+		else if (strcmp(argv[a], "--profile") == 0)
+			options.profile = 1;
+		else if (strcmp(argv[a], "--optimize") == 0)
+			options.optimize = 1;
+		else if (a + 1 < argc && strcmp(argv[a], "--json") == 0)
+			options.json = argv[++a];
+		else if (a + 1 < argc && strcmp(argv[a], "--output") == 0)
+			options.output = argv[++a];
+		else if (a + 1 < argc && strcmp(argv[a], "--match") == 0)
+			options.match = argv[++a];
+		else if (a + 1 < argc && strcmp(argv[a], "--samples") == 0)
+			options.samples = (size_t)strtoul(argv[++a], NULL, 10);
+		else if (a + 1 < argc && strcmp(argv[a], "--frames") == 0)
+			options.frames = strtoull(argv[++a], NULL, 10);
+		else if (a + 1 < argc && strcmp(argv[a], "--threads") == 0)
+			options.threads = (unsigned int)strtoul(argv[++a], NULL, 10);
+		else if (a + 1 < argc && strcmp(argv[a], "--plugin") == 0)
+			AddOption(&options.plugins, &options.plugin_count, argv[++a]);
+		else if (a + 1 < argc && strcmp(argv[a], "--chain") == 0)
+			AddOption(&options.chains, &options.chain_count, argv[++a]);
+		else
+		{
+			Usage();
+			return 2;
+		}
+	}
+	if (options.samples == 0 || options.frames == 0)
+	{
+		Usage();
+		return 2;
+	}
+	table_output = options.json == NULL || strcmp(options.json, "-") != 0;
+
+	vsynth = Vs_InitLibrary();
+	if (options.threads != 0)
+		vsynth->ThreadPool->SetThreadCount(vsynth, options.threads);
+	vsynth->Profile->SetEnabled(vsynth, options.profile);
+	if (options.plugin_count == 0)
+	{
+		for (i = 0; default_plugins[i] != NULL; i++)
+			LoadPlugin(vsynth, default_plugins[i]);
+	}
+	for (i = 0; i < options.plugin_count; i++)
+	{
+		if (!LoadPlugin(vsynth, options.plugins[i]))
+			return 1;
+	}
+
+	if (table_output)
+		printf("%-72s %12s %12s %12s %12s %12s\n", "benchmark", "p50 ns", "p99 ns", "mean ns", "ops/s", "bytes/op");
+
+	BenchStdframe(vsynth);
+	BenchRegistry();
+	if (options.chain_count > 0)
+	{
+		for (i = 0; i < options.chain_count; i++)
+		{
+			BenchChain(vsynth, options.chains[i], 0);
+			BenchChain(vsynth, options.chains[i], 1);
+			BenchSink(vsynth, options.chains[i]);
+		}
+	}
+	else
+	{
+		for (i = 0; default_chains[i] != NULL; i++)
+		{
+			snprintf(spec, sizeof(spec), default_chains[i], options.frames + 1);
+			BenchChain(vsynth, spec, 0);
+			BenchChain(vsynth, spec, 1);
+			BenchSink(vsynth, spec);
+		}
+	}
+
+	if (options.json != NULL)
+	{
+		out = strcmp(options.json, "-") == 0 ? stdout : fopen(options.json, "w");
+		if (out == NULL)
+		{
+			fprintf(stderr, "vsynth-bench: cannot write %s\n", options.json);
+			return 1;
+		}
+		WriteJson(out, vsynth->ThreadPool->GetThreadCount(vsynth));
+		if (out != stdout)
+			fclose(out);
+	}
+
+	for (i = 0; i < result_count; i++)
+	{
+		free(results[i].name);
+		free(results[i].filters);
+	}
+	free(results);
+	free((void *)options.plugins);
+	free((void *)options.chains);
+	Vs_FreeLibrary(vsynth);
+	return 0;
+}
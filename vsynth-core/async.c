@@ -0,0 +1,194 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <vsynth/vsynth.h>
+#include <vsynth/platform.h>
+#include "core.h"
+
+
+/*
+
+Asynchronous frame requests. Filters with a get_frame_async method are
+called directly. For all other filters the synchronous get_frame is run as a
+task on the worker pool, which is what lets existing synchronous filters take
+part in asynchronous graphs unchanged.
+
+*/
+
+
+struct SyncRequest {
+	Vs_ActiveFilter filter;
+	Vs_FrameNumber n;
+	Vs_FrameCallback callback;
+	void *userdata;
+};
+
+static void RunSyncRequest(void *arg)
+{
+	struct SyncRequest *req = (struct SyncRequest *)arg;
+	Vs_Frame frame = req->filter->methods->get_frame(req->filter, req->n);
+	req->callback(frame, req->userdata);
+	free(req);
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, Async_GetFrame)(Vs_Library vsynth, Vs_ActiveFilter filter, Vs_FrameNumber n, Vs_FrameCallback callback, void *userdata)
+{
+	struct SyncRequest *req;
+
+	if (filter->methods->get_frame_async != NULL)
+	{
+		filter->methods->get_frame_async(filter, n, callback, userdata);
+		return;
+	}
+
+	req = (struct SyncRequest *)malloc(sizeof(struct SyncRequest));
+	if (req == NULL)
+	{
+		// can't queue it, do it right here instead
+		callback(filter->methods->get_frame(filter, n), userdata);
+		return;
+	}
+	req->filter = filter;
+	req->n = n;
+	req->callback = callback;
+	req->userdata = userdata;
+	ThreadPool_Submit(GetThreadPool(getlib(vsynth)), RunSyncRequest, req);
+}
+
+
+/// Collects the frames of one RequestFrames call
+///
+/// Allocated with room for count frames and count parts after it.
+struct FrameJoin {
+	Vs_AtomicCount remaining;
+	size_t count;
+	Vs_FramesReadyFunc callback;
+	void *userdata;
+	Vs_Frame *frames;
+};
+
+/// Userdata for each single frame request of a join
+struct JoinPart {
+	struct FrameJoin *join;
+	size_t index;
+};
+
+VSYNTH_IMPLEMENT_METHOD(void, JoinFrameReady)(Vs_Frame frame, void *userdata)
+{
+	struct JoinPart *part = (struct JoinPart *)userdata;
+	struct FrameJoin *join = part->join;
+
+	join->frames[part->index] = frame;
+
+	// last one in delivers the lot
+	if (Vs_AtomicDecrement(&join->remaining) == 0)
+	{
+		join->callback(join->frames, join->count, join->userdata);
+		free(join);
+	}
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, Async_RequestFrames)(Vs_Library vsynth, size_t count, const Vs_ActiveFilter *filters, const Vs_FrameNumber *numbers, Vs_FramesReadyFunc callback, void *userdata)
+{
+	struct FrameJoin *join;
+	struct JoinPart *parts;
+	size_t i;
+
+	// a request too large to ever allocate is treated as out of memory
+	if (count == 0 || count > (SIZE_MAX - sizeof(struct FrameJoin)) / (sizeof(Vs_Frame) + sizeof(struct JoinPart)))
+	{
+		callback(NULL, 0, userdata);
+		return;
+	}
+
+	join = (struct FrameJoin *)malloc(sizeof(struct FrameJoin) + count * (sizeof(Vs_Frame) + sizeof(struct JoinPart)));
+	if (join == NULL)
+	{
+		// no memory to track it, fetch the frames synchronously
+		Vs_Frame *frames = (Vs_Frame *)malloc(count * sizeof(Vs_Frame));
+		if (frames == NULL)
+		{
+			// the callback must run regardless, waiters would hang otherwise
+			callback(NULL, 0, userdata);
+			return;
+		}
+		for (i = 0; i < count; i++)
+			frames[i] = filters[i]->methods->get_frame(filters[i], numbers[i]);
+		callback(frames, count, userdata);
+		free(frames);
+		return;
+	}
+
+	join->frames = (Vs_Frame *)(join + 1);
+	parts = (struct JoinPart *)(join->frames + count);
+	join->remaining = (long)count;
+	join->count = count;
+	join->callback = callback;
+	join->userdata = userdata;
+
+	for (i = 0; i < count; i++)
+	{
+		join->frames[i] = NULL;
+		parts[i].join = join;
+		parts[i].index = i;
+	}
+
+	// the join may be freed as soon as the last request is made
+	for (i = 0; i < count; i++)
+		Async_GetFrame(vsynth, filters[i], numbers[i], JoinFrameReady, &parts[i]);
+}
+
+
+struct FrameWait {
+	VsMutex lock;
+	VsCond cond;
+	int finished;
+	Vs_Frame frame;
+};
+
+VSYNTH_IMPLEMENT_METHOD(void, WaitFrameReady)(Vs_Frame frame, void *userdata)
+{
+	struct FrameWait *wait = (struct FrameWait *)userdata;
+
+	VsMutex_Lock(&wait->lock);
+	wait->frame = frame;
+	wait->finished = 1;
+	VsCond_Signal(&wait->cond);
+	VsMutex_Unlock(&wait->lock);
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Frame, Async_WaitFrame)(Vs_Library vsynth, Vs_ActiveFilter filter, Vs_FrameNumber n)
+{
+	struct ThreadPool *pool = GetThreadPool(getlib(vsynth));
+	struct FrameWait wait;
+	int ran;
+
+	VsMutex_Init(&wait.lock);
+	VsCond_Init(&wait.cond);
+	wait.finished = 0;
+	wait.frame = NULL;
+
+	Async_GetFrame(vsynth, filter, n, WaitFrameReady, &wait);
+
+	VsMutex_Lock(&wait.lock);
+	while (!wait.finished)
+	{
+		// help with the queue, the frame we wait for may be in it
+		VsMutex_Unlock(&wait.lock);
+		ran = ThreadPool_RunPending(pool);
+		VsMutex_Lock(&wait.lock);
+		if (!ran && !wait.finished)
+			VsCond_Wait(&wait.cond, &wait.lock);
+	}
+	VsMutex_Unlock(&wait.lock);
+
+	VsCond_Destroy(&wait.cond);
+	VsMutex_Destroy(&wait.lock);
+
+	return wait.frame;
+}
+
+struct TAG_Vs_AsyncAPI AsyncAPI = {
+	Async_GetFrame,
+	Async_RequestFrames,
+	Async_WaitFrame
+};
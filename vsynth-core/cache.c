@@ -0,0 +1,970 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <vsynth/vsynth.h>
+#include "core.h"
+
+
+/*
+
+All caches of a library share one FrameCache. Entries are found through a
+hash table keyed on (cache, frame number) and are also linked into a single
+LRU list, most recently used at the head. When the byte budget is exceeded,
+entries are evicted from the tail of the list regardless of which cache they
+belong to, so busy caches naturally get a bigger share of the budget.
+
+The cache holds one reference to every frame it keeps, and hands out extra
+references on hits. Frames are released outside the lock, since releasing the
+last reference to a frame can be expensive.
+
+The first request missing on a frame puts a pending entry in the hash table
+and goes upstream for it. Requests for the same frame arriving meanwhile are
+queued as waiters on the pending entry instead of producing the frame again,
+which matters for temporal filters where neighbouring output frames ask for
+the same input frames at the same time. Pending entries are not on the LRU
+list and don't count towards the budget.
+
+Frames evicted from the LRU list go to the compressed tier if it has a
+budget. The evicting thread takes them out of the LRU list and the budget,
+compresses them after unlocking, and puts them on a second LRU list with a
+budget of its own, from which the least recently used are dropped. While an
+entry is being compressed it keeps its frame and still answers hits, and a
+cache destroyed meanwhile disowns it, leaving it to the compressing thread to
+free. A hit on a compressed frame turns the entry back into a pending one and
+decompresses the frame outside the lock, so requests for it arriving
+meanwhile wait for it like for any pending frame, and it is then held
+uncompressed again as if it had just been produced. Compression is done by
+packframe.c.
+
+*/
+
+
+/// Default number of bytes of frames held across all caches
+#define DEFAULT_BUDGET ((size_t)512*1024*1024)
+/// Initial number of hash slots, must be a power of two
+#define INITIAL_SLOTS 256
+
+
+struct CachedFilter;
+
+/// A request waiting for a pending entry to be filled
+struct CacheWaiter {
+	Vs_FrameCallback callback;
+	void *userdata;
+	struct CacheWaiter *next;
+};
+
+enum EntryState {
+	/// The frame is being produced
+	ENTRY_PENDING,
+	/// The frame is held uncompressed, on the LRU list
+	ENTRY_HELD,
+	/// The frame has been evicted and is being compressed, on no list
+	ENTRY_COMPRESSING,
+	/// The frame is held compressed, on the compressed LRU list
+	ENTRY_COMPRESSED
+};
+
+struct CacheEntry {
+	/// Cache the entry belongs to, NULL if it was destroyed while compressing
+	struct CachedFilter *owner;
+	Vs_FrameNumber n;
+	/// The frame, unless compressed
+	Vs_Frame frame;
+	/// The compressed frame
+	struct PackedFrame *packed;
+	/// Size of the uncompressed frame
+	size_t size;
+	enum EntryState state;
+	/// Requests waiting for a pending entry
+	struct CacheWaiter *waiters;
+	struct CacheEntry *hash_next;
+	struct CacheEntry *lru_prev;
+	struct CacheEntry *lru_next;
+};
+
+struct LruList {
+	/// Most recently used entry
+	struct CacheEntry *head;
+	/// Least recently used entry
+	struct CacheEntry *tail;
+};
+
+struct FrameCache {
+	Vs_Library vsynth;
+	VsMutex lock;
+	struct CacheEntry **slots;
+	size_t slot_count;
+	/// Number of frames held uncompressed
+	size_t entry_count;
+	struct LruList lru;
+	size_t budget;
+	size_t bytes_held;
+	unsigned long long hits;
+	unsigned long long misses;
+	unsigned long long evictions;
+	/// Compressed frames
+	struct LruList compressed_lru;
+	size_t compressed_budget;
+	size_t compressed_count;
+	size_t compressed_bytes;
+	size_t compressed_source_bytes;
+	unsigned long long compressed_hits;
+	unsigned long long frames_compressed;
+	unsigned long long compress_ns;
+	unsigned long long decompress_ns;
+};
+
+struct CachedFilter {
+	struct TAG_Vs_ActiveFilter base;
+	Vs_Library vsynth;
+	Vs_ActiveFilter upstream;
+	struct FrameCache *cache;
+	// per-cache statistics, protected by the cache lock
+	unsigned long long hits;
+	unsigned long long misses;
+	unsigned long long evictions;
+	size_t frames_held;
+	size_t bytes_held;
+	unsigned long long compressed_hits;
+	unsigned long long frames_compressed;
+	size_t compressed_frames_held;
+	size_t compressed_bytes_held;
+	size_t compressed_source_bytes;
+	unsigned long long compress_ns;
+	unsigned long long decompress_ns;
+};
+
+extern struct TAG_Vs_ActiveFilterVirtual CachedFilter_vtable;
+
+INLINE static struct CachedFilter *GetCachedFilter(Vs_ActiveFilter filter)
+{
+	if (filter->methods == &CachedFilter_vtable)
+		return (struct CachedFilter *)filter;
+	else
+		return NULL;
+}
+
+
+INLINE static size_t HashEntry(struct CachedFilter *owner, Vs_FrameNumber n, size_t slot_count)
+{
+	unsigned long long h = ((unsigned long long)(uintptr_t)owner >> 4) ^ (n * 0x9E3779B97F4A7C15ULL);
+	h ^= h >> 29;
+	return (size_t)h & (slot_count - 1);
+}
+
+/// Look up an entry, cache must be locked
+static struct CacheEntry *FindEntry(struct FrameCache *cache, struct CachedFilter *owner, Vs_FrameNumber n)
+{
+	struct CacheEntry *e;
+	for (e = cache->slots[HashEntry(owner, n, cache->slot_count)]; e != NULL; e = e->hash_next)
+	{
+		if (e->owner == owner && e->n == n)
+			return e;
+	}
+	return NULL;
+}
+
+/// Double the hash table size, cache must be locked
+static void GrowTable(struct FrameCache *cache)
+{
+	size_t new_count = cache->slot_count * 2;
+	struct CacheEntry **new_slots = (struct CacheEntry **)calloc(new_count, sizeof(struct CacheEntry *));
+	struct CacheEntry *e, *next;
+	size_t i, slot;
+
+	// keep working with the old table if out of memory, it's only slower
+	if (new_slots == NULL)
+		return;
+
+	for (i = 0; i < cache->slot_count; i++)
+	{
+		for (e = cache->slots[i]; e != NULL; e = next)
+		{
+			next = e->hash_next;
+			slot = HashEntry(e->owner, e->n, new_count);
+			e->hash_next = new_slots[slot];
+			new_slots[slot] = e;
+		}
+	}
+
+	free(cache->slots);
+	cache->slots = new_slots;
+	cache->slot_count = new_count;
+}
+
+INLINE static void LruUnlink(struct LruList *list, struct CacheEntry *e)
+{
+	if (e->lru_prev != NULL)
+		e->lru_prev->lru_next = e->lru_next;
+	else
+		list->head = e->lru_next;
+	if (e->lru_next != NULL)
+		e->lru_next->lru_prev = e->lru_prev;
+	else
+		list->tail = e->lru_prev;
+}
+
+INLINE static void LruPushFront(struct LruList *list, struct CacheEntry *e)
+{
+	e->lru_prev = NULL;
+	e->lru_next = list->head;
+	if (list->head != NULL)
+		list->head->lru_prev = e;
+	else
+		list->tail = e;
+	list->head = e;
+}
+
+/// Unlink an entry from the hash table, cache must be locked
+static void HashUnlink(struct FrameCache *cache, struct CacheEntry *e)
+{
+	struct CacheEntry **link = &cache->slots[HashEntry(e->owner, e->n, cache->slot_count)];
+
+	while (*link != e)
+		link = &(*link)->hash_next;
+	*link = e->hash_next;
+}
+
+/// Take an uncompressed entry off the LRU list and out of the budget, cache must be locked
+static void UnlinkHeld(struct FrameCache *cache, struct CacheEntry *e)
+{
+	LruUnlink(&cache->lru, e);
+	cache->entry_count--;
+	cache->bytes_held -= e->size;
+	e->owner->frames_held--;
+	e->owner->bytes_held -= e->size;
+}
+
+/// Take a compressed entry off the compressed LRU list and out of the budget, cache must be locked
+static void UnlinkCompressed(struct FrameCache *cache, struct CacheEntry *e)
+{
+	size_t size = PackedFrame_Size(e->packed);
+
+	LruUnlink(&cache->compressed_lru, e);
+	cache->compressed_count--;
+	cache->compressed_bytes -= size;
+	cache->compressed_source_bytes -= e->size;
+	e->owner->compressed_frames_held--;
+	e->owner->compressed_bytes_held -= size;
+	e->owner->compressed_source_bytes -= e->size;
+}
+
+/// Unlink a held or compressed entry from the hash table and its LRU list, cache must be locked
+///
+/// The entry is not freed, instead it is pushed on the released list through
+/// its hash_next pointer, to have its frame released after unlocking.
+static void RemoveEntry(struct FrameCache *cache, struct CacheEntry *e, struct CacheEntry **released)
+{
+	HashUnlink(cache, e);
+	if (e->state == ENTRY_COMPRESSED)
+		UnlinkCompressed(cache, e);
+	else
+		UnlinkHeld(cache, e);
+
+	e->hash_next = *released;
+	*released = e;
+}
+
+/// Evict least recently used entries until within budget, cache must be locked
+///
+/// If the compressed tier is enabled, evicted entries are pushed on the
+/// compress list through their lru_next pointers, to be compressed after
+/// unlocking, otherwise they are released.
+static void EvictToBudget(struct FrameCache *cache, size_t budget, struct CacheEntry **released, struct CacheEntry **compress)
+{
+	struct CacheEntry *e;
+
+	while (cache->bytes_held > budget && cache->lru.tail != NULL)
+	{
+		e = cache->lru.tail;
+		cache->evictions++;
+		e->owner->evictions++;
+		if (cache->compressed_budget > 0)
+		{
+			UnlinkHeld(cache, e);
+			e->state = ENTRY_COMPRESSING;
+			e->lru_next = *compress;
+			*compress = e;
+		}
+		else
+			RemoveEntry(cache, e, released);
+	}
+}
+
+/// Drop least recently used compressed entries until within budget, cache must be locked
+static void EvictCompressed(struct FrameCache *cache, size_t budget, struct CacheEntry **released)
+{
+	while (cache->compressed_bytes > budget && cache->compressed_lru.tail != NULL)
+		RemoveEntry(cache, cache->compressed_lru.tail, released);
+}
+
+/// Release the frames of removed entries and free them, must not be locked
+static void FreeReleased(struct CacheEntry *released)
+{
+	struct CacheEntry *next;
+
+	while (released != NULL)
+	{
+		next = released->hash_next;
+		if (released->frame != NULL)
+			released->frame->methods->unref(released->frame);
+		if (released->packed != NULL)
+			PackedFrame_Destroy(released->packed);
+		free(released);
+		released = next;
+	}
+}
+
+/// Compress evicted entries into the compressed tier, must not be locked
+///
+/// Entries that don't compress, or no longer belong to a cache, are freed.
+static void CompressEvicted(struct FrameCache *cache, struct CacheEntry *compress)
+{
+	struct CacheEntry *e, *next;
+	struct CacheEntry *released;
+	struct PackedFrame *packed;
+	unsigned long long start, elapsed;
+	Vs_Frame frame;
+
+	for (e = compress; e != NULL; e = next)
+	{
+		next = e->lru_next;
+		released = NULL;
+		frame = NULL;
+
+		start = VsTime_Now();
+		packed = PackedFrame_Create(cache->vsynth, e->frame);
+		elapsed = VsTime_Now() - start;
+
+		VsMutex_Lock(&cache->lock);
+		cache->compress_ns += elapsed;
+		if (e->owner == NULL)
+		{
+			// the cache was destroyed and has forgotten about it
+			e->packed = packed;
+			e->hash_next = NULL;
+			released = e;
+		}
+		else if (packed == NULL || PackedFrame_Size(packed) >= e->size)
+		{
+			// not worth keeping
+			e->owner->compress_ns += elapsed;
+			HashUnlink(cache, e);
+			e->packed = packed;
+			e->hash_next = NULL;
+			released = e;
+		}
+		else
+		{
+			e->owner->compress_ns += elapsed;
+			frame = e->frame;
+			e->frame = NULL;
+			e->packed = packed;
+			e->state = ENTRY_COMPRESSED;
+			LruPushFront(&cache->compressed_lru, e);
+			cache->compressed_count++;
+			cache->compressed_bytes += PackedFrame_Size(packed);
+			cache->compressed_source_bytes += e->size;
+			cache->frames_compressed++;
+			e->owner->compressed_frames_held++;
+			e->owner->compressed_bytes_held += PackedFrame_Size(packed);
+			e->owner->compressed_source_bytes += e->size;
+			e->owner->frames_compressed++;
+			EvictCompressed(cache, cache->compressed_budget, &released);
+		}
+		VsMutex_Unlock(&cache->lock);
+
+		if (frame != NULL)
+			frame->methods->unref(frame);
+		FreeReleased(released);
+	}
+}
+
+
+VSYNTH_IMPLEMENT_METHOD(void, CachedFilter_destroy)(Vs_ActiveFilter filter)
+{
+	struct CachedFilter *cf = GetCachedFilter(filter);
+	struct FrameCache *cache = cf->cache;
+	struct CacheEntry *e, *next;
+	struct CacheEntry *released = NULL;
+	size_t i;
+
+	VsMutex_Lock(&cache->lock);
+	for (i = 0; i < cache->slot_count; i++)
+	{
+		for (e = cache->slots[i]; e != NULL; e = next)
+		{
+			next = e->hash_next;
+			if (e->owner != cf)
+				continue;
+			if (e->state == ENTRY_HELD || e->state == ENTRY_COMPRESSED)
+			{
+				RemoveEntry(cache, e, &released);
+			}
+			else if (e->state == ENTRY_COMPRESSING)
+			{
+				// the compressing thread frees it when it's done
+				HashUnlink(cache, e);
+				e->owner = NULL;
+			}
+		}
+	}
+	VsMutex_Unlock(&cache->lock);
+
+	FreeReleased(released);
+
+	cf->upstream->methods->destroy(cf->upstream);
+	free(cf);
+}
+
+enum FetchResult {
+	/// The frame was in the cache
+	FETCH_HIT,
+	/// The frame is being produced, the waiter has been queued
+	FETCH_WAITING,
+	/// The caller must produce the frame and call CompleteFetch
+	FETCH_MISS,
+	/// The caller must decompress the frame and call CompleteFetch
+	FETCH_DECOMPRESS
+};
+
+/// Look up a frame, joining a pending request for it if there is one
+///
+/// On a hit the frame is returned with a new reference through hit. If the
+/// frame is pending and waiter is not NULL, the waiter is queued and will get
+/// the frame when it arrives. Otherwise a pending entry is added, and the
+/// caller is responsible for producing the frame. If the frame is held
+/// compressed, the entry is made pending and the caller gets the compressed
+/// frame through packed, to decompress it.
+static enum FetchResult BeginFetch(struct CachedFilter *cf, Vs_FrameNumber n, Vs_Frame *hit, struct CacheWaiter *waiter, struct PackedFrame **packed)
+{
+	struct FrameCache *cache = cf->cache;
+	struct CacheEntry *e;
+	size_t slot;
+
+	VsMutex_Lock(&cache->lock);
+	e = FindEntry(cache, cf, n);
+	if (e != NULL && (e->state == ENTRY_HELD || e->state == ENTRY_COMPRESSING))
+	{
+		cache->hits++;
+		cf->hits++;
+		// a frame being compressed isn't on the LRU list
+		if (e->state == ENTRY_HELD)
+		{
+			LruUnlink(&cache->lru, e);
+			LruPushFront(&cache->lru, e);
+		}
+		*hit = e->frame;
+		(*hit)->methods->addref(*hit);
+		VsMutex_Unlock(&cache->lock);
+		return FETCH_HIT;
+	}
+	if (e != NULL && e->state == ENTRY_COMPRESSED)
+	{
+		cache->hits++;
+		cf->hits++;
+		cache->compressed_hits++;
+		cf->compressed_hits++;
+		UnlinkCompressed(cache, e);
+		*packed = e->packed;
+		e->packed = NULL;
+		e->state = ENTRY_PENDING;
+		e->lru_prev = NULL;
+		e->lru_next = NULL;
+		VsMutex_Unlock(&cache->lock);
+		return FETCH_DECOMPRESS;
+	}
+	if (e != NULL && waiter != NULL)
+	{
+		cache->hits++;
+		cf->hits++;
+		waiter->next = e->waiters;
+		e->waiters = waiter;
+		VsMutex_Unlock(&cache->lock);
+		return FETCH_WAITING;
+	}
+
+	cache->misses++;
+	cf->misses++;
+	// without an entry to mark it pending, duplicate requests just go upstream
+	if (e == NULL)
+	{
+		e = (struct CacheEntry *)malloc(sizeof(struct CacheEntry));
+		if (e != NULL)
+		{
+			e->owner = cf;
+			e->n = n;
+			e->frame = NULL;
+			e->packed = NULL;
+			e->size = 0;
+			e->state = ENTRY_PENDING;
+			e->waiters = NULL;
+			e->lru_prev = NULL;
+			e->lru_next = NULL;
+			if (cache->entry_count + cache->compressed_count >= cache->slot_count)
+				GrowTable(cache);
+			slot = HashEntry(cf, n, cache->slot_count);
+			e->hash_next = cache->slots[slot];
+			cache->slots[slot] = e;
+		}
+	}
+	VsMutex_Unlock(&cache->lock);
+
+	return FETCH_MISS;
+}
+
+/// Finish a fetch started by BeginFetch that returned FETCH_MISS
+///
+/// Takes over the reference to the frame passed in, puts it in the cache if
+/// it fits the budget and hands it to everyone waiting for it. Returns the
+/// frame with a reference for the caller.
+static Vs_Frame CompleteFetch(struct CachedFilter *cf, Vs_FrameNumber n, Vs_Frame frame)
+{
+	struct FrameCache *cache = cf->cache;
+	struct CacheEntry *e;
+	struct CacheEntry *released = NULL;
+	struct CacheEntry *compress = NULL;
+	struct CacheWaiter *waiters = NULL;
+	struct CacheWaiter *next;
+	Vs_Frame theirs;
+	size_t size = 0;
+
+	if (frame != NULL)
+		size = frame->methods->memory_size(frame);
+
+	VsMutex_Lock(&cache->lock);
+	e = FindEntry(cache, cf, n);
+	if (e != NULL && e->state == ENTRY_PENDING)
+	{
+		waiters = e->waiters;
+		e->waiters = NULL;
+		if (frame != NULL && size <= cache->budget)
+		{
+			e->state = ENTRY_HELD;
+			e->frame = frame;
+			e->size = size;
+			frame->methods->addref(frame);
+
+			LruPushFront(&cache->lru, e);
+			cache->entry_count++;
+			cache->bytes_held += size;
+			cf->frames_held++;
+			cf->bytes_held += size;
+
+			EvictToBudget(cache, cache->budget, &released, &compress);
+		}
+		else
+		{
+			// nothing to keep
+			HashUnlink(cache, e);
+			free(e);
+		}
+	}
+	else if (e != NULL && e->frame != NULL && frame != NULL)
+	{
+		// produced twice after all, hand out the cached one and drop ours
+		theirs = e->frame;
+		theirs->methods->addref(theirs);
+		VsMutex_Unlock(&cache->lock);
+		frame->methods->unref(frame);
+		return theirs;
+	}
+	// every waiter gets its own reference
+	for (next = waiters; next != NULL; next = next->next)
+	{
+		if (frame != NULL)
+			frame->methods->addref(frame);
+	}
+	VsMutex_Unlock(&cache->lock);
+
+	FreeReleased(released);
+
+	while (waiters != NULL)
+	{
+		next = waiters->next;
+		waiters->callback(frame, waiters->userdata);
+		free(waiters);
+		waiters = next;
+	}
+
+	// only after the waiters have their frame, it takes a while
+	CompressEvicted(cache, compress);
+
+	return frame;
+}
+
+/// Finish a fetch started by BeginFetch that returned FETCH_DECOMPRESS
+///
+/// Takes over the compressed frame, and returns the frame with a reference
+/// for the caller.
+static Vs_Frame CompleteDecompress(struct CachedFilter *cf, Vs_FrameNumber n, struct PackedFrame *packed)
+{
+	struct FrameCache *cache = cf->cache;
+	unsigned long long start, elapsed;
+	Vs_Frame frame;
+
+	start = VsTime_Now();
+	frame = PackedFrame_Unpack(cf->vsynth, packed);
+	elapsed = VsTime_Now() - start;
+	PackedFrame_Destroy(packed);
+
+	VsMutex_Lock(&cache->lock);
+	cache->decompress_ns += elapsed;
+	cf->decompress_ns += elapsed;
+	VsMutex_Unlock(&cache->lock);
+
+	// out of memory, so try producing it instead
+	if (frame == NULL)
+		frame = cf->upstream->methods->get_frame(cf->upstream, n);
+	return CompleteFetch(cf, n, frame);
+}
+
+
+/// A synchronous request waiting for a pending entry
+struct SyncWait {
+	VsMutex lock;
+	VsCond cond;
+	int finished;
+	Vs_Frame frame;
+};
+
+VSYNTH_IMPLEMENT_METHOD(void, SyncWaitReady)(Vs_Frame frame, void *userdata)
+{
+	struct SyncWait *wait = (struct SyncWait *)userdata;
+
+	VsMutex_Lock(&wait->lock);
+	wait->frame = frame;
+	wait->finished = 1;
+	VsCond_Signal(&wait->cond);
+	VsMutex_Unlock(&wait->lock);
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Frame, CachedFilter_get_frame)(Vs_ActiveFilter filter, Vs_FrameNumber n)
+{
+	struct CachedFilter *cf = GetCachedFilter(filter);
+	struct CacheWaiter *waiter = (struct CacheWaiter *)malloc(sizeof(struct CacheWaiter));
+	struct ThreadPool *pool;
+	struct SyncWait wait;
+	struct PackedFrame *packed = NULL;
+	Vs_Frame frame = NULL;
+	int have_wait = (waiter != NULL);
+	int ran;
+
+	if (have_wait)
+	{
+		waiter->callback = SyncWaitReady;
+		waiter->userdata = &wait;
+		VsMutex_Init(&wait.lock);
+		VsCond_Init(&wait.cond);
+		wait.finished = 0;
+		wait.frame = NULL;
+	}
+
+	switch (BeginFetch(cf, n, &frame, waiter, &packed))
+	{
+	case FETCH_HIT:
+		break;
+
+	case FETCH_WAITING:
+		// someone else is producing it, help with the queue meanwhile
+		pool = GetThreadPool(getlib(cf->vsynth));
+		VsMutex_Lock(&wait.lock);
+		while (!wait.finished)
+		{
+			VsMutex_Unlock(&wait.lock);
+			ran = ThreadPool_RunPending(pool);
+			VsMutex_Lock(&wait.lock);
+			if (!ran && !wait.finished)
+				VsCond_Wait(&wait.cond, &wait.lock);
+		}
+		VsMutex_Unlock(&wait.lock);
+		// the waiter was freed by CompleteFetch
+		waiter = NULL;
+		frame = wait.frame;
+		break;
+
+	case FETCH_MISS:
+		// produce the frame without holding the lock
+		frame = cf->upstream->methods->get_frame(cf->upstream, n);
+		frame = CompleteFetch(cf, n, frame);
+		break;
+
+	case FETCH_DECOMPRESS:
+		frame = CompleteDecompress(cf, n, packed);
+		break;
+	}
+
+	free(waiter);
+	if (have_wait)
+	{
+		VsCond_Destroy(&wait.cond);
+		VsMutex_Destroy(&wait.lock);
+	}
+
+	return frame;
+}
+
+/// An asynchronous cache miss waiting for the upstream frame
+struct CacheFill {
+	struct CachedFilter *cf;
+	Vs_FrameNumber n;
+	Vs_FrameCallback callback;
+	void *userdata;
+};
+
+VSYNTH_IMPLEMENT_METHOD(void, CacheFillReady)(Vs_Frame frame, void *userdata)
+{
+	struct CacheFill *fill = (struct CacheFill *)userdata;
+
+	frame = CompleteFetch(fill->cf, fill->n, frame);
+	fill->callback(frame, fill->userdata);
+	free(fill);
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, CachedFilter_get_frame_async)(Vs_ActiveFilter filter, Vs_FrameNumber n, Vs_FrameCallback callback, void *userdata)
+{
+	struct CachedFilter *cf = GetCachedFilter(filter);
+	struct CacheWaiter *waiter = (struct CacheWaiter *)malloc(sizeof(struct CacheWaiter));
+	struct CacheFill *fill;
+	struct PackedFrame *packed = NULL;
+	Vs_Frame frame = NULL;
+
+	if (waiter != NULL)
+	{
+		waiter->callback = callback;
+		waiter->userdata = userdata;
+	}
+
+	switch (BeginFetch(cf, n, &frame, waiter, &packed))
+	{
+	case FETCH_HIT:
+		free(waiter);
+		callback(frame, userdata);
+		return;
+
+	case FETCH_WAITING:
+		// callback is made when the frame arrives
+		return;
+
+	case FETCH_MISS:
+		free(waiter);
+		break;
+
+	case FETCH_DECOMPRESS:
+		// decompressing is quick and runs in slices on the workers anyway
+		free(waiter);
+		callback(CompleteDecompress(cf, n, packed), userdata);
+		return;
+	}
+
+	fill = (struct CacheFill *)malloc(sizeof(struct CacheFill));
+	if (fill == NULL)
+	{
+		callback(CompleteFetch(cf, n, cf->upstream->methods->get_frame(cf->upstream, n)), userdata);
+		return;
+	}
+	fill->cf = cf;
+	fill->n = n;
+	fill->callback = callback;
+	fill->userdata = userdata;
+	cf->vsynth->Async->GetFrame(cf->vsynth, cf->upstream, n, CacheFillReady, fill);
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_FrameNumber, CachedFilter_get_frame_count)(Vs_ActiveFilter filter)
+{
+	struct CachedFilter *cf = GetCachedFilter(filter);
+	return cf->upstream->methods->get_frame_count(cf->upstream);
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Timestamp, CachedFilter_get_duration)(Vs_ActiveFilter filter)
+{
+	struct CachedFilter *cf = GetCachedFilter(filter);
+	return cf->upstream->methods->get_duration(cf->upstream);
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_FrameNumber, CachedFilter_frame_at_timestamp)(Vs_ActiveFilter filter, Vs_Timestamp t)
+{
+	struct CachedFilter *cf = GetCachedFilter(filter);
+	if (cf->upstream->methods->frame_at_timestamp != NULL)
+		return cf->upstream->methods->frame_at_timestamp(cf->upstream, t);
+	// probing through the cache keeps the frames seen for the playback that follows
+	return Seek_SearchFrames(filter, t);
+}
+
+struct TAG_Vs_ActiveFilterVirtual CachedFilter_vtable = {
+	CachedFilter_destroy,
+	CachedFilter_get_frame,
+	CachedFilter_get_frame_count,
+	CachedFilter_get_duration,
+	CachedFilter_get_frame_async,
+	CachedFilter_frame_at_timestamp
+};
+
+
+VSYNTH_IMPLEMENT_METHOD(Vs_ActiveFilter, Cache_Wrap)(Vs_Library vsynth, Vs_ActiveFilter upstream)
+{
+	struct CachedFilter *cf = (struct CachedFilter *)malloc(sizeof(struct CachedFilter));
+	if (cf == NULL)
+		return NULL;
+
+	cf->base.methods = &CachedFilter_vtable;
+	cf->base.filter = upstream->filter;
+	cf->vsynth = vsynth;
+	cf->upstream = upstream;
+	cf->cache = getlib(vsynth)->frame_cache;
+	cf->hits = 0;
+	cf->misses = 0;
+	cf->evictions = 0;
+	cf->frames_held = 0;
+	cf->bytes_held = 0;
+	cf->compressed_hits = 0;
+	cf->frames_compressed = 0;
+	cf->compressed_frames_held = 0;
+	cf->compressed_bytes_held = 0;
+	cf->compressed_source_bytes = 0;
+	cf->compress_ns = 0;
+	cf->decompress_ns = 0;
+
+	return &cf->base;
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, Cache_SetBudget)(Vs_Library vsynth, size_t max_bytes)
+{
+	struct FrameCache *cache = getlib(vsynth)->frame_cache;
+	struct CacheEntry *released = NULL;
+	struct CacheEntry *compress = NULL;
+
+	VsMutex_Lock(&cache->lock);
+	cache->budget = max_bytes;
+	EvictToBudget(cache, max_bytes, &released, &compress);
+	VsMutex_Unlock(&cache->lock);
+
+	FreeReleased(released);
+	CompressEvicted(cache, compress);
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, Cache_SetCompressedBudget)(Vs_Library vsynth, size_t max_bytes)
+{
+	struct FrameCache *cache = getlib(vsynth)->frame_cache;
+	struct CacheEntry *released = NULL;
+
+	VsMutex_Lock(&cache->lock);
+	cache->compressed_budget = max_bytes;
+	EvictCompressed(cache, max_bytes, &released);
+	VsMutex_Unlock(&cache->lock);
+
+	FreeReleased(released);
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, Cache_Flush)(Vs_Library vsynth)
+{
+	struct FrameCache *cache = getlib(vsynth)->frame_cache;
+	struct CacheEntry *released = NULL;
+
+	VsMutex_Lock(&cache->lock);
+	while (cache->lru.tail != NULL)
+		RemoveEntry(cache, cache->lru.tail, &released);
+	while (cache->compressed_lru.tail != NULL)
+		RemoveEntry(cache, cache->compressed_lru.tail, &released);
+	VsMutex_Unlock(&cache->lock);
+
+	FreeReleased(released);
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, Cache_GetStats)(Vs_Library vsynth, Vs_CacheStats *stats)
+{
+	struct FrameCache *cache = getlib(vsynth)->frame_cache;
+
+	VsMutex_Lock(&cache->lock);
+	stats->hits = cache->hits;
+	stats->misses = cache->misses;
+	stats->evictions = cache->evictions;
+	stats->frames_held = cache->entry_count;
+	stats->bytes_held = cache->bytes_held;
+	stats->budget = cache->budget;
+	stats->compressed_hits = cache->compressed_hits;
+	stats->frames_compressed = cache->frames_compressed;
+	stats->compressed_frames_held = cache->compressed_count;
+	stats->compressed_bytes_held = cache->compressed_bytes;
+	stats->compressed_source_bytes = cache->compressed_source_bytes;
+	stats->compressed_budget = cache->compressed_budget;
+	stats->compress_ns = cache->compress_ns;
+	stats->decompress_ns = cache->decompress_ns;
+	VsMutex_Unlock(&cache->lock);
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, Cache_GetFilterStats)(Vs_Library vsynth, Vs_ActiveFilter filter, Vs_CacheStats *stats)
+{
+	struct FrameCache *cache = getlib(vsynth)->frame_cache;
+	struct CachedFilter *cf = GetCachedFilter(filter);
+
+	memset(stats, 0, sizeof(*stats));
+	if (cf == NULL)
+		return;
+
+	VsMutex_Lock(&cache->lock);
+	stats->hits = cf->hits;
+	stats->misses = cf->misses;
+	stats->evictions = cf->evictions;
+	stats->frames_held = cf->frames_held;
+	stats->bytes_held = cf->bytes_held;
+	stats->budget = cache->budget;
+	stats->compressed_hits = cf->compressed_hits;
+	stats->frames_compressed = cf->frames_compressed;
+	stats->compressed_frames_held = cf->compressed_frames_held;
+	stats->compressed_bytes_held = cf->compressed_bytes_held;
+	stats->compressed_source_bytes = cf->compressed_source_bytes;
+	stats->compressed_budget = cache->compressed_budget;
+	stats->compress_ns = cf->compress_ns;
+	stats->decompress_ns = cf->decompress_ns;
+	VsMutex_Unlock(&cache->lock);
+}
+
+struct TAG_Vs_CacheAPI CacheAPI = {
+	Cache_Wrap,
+	Cache_SetBudget,
+	Cache_Flush,
+	Cache_GetStats,
+	Cache_GetFilterStats,
+	Cache_SetCompressedBudget
+};
+
+
+struct FrameCache *FrameCache_Create(Vs_Library vsynth)
+{
+	struct FrameCache *cache = (struct FrameCache *)malloc(sizeof(struct FrameCache));
+
+	cache->vsynth = vsynth;
+	VsMutex_Init(&cache->lock);
+	cache->slot_count = INITIAL_SLOTS;
+	cache->slots = (struct CacheEntry **)calloc(cache->slot_count, sizeof(struct CacheEntry *));
+	cache->entry_count = 0;
+	cache->lru.head = NULL;
+	cache->lru.tail = NULL;
+	cache->budget = DEFAULT_BUDGET;
+	cache->bytes_held = 0;
+	cache->hits = 0;
+	cache->misses = 0;
+	cache->evictions = 0;
+	cache->compressed_lru.head = NULL;
+	cache->compressed_lru.tail = NULL;
+	cache->compressed_budget = 0;
+	cache->compressed_count = 0;
+	cache->compressed_bytes = 0;
+	cache->compressed_source_bytes = 0;
+	cache->compressed_hits = 0;
+	cache->frames_compressed = 0;
+	cache->compress_ns = 0;
+	cache->decompress_ns = 0;
+
+	return cache;
+}
+
+void FrameCache_Destroy(struct FrameCache *cache)
+{
+	// all cached filters must be destroyed by now, so the cache is empty
+	free(cache->slots);
+	VsMutex_Destroy(&cache->lock);
+	free(cache);
+}
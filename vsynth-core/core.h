@@ -0,0 +1,142 @@
+#pragma once
+
+/*
+
+Internal declarations shared between the source files of the core library.
+
+*/
+
+#include <stddef.h>
+#include <vsynth/vsynth.h>
+#include "vsthread.h"
+
+
+struct FactoryList;
+struct FramePool;
+struct FrameCache;
+struct ThreadPool;
+struct PropertyCache;
+struct StringTable;
+struct Profiler;
+struct ShareTable;
+
+/// Private state of a library instance, wrapping the public interface
+struct LibraryInstance {
+	struct FactoryList *factory_list;
+	struct FramePool *frame_pool;
+	struct FrameCache *frame_cache;
+	/// Protects lazily initialised members
+	VsMutex lock;
+	/// Number of worker threads to start, 0 for one per processor
+	unsigned int thread_count;
+	/// Worker threads, started on first use
+	struct ThreadPool *thread_pool;
+	/// Property tables of the filter types seen, protected by lock
+	struct PropertyCache *property_cache;
+	/// Interned strings
+	struct StringTable *string_table;
+	/// Per-filter performance counters
+	struct Profiler *profiler;
+	/// Active filters shared between identical subgraphs
+	struct ShareTable *share_table;
+	struct TAG_Vs_Library public_interface;
+};
+
+INLINE static struct LibraryInstance *getlib(Vs_Library vsynth)
+{
+	return (struct LibraryInstance *)( ((volatile char *)vsynth) - offsetof(struct LibraryInstance,public_interface) );
+}
+
+
+// string.c
+extern struct TAG_Vs_StringAPI StringAPI;
+struct StringTable *StringTable_Create(void);
+void StringTable_Destroy(struct StringTable *table);
+
+// framepool.c
+extern struct TAG_Vs_FramePoolAPI FramePoolAPI;
+struct FramePool *FramePool_Create(void);
+void FramePool_Destroy(struct FramePool *pool);
+
+// cache.c
+extern struct TAG_Vs_CacheAPI CacheAPI;
+struct FrameCache *FrameCache_Create(Vs_Library vsynth);
+void FrameCache_Destroy(struct FrameCache *cache);
+
+// packframe.c
+/// A stdframe compressed losslessly
+struct PackedFrame;
+/// Compress a frame, NULL if it isn't a stdframe owning its pixels or out of memory
+struct PackedFrame *PackedFrame_Create(Vs_Library vsynth, Vs_Frame frame);
+/// Decompress a frame into a new stdframe, NULL if out of memory
+Vs_Frame PackedFrame_Unpack(Vs_Library vsynth, const struct PackedFrame *packed);
+/// Number of bytes of memory held by a compressed frame
+size_t PackedFrame_Size(const struct PackedFrame *packed);
+void PackedFrame_Destroy(struct PackedFrame *packed);
+
+// threadpool.c
+/// Type of functions run on the worker pool
+typedef void (*VsTaskFunc)(void *arg);
+extern struct TAG_Vs_ThreadPoolAPI ThreadPoolAPI;
+struct ThreadPool *ThreadPool_Create(unsigned int threads);
+void ThreadPool_Destroy(struct ThreadPool *pool);
+/// Queue a task to be run by a worker
+void ThreadPool_Submit(struct ThreadPool *pool, VsTaskFunc func, void *arg);
+/// Run one queued task on the calling thread, returns zero if there was none
+int ThreadPool_RunPending(struct ThreadPool *pool);
+unsigned int ThreadPool_Size(struct ThreadPool *pool);
+/// Get the library's worker pool, starting it if necessary
+struct ThreadPool *GetThreadPool(struct LibraryInstance *v);
+
+// frameserver.c
+extern struct TAG_Vs_FrameServerAPI FrameServerAPI;
+
+// async.c
+extern struct TAG_Vs_AsyncAPI AsyncAPI;
+
+// property.c
+extern struct TAG_Vs_PropertyAPI PropertyAPI;
+struct PropertyCache *PropertyCache_Create(void);
+void PropertyCache_Destroy(struct PropertyCache *cache);
+
+// graph.c
+extern struct TAG_Vs_GraphAPI GraphAPI;
+
+// profile.c
+extern struct TAG_Vs_ProfileAPI ProfileAPI;
+struct Profiler *Profiler_Create(void);
+void Profiler_Destroy(struct Profiler *p);
+/// Wrap an active filter for profiling if profiling is enabled
+Vs_ActiveFilter Profiler_Wrap(struct Profiler *p, Vs_Library vsynth, Vs_ActiveFilter upstream);
+/// Count a frame pool allocation against the profiled call running on this thread
+void Profiler_CountAlloc(struct Profiler *p, size_t size);
+
+// seek.c
+extern struct TAG_Vs_SeekAPI SeekAPI;
+/// Find the frame shown at time t by requesting frames, ignoring frame_at_timestamp
+///
+/// For wrappers whose upstream has no frame_at_timestamp, so the frames
+/// probed go through the wrapper.
+Vs_FrameNumber Seek_SearchFrames(Vs_ActiveFilter filter, Vs_Timestamp t);
+
+// share.c
+/// Structural key of an activation, see ShareTable_MakeKey
+struct ShareKey {
+	unsigned long long hash;
+	unsigned char *data;
+	size_t len;
+};
+struct ShareTable *ShareTable_Create(void);
+void ShareTable_Destroy(struct ShareTable *table);
+void ShareTable_SetEnabled(struct ShareTable *table, int enabled);
+/// Start an activation on the calling thread, hashes are kept until the outermost one leaves
+void ShareTable_Enter(struct ShareTable *table);
+void ShareTable_Leave(struct ShareTable *table);
+/// Find the key of activating a filter, returns zero if the activation can't be shared
+int ShareTable_MakeKey(struct ShareTable *table, Vs_Library vsynth, Vs_Filter filter, Vs_FrameTypeDescription **frametypes, struct ShareKey *key);
+/// Get a new handle to the active filter of a key, and fill in the frame types, NULL if there is none
+Vs_ActiveFilter ShareTable_Find(struct ShareTable *table, Vs_Filter filter, const struct ShareKey *key, Vs_FrameTypeDescription **frametypes);
+/// Share a newly activated filter under a key, taking over the key and the filter
+///
+/// Returns the handle to use, or the filter itself if it couldn't be shared.
+Vs_ActiveFilter ShareTable_Add(struct ShareTable *table, Vs_Filter filter, struct ShareKey *key, Vs_FrameTypeDescription **frametypes, Vs_ActiveFilter active);
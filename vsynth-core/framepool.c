@@ -0,0 +1,272 @@
+#include <stdlib.h>
+#include <string.h>
+#include <vsynth/vsynth.h>
+#include <vsynth/platform.h>
+#include "core.h"
+
+
+/*
+
+The frame pool keeps free lists of memory blocks, bucketed by frame pool key
+and block size. Every block carries a small header pointing back to its
+bucket, so a block can be returned to the right free list without the caller
+having to remember the key.
+
+Free lists are LIFO so the most recently released block, which is most likely
+to still be in cache, is handed out first.
+
+*/
+
+
+/// Default number of bytes the pool holds on to
+#define DEFAULT_RETENTION ((size_t)256*1024*1024)
+/// Number of hash slots for buckets, must be a power of two
+#define BUCKET_SLOTS 64
+/// Alignment of the memory blocks handed out
+#define BLOCK_ALIGNMENT 64
+/// Space reserved in front of each block for the header
+///
+/// Kept at a cache line so the header doesn't share a line with frame data,
+/// and so the block handed out keeps the alignment of the allocation.
+#define BLOCK_HEADER_SIZE 64
+
+
+struct PoolBucket;
+
+struct PoolBlock {
+	struct PoolBucket *bucket;
+	struct PoolBlock *next;
+};
+
+struct PoolBucket {
+	Vs_FramePoolKey key;
+	size_t size;
+	struct PoolBlock *free_list;
+	struct PoolBucket *next;
+};
+
+struct FramePool {
+	VsMutex lock;
+	struct PoolBucket *buckets[BUCKET_SLOTS];
+	size_t retention_limit;
+	size_t bytes_held;
+	size_t blocks_held;
+	unsigned long long hits;
+	unsigned long long misses;
+};
+
+
+INLINE static size_t HashKey(const Vs_FramePoolKey *key, size_t size)
+{
+	size_t h = (size_t)key->format;
+	h = h * 31 + (unsigned char)key->frame_type.id[0];
+	h = h * 31 + (unsigned char)key->frame_type.id[1];
+	h = h * 31 + (unsigned char)key->frame_type.id[2];
+	h = h * 31 + (unsigned char)key->frame_type.id[3];
+	h = h * 31 + key->width;
+	h = h * 31 + key->height;
+	h = h * 31 + size;
+	return h & (BUCKET_SLOTS - 1);
+}
+
+INLINE static int KeyEquals(const Vs_FramePoolKey *a, const Vs_FramePoolKey *b)
+{
+	return
+		memcmp(&a->frame_type, &b->frame_type, sizeof(Vs_FourCharId)) == 0 &&
+		a->format == b->format &&
+		a->width == b->width &&
+		a->height == b->height;
+}
+
+/// Find or create the bucket for a key and size, pool must be locked
+static struct PoolBucket *GetBucket(struct FramePool *pool, const Vs_FramePoolKey *key, size_t size)
+{
+	size_t slot = HashKey(key, size);
+	struct PoolBucket *bucket;
+
+	for (bucket = pool->buckets[slot]; bucket != NULL; bucket = bucket->next)
+	{
+		if (bucket->size == size && KeyEquals(&bucket->key, key))
+			return bucket;
+	}
+
+	bucket = (struct PoolBucket *)malloc(sizeof(struct PoolBucket));
+	if (bucket == NULL)
+		return NULL;
+	bucket->key = *key;
+	bucket->size = size;
+	bucket->free_list = NULL;
+	bucket->next = pool->buckets[slot];
+	pool->buckets[slot] = bucket;
+	return bucket;
+}
+
+/// Free held blocks until no more than limit bytes are held, pool must be locked
+static void TrimPool(struct FramePool *pool, size_t limit)
+{
+	size_t slot;
+	struct PoolBucket *bucket;
+	struct PoolBlock *block;
+
+	for (slot = 0; slot < BUCKET_SLOTS && pool->bytes_held > limit; slot++)
+	{
+		for (bucket = pool->buckets[slot]; bucket != NULL && pool->bytes_held > limit; bucket = bucket->next)
+		{
+			while (bucket->free_list != NULL && pool->bytes_held > limit)
+			{
+				block = bucket->free_list;
+				bucket->free_list = block->next;
+				pool->bytes_held -= bucket->size;
+				pool->blocks_held--;
+				Vs_AlignedFree(block);
+			}
+		}
+	}
+}
+
+
+VSYNTH_IMPLEMENT_METHOD(void *, FramePool_Alloc)(Vs_Library vsynth, const Vs_FramePoolKey *key, size_t size)
+{
+	struct FramePool *pool = getlib(vsynth)->frame_pool;
+	struct PoolBucket *bucket;
+	struct PoolBlock *block = NULL;
+
+	VsMutex_Lock(&pool->lock);
+	bucket = GetBucket(pool, key, size);
+	if (bucket == NULL)
+	{
+		VsMutex_Unlock(&pool->lock);
+		return NULL;
+	}
+	if (bucket->free_list != NULL)
+	{
+		block = bucket->free_list;
+		bucket->free_list = block->next;
+		pool->bytes_held -= size;
+		pool->blocks_held--;
+		pool->hits++;
+	}
+	else
+	{
+		pool->misses++;
+	}
+	VsMutex_Unlock(&pool->lock);
+
+	Profiler_CountAlloc(getlib(vsynth)->profiler, size);
+	if (block == NULL)
+	{
+		block = (struct PoolBlock *)Vs_AlignedAlloc(BLOCK_HEADER_SIZE + size, BLOCK_ALIGNMENT);
+		if (block == NULL)
+			return NULL;
+		block->bucket = bucket;
+	}
+	block->next = NULL;
+
+	return (char *)block + BLOCK_HEADER_SIZE;
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, FramePool_Release)(Vs_Library vsynth, void *ptr)
+{
+	struct FramePool *pool = getlib(vsynth)->frame_pool;
+	struct PoolBlock *block;
+	struct PoolBucket *bucket;
+
+	if (ptr == NULL)
+		return;
+
+	block = (struct PoolBlock *)((char *)ptr - BLOCK_HEADER_SIZE);
+	bucket = block->bucket;
+
+	VsMutex_Lock(&pool->lock);
+	if (pool->bytes_held + bucket->size <= pool->retention_limit)
+	{
+		block->next = bucket->free_list;
+		bucket->free_list = block;
+		pool->bytes_held += bucket->size;
+		pool->blocks_held++;
+		block = NULL;
+	}
+	VsMutex_Unlock(&pool->lock);
+
+	// over the retention limit, give it back to the system
+	Vs_AlignedFree(block);
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, FramePool_SetRetention)(Vs_Library vsynth, size_t max_bytes)
+{
+	struct FramePool *pool = getlib(vsynth)->frame_pool;
+
+	VsMutex_Lock(&pool->lock);
+	pool->retention_limit = max_bytes;
+	TrimPool(pool, max_bytes);
+	VsMutex_Unlock(&pool->lock);
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, FramePool_Flush)(Vs_Library vsynth)
+{
+	struct FramePool *pool = getlib(vsynth)->frame_pool;
+
+	VsMutex_Lock(&pool->lock);
+	TrimPool(pool, 0);
+	VsMutex_Unlock(&pool->lock);
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, FramePool_GetStats)(Vs_Library vsynth, Vs_FramePoolStats *stats)
+{
+	struct FramePool *pool = getlib(vsynth)->frame_pool;
+
+	VsMutex_Lock(&pool->lock);
+	stats->hits = pool->hits;
+	stats->misses = pool->misses;
+	stats->blocks_held = pool->blocks_held;
+	stats->bytes_held = pool->bytes_held;
+	stats->retention_limit = pool->retention_limit;
+	VsMutex_Unlock(&pool->lock);
+}
+
+struct TAG_Vs_FramePoolAPI FramePoolAPI = {
+	FramePool_Alloc,
+	FramePool_Release,
+	FramePool_SetRetention,
+	FramePool_Flush,
+	FramePool_GetStats
+};
+
+
+struct FramePool *FramePool_Create(void)
+{
+	struct FramePool *pool = (struct FramePool *)malloc(sizeof(struct FramePool));
+
+	VsMutex_Init(&pool->lock);
+	memset(pool->buckets, 0, sizeof(pool->buckets));
+	pool->retention_limit = DEFAULT_RETENTION;
+	pool->bytes_held = 0;
+	pool->blocks_held = 0;
+	pool->hits = 0;
+	pool->misses = 0;
+
+	return pool;
+}
+
+void FramePool_Destroy(struct FramePool *pool)
+{
+	size_t slot;
+	struct PoolBucket *bucket, *next;
+
+	// all frames must be gone by now, so every block is on a free list
+	TrimPool(pool, 0);
+
+	for (slot = 0; slot < BUCKET_SLOTS; slot++)
+	{
+		bucket = pool->buckets[slot];
+		while (bucket != NULL)
+		{
+			next = bucket->next;
+			free(bucket);
+			bucket = next;
+		}
+	}
+
+	VsMutex_Destroy(&pool->lock);
+	free(pool);
+}
@@ -0,0 +1,320 @@
+#include <stdlib.h>
+#include <vsynth/vsynth.h>
+#include "core.h"
+
+
+/*
+
+The frame server keeps a window of asynchronous frame requests in flight on
+the library's worker pool, starting at the next frame to be returned and extending
+lookahead frames ahead. Every request has a slot in a ring buffer indexed by
+frame number modulo the window size; since only frames within the window are
+ever requested, slots never collide.
+
+Results are handed out strictly in order. When the consumer asks for a frame
+that isn't ready yet, it helps running queued work instead of just blocking.
+
+Seeking bumps a generation counter. Requests from an older generation still
+finish, but their results are thrown away instead of being put in a slot.
+
+*/
+
+
+enum SlotState {
+	SLOT_EMPTY,
+	SLOT_PENDING,
+	SLOT_READY
+};
+
+struct ServerSlot {
+	Vs_FrameNumber n;
+	enum SlotState state;
+	Vs_Frame frame;
+};
+
+struct ServerRequest {
+	struct TAG_Vs_FrameServer *server;
+	Vs_FrameNumber n;
+	unsigned int generation;
+	struct ServerRequest *next;
+};
+
+struct TAG_Vs_FrameServer {
+	Vs_Library vsynth;
+	struct ThreadPool *pool;
+	Vs_ActiveFilter filter;
+	VsMutex lock;
+	/// Signalled whenever a request finishes
+	VsCond done;
+	size_t lookahead;
+	struct ServerSlot *slots;
+	/// Scratch space for frames dropped on seek
+	Vs_Frame *dropped;
+	/// Next frame number to return
+	Vs_FrameNumber next_out;
+	/// Next frame number to request
+	Vs_FrameNumber next_issue;
+	/// First frame number known to not exist
+	Vs_FrameNumber end;
+	unsigned int generation;
+	size_t in_flight;
+};
+
+
+/// Fill the request window, server must be locked
+///
+/// The requests are only queued on the pool by SubmitRequests, which must be
+/// called after unlocking, since the pool may run them right away.
+static struct ServerRequest *IssueRequests(struct TAG_Vs_FrameServer *server)
+{
+	struct ServerRequest *list = NULL;
+	struct ServerRequest *req;
+	struct ServerSlot *slot;
+
+	while (server->next_issue < server->end && server->next_issue < server->next_out + server->lookahead)
+	{
+		req = (struct ServerRequest *)malloc(sizeof(struct ServerRequest));
+		if (req == NULL)
+			break;
+		req->server = server;
+		req->n = server->next_issue;
+		req->generation = server->generation;
+		req->next = list;
+		list = req;
+
+		slot = &server->slots[req->n % server->lookahead];
+		slot->n = req->n;
+		slot->state = SLOT_PENDING;
+		slot->frame = NULL;
+
+		server->in_flight++;
+		server->next_issue++;
+	}
+
+	return list;
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, ServeRequest)(Vs_Frame frame, void *userdata)
+{
+	struct ServerRequest *req = (struct ServerRequest *)userdata;
+	struct TAG_Vs_FrameServer *server = req->server;
+	struct ServerSlot *slot;
+
+	VsMutex_Lock(&server->lock);
+	if (req->generation == server->generation)
+	{
+		slot = &server->slots[req->n % server->lookahead];
+		slot->frame = frame;
+		slot->state = SLOT_READY;
+		frame = NULL;
+		// past the end, and so is everything after it
+		if (slot->frame == NULL && req->n < server->end)
+			server->end = req->n;
+	}
+	server->in_flight--;
+	VsCond_Broadcast(&server->done);
+	VsMutex_Unlock(&server->lock);
+
+	// result from before a seek
+	if (frame != NULL)
+		frame->methods->unref(frame);
+	free(req);
+}
+
+static void SubmitRequests(struct TAG_Vs_FrameServer *server, struct ServerRequest *list)
+{
+	struct ServerRequest *next;
+
+	// list was built backwards, reverse it so earlier frames are queued first
+	struct ServerRequest *ordered = NULL;
+	while (list != NULL)
+	{
+		next = list->next;
+		list->next = ordered;
+		ordered = list;
+		list = next;
+	}
+
+	while (ordered != NULL)
+	{
+		next = ordered->next;
+		AsyncAPI.GetFrame(server->vsynth, server->filter, ordered->n, ServeRequest, ordered);
+		ordered = next;
+	}
+}
+
+/// Drop all finished results, server must be locked
+///
+/// The frames are moved to the dropped array, to be released by ReleaseSlots
+/// after unlocking.
+static void ClearSlots(struct TAG_Vs_FrameServer *server)
+{
+	size_t i;
+
+	for (i = 0; i < server->lookahead; i++)
+	{
+		server->dropped[i] = NULL;
+		if (server->slots[i].state == SLOT_READY)
+			server->dropped[i] = server->slots[i].frame;
+		server->slots[i].state = SLOT_EMPTY;
+		server->slots[i].frame = NULL;
+	}
+}
+
+static void ReleaseSlots(struct TAG_Vs_FrameServer *server)
+{
+	size_t i;
+
+	for (i = 0; i < server->lookahead; i++)
+	{
+		if (server->dropped[i] != NULL)
+			server->dropped[i]->methods->unref(server->dropped[i]);
+		server->dropped[i] = NULL;
+	}
+}
+
+
+VSYNTH_IMPLEMENT_METHOD(Vs_FrameServer, FrameServer_Create)(Vs_Library vsynth, Vs_ActiveFilter filter, Vs_FrameNumber start, size_t lookahead)
+{
+	struct TAG_Vs_FrameServer *server;
+	struct ThreadPool *pool = GetThreadPool(getlib(vsynth));
+	size_t i;
+
+	if (lookahead == 0)
+		lookahead = 2 * (size_t)ThreadPool_Size(pool) + 1;
+
+	server = (struct TAG_Vs_FrameServer *)malloc(sizeof(struct TAG_Vs_FrameServer));
+	if (server == NULL)
+		return NULL;
+	server->slots = (struct ServerSlot *)malloc(lookahead * sizeof(struct ServerSlot));
+	server->dropped = (Vs_Frame *)malloc(lookahead * sizeof(Vs_Frame));
+	if (server->slots == NULL || server->dropped == NULL)
+	{
+		free(server->slots);
+		free(server->dropped);
+		free(server);
+		return NULL;
+	}
+
+	server->vsynth = vsynth;
+	server->pool = pool;
+	server->filter = filter;
+	VsMutex_Init(&server->lock);
+	VsCond_Init(&server->done);
+	server->lookahead = lookahead;
+	for (i = 0; i < lookahead; i++)
+	{
+		server->slots[i].n = 0;
+		server->slots[i].state = SLOT_EMPTY;
+		server->slots[i].frame = NULL;
+		server->dropped[i] = NULL;
+	}
+	server->next_out = start;
+	server->next_issue = start;
+	server->end = filter->methods->get_frame_count(filter);
+	server->generation = 0;
+	server->in_flight = 0;
+
+	return server;
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Frame, FrameServer_Next)(Vs_FrameServer server, Vs_FrameNumber *n)
+{
+	struct ServerSlot *slot;
+	struct ServerRequest *issued;
+	struct ServerRequest *more;
+	Vs_Frame frame;
+	int ran;
+
+	VsMutex_Lock(&server->lock);
+	for (;;)
+	{
+		if (server->next_out >= server->end)
+		{
+			VsMutex_Unlock(&server->lock);
+			return NULL;
+		}
+
+		issued = IssueRequests(server);
+		slot = &server->slots[server->next_out % server->lookahead];
+		if (slot->state == SLOT_READY && slot->n == server->next_out)
+			break;
+
+		// not ready yet, help out with the queue while waiting
+		VsMutex_Unlock(&server->lock);
+		SubmitRequests(server, issued);
+		ran = ThreadPool_RunPending(server->pool);
+		VsMutex_Lock(&server->lock);
+
+		if (!ran && !(slot->state == SLOT_READY && slot->n == server->next_out))
+			VsCond_Wait(&server->done, &server->lock);
+	}
+
+	frame = slot->frame;
+	slot->state = SLOT_EMPTY;
+	slot->frame = NULL;
+	if (frame != NULL)
+	{
+		if (n != NULL)
+			*n = server->next_out;
+		server->next_out++;
+	}
+	// the window moved, keep the workers busy
+	more = IssueRequests(server);
+	VsMutex_Unlock(&server->lock);
+
+	SubmitRequests(server, issued);
+	SubmitRequests(server, more);
+
+	return frame;
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, FrameServer_Seek)(Vs_FrameServer server, Vs_FrameNumber n)
+{
+	Vs_FrameNumber end = server->filter->methods->get_frame_count(server->filter);
+
+	VsMutex_Lock(&server->lock);
+	server->generation++;
+	ClearSlots(server);
+	server->next_out = n;
+	server->next_issue = n;
+	// an end found by a missing frame only holds until it is requested again
+	server->end = end;
+	VsMutex_Unlock(&server->lock);
+
+	ReleaseSlots(server);
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, FrameServer_Destroy)(Vs_FrameServer server)
+{
+	int ran;
+
+	// outstanding requests still reference the server, wait them out
+	VsMutex_Lock(&server->lock);
+	server->generation++;
+	while (server->in_flight > 0)
+	{
+		VsMutex_Unlock(&server->lock);
+		ran = ThreadPool_RunPending(server->pool);
+		VsMutex_Lock(&server->lock);
+		if (!ran && server->in_flight > 0)
+			VsCond_Wait(&server->done, &server->lock);
+	}
+	ClearSlots(server);
+	VsMutex_Unlock(&server->lock);
+
+	ReleaseSlots(server);
+
+	VsCond_Destroy(&server->done);
+	VsMutex_Destroy(&server->lock);
+	free(server->slots);
+	free(server->dropped);
+	free(server);
+}
+
+struct TAG_Vs_FrameServerAPI FrameServerAPI = {
+	FrameServer_Create,
+	FrameServer_Next,
+	FrameServer_Seek,
+	FrameServer_Destroy
+};
@@ -0,0 +1,405 @@
+#include <stdlib.h>
+#include <vsynth/vsynth.h>
+#include "core.h"
+
+
+/*
+
+Activation goes through the library so it can wrap active filters in its own
+services: profiling, and sharing one active filter between all activations
+of identical subgraphs, see share.c.
+
+Optimizing rewrites a graph of filter prototypes before it is activated.
+The graph is walked depth first from the output towards the sources, with
+an explicit stack, as edit decision lists can nest filters thousands deep.
+A filter is finished after its input clips: if any of them was replaced, the
+filter is cloned onto the replacements, then its optimize method may replace
+it in turn. A replacement is pushed back on the stack, so it is optimized
+like any other filter, and once done stands in for the filter it replaced.
+
+Finished filters are kept in a hash table keyed by pointer, mapping each to
+its replacement, so a filter reached through several paths is only
+optimized once and its replacement is shared the same way. The table holds
+references to both, keeping the keys alive so their addresses can't be
+reused during the walk.
+
+*/
+
+
+VSYNTH_IMPLEMENT_METHOD(Vs_ActiveFilter, Graph_Activate)(Vs_Library vsynth, Vs_Filter filter, Vs_String *error, Vs_FrameTypeDescription **frametypes)
+{
+	struct LibraryInstance *v = getlib(vsynth);
+	struct ShareKey key;
+	Vs_ActiveFilter active = NULL;
+	int shared;
+
+	ShareTable_Enter(v->share_table);
+	shared = ShareTable_MakeKey(v->share_table, vsynth, filter, frametypes, &key);
+	if (shared)
+		active = ShareTable_Find(v->share_table, filter, &key, frametypes);
+	if (active != NULL)
+	{
+		free(key.data);
+		ShareTable_Leave(v->share_table);
+		return active;
+	}
+
+	active = filter->methods->activate(filter, error, frametypes);
+	if (active != NULL)
+	{
+		active = Profiler_Wrap(v->profiler, vsynth, active);
+		if (shared)
+			active = ShareTable_Add(v->share_table, filter, &key, frametypes, active);
+	}
+	else if (shared)
+		free(key.data);
+	ShareTable_Leave(v->share_table);
+	return active;
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, Graph_SetSharing)(Vs_Library vsynth, int enabled)
+{
+	ShareTable_SetEnabled(getlib(vsynth)->share_table, enabled);
+}
+
+
+/*
+	Optimizing
+*/
+
+/// Initial number of hash slots, must be a power of two
+#define INITIAL_SLOTS 64
+
+/// A finished filter and the filter standing in for it
+struct Rewrite {
+	Vs_Filter key;
+	Vs_Filter result;
+};
+
+/// A filter on the walk stack
+struct OptimizeTask {
+	Vs_Filter node;
+	/// Filter node replaces, or NULL
+	///
+	/// The task holds a reference to node if this is set.
+	Vs_Filter replaces;
+	/// Set once the input clips have been pushed
+	int expanded;
+};
+
+struct Optimizer {
+	Vs_Library vsynth;
+	/// Open addressed, with linear probing
+	struct Rewrite *slots;
+	size_t slot_count;
+	size_t count;
+	struct OptimizeTask *stack;
+	size_t depth;
+	size_t stack_size;
+	/// Property IDs of the clips of the filter being looked at
+	Vs_PropertyId *clip_ids;
+	size_t clip_count;
+	size_t clip_size;
+	/// Property index counted up while enumerating
+	Vs_PropertyId next_id;
+	/// Set when memory ran out, the walk is abandoned
+	int failed;
+};
+
+INLINE static size_t HashFilter(Vs_Filter filter, size_t slot_count)
+{
+	size_t h = (size_t)filter;
+	// filters are pointer aligned, the low bits carry no information
+	h ^= h >> 4;
+	h ^= h >> 12;
+	return h & (slot_count - 1);
+}
+
+static struct Rewrite *Optimizer_Find(struct Optimizer *opt, Vs_Filter key)
+{
+	size_t i = HashFilter(key, opt->slot_count);
+
+	while (opt->slots[i].key != NULL)
+	{
+		if (opt->slots[i].key == key)
+			return &opt->slots[i];
+		i = (i + 1) & (opt->slot_count - 1);
+	}
+	return NULL;
+}
+
+/// Look up the replacement of a finished filter, NULL if it isn't finished
+static Vs_Filter Optimizer_Lookup(struct Optimizer *opt, Vs_Filter key)
+{
+	struct Rewrite *r = Optimizer_Find(opt, key);
+	return r != NULL ? r->result : NULL;
+}
+
+/// Record the replacement of a filter, taking a reference to both
+static void Optimizer_Add(struct Optimizer *opt, Vs_Filter key, Vs_Filter result)
+{
+	struct Rewrite *slots;
+	size_t i, j, count;
+
+	if (Optimizer_Find(opt, key) != NULL)
+		return;
+	// keep the table at most half full
+	if ((opt->count + 1) * 2 > opt->slot_count)
+	{
+		count = opt->slot_count * 2;
+		slots = (struct Rewrite *)calloc(count, sizeof(struct Rewrite));
+		if (slots == NULL)
+		{
+			opt->failed = 1;
+			return;
+		}
+		for (i = 0; i < opt->slot_count; i++)
+		{
+			if (opt->slots[i].key == NULL)
+				continue;
+			j = HashFilter(opt->slots[i].key, count);
+			while (slots[j].key != NULL)
+				j = (j + 1) & (count - 1);
+			slots[j] = opt->slots[i];
+		}
+		free(opt->slots);
+		opt->slots = slots;
+		opt->slot_count = count;
+	}
+
+	i = HashFilter(key, opt->slot_count);
+	while (opt->slots[i].key != NULL)
+		i = (i + 1) & (opt->slot_count - 1);
+	key->methods->addref(key);
+	result->methods->addref(result);
+	opt->slots[i].key = key;
+	opt->slots[i].result = result;
+	opt->count++;
+}
+
+/// Push a filter on the walk stack, taking over the reference if replaces is set
+static void Optimizer_Push(struct Optimizer *opt, Vs_Filter node, Vs_Filter replaces)
+{
+	struct OptimizeTask *grown;
+
+	if (opt->depth == opt->stack_size)
+	{
+		grown = (struct OptimizeTask *)realloc(opt->stack, opt->stack_size * 2 * sizeof(struct OptimizeTask));
+		if (grown == NULL)
+		{
+			opt->failed = 1;
+			if (replaces != NULL)
+				node->methods->unref(node);
+			return;
+		}
+		opt->stack = grown;
+		opt->stack_size *= 2;
+	}
+	opt->stack[opt->depth].node = node;
+	opt->stack[opt->depth].replaces = replaces;
+	opt->stack[opt->depth].expanded = 0;
+	opt->depth++;
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, CollectClipId)(const char *name, enum Vs_PropertyType type, void *userdata)
+{
+	struct Optimizer *opt = (struct Optimizer *)userdata;
+	Vs_PropertyId *grown;
+
+	if (type == PROP_FILTER)
+	{
+		if (opt->clip_count == opt->clip_size)
+		{
+			grown = (Vs_PropertyId *)realloc(opt->clip_ids, (opt->clip_size ? opt->clip_size * 2 : 8) * sizeof(Vs_PropertyId));
+			if (grown == NULL)
+			{
+				opt->failed = 1;
+				opt->next_id++;
+				return;
+			}
+			opt->clip_ids = grown;
+			opt->clip_size = opt->clip_size ? opt->clip_size * 2 : 8;
+		}
+		opt->clip_ids[opt->clip_count++] = opt->next_id;
+	}
+	// IDs are the enumeration order
+	opt->next_id++;
+}
+
+/// Find the properties of Filter type of a filter
+static void Optimizer_FindClips(struct Optimizer *opt, Vs_Filter node)
+{
+	opt->clip_count = 0;
+	opt->next_id = 0;
+	node->methods->enum_properties(CollectClipId, opt);
+}
+
+static Vs_Filter GetClip(struct Optimizer *opt, Vs_Filter node, Vs_PropertyId id)
+{
+	Vs_PropertyValue value;
+
+	if (!PropertyAPI.Get(opt->vsynth, node, id, &value) || value.type != PROP_FILTER)
+		return NULL;
+	return value.v.f;
+}
+
+/// Push the input clips of a filter that aren't finished yet
+static void Optimizer_Expand(struct Optimizer *opt, Vs_Filter node)
+{
+	Vs_Filter clip;
+	size_t i;
+
+	Optimizer_FindClips(opt, node);
+	for (i = 0; i < opt->clip_count && !opt->failed; i++)
+	{
+		clip = GetClip(opt, node, opt->clip_ids[i]);
+		if (clip == NULL)
+			continue;
+		// node keeps the clip alive
+		if (Optimizer_Lookup(opt, clip) == NULL)
+			Optimizer_Push(opt, clip, NULL);
+		clip->methods->unref(clip);
+	}
+}
+
+/// Put a filter onto the replacements of its input clips
+///
+/// Returns a new reference to the filter itself if no clip was replaced,
+/// otherwise to a clone.
+static Vs_Filter Optimizer_Rebuild(struct Optimizer *opt, Vs_Filter node)
+{
+	Vs_Filter result = NULL, clip, replacement;
+	Vs_PropertyValue value;
+	size_t i;
+
+	Optimizer_FindClips(opt, node);
+	for (i = 0; i < opt->clip_count; i++)
+	{
+		clip = GetClip(opt, node, opt->clip_ids[i]);
+		if (clip == NULL)
+			continue;
+		replacement = Optimizer_Lookup(opt, clip);
+		if (replacement != NULL && replacement != clip)
+		{
+			if (result == NULL)
+				result = node->methods->clone(node);
+			value.type = PROP_FILTER;
+			value.v.f = replacement;
+			PropertyAPI.Set(opt->vsynth, result, opt->clip_ids[i], &value);
+		}
+		clip->methods->unref(clip);
+	}
+	if (result == NULL)
+	{
+		node->methods->addref(node);
+		result = node;
+	}
+	return result;
+}
+
+/// Finish the filter on top of the stack, its input clips are finished
+static void Optimizer_Finish(struct Optimizer *opt)
+{
+	struct OptimizeTask task = opt->stack[opt->depth - 1];
+	Vs_Filter result, rewritten;
+
+	result = Optimizer_Lookup(opt, task.node);
+	if (result == NULL)
+	{
+		result = Optimizer_Rebuild(opt, task.node);
+		rewritten = result->methods->optimize != NULL ? result->methods->optimize(result) : NULL;
+		if (rewritten != NULL)
+		{
+			// the replacement takes this task's place, and stands in for it when done
+			result->methods->unref(result);
+			opt->stack[opt->depth - 1].node = rewritten;
+			opt->stack[opt->depth - 1].replaces = task.replaces != NULL ? task.replaces : task.node;
+			opt->stack[opt->depth - 1].expanded = 0;
+			if (task.replaces != NULL)
+				task.node->methods->unref(task.node);
+			return;
+		}
+		Optimizer_Add(opt, task.node, result);
+		// a rewritten graph is already optimized
+		Optimizer_Add(opt, result, result);
+		result->methods->unref(result);
+		result = Optimizer_Lookup(opt, task.node);
+	}
+
+	opt->depth--;
+	if (task.replaces != NULL)
+	{
+		if (result != NULL)
+			Optimizer_Add(opt, task.replaces, result);
+		task.node->methods->unref(task.node);
+	}
+}
+
+static void Optimizer_Free(struct Optimizer *opt)
+{
+	size_t i;
+
+	for (i = 0; i < opt->depth; i++)
+	{
+		if (opt->stack[i].replaces != NULL)
+			opt->stack[i].node->methods->unref(opt->stack[i].node);
+	}
+	for (i = 0; opt->slots != NULL && i < opt->slot_count; i++)
+	{
+		if (opt->slots[i].key == NULL)
+			continue;
+		opt->slots[i].key->methods->unref(opt->slots[i].key);
+		opt->slots[i].result->methods->unref(opt->slots[i].result);
+	}
+	free(opt->slots);
+	free(opt->stack);
+	free(opt->clip_ids);
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Filter, Graph_Optimize)(Vs_Library vsynth, Vs_Filter filter)
+{
+	struct Optimizer opt;
+	struct OptimizeTask *top;
+	Vs_Filter result = NULL;
+
+	opt.vsynth = vsynth;
+	opt.slot_count = INITIAL_SLOTS;
+	opt.count = 0;
+	opt.slots = (struct Rewrite *)calloc(opt.slot_count, sizeof(struct Rewrite));
+	opt.stack_size = 16;
+	opt.depth = 0;
+	opt.stack = (struct OptimizeTask *)malloc(opt.stack_size * sizeof(struct OptimizeTask));
+	opt.clip_ids = NULL;
+	opt.clip_count = 0;
+	opt.clip_size = 0;
+	opt.failed = opt.slots == NULL || opt.stack == NULL;
+
+	if (!opt.failed)
+		Optimizer_Push(&opt, filter, NULL);
+	while (opt.depth > 0 && !opt.failed)
+	{
+		top = &opt.stack[opt.depth - 1];
+		if (Optimizer_Lookup(&opt, top->node) != NULL || top->expanded)
+		{
+			Optimizer_Finish(&opt);
+			continue;
+		}
+		top->expanded = 1;
+		Optimizer_Expand(&opt, top->node);
+	}
+
+	// optimizing is only an improvement, without memory the graph is used as it is
+	if (!opt.failed)
+		result = Optimizer_Lookup(&opt, filter);
+	if (result == NULL)
+		result = filter;
+	result->methods->addref(result);
+	Optimizer_Free(&opt);
+	return result;
+}
+
+struct TAG_Vs_GraphAPI GraphAPI = {
+	Graph_Activate,
+	Graph_Optimize,
+	Graph_SetSharing
+};
@@ -0,0 +1,546 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <vsynth/vsynth.h>
+#include <vsynth/stdframe.h>
+#include "core.h"
+
+
+/*
+
+Lossless compression of stdframes, for the compressed tier of the frame
+cache. It has to be fast in both directions, decoding most of all, since
+every hit on the compressed tier waits for it, so it is a simple predictor
+followed by bit packing rather than a real entropy coder.
+
+Each plane is coded on its own. Every sample is predicted from its left,
+upper and upper left neighbours as left + up - upleft, the same channel of
+the pixel before for packed RGB, and the difference from the prediction is
+zigzag mapped so small differences of either sign become small numbers. The
+first line of a band is predicted from the left only, the first pixel of a
+line is predicted from above. Smooth picture areas give differences of a few
+bits, flat ones give zeros.
+
+The differences are written in blocks of 16: a byte holding the number of
+bits of the largest difference of the block, followed by all 16 differences
+in that many bits, so 16 * bits / 8 bytes. A flat area costs one byte per 16
+samples, noise costs a little more than the samples themselves.
+
+Frames are coded in bands of BAND_LINES scanlines, each band of each plane
+independent of the others, with an offset table to find them. Coding and
+decoding run the bands in parallel slices on the worker threads. Coding
+writes every band at the offset of its worst case size, and the bands are
+moved together afterwards, so no band has to wait for the size of the ones
+before it.
+
+All loops work on whole lines with no dependencies between samples except
+for the running sum undoing the left prediction, so compilers vectorise
+them.
+
+*/
+
+
+/// Scanlines per independently coded band, a multiple of every subsampling factor
+#define BAND_LINES 32
+/// Samples per block of bit packed differences
+#define BLOCK_SAMPLES 16
+
+struct PackedFrame {
+	Vs_Timestamp timestamp;
+	enum Vs_StdframePixelFormat pixfmt;
+	size_t width, height;
+	size_t padding_right, padding_bottom;
+	size_t bands;
+	size_t planes;
+	/// Coded bands, each holding its planes in order
+	unsigned char *data;
+	size_t data_size;
+	/// Offset in data of each plane of each band, bands * planes + 1 entries
+	size_t offsets[1];
+};
+
+/// Layout of the samples of one plane
+struct PlaneShape {
+	/// Bytes per sample, 1 or 2
+	size_t sample_bytes;
+	/// Samples per pixel, 4 for packed RGB, 1 otherwise
+	size_t channels;
+	/// Samples per line
+	size_t samples;
+	size_t lines;
+	size_t heightscale;
+};
+
+static void GetPlaneShape(enum Vs_StdframePixelFormat pixfmt, size_t width, size_t height, size_t plane, struct PlaneShape *shape)
+{
+	size_t pixelsize = STDPIXFMT_pixelsize(pixfmt);
+	size_t wscale = STDPIXFMT_planewidthscale(pixfmt, plane);
+
+	shape->channels = pixelsize >= 4 ? 4 : 1;
+	shape->sample_bytes = pixelsize / shape->channels;
+	shape->samples = (width + wscale-1) / wscale * shape->channels;
+	shape->heightscale = STDPIXFMT_planeheightscale(pixfmt, plane);
+	shape->lines = (height + shape->heightscale-1) / shape->heightscale;
+}
+
+/// Get the lines of a plane in a band
+static void BandLines(const struct PlaneShape *shape, size_t band, size_t *top, size_t *count)
+{
+	size_t bottom = (band + 1) * BAND_LINES / shape->heightscale;
+
+	*top = band * BAND_LINES / shape->heightscale;
+	if (bottom > shape->lines)
+		bottom = shape->lines;
+	*count = bottom > *top ? bottom - *top : 0;
+}
+
+/// Largest number of bytes a band of a plane can be coded in
+static size_t WorstCase(const struct PlaneShape *shape, size_t lines)
+{
+	size_t blocks = (shape->samples * lines + BLOCK_SAMPLES-1) / BLOCK_SAMPLES;
+	return blocks * (1 + BLOCK_SAMPLES * shape->sample_bytes);
+}
+
+
+/*
+	Prediction
+*/
+
+INLINE static uint16_t Zigzag8(uint8_t v)
+{
+	return (uint8_t)((v << 1) ^ (0u - (v >> 7)));
+}
+
+INLINE static uint16_t Zigzag16(uint16_t v)
+{
+	return (uint16_t)((v << 1) ^ (0u - (v >> 15)));
+}
+
+INLINE static uint16_t Unzigzag(uint16_t v)
+{
+	return (uint16_t)((v >> 1) ^ (0u - (v & 1)));
+}
+
+/// Find the zigzagged prediction differences of lines of 8 bit samples
+static void Predict8(uint16_t *res, const unsigned char *src, ptrdiff_t stride, size_t samples, size_t lines, size_t ch)
+{
+	const uint8_t *s, *up;
+	size_t x, y;
+
+	for (y = 0; y < lines; y++, res += samples)
+	{
+		s = (const uint8_t *)src + (ptrdiff_t)y * stride;
+		if (y == 0)
+		{
+			for (x = 0; x < ch; x++)
+				res[x] = Zigzag8(s[x]);
+			for (x = ch; x < samples; x++)
+				res[x] = Zigzag8((uint8_t)(s[x] - s[x-ch]));
+		}
+		else
+		{
+			up = s - stride;
+			for (x = 0; x < ch; x++)
+				res[x] = Zigzag8((uint8_t)(s[x] - up[x]));
+			for (x = ch; x < samples; x++)
+				res[x] = Zigzag8((uint8_t)(s[x] - s[x-ch] - up[x] + up[x-ch]));
+		}
+	}
+}
+
+/// Find the zigzagged prediction differences of lines of 16 bit samples
+static void Predict16(uint16_t *res, const unsigned char *src, ptrdiff_t stride, size_t samples, size_t lines, size_t ch)
+{
+	const uint16_t *s, *up;
+	size_t x, y;
+
+	for (y = 0; y < lines; y++, res += samples)
+	{
+		s = (const uint16_t *)(src + (ptrdiff_t)y * stride);
+		if (y == 0)
+		{
+			for (x = 0; x < ch; x++)
+				res[x] = Zigzag16(s[x]);
+			for (x = ch; x < samples; x++)
+				res[x] = Zigzag16((uint16_t)(s[x] - s[x-ch]));
+		}
+		else
+		{
+			up = (const uint16_t *)((const unsigned char *)s - stride);
+			for (x = 0; x < ch; x++)
+				res[x] = Zigzag16((uint16_t)(s[x] - up[x]));
+			for (x = ch; x < samples; x++)
+				res[x] = Zigzag16((uint16_t)(s[x] - s[x-ch] - up[x] + up[x-ch]));
+		}
+	}
+}
+
+/// Undo the left prediction of a line of differences, in place
+static void Accumulate(uint16_t *res, size_t samples, size_t ch)
+{
+	size_t x;
+
+	for (x = 0; x < samples; x++)
+		res[x] = Unzigzag(res[x]);
+	for (x = ch; x < samples; x++)
+		res[x] = (uint16_t)(res[x] + res[x-ch]);
+}
+
+/// Rebuild lines of 8 bit samples from their differences, destroys res
+static void Reconstruct8(unsigned char *dst, ptrdiff_t stride, uint16_t *res, size_t samples, size_t lines, size_t ch)
+{
+	uint8_t *d;
+	const uint8_t *up;
+	size_t x, y;
+
+	for (y = 0; y < lines; y++, res += samples)
+	{
+		d = (uint8_t *)dst + (ptrdiff_t)y * stride;
+		Accumulate(res, samples, ch);
+		if (y == 0)
+		{
+			for (x = 0; x < samples; x++)
+				d[x] = (uint8_t)res[x];
+		}
+		else
+		{
+			up = d - stride;
+			for (x = 0; x < samples; x++)
+				d[x] = (uint8_t)(res[x] + up[x]);
+		}
+	}
+}
+
+/// Rebuild lines of 16 bit samples from their differences, destroys res
+static void Reconstruct16(unsigned char *dst, ptrdiff_t stride, uint16_t *res, size_t samples, size_t lines, size_t ch)
+{
+	uint16_t *d;
+	const uint16_t *up;
+	size_t x, y;
+
+	for (y = 0; y < lines; y++, res += samples)
+	{
+		d = (uint16_t *)(dst + (ptrdiff_t)y * stride);
+		Accumulate(res, samples, ch);
+		if (y == 0)
+		{
+			for (x = 0; x < samples; x++)
+				d[x] = res[x];
+		}
+		else
+		{
+			up = (const uint16_t *)((const unsigned char *)d - stride);
+			for (x = 0; x < samples; x++)
+				d[x] = (uint16_t)(res[x] + up[x]);
+		}
+	}
+}
+
+
+/*
+	Bit packing
+*/
+
+/// Write count differences as bit packed blocks, returns the number of bytes written
+static size_t PackBlocks(unsigned char *out, const uint16_t *res, size_t count)
+{
+	unsigned char *start = out;
+	uint16_t block[BLOCK_SAMPLES];
+	const uint16_t *v;
+	unsigned int bits, nbits, any, i;
+	uint64_t acc;
+	size_t pos;
+
+	for (pos = 0; pos < count; pos += BLOCK_SAMPLES)
+	{
+		v = res + pos;
+		if (count - pos < BLOCK_SAMPLES)
+		{
+			// the last block is filled up with zeros
+			memset(block, 0, sizeof(block));
+			memcpy(block, v, (count - pos) * sizeof(uint16_t));
+			v = block;
+		}
+		any = 0;
+		for (i = 0; i < BLOCK_SAMPLES; i++)
+			any |= v[i];
+		for (bits = 0; any != 0; bits++)
+			any >>= 1;
+
+		*out++ = (unsigned char)bits;
+		if (bits == 0)
+			continue;
+		// 16 samples make whole bytes at any width
+		acc = 0;
+		nbits = 0;
+		for (i = 0; i < BLOCK_SAMPLES; i++)
+		{
+			acc |= (uint64_t)v[i] << nbits;
+			nbits += bits;
+			if (nbits >= 32)
+			{
+				out[0] = (unsigned char)acc;
+				out[1] = (unsigned char)(acc >> 8);
+				out[2] = (unsigned char)(acc >> 16);
+				out[3] = (unsigned char)(acc >> 24);
+				out += 4;
+				acc >>= 32;
+				nbits -= 32;
+			}
+		}
+		for (; nbits > 0; nbits -= 8)
+		{
+			*out++ = (unsigned char)acc;
+			acc >>= 8;
+		}
+	}
+	return (size_t)(out - start);
+}
+
+/// Read count differences from bit packed blocks, rounded up to whole blocks
+///
+/// res must have room for the rounded up count.
+static void UnpackBlocks(uint16_t *res, const unsigned char *in, size_t count)
+{
+	unsigned int bits, nbits, i;
+	uint64_t acc;
+	uint16_t mask;
+	size_t pos;
+
+	for (pos = 0; pos < count; pos += BLOCK_SAMPLES, res += BLOCK_SAMPLES)
+	{
+		bits = *in++;
+		if (bits == 0)
+		{
+			memset(res, 0, BLOCK_SAMPLES * sizeof(uint16_t));
+			continue;
+		}
+		mask = (uint16_t)((1u << bits) - 1);
+		acc = 0;
+		nbits = 0;
+		for (i = 0; i < BLOCK_SAMPLES; i++)
+		{
+			while (nbits < bits)
+			{
+				acc |= (uint64_t)*in++ << nbits;
+				nbits += 8;
+			}
+			res[i] = (uint16_t)acc & mask;
+			acc >>= bits;
+			nbits -= bits;
+		}
+	}
+}
+
+
+/*
+	Frames
+*/
+
+/// Shared state of the slices packing or unpacking a frame
+struct PackJob {
+	struct PackedFrame *pf;
+	/// Bytes written for each plane of each band, when packing
+	size_t *lengths;
+	/// Largest number of samples of a band of any plane
+	size_t band_samples;
+	/// Set by slices that ran out of memory
+	volatile int failed;
+};
+
+VSYNTH_IMPLEMENT_METHOD(void, PackSlice)(Vs_StandardFrame frame, const struct Vs_StdframeSlice *slice, void *userdata)
+{
+	struct PackJob *job = (struct PackJob *)userdata;
+	struct PackedFrame *pf = job->pf;
+	struct PlaneShape shape;
+	size_t band, end, p, i, top, lines;
+	const unsigned char *src;
+	uint16_t *res;
+
+	res = (uint16_t *)malloc(job->band_samples * sizeof(uint16_t));
+	if (res == NULL)
+	{
+		job->failed = 1;
+		return;
+	}
+	end = (slice->top + slice->height + BAND_LINES-1) / BAND_LINES;
+	for (band = slice->top / BAND_LINES; band < end; band++)
+	{
+		for (p = 0; p < pf->planes; p++)
+		{
+			i = band * pf->planes + p;
+			GetPlaneShape(pf->pixfmt, pf->width, pf->height, p, &shape);
+			BandLines(&shape, band, &top, &lines);
+			src = (const unsigned char *)frame->data[p] + (ptrdiff_t)top * frame->stride[p];
+			if (shape.sample_bytes == 1)
+				Predict8(res, src, frame->stride[p], shape.samples, lines, shape.channels);
+			else
+				Predict16(res, src, frame->stride[p], shape.samples, lines, shape.channels);
+			job->lengths[i] = PackBlocks(pf->data + pf->offsets[i], res, shape.samples * lines);
+		}
+	}
+	free(res);
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, UnpackSlice)(Vs_StandardFrame frame, const struct Vs_StdframeSlice *slice, void *userdata)
+{
+	struct PackJob *job = (struct PackJob *)userdata;
+	const struct PackedFrame *pf = job->pf;
+	struct PlaneShape shape;
+	size_t band, end, p, i, top, lines;
+	unsigned char *dst;
+	uint16_t *res;
+
+	// room for the zeros filling up the last block
+	res = (uint16_t *)malloc((job->band_samples + BLOCK_SAMPLES) * sizeof(uint16_t));
+	if (res == NULL)
+	{
+		job->failed = 1;
+		return;
+	}
+	end = (slice->top + slice->height + BAND_LINES-1) / BAND_LINES;
+	for (band = slice->top / BAND_LINES; band < end; band++)
+	{
+		for (p = 0; p < pf->planes; p++)
+		{
+			i = band * pf->planes + p;
+			GetPlaneShape(pf->pixfmt, pf->width, pf->height, p, &shape);
+			BandLines(&shape, band, &top, &lines);
+			dst = (unsigned char *)frame->data[p] + (ptrdiff_t)top * frame->stride[p];
+			UnpackBlocks(res, pf->data + pf->offsets[i], shape.samples * lines);
+			if (shape.sample_bytes == 1)
+				Reconstruct8(dst, frame->stride[p], res, shape.samples, lines, shape.channels);
+			else
+				Reconstruct16(dst, frame->stride[p], res, shape.samples, lines, shape.channels);
+		}
+	}
+	free(res);
+}
+
+/// Largest number of samples in a band of any plane
+static size_t BandSamples(enum Vs_StdframePixelFormat pixfmt, size_t width, size_t height, size_t planes)
+{
+	struct PlaneShape shape;
+	size_t p, most = 0;
+
+	for (p = 0; p < planes; p++)
+	{
+		GetPlaneShape(pixfmt, width, height, p, &shape);
+		if (shape.samples * (BAND_LINES / shape.heightscale) > most)
+			most = shape.samples * (BAND_LINES / shape.heightscale);
+	}
+	return most;
+}
+
+struct PackedFrame *PackedFrame_Create(Vs_Library vsynth, Vs_Frame frame)
+{
+	Vs_StandardFrame sf = Vs_Stdframe_Get(frame);
+	struct PackedFrame *pf;
+	struct PlaneShape shape;
+	struct PackJob job;
+	size_t count, worst, pos, top, lines, i, p;
+	unsigned char *data;
+
+	// views and wrapped frames cost next to nothing uncompressed
+	if (sf == NULL || sf->parent != NULL || sf->data_baseptr == NULL || sf->width == 0 || sf->height == 0)
+		return NULL;
+
+	job.band_samples = 0;
+	count = (sf->height + BAND_LINES-1) / BAND_LINES * STDPIXFMT_planecount(sf->pixfmt);
+	pf = (struct PackedFrame *)malloc(sizeof(struct PackedFrame) + count * sizeof(size_t));
+	job.lengths = (size_t *)malloc(count * sizeof(size_t));
+	if (pf == NULL || job.lengths == NULL)
+	{
+		free(pf);
+		free(job.lengths);
+		return NULL;
+	}
+	pf->timestamp = frame->timestamp;
+	pf->pixfmt = sf->pixfmt;
+	pf->width = sf->width;
+	pf->height = sf->height;
+	pf->padding_right = sf->padding_right;
+	pf->padding_bottom = sf->padding_bottom;
+	pf->bands = (sf->height + BAND_LINES-1) / BAND_LINES;
+	pf->planes = STDPIXFMT_planecount(sf->pixfmt);
+
+	// every band starts at the offset of its worst case
+	worst = 0;
+	for (i = 0; i < count; i++)
+	{
+		p = i % pf->planes;
+		GetPlaneShape(pf->pixfmt, pf->width, pf->height, p, &shape);
+		BandLines(&shape, i / pf->planes, &top, &lines);
+		pf->offsets[i] = worst;
+		worst += WorstCase(&shape, lines);
+	}
+	pf->data = (unsigned char *)malloc(worst);
+	if (pf->data == NULL)
+	{
+		free(job.lengths);
+		free(pf);
+		return NULL;
+	}
+
+	job.pf = pf;
+	job.band_samples = BandSamples(pf->pixfmt, pf->width, pf->height, pf->planes);
+	job.failed = 0;
+	Vs_Stdframe_RunSlices(vsynth, sf, BAND_LINES, PackSlice, &job);
+	if (job.failed)
+	{
+		PackedFrame_Destroy(pf);
+		free(job.lengths);
+		return NULL;
+	}
+
+	// move the bands together, each only ever moves down
+	pos = 0;
+	for (i = 0; i < count; i++)
+	{
+		memmove(pf->data + pos, pf->data + pf->offsets[i], job.lengths[i]);
+		pf->offsets[i] = pos;
+		pos += job.lengths[i];
+	}
+	pf->offsets[count] = pos;
+	pf->data_size = pos;
+	free(job.lengths);
+	// shrinking never fails to keep the data, at worst it keeps the memory too
+	data = (unsigned char *)realloc(pf->data, pos > 0 ? pos : 1);
+	if (data != NULL)
+		pf->data = data;
+	return pf;
+}
+
+Vs_Frame PackedFrame_Unpack(Vs_Library vsynth, const struct PackedFrame *packed)
+{
+	Vs_StandardFrame sf;
+	struct PackJob job;
+
+	sf = Vs_Stdframe_NewPadded(vsynth, packed->pixfmt, packed->width, packed->height, packed->padding_right, packed->padding_bottom);
+	if (sf == NULL)
+		return NULL;
+	sf->base.timestamp = packed->timestamp;
+
+	job.pf = (struct PackedFrame *)packed;
+	job.lengths = NULL;
+	job.band_samples = BandSamples(packed->pixfmt, packed->width, packed->height, packed->planes);
+	job.failed = 0;
+	Vs_Stdframe_RunSlices(vsynth, sf, BAND_LINES, UnpackSlice, &job);
+	if (job.failed)
+	{
+		sf->base.methods->unref(&sf->base);
+		return NULL;
+	}
+	return &sf->base;
+}
+
+size_t PackedFrame_Size(const struct PackedFrame *packed)
+{
+	return sizeof(struct PackedFrame) + packed->bands * packed->planes * sizeof(size_t) + packed->data_size;
+}
+
+void PackedFrame_Destroy(struct PackedFrame *packed)
+{
+	free(packed->data);
+	free(packed);
+}
@@ -0,0 +1,502 @@
+#include <stdlib.h>
+#include <string.h>
+#include <vsynth/vsynth.h>
+#include "core.h"
+
+
+/*
+
+Every profiled filter gets a slot number. Each thread that calls a profiled
+filter has its own counters for every slot, allocated in chunks the first
+time the thread touches a slot in them, so counting never takes a lock and
+threads never write to the same cache lines. Reading adds up the counters of
+all threads. Thread counters are kept until the library is freed, so counts
+made on threads that have since exited are not lost.
+
+Chunks are only ever added, never moved, which lets readers walk them while
+the threads owning them keep counting. Only the owning thread writes its
+counters, but they are read and written with relaxed atomic accesses, so a
+reader summing them while frames are being made may be a few calls behind,
+but never sees a torn value on platforms without atomic 64 bit accesses. Reset doesn't touch thread counters,
+it records the current totals of each slot as a baseline that is subtracted
+when reading. Slots of filters that are destroyed and forgotten by Reset are
+reused the same way, with the baseline taken when the slot is reused.
+
+Self time is found by keeping a stack of the profiled calls in progress on
+each thread. Every call adds its elapsed time to the child time of the call
+below it on the stack, and subtracts its own child time to get its self time.
+Frame pool allocations are counted against the call at the top of the stack
+of the allocating thread.
+
+*/
+
+
+/// Number of slots per chunk of thread counters
+#define CHUNK_SLOTS 64
+/// Number of chunks per thread, limiting the number of profiled filters
+#define MAX_CHUNKS 1024
+
+struct ProfileCounters {
+	unsigned long long calls;
+	unsigned long long frames;
+	unsigned long long null_frames;
+	unsigned long long total_ns;
+	unsigned long long self_ns;
+	unsigned long long bytes_allocated;
+};
+
+/// A profiled call in progress, lives on the stack of the calling thread
+struct ProfileCall {
+	struct ProfileCounters *counters;
+	/// Time spent in profiled calls made from this one
+	unsigned long long child_ns;
+	struct ProfileCall *parent;
+};
+
+/// Counters of one thread
+struct ProfileThread {
+	struct ProfileCounters *chunks[MAX_CHUNKS];
+	/// Innermost profiled call in progress on the thread
+	struct ProfileCall *current;
+	struct ProfileThread *next;
+};
+
+struct ProfileRecord {
+	/// The profiled filter, NULL once destroyed
+	Vs_ActiveFilter filter;
+	Vs_Filter prototype;
+	/// Totals at the last Reset, or when the slot was taken
+	struct ProfileCounters base;
+};
+
+struct Profiler {
+	/// Protects everything but the counters
+	VsMutex lock;
+	VsTls tls;
+	/// Zero if the thread local slot could not be allocated
+	int usable;
+	int enabled;
+	/// Set when the first filter is profiled, allocations aren't looked at before
+	volatile int active;
+	/// Indexed by slot number
+	struct ProfileRecord *records;
+	size_t record_count;
+	size_t record_capacity;
+	/// Slots listed by Enumerate, in activation order
+	size_t *order;
+	size_t order_count;
+	/// Slots that can be reused
+	size_t *free_slots;
+	size_t free_count;
+	struct ProfileThread *threads;
+};
+
+struct ProfiledFilter {
+	struct TAG_Vs_ActiveFilter base;
+	Vs_Library vsynth;
+	struct Profiler *profiler;
+	Vs_ActiveFilter upstream;
+	size_t slot;
+};
+
+extern struct TAG_Vs_ActiveFilterVirtual ProfiledFilter_vtable;
+extern struct TAG_Vs_ActiveFilterVirtual ProfiledFilter_sync_vtable;
+
+
+/// Get the calling thread's counters, NULL if out of memory
+static struct ProfileThread *GetThread(struct Profiler *p)
+{
+	struct ProfileThread *t = (struct ProfileThread *)VsTls_Get(&p->tls);
+
+	if (t == NULL)
+	{
+		t = (struct ProfileThread *)calloc(1, sizeof(struct ProfileThread));
+		if (t == NULL)
+			return NULL;
+		VsMutex_Lock(&p->lock);
+		t->next = p->threads;
+		p->threads = t;
+		VsMutex_Unlock(&p->lock);
+		VsTls_Set(&p->tls, t);
+	}
+	return t;
+}
+
+/// Get a thread's counters for a slot, NULL if out of memory
+INLINE static struct ProfileCounters *GetCounters(struct Profiler *p, struct ProfileThread *t, size_t slot)
+{
+	struct ProfileCounters *chunk = t->chunks[slot / CHUNK_SLOTS];
+
+	if (chunk == NULL)
+	{
+		chunk = (struct ProfileCounters *)calloc(CHUNK_SLOTS, sizeof(struct ProfileCounters));
+		if (chunk == NULL)
+			return NULL;
+		// published under the lock, readers walk the chunks holding it
+		VsMutex_Lock(&p->lock);
+		t->chunks[slot / CHUNK_SLOTS] = chunk;
+		VsMutex_Unlock(&p->lock);
+	}
+	return &chunk[slot % CHUNK_SLOTS];
+}
+
+/// Add to a counter of the calling thread, see the comment at the top
+INLINE static void Count(unsigned long long *counter, unsigned long long value)
+{
+	VsAtomic_Store64(counter, VsAtomic_Load64(counter) + value);
+}
+
+/// Add up the counters of all threads for a slot, profiler must be locked
+static void SumCounters(struct Profiler *p, size_t slot, struct ProfileCounters *sum)
+{
+	struct ProfileThread *t;
+	struct ProfileCounters *c;
+
+	memset(sum, 0, sizeof(*sum));
+	for (t = p->threads; t != NULL; t = t->next)
+	{
+		if (t->chunks[slot / CHUNK_SLOTS] == NULL)
+			continue;
+		c = &t->chunks[slot / CHUNK_SLOTS][slot % CHUNK_SLOTS];
+		sum->calls += VsAtomic_Load64(&c->calls);
+		sum->frames += VsAtomic_Load64(&c->frames);
+		sum->null_frames += VsAtomic_Load64(&c->null_frames);
+		sum->total_ns += VsAtomic_Load64(&c->total_ns);
+		sum->self_ns += VsAtomic_Load64(&c->self_ns);
+		sum->bytes_allocated += VsAtomic_Load64(&c->bytes_allocated);
+	}
+}
+
+INLINE static void CountFrame(struct ProfileCounters *c, Vs_Frame frame)
+{
+	if (frame != NULL)
+		Count(&c->frames, 1);
+	else
+		Count(&c->null_frames, 1);
+}
+
+
+VSYNTH_IMPLEMENT_METHOD(void, ProfiledFilter_destroy)(Vs_ActiveFilter filter)
+{
+	struct ProfiledFilter *pf = (struct ProfiledFilter *)filter;
+
+	// the counters stay until Reset
+	VsMutex_Lock(&pf->profiler->lock);
+	pf->profiler->records[pf->slot].filter = NULL;
+	VsMutex_Unlock(&pf->profiler->lock);
+
+	pf->upstream->methods->destroy(pf->upstream);
+	free(pf);
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Frame, ProfiledFilter_get_frame)(Vs_ActiveFilter filter, Vs_FrameNumber n)
+{
+	struct ProfiledFilter *pf = (struct ProfiledFilter *)filter;
+	struct ProfileThread *t = GetThread(pf->profiler);
+	struct ProfileCall call;
+	unsigned long long start, elapsed;
+	Vs_Frame frame;
+
+	// out of memory only loses the count
+	if (t == NULL || (call.counters = GetCounters(pf->profiler, t, pf->slot)) == NULL)
+		return pf->upstream->methods->get_frame(pf->upstream, n);
+
+	call.child_ns = 0;
+	call.parent = t->current;
+	t->current = &call;
+	start = VsTime_Now();
+
+	frame = pf->upstream->methods->get_frame(pf->upstream, n);
+
+	elapsed = VsTime_Now() - start;
+	t->current = call.parent;
+	if (call.parent != NULL)
+		call.parent->child_ns += elapsed;
+
+	Count(&call.counters->calls, 1);
+	Count(&call.counters->total_ns, elapsed);
+	Count(&call.counters->self_ns, elapsed - call.child_ns);
+	CountFrame(call.counters, frame);
+
+	return frame;
+}
+
+/// An asynchronous request waiting for its frame
+struct ProfileRequest {
+	struct ProfiledFilter *pf;
+	unsigned long long start;
+	Vs_FrameCallback callback;
+	void *userdata;
+};
+
+VSYNTH_IMPLEMENT_METHOD(void, ProfiledFilter_FrameReady)(Vs_Frame frame, void *userdata)
+{
+	struct ProfileRequest *req = (struct ProfileRequest *)userdata;
+	struct ProfileThread *t = GetThread(req->pf->profiler);
+	struct ProfileCounters *c = t != NULL ? GetCounters(req->pf->profiler, t, req->pf->slot) : NULL;
+
+	// counted on the thread making the callback
+	if (c != NULL)
+	{
+		Count(&c->total_ns, VsTime_Now() - req->start);
+		CountFrame(c, frame);
+	}
+	req->callback(frame, req->userdata);
+	free(req);
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, ProfiledFilter_get_frame_async)(Vs_ActiveFilter filter, Vs_FrameNumber n, Vs_FrameCallback callback, void *userdata)
+{
+	struct ProfiledFilter *pf = (struct ProfiledFilter *)filter;
+	struct ProfileThread *t = GetThread(pf->profiler);
+	struct ProfileCounters *c = t != NULL ? GetCounters(pf->profiler, t, pf->slot) : NULL;
+	struct ProfileRequest *req = c != NULL ? (struct ProfileRequest *)malloc(sizeof(struct ProfileRequest)) : NULL;
+
+	if (req == NULL)
+	{
+		pf->upstream->methods->get_frame_async(pf->upstream, n, callback, userdata);
+		return;
+	}
+
+	Count(&c->calls, 1);
+	req->pf = pf;
+	req->callback = callback;
+	req->userdata = userdata;
+	req->start = VsTime_Now();
+	pf->upstream->methods->get_frame_async(pf->upstream, n, ProfiledFilter_FrameReady, req);
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_FrameNumber, ProfiledFilter_get_frame_count)(Vs_ActiveFilter filter)
+{
+	struct ProfiledFilter *pf = (struct ProfiledFilter *)filter;
+	return pf->upstream->methods->get_frame_count(pf->upstream);
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Timestamp, ProfiledFilter_get_duration)(Vs_ActiveFilter filter)
+{
+	struct ProfiledFilter *pf = (struct ProfiledFilter *)filter;
+	return pf->upstream->methods->get_duration(pf->upstream);
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_FrameNumber, ProfiledFilter_frame_at_timestamp)(Vs_ActiveFilter filter, Vs_Timestamp t)
+{
+	struct ProfiledFilter *pf = (struct ProfiledFilter *)filter;
+	if (pf->upstream->methods->frame_at_timestamp != NULL)
+		return pf->upstream->methods->frame_at_timestamp(pf->upstream, t);
+	// the frames probed are counted like any others
+	return Seek_SearchFrames(filter, t);
+}
+
+struct TAG_Vs_ActiveFilterVirtual ProfiledFilter_vtable = {
+	ProfiledFilter_destroy,
+	ProfiledFilter_get_frame,
+	ProfiledFilter_get_frame_count,
+	ProfiledFilter_get_duration,
+	ProfiledFilter_get_frame_async,
+	ProfiledFilter_frame_at_timestamp
+};
+
+/// For filters without get_frame_async, so asynchronous requests still go
+/// through the timed get_frame on a worker
+struct TAG_Vs_ActiveFilterVirtual ProfiledFilter_sync_vtable = {
+	ProfiledFilter_destroy,
+	ProfiledFilter_get_frame,
+	ProfiledFilter_get_frame_count,
+	ProfiledFilter_get_duration,
+	NULL,
+	ProfiledFilter_frame_at_timestamp
+};
+
+
+/// Take a slot for a new record, profiler must be locked
+static int AllocSlot(struct Profiler *p, size_t *slot)
+{
+	struct ProfileRecord *records;
+	size_t *order, *free_slots;
+	size_t capacity;
+
+	if (p->free_count > 0)
+	{
+		*slot = p->free_slots[--p->free_count];
+		return 1;
+	}
+
+	if (p->record_count == p->record_capacity)
+	{
+		capacity = p->record_capacity ? p->record_capacity * 2 : 64;
+		if (capacity > (size_t)CHUNK_SLOTS * MAX_CHUNKS)
+			return 0;
+		records = (struct ProfileRecord *)realloc(p->records, capacity * sizeof(struct ProfileRecord));
+		if (records == NULL)
+			return 0;
+		p->records = records;
+		order = (size_t *)realloc(p->order, capacity * sizeof(size_t));
+		if (order == NULL)
+			return 0;
+		p->order = order;
+		free_slots = (size_t *)realloc(p->free_slots, capacity * sizeof(size_t));
+		if (free_slots == NULL)
+			return 0;
+		p->free_slots = free_slots;
+		p->record_capacity = capacity;
+	}
+	*slot = p->record_count++;
+	return 1;
+}
+
+Vs_ActiveFilter Profiler_Wrap(struct Profiler *p, Vs_Library vsynth, Vs_ActiveFilter upstream)
+{
+	struct ProfiledFilter *pf;
+	struct ProfileRecord *record;
+	size_t slot;
+
+	if (!p->enabled)
+		return upstream;
+
+	// failing to profile a filter is no reason to fail activating it
+	pf = (struct ProfiledFilter *)malloc(sizeof(struct ProfiledFilter));
+	if (pf == NULL)
+		return upstream;
+
+	VsMutex_Lock(&p->lock);
+	if (!p->enabled || !AllocSlot(p, &slot))
+	{
+		VsMutex_Unlock(&p->lock);
+		free(pf);
+		return upstream;
+	}
+
+	pf->base.methods = upstream->methods->get_frame_async != NULL ? &ProfiledFilter_vtable : &ProfiledFilter_sync_vtable;
+	pf->base.filter = upstream->filter;
+	pf->vsynth = vsynth;
+	pf->profiler = p;
+	pf->upstream = upstream;
+	pf->slot = slot;
+
+	record = &p->records[slot];
+	record->filter = &pf->base;
+	record->prototype = upstream->filter;
+	// a reused slot may still have counts from its previous filter
+	SumCounters(p, slot, &record->base);
+	p->order[p->order_count++] = slot;
+	p->active = 1;
+	VsMutex_Unlock(&p->lock);
+
+	return &pf->base;
+}
+
+void Profiler_CountAlloc(struct Profiler *p, size_t size)
+{
+	struct ProfileThread *t;
+
+	if (!p->active)
+		return;
+	t = (struct ProfileThread *)VsTls_Get(&p->tls);
+	if (t != NULL && t->current != NULL)
+		Count(&t->current->counters->bytes_allocated, size);
+}
+
+
+VSYNTH_IMPLEMENT_METHOD(void, Profile_SetEnabled)(Vs_Library vsynth, int enabled)
+{
+	struct Profiler *p = getlib(vsynth)->profiler;
+
+	VsMutex_Lock(&p->lock);
+	p->enabled = enabled && p->usable;
+	VsMutex_Unlock(&p->lock);
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, Profile_Enumerate)(Vs_Library vsynth, Vs_EnumProfilesFunc callback, void *userdata)
+{
+	struct Profiler *p = getlib(vsynth)->profiler;
+	Vs_FilterProfile *profiles;
+	struct ProfileRecord *record;
+	struct ProfileCounters sum;
+	size_t i, count;
+
+	// collected first, so the callback runs without the lock held
+	VsMutex_Lock(&p->lock);
+	count = p->order_count;
+	profiles = (Vs_FilterProfile *)malloc((count ? count : 1) * sizeof(Vs_FilterProfile));
+	if (profiles == NULL)
+	{
+		VsMutex_Unlock(&p->lock);
+		return;
+	}
+	for (i = 0; i < count; i++)
+	{
+		record = &p->records[p->order[i]];
+		SumCounters(p, p->order[i], &sum);
+		profiles[i].filter = record->filter;
+		profiles[i].prototype = record->prototype;
+		profiles[i].calls = sum.calls - record->base.calls;
+		profiles[i].frames = sum.frames - record->base.frames;
+		profiles[i].null_frames = sum.null_frames - record->base.null_frames;
+		profiles[i].total_ns = sum.total_ns - record->base.total_ns;
+		profiles[i].self_ns = sum.self_ns - record->base.self_ns;
+		profiles[i].bytes_allocated = sum.bytes_allocated - record->base.bytes_allocated;
+	}
+	VsMutex_Unlock(&p->lock);
+
+	for (i = 0; i < count; i++)
+		callback(&profiles[i], userdata);
+	free(profiles);
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, Profile_Reset)(Vs_Library vsynth)
+{
+	struct Profiler *p = getlib(vsynth)->profiler;
+	size_t i, kept = 0, slot;
+
+	VsMutex_Lock(&p->lock);
+	for (i = 0; i < p->order_count; i++)
+	{
+		slot = p->order[i];
+		if (p->records[slot].filter == NULL)
+		{
+			p->free_slots[p->free_count++] = slot;
+			continue;
+		}
+		SumCounters(p, slot, &p->records[slot].base);
+		p->order[kept++] = slot;
+	}
+	p->order_count = kept;
+	VsMutex_Unlock(&p->lock);
+}
+
+struct TAG_Vs_ProfileAPI ProfileAPI = {
+	Profile_SetEnabled,
+	Profile_Enumerate,
+	Profile_Reset
+};
+
+
+struct Profiler *Profiler_Create(void)
+{
+	struct Profiler *p = (struct Profiler *)calloc(1, sizeof(struct Profiler));
+
+	VsMutex_Init(&p->lock);
+	p->usable = VsTls_Init(&p->tls);
+	return p;
+}
+
+void Profiler_Destroy(struct Profiler *p)
+{
+	struct ProfileThread *t, *next;
+	size_t i;
+
+	for (t = p->threads; t != NULL; t = next)
+	{
+		next = t->next;
+		for (i = 0; i < MAX_CHUNKS; i++)
+			free(t->chunks[i]);
+		free(t);
+	}
+	if (p->usable)
+		VsTls_Destroy(&p->tls);
+	VsMutex_Destroy(&p->lock);
+	free(p->records);
+	free(p->order);
+	free(p->free_slots);
+	free(p);
+}
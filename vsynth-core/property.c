@@ -0,0 +1,395 @@
+#include <stdlib.h>
+#include <string.h>
+#include <vsynth/vsynth.h>
+#include "core.h"
+
+
+/*
+
+Property IDs are resolved against a table of property names built from a
+filter type's enum_properties the first time a filter of the type is seen.
+Tables are kept per library in a hash keyed by vtable pointer, and are never
+freed before the library is.
+
+Filters implementing get/set_property_by_id are called directly on access.
+For other filters the table maps the ID back to a name and type, and the
+name based methods are used.
+
+Lookups don't lock, since they happen on every property access. The hash is
+open addressed, and a table is only stored in a slot once it is complete,
+with a release store, so readers see either nothing or the whole table. When
+the hash grows, the new slot array is filled before it is published, and the
+old one is kept until the library is freed, as readers may still be probing
+it. A reader missing a table that is being added meanwhile just takes the
+library lock and looks again, which is also how tables get built. Building a
+table that runs out of memory fails the access, and is retried by the next.
+
+*/
+
+
+#define INITIAL_SLOTS 64
+
+struct PropertyInfo {
+	char *name;
+	enum Vs_PropertyType type;
+};
+
+struct PropertyTable {
+	Vs_FilterVirtual vtable;
+	size_t count;
+	size_t capacity;
+	struct PropertyInfo *props;
+	/// Set when collecting the properties ran out of memory
+	int failed;
+};
+
+/// Open addressed hash of property tables, at most half full
+struct PropertySlots {
+	size_t slot_count;
+	struct PropertyTable *volatile *slots;
+	/// The smaller slot array this one replaced
+	struct PropertySlots *retired;
+};
+
+struct PropertyCache {
+	/// Current slot array, read without locking
+	struct PropertySlots *volatile current;
+	/// Number of tables, protected by the library lock
+	size_t count;
+};
+
+
+INLINE static size_t HashVtable(Vs_FilterVirtual vtable, size_t slot_count)
+{
+	size_t h = (size_t)vtable;
+	// vtables are pointer aligned, the low bits carry no information
+	h ^= h >> 4;
+	h ^= h >> 12;
+	return h & (slot_count - 1);
+}
+
+static struct PropertySlots *NewSlots(size_t slot_count)
+{
+	struct PropertySlots *hash = (struct PropertySlots *)malloc(sizeof(struct PropertySlots));
+	if (hash == NULL)
+		return NULL;
+	hash->slot_count = slot_count;
+	hash->slots = (struct PropertyTable *volatile *)calloc(slot_count, sizeof(struct PropertyTable *));
+	hash->retired = NULL;
+	if (hash->slots == NULL)
+	{
+		free(hash);
+		return NULL;
+	}
+	return hash;
+}
+
+static void FreeTable(struct PropertyTable *table)
+{
+	size_t i;
+
+	for (i = 0; i < table->count; i++)
+		free(table->props[i].name);
+	free(table->props);
+	free(table);
+}
+
+
+struct PropertyCache *PropertyCache_Create(void)
+{
+	struct PropertyCache *cache = (struct PropertyCache *)malloc(sizeof(struct PropertyCache));
+	cache->current = NewSlots(INITIAL_SLOTS);
+	cache->count = 0;
+	return cache;
+}
+
+void PropertyCache_Destroy(struct PropertyCache *cache)
+{
+	struct PropertySlots *hash, *retired;
+	size_t i;
+
+	// retired slot arrays only hold tables that are also in the current one
+	for (i = 0; i < cache->current->slot_count; i++)
+	{
+		if (cache->current->slots[i] != NULL)
+			FreeTable(cache->current->slots[i]);
+	}
+	for (hash = cache->current; hash != NULL; hash = retired)
+	{
+		retired = hash->retired;
+		free((void *)hash->slots);
+		free(hash);
+	}
+	free(cache);
+}
+
+/// Find the table for a vtable, without locking
+static struct PropertyTable *FindTable(struct PropertyCache *cache, Vs_FilterVirtual vtable)
+{
+	struct PropertySlots *hash = (struct PropertySlots *)VsAtomic_LoadPtr((void *const volatile *)&cache->current);
+	struct PropertyTable *table;
+	size_t slot;
+
+	// there is always an empty slot to end the probe
+	for (slot = HashVtable(vtable, hash->slot_count); ; slot = (slot + 1) & (hash->slot_count - 1))
+	{
+		table = (struct PropertyTable *)VsAtomic_LoadPtr((void *const volatile *)&hash->slots[slot]);
+		if (table == NULL || table->vtable == vtable)
+			return table;
+	}
+}
+
+/// Store a table in the first free slot of its probe sequence, library must be locked
+static void InsertTable(struct PropertySlots *hash, struct PropertyTable *table)
+{
+	size_t slot = HashVtable(table->vtable, hash->slot_count);
+
+	while (hash->slots[slot] != NULL)
+		slot = (slot + 1) & (hash->slot_count - 1);
+	VsAtomic_StorePtr((void *volatile *)&hash->slots[slot], table);
+}
+
+/// Add a complete table to the hash, library must be locked
+///
+/// Returns zero if out of memory.
+static int PublishTable(struct PropertyCache *cache, struct PropertyTable *table)
+{
+	struct PropertySlots *hash = cache->current;
+	struct PropertySlots *grown;
+	size_t i;
+
+	if ((cache->count + 1) * 2 > hash->slot_count)
+	{
+		grown = NewSlots(hash->slot_count * 2);
+		if (grown == NULL)
+			return 0;
+		for (i = 0; i < hash->slot_count; i++)
+		{
+			if (hash->slots[i] != NULL)
+				InsertTable(grown, hash->slots[i]);
+		}
+		grown->retired = hash;
+		VsAtomic_StorePtr((void *volatile *)&cache->current, grown);
+		hash = grown;
+	}
+
+	InsertTable(hash, table);
+	cache->count++;
+	return 1;
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, CollectProperty)(const char *name, enum Vs_PropertyType type, void *userdata)
+{
+	struct PropertyTable *table = (struct PropertyTable *)userdata;
+	struct PropertyInfo *props;
+	size_t len;
+
+	// a table missing a property would give the later ones the wrong IDs
+	if (table->failed)
+		return;
+
+	if (table->count == table->capacity)
+	{
+		size_t capacity = table->capacity ? table->capacity * 2 : 8;
+		props = (struct PropertyInfo *)realloc(table->props, capacity * sizeof(struct PropertyInfo));
+		if (props == NULL)
+		{
+			table->failed = 1;
+			return;
+		}
+		table->props = props;
+		table->capacity = capacity;
+	}
+
+	// copied, since the names may live in a plugin that is unloaded before the library
+	len = strlen(name);
+	table->props[table->count].name = (char *)malloc(len + 1);
+	if (table->props[table->count].name == NULL)
+	{
+		table->failed = 1;
+		return;
+	}
+	memcpy(table->props[table->count].name, name, len + 1);
+	table->props[table->count].type = type;
+	table->count++;
+}
+
+/// Get the property table for a filter's type, building it if necessary
+///
+/// Returns NULL if out of memory.
+static struct PropertyTable *GetPropertyTable(struct LibraryInstance *v, Vs_Filter filter)
+{
+	struct PropertyCache *cache = v->property_cache;
+	struct PropertyTable *table;
+
+	table = FindTable(cache, filter->methods);
+	if (table != NULL)
+		return table;
+
+	VsMutex_Lock(&v->lock);
+
+	// another thread may have built it meanwhile
+	table = FindTable(cache, filter->methods);
+	if (table == NULL)
+	{
+		table = (struct PropertyTable *)malloc(sizeof(struct PropertyTable));
+		if (table != NULL)
+		{
+			table->vtable = filter->methods;
+			table->count = 0;
+			table->capacity = 0;
+			table->props = NULL;
+			table->failed = 0;
+			filter->methods->enum_properties(CollectProperty, table);
+
+			if (table->failed || !PublishTable(cache, table))
+			{
+				FreeTable(table);
+				table = NULL;
+			}
+		}
+	}
+
+	VsMutex_Unlock(&v->lock);
+
+	return table;
+}
+
+
+VSYNTH_IMPLEMENT_METHOD(Vs_PropertyId, Property_Resolve)(Vs_Library vsynth, Vs_Filter filter, const char *name, enum Vs_PropertyType *type)
+{
+	struct PropertyTable *table = GetPropertyTable(getlib(vsynth), filter);
+	size_t i;
+
+	if (table == NULL)
+		return PROPERTY_INVALID;
+
+	for (i = 0; i < table->count; i++)
+	{
+		if (strcmp(name, table->props[i].name) == 0)
+		{
+			if (type != NULL)
+				*type = table->props[i].type;
+			return (Vs_PropertyId)i;
+		}
+	}
+	return PROPERTY_INVALID;
+}
+
+VSYNTH_IMPLEMENT_METHOD(int, Property_Get)(Vs_Library vsynth, Vs_Filter filter, Vs_PropertyId id, Vs_PropertyValue *value)
+{
+	struct PropertyTable *table;
+	struct PropertyInfo *prop;
+
+	if (filter->methods->get_property_by_id != NULL)
+		return filter->methods->get_property_by_id(filter, id, value);
+
+	table = GetPropertyTable(getlib(vsynth), filter);
+	if (table == NULL || id < 0 || (size_t)id >= table->count)
+		return 0;
+	prop = &table->props[id];
+
+	value->type = prop->type;
+	switch (prop->type)
+	{
+	case PROP_FILTER:
+		value->v.f = filter->methods->get_property_filter(filter, prop->name);
+		break;
+	case PROP_INT:
+		value->v.i = filter->methods->get_property_int(filter, prop->name);
+		break;
+	case PROP_DOUBLE:
+		value->v.d = filter->methods->get_property_double(filter, prop->name);
+		break;
+	case PROP_STRING:
+		value->v.s = filter->methods->get_property_string(filter, prop->name);
+		break;
+	case PROP_FRAMENUMBER:
+		value->v.fn = filter->methods->get_property_framenumber(filter, prop->name);
+		break;
+	case PROP_TIMESTAMP:
+		value->v.ts = filter->methods->get_property_timestamp(filter, prop->name);
+		break;
+	default:
+		return 0;
+	}
+	return 1;
+}
+
+/// Set a property through the name based methods
+static int SetByName(Vs_Filter filter, struct PropertyTable *table, Vs_PropertyId id, const Vs_PropertyValue *value)
+{
+	struct PropertyInfo *prop;
+
+	if (id < 0 || (size_t)id >= table->count)
+		return 0;
+	prop = &table->props[id];
+	if (prop->type != value->type)
+		return 0;
+
+	switch (prop->type)
+	{
+	case PROP_FILTER:
+		filter->methods->set_property_filter(filter, prop->name, value->v.f);
+		break;
+	case PROP_INT:
+		filter->methods->set_property_int(filter, prop->name, value->v.i);
+		break;
+	case PROP_DOUBLE:
+		filter->methods->set_property_double(filter, prop->name, value->v.d);
+		break;
+	case PROP_STRING:
+		filter->methods->set_property_string(filter, prop->name, value->v.s);
+		break;
+	case PROP_FRAMENUMBER:
+		filter->methods->set_property_framenumber(filter, prop->name, value->v.fn);
+		break;
+	case PROP_TIMESTAMP:
+		filter->methods->set_property_timestamp(filter, prop->name, value->v.ts);
+		break;
+	default:
+		return 0;
+	}
+	return 1;
+}
+
+VSYNTH_IMPLEMENT_METHOD(int, Property_Set)(Vs_Library vsynth, Vs_Filter filter, Vs_PropertyId id, const Vs_PropertyValue *value)
+{
+	struct PropertyTable *table;
+
+	if (filter->methods->set_property_by_id != NULL)
+		return filter->methods->set_property_by_id(filter, id, value);
+
+	table = GetPropertyTable(getlib(vsynth), filter);
+	if (table == NULL)
+		return 0;
+	return SetByName(filter, table, id, value);
+}
+
+VSYNTH_IMPLEMENT_METHOD(size_t, Property_SetMany)(Vs_Library vsynth, Vs_Filter filter, size_t count, const Vs_PropertyId *ids, const Vs_PropertyValue *values)
+{
+	struct PropertyTable *table;
+	size_t i, done = 0;
+
+	if (filter->methods->set_property_by_id != NULL)
+	{
+		for (i = 0; i < count; i++)
+			done += filter->methods->set_property_by_id(filter, ids[i], &values[i]) ? 1 : 0;
+		return done;
+	}
+
+	// only look the table up once for the lot
+	table = GetPropertyTable(getlib(vsynth), filter);
+	if (table == NULL)
+		return 0;
+	for (i = 0; i < count; i++)
+		done += SetByName(filter, table, ids[i], &values[i]) ? 1 : 0;
+	return done;
+}
+
+struct TAG_Vs_PropertyAPI PropertyAPI = {
+	Property_Resolve,
+	Property_Get,
+	Property_Set,
+	Property_SetMany
+};
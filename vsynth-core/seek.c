@@ -0,0 +1,299 @@
+#include <stdlib.h>
+#include <vsynth/vsynth.h>
+#include "core.h"
+
+
+/*
+
+Finding frames by time. Filters that know their timestamps answer through
+their frame_at_timestamp method. For all others the frame is found by binary
+search over frame numbers, requesting the frames probed to read their
+timestamps; when the frame count is unknown the upper bound is found first by
+doubling the frame number until a frame past t or past the end turns up.
+
+A timestamp index stores the timestamps of a stream in blocks of BLOCK_SIZE
+frames. Each block keeps the absolute timestamp of its first frame and the
+offsets of the others from it, little endian, in as few bytes as the largest
+offset of the block needs, so a few bytes per frame for any stream with sane
+frame durations. Offsets from the block start rather than from the previous
+frame keep every timestamp readable without decoding the ones before it, so
+finding a frame is a binary search over the block starts followed by one
+over the offsets of a single block.
+
+The block being filled is kept decoded until it is full.
+
+*/
+
+
+/// Number of frames per block of a timestamp index
+#define BLOCK_SIZE 64
+
+struct TimestampBlock {
+	/// Timestamp of the first frame of the block
+	Vs_Timestamp base;
+	/// Position of the offsets of the block in the index data
+	size_t pos;
+	/// Bytes per offset, 1, 2, 4 or 8
+	unsigned int width;
+};
+
+struct TAG_Vs_TimestampIndex {
+	Vs_FrameNumber count;
+	/// Full blocks
+	struct TimestampBlock *blocks;
+	size_t block_count;
+	size_t block_capacity;
+	/// Offsets of all full blocks
+	unsigned char *data;
+	size_t data_size;
+	size_t data_capacity;
+	/// Timestamps of the block being filled, count % BLOCK_SIZE of them
+	Vs_Timestamp pending[BLOCK_SIZE];
+};
+
+
+static Vs_Timestamp ReadOffset(const unsigned char *p, unsigned int width)
+{
+	Vs_Timestamp v = 0;
+	unsigned int i;
+
+	for (i = width; i > 0; i--)
+		v = (v << 8) | p[i - 1];
+	return v;
+}
+
+static void WriteOffset(unsigned char *p, unsigned int width, Vs_Timestamp v)
+{
+	unsigned int i;
+
+	for (i = 0; i < width; i++)
+	{
+		p[i] = (unsigned char)v;
+		v >>= 8;
+	}
+}
+
+/// Get timestamp i of a full block
+static Vs_Timestamp BlockGet(const struct TAG_Vs_TimestampIndex *index, const struct TimestampBlock *block, unsigned int i)
+{
+	if (i == 0)
+		return block->base;
+	return block->base + ReadOffset(index->data + block->pos + (i - 1) * block->width, block->width);
+}
+
+/// Encode the pending timestamps as a new full block, returns zero if out of memory
+static int FlushBlock(struct TAG_Vs_TimestampIndex *index)
+{
+	struct TimestampBlock *block;
+	Vs_Timestamp span = index->pending[BLOCK_SIZE - 1] - index->pending[0];
+	unsigned int width, i;
+	size_t size;
+
+	// timestamps ascend, so the last offset is the largest
+	if (span <= 0xFFu)
+		width = 1;
+	else if (span <= 0xFFFFu)
+		width = 2;
+	else if (span <= 0xFFFFFFFFu)
+		width = 4;
+	else
+		width = 8;
+	size = (BLOCK_SIZE - 1) * width;
+
+	if (index->block_count == index->block_capacity)
+	{
+		size_t capacity = index->block_capacity ? index->block_capacity * 2 : 16;
+		struct TimestampBlock *blocks = (struct TimestampBlock *)realloc(index->blocks, capacity * sizeof(struct TimestampBlock));
+		if (blocks == NULL)
+			return 0;
+		index->blocks = blocks;
+		index->block_capacity = capacity;
+	}
+	if (index->data_capacity - index->data_size < size)
+	{
+		size_t capacity = index->data_capacity ? index->data_capacity * 2 : 1024;
+		unsigned char *data;
+		while (capacity - index->data_size < size)
+			capacity *= 2;
+		data = (unsigned char *)realloc(index->data, capacity);
+		if (data == NULL)
+			return 0;
+		index->data = data;
+		index->data_capacity = capacity;
+	}
+
+	block = &index->blocks[index->block_count++];
+	block->base = index->pending[0];
+	block->pos = index->data_size;
+	block->width = width;
+	for (i = 1; i < BLOCK_SIZE; i++)
+		WriteOffset(index->data + block->pos + (i - 1) * width, width, index->pending[i] - block->base);
+	index->data_size += size;
+	return 1;
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_TimestampIndex, Seek_NewIndex)(Vs_Library vsynth)
+{
+	return (Vs_TimestampIndex)calloc(1, sizeof(struct TAG_Vs_TimestampIndex));
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Timestamp, Seek_IndexGet)(Vs_TimestampIndex index, Vs_FrameNumber n)
+{
+	Vs_FrameNumber b = n / BLOCK_SIZE;
+	unsigned int i = (unsigned int)(n % BLOCK_SIZE);
+
+	if (b == index->block_count)
+		return index->pending[i];
+	return BlockGet(index, &index->blocks[b], i);
+}
+
+VSYNTH_IMPLEMENT_METHOD(int, Seek_IndexAppend)(Vs_TimestampIndex index, Vs_Timestamp t)
+{
+	if (index->count > 0 && t <= Seek_IndexGet(index, index->count - 1))
+		return 0;
+	index->pending[index->count % BLOCK_SIZE] = t;
+	if (index->count % BLOCK_SIZE == BLOCK_SIZE - 1 && !FlushBlock(index))
+		return 0;
+	index->count++;
+	return 1;
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_FrameNumber, Seek_IndexFind)(Vs_TimestampIndex index, Vs_Timestamp t)
+{
+	size_t lo, hi, mid, blocks;
+	unsigned int pending = (unsigned int)(index->count % BLOCK_SIZE);
+	const struct TimestampBlock *block;
+
+	if (index->count == 0 || t < Seek_IndexGet(index, 0))
+		return FRAMENUMBER_NONE;
+
+	// the block being filled counts as the last block
+	blocks = index->block_count + (pending > 0);
+	lo = 0;
+	hi = blocks;
+	// block lo starts at or before t, block hi after it or doesn't exist
+	while (hi - lo > 1)
+	{
+		mid = lo + (hi - lo) / 2;
+		if (Seek_IndexGet(index, (Vs_FrameNumber)mid * BLOCK_SIZE) <= t)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	if (lo == index->block_count)
+	{
+		unsigned int a = 0, b = pending, m;
+		while (b - a > 1)
+		{
+			m = a + (b - a) / 2;
+			if (index->pending[m] <= t)
+				a = m;
+			else
+				b = m;
+		}
+		return (Vs_FrameNumber)lo * BLOCK_SIZE + a;
+	}
+	else
+	{
+		unsigned int a = 0, b = BLOCK_SIZE, m;
+		block = &index->blocks[lo];
+		while (b - a > 1)
+		{
+			m = a + (b - a) / 2;
+			if (BlockGet(index, block, m) <= t)
+				a = m;
+			else
+				b = m;
+		}
+		return (Vs_FrameNumber)lo * BLOCK_SIZE + a;
+	}
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_FrameNumber, Seek_IndexCount)(Vs_TimestampIndex index)
+{
+	return index->count;
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, Seek_FreeIndex)(Vs_TimestampIndex index)
+{
+	if (index == NULL)
+		return;
+	free(index->blocks);
+	free(index->data);
+	free(index);
+}
+
+
+/// Get the timestamp of a frame, returns zero if there is no such frame
+static int FrameTimestamp(Vs_ActiveFilter filter, Vs_FrameNumber n, Vs_Timestamp *timestamp)
+{
+	Vs_Frame frame = filter->methods->get_frame(filter, n);
+
+	if (frame == NULL)
+		return 0;
+	*timestamp = frame->timestamp;
+	frame->methods->unref(frame);
+	return 1;
+}
+
+Vs_FrameNumber Seek_SearchFrames(Vs_ActiveFilter filter, Vs_Timestamp t)
+{
+	Vs_FrameNumber count, lo, hi, mid;
+	Vs_Timestamp duration, ts;
+
+	duration = filter->methods->get_duration(filter);
+	if (duration != DURATION_UNKNOWN && t >= duration)
+		return FRAMENUMBER_NONE;
+	count = filter->methods->get_frame_count(filter);
+	if (count == 0 || !FrameTimestamp(filter, 0, &ts) || t < ts)
+		return FRAMENUMBER_NONE;
+
+	// frame lo starts at or before t, frame hi after it or doesn't exist
+	lo = 0;
+	if (count != FRAMECOUNT_UNKNOWN)
+	{
+		hi = count;
+	}
+	else
+	{
+		hi = 1;
+		while (FrameTimestamp(filter, hi, &ts) && ts <= t)
+		{
+			lo = hi;
+			if (hi * 2 < hi)
+			{
+				hi = FRAMECOUNT_UNKNOWN;
+				break;
+			}
+			hi *= 2;
+		}
+	}
+	while (hi - lo > 1)
+	{
+		mid = lo + (hi - lo) / 2;
+		if (FrameTimestamp(filter, mid, &ts) && ts <= t)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_FrameNumber, Seek_FrameAtTimestamp)(Vs_Library vsynth, Vs_ActiveFilter filter, Vs_Timestamp t)
+{
+	if (filter->methods->frame_at_timestamp != NULL)
+		return filter->methods->frame_at_timestamp(filter, t);
+	return Seek_SearchFrames(filter, t);
+}
+
+
+struct TAG_Vs_SeekAPI SeekAPI = {
+	Seek_FrameAtTimestamp,
+	Seek_NewIndex,
+	Seek_IndexAppend,
+	Seek_IndexFind,
+	Seek_IndexGet,
+	Seek_IndexCount,
+	Seek_FreeIndex
+};
@@ -0,0 +1,746 @@
+#include <stdlib.h>
+#include <string.h>
+#include <vsynth/vsynth.h>
+#include <vsynth/stdframe.h>
+#include "core.h"
+
+
+/*
+
+Sharing active filters between identical subgraphs.
+
+Every filter activated through Graph::Activate gets a structural key: its
+vtable, the values of all its properties in enumeration order, and the frame
+types it is asked for. Filter values are written as the structural hash of
+the input filter, which is found the same way, so the hash of a filter covers
+its whole subgraph. Two prototypes with equal keys produce the same frames,
+as get_frame must be idempotent, so a single active instance can serve both.
+
+The first activation of a key wraps the active filter in a shared instance,
+which is kept in a hash table for as long as any handle to it is alive. Each
+caller gets its own handle, destroying the last handle destroys the shared
+instance. Later activations of the same key get a new handle, and their
+frame type descriptions are filled in with what the first activation set.
+
+Only the standard frame type is understood, activations asking for any other
+frame type are never shared. Input filters are compared by their 64 bit
+hash, not structurally, which keeps keys small and comparing them cheap.
+
+Hashing a filter walks its whole subgraph, and every filter activates its
+input clips, so hashes are kept in a table for the duration of the outermost
+activation on each thread. Nested activations look the hashes of their
+subgraph up in it, and hashing a graph stays linear in its size.
+
+*/
+
+
+#define INITIAL_SLOTS 64
+
+/// Marks the end of a frame type request in keys
+#define KEY_END_FRAMETYPES 0xFF
+
+/// An active filter shared by all activations of one key
+struct SharedInstance {
+	unsigned long long hash;
+	unsigned char *key;
+	size_t key_len;
+	Vs_ActiveFilter upstream;
+	/// Number of handles, protected by the table lock
+	size_t handles;
+	/// Frame type descriptions as the first activation left them
+	struct Vs_StandardFrameTypeDescription *frametypes;
+	size_t frametype_count;
+	struct SharedInstance *next;
+};
+
+struct SharedHandle {
+	struct TAG_Vs_ActiveFilter base;
+	struct ShareTable *table;
+	struct SharedInstance *instance;
+};
+
+/// A filter and the structural hash of its subgraph
+struct HashedFilter {
+	Vs_Filter filter;
+	unsigned long long hash;
+};
+
+/// Hashes known during the outermost activation on a thread
+struct ShareScope {
+	/// Number of activations in progress on the thread
+	unsigned int depth;
+	/// Open addressed, with linear probing, holds a reference to each filter
+	struct HashedFilter *slots;
+	size_t slot_count;
+	size_t count;
+};
+
+struct ShareTable {
+	VsMutex lock;
+	VsTls tls;
+	/// Zero if the thread local slot could not be allocated
+	int usable;
+	int enabled;
+	/// Chained, protected by lock
+	struct SharedInstance **slots;
+	size_t slot_count;
+	size_t count;
+};
+
+extern struct TAG_Vs_ActiveFilterVirtual SharedHandle_vtable;
+extern struct TAG_Vs_ActiveFilterVirtual SharedHandle_sync_vtable;
+
+
+/*
+	Keys
+*/
+
+/// A growing byte buffer a key is written to
+struct KeyBuffer {
+	unsigned char *data;
+	size_t len;
+	size_t size;
+	/// Set when memory ran out or the key can't be written
+	int failed;
+};
+
+static void Key_Write(struct KeyBuffer *buf, const void *data, size_t len)
+{
+	unsigned char *grown;
+	size_t size;
+
+	if (buf->failed)
+		return;
+	if (buf->len + len > buf->size)
+	{
+		size = buf->size ? buf->size * 2 : 128;
+		while (size < buf->len + len)
+			size *= 2;
+		grown = (unsigned char *)realloc(buf->data, size);
+		if (grown == NULL)
+		{
+			buf->failed = 1;
+			return;
+		}
+		buf->data = grown;
+		buf->size = size;
+	}
+	memcpy(buf->data + buf->len, data, len);
+	buf->len += len;
+}
+
+INLINE static void Key_WriteByte(struct KeyBuffer *buf, unsigned char b)
+{
+	Key_Write(buf, &b, 1);
+}
+
+INLINE static void Key_WriteSize(struct KeyBuffer *buf, size_t v)
+{
+	Key_Write(buf, &v, sizeof(v));
+}
+
+/// FNV-1a, 64 bit
+static unsigned long long HashBytes(const unsigned char *data, size_t len)
+{
+	unsigned long long hash = 14695981039346656037ull;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+	{
+		hash ^= data[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+
+/// Property types of a filter, collected from enum_properties
+struct PropertyTypes {
+	enum Vs_PropertyType *types;
+	size_t count;
+	size_t size;
+	int failed;
+};
+
+VSYNTH_IMPLEMENT_METHOD(void, CollectPropertyType)(const char *name, enum Vs_PropertyType type, void *userdata)
+{
+	struct PropertyTypes *pt = (struct PropertyTypes *)userdata;
+	enum Vs_PropertyType *grown;
+
+	if (pt->failed)
+		return;
+	if (pt->count == pt->size)
+	{
+		grown = (enum Vs_PropertyType *)realloc(pt->types, (pt->size ? pt->size * 2 : 8) * sizeof(enum Vs_PropertyType));
+		if (grown == NULL)
+		{
+			pt->failed = 1;
+			return;
+		}
+		pt->types = grown;
+		pt->size = pt->size ? pt->size * 2 : 8;
+	}
+	// IDs are the enumeration order
+	pt->types[pt->count++] = type;
+}
+
+
+static struct HashedFilter *Scope_Find(struct ShareScope *scope, Vs_Filter filter)
+{
+	size_t h = (size_t)filter;
+	size_t i;
+
+	// filters are pointer aligned, the low bits carry no information
+	h ^= h >> 4;
+	h ^= h >> 12;
+	for (i = h & (scope->slot_count - 1); scope->slots[i].filter != NULL; i = (i + 1) & (scope->slot_count - 1))
+	{
+		if (scope->slots[i].filter == filter)
+			return &scope->slots[i];
+	}
+	return &scope->slots[i];
+}
+
+/// Remember the hash of a filter, returns zero if out of memory
+static int Scope_Add(struct ShareScope *scope, Vs_Filter filter, unsigned long long hash)
+{
+	struct HashedFilter *old = scope->slots, *slot;
+	size_t old_count = scope->slot_count, i;
+
+	// keep the table at most half full
+	if ((scope->count + 1) * 2 > scope->slot_count)
+	{
+		scope->slots = (struct HashedFilter *)calloc(old_count * 2, sizeof(struct HashedFilter));
+		if (scope->slots == NULL)
+		{
+			scope->slots = old;
+			return 0;
+		}
+		scope->slot_count = old_count * 2;
+		for (i = 0; i < old_count; i++)
+		{
+			if (old[i].filter != NULL)
+				*Scope_Find(scope, old[i].filter) = old[i];
+		}
+		free(old);
+	}
+
+	slot = Scope_Find(scope, filter);
+	if (slot->filter != NULL)
+		return 1;
+	filter->methods->addref(filter);
+	slot->filter = filter;
+	slot->hash = hash;
+	scope->count++;
+	return 1;
+}
+
+/// Write the properties of a filter, input filters as their hashes
+///
+/// Fails if the hash of an input filter isn't known.
+static void Key_WriteFilter(struct KeyBuffer *buf, struct ShareScope *scope, Vs_Library vsynth, Vs_Filter filter)
+{
+	struct PropertyTypes pt = { NULL, 0, 0, 0 };
+	struct HashedFilter *input;
+	Vs_PropertyValue value;
+	size_t i;
+
+	filter->methods->enum_properties(CollectPropertyType, &pt);
+	buf->failed |= pt.failed;
+	Key_Write(buf, &filter->methods, sizeof(filter->methods));
+	for (i = 0; i < pt.count && !buf->failed; i++)
+	{
+		if (!PropertyAPI.Get(vsynth, filter, (Vs_PropertyId)i, &value) || value.type != pt.types[i])
+		{
+			buf->failed = 1;
+			break;
+		}
+		Key_WriteByte(buf, (unsigned char)value.type);
+		switch (value.type)
+		{
+		case PROP_FILTER:
+			if (value.v.f == NULL)
+			{
+				Key_WriteByte(buf, 0);
+				break;
+			}
+			input = Scope_Find(scope, value.v.f);
+			if (input->filter == NULL)
+				buf->failed = 1;
+			Key_WriteByte(buf, 1);
+			Key_Write(buf, &input->hash, sizeof(input->hash));
+			value.v.f->methods->unref(value.v.f);
+			break;
+		case PROP_INT:
+			Key_Write(buf, &value.v.i, sizeof(value.v.i));
+			break;
+		case PROP_DOUBLE:
+			Key_Write(buf, &value.v.d, sizeof(value.v.d));
+			break;
+		case PROP_STRING:
+			// the getter keeps its reference, NULL is the empty string
+			Key_WriteSize(buf, value.v.s != NULL ? value.v.s->len : 0);
+			if (value.v.s != NULL && value.v.s->len > 0)
+				Key_Write(buf, value.v.s->str, value.v.s->len);
+			break;
+		case PROP_FRAMENUMBER:
+			Key_Write(buf, &value.v.fn, sizeof(value.v.fn));
+			break;
+		case PROP_TIMESTAMP:
+			Key_Write(buf, &value.v.ts, sizeof(value.v.ts));
+			break;
+		default:
+			buf->failed = 1;
+			break;
+		}
+	}
+	free(pt.types);
+}
+
+/// A filter on the hashing stack
+struct HashTask {
+	Vs_Filter filter;
+	/// Set once the input filters have been pushed
+	int expanded;
+};
+
+/// Push the input filters of a filter whose hash isn't known yet
+static int PushInputs(struct HashTask **stack, size_t *depth, size_t *size, struct ShareScope *scope, Vs_Library vsynth, Vs_Filter filter)
+{
+	struct PropertyTypes pt = { NULL, 0, 0, 0 };
+	struct HashTask *grown;
+	Vs_PropertyValue value;
+	size_t i;
+	int ok;
+
+	filter->methods->enum_properties(CollectPropertyType, &pt);
+	ok = !pt.failed;
+	for (i = 0; i < pt.count && ok; i++)
+	{
+		if (pt.types[i] != PROP_FILTER || !PropertyAPI.Get(vsynth, filter, (Vs_PropertyId)i, &value) || value.type != PROP_FILTER || value.v.f == NULL)
+			continue;
+		if (Scope_Find(scope, value.v.f)->filter == NULL)
+		{
+			if (*depth == *size)
+			{
+				grown = (struct HashTask *)realloc(*stack, *size * 2 * sizeof(struct HashTask));
+				if (grown == NULL)
+					ok = 0;
+				else
+				{
+					*stack = grown;
+					*size *= 2;
+				}
+			}
+			if (ok)
+			{
+				// the filter keeps its input alive
+				(*stack)[*depth].filter = value.v.f;
+				(*stack)[*depth].expanded = 0;
+				(*depth)++;
+			}
+		}
+		value.v.f->methods->unref(value.v.f);
+	}
+	free(pt.types);
+	return ok;
+}
+
+/// Find the structural hashes of a filter's subgraph
+///
+/// Walks the subgraph depth first with an explicit stack, as graphs can nest
+/// filters thousands deep. Returns zero if any hash couldn't be found.
+static int HashSubgraph(struct ShareScope *scope, Vs_Library vsynth, Vs_Filter filter)
+{
+	struct KeyBuffer buf = { NULL, 0, 0, 0 };
+	struct HashTask *stack, *top;
+	size_t depth = 0, size = 16;
+	int ok = 1;
+
+	if (Scope_Find(scope, filter)->filter != NULL)
+		return 1;
+	stack = (struct HashTask *)malloc(size * sizeof(struct HashTask));
+	if (stack == NULL)
+		return 0;
+	stack[depth].filter = filter;
+	stack[depth].expanded = 0;
+	depth++;
+
+	while (depth > 0 && ok)
+	{
+		top = &stack[depth - 1];
+		if (Scope_Find(scope, top->filter)->filter != NULL)
+		{
+			depth--;
+		}
+		else if (!top->expanded)
+		{
+			top->expanded = 1;
+			ok = PushInputs(&stack, &depth, &size, scope, vsynth, top->filter);
+		}
+		else
+		{
+			// an input still missing here means the graph has a cycle
+			buf.len = 0;
+			buf.failed = 0;
+			Key_WriteFilter(&buf, scope, vsynth, top->filter);
+			ok = !buf.failed && Scope_Add(scope, top->filter, HashBytes(buf.data, buf.len));
+			depth--;
+		}
+	}
+
+	free(buf.data);
+	free(stack);
+	return ok;
+}
+
+/// Write the frame types asked for, fails for types other than stdframe
+static void Key_WriteFrameTypes(struct KeyBuffer *buf, Vs_FrameTypeDescription **frametypes)
+{
+	struct Vs_StandardFrameTypeDescription *sfd;
+	enum Vs_StdframePixelFormat *pf;
+
+	for (; *frametypes != NULL && !buf->failed; frametypes++)
+	{
+		sfd = Vs_Stdframe_CheckFTD(*frametypes);
+		if (sfd == NULL)
+		{
+			buf->failed = 1;
+			break;
+		}
+		// only the fields set by the caller, out_supported is set by the callee
+		Key_Write(buf, &sfd->allow_resolution_change, sizeof(sfd->allow_resolution_change));
+		Key_Write(buf, &sfd->allow_pixfmt_change, sizeof(sfd->allow_pixfmt_change));
+		Key_WriteSize(buf, sfd->minwidth);
+		Key_WriteSize(buf, sfd->maxwidth);
+		Key_WriteSize(buf, sfd->minheight);
+		Key_WriteSize(buf, sfd->maxheight);
+		Key_Write(buf, &sfd->width_modulo, sizeof(sfd->width_modulo));
+		Key_Write(buf, &sfd->height_modulo, sizeof(sfd->height_modulo));
+		Key_WriteSize(buf, sfd->alignment);
+		Key_WriteSize(buf, sfd->padding_right);
+		Key_WriteSize(buf, sfd->padding_bottom);
+		for (pf = sfd->pixfmts; pf != NULL && *pf != STDPIXFMT_MAX; pf++)
+			Key_WriteByte(buf, (unsigned char)*pf);
+		Key_WriteByte(buf, KEY_END_FRAMETYPES);
+	}
+}
+
+
+/*
+	Shared handles
+*/
+
+VSYNTH_IMPLEMENT_METHOD(void, SharedHandle_destroy)(Vs_ActiveFilter filter)
+{
+	struct SharedHandle *sh = (struct SharedHandle *)filter;
+	struct ShareTable *table = sh->table;
+	struct SharedInstance *si = sh->instance, **link;
+	int last;
+
+	VsMutex_Lock(&table->lock);
+	last = --si->handles == 0;
+	if (last)
+	{
+		for (link = &table->slots[si->hash & (table->slot_count - 1)]; *link != si; link = &(*link)->next)
+			;
+		*link = si->next;
+		table->count--;
+	}
+	VsMutex_Unlock(&table->lock);
+
+	if (last)
+	{
+		si->upstream->methods->destroy(si->upstream);
+		free(si->frametypes);
+		free(si->key);
+		free(si);
+	}
+	sh->base.filter->methods->unref(sh->base.filter);
+	free(sh);
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Frame, SharedHandle_get_frame)(Vs_ActiveFilter filter, Vs_FrameNumber n)
+{
+	Vs_ActiveFilter upstream = ((struct SharedHandle *)filter)->instance->upstream;
+	return upstream->methods->get_frame(upstream, n);
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, SharedHandle_get_frame_async)(Vs_ActiveFilter filter, Vs_FrameNumber n, Vs_FrameCallback callback, void *userdata)
+{
+	Vs_ActiveFilter upstream = ((struct SharedHandle *)filter)->instance->upstream;
+	upstream->methods->get_frame_async(upstream, n, callback, userdata);
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_FrameNumber, SharedHandle_get_frame_count)(Vs_ActiveFilter filter)
+{
+	Vs_ActiveFilter upstream = ((struct SharedHandle *)filter)->instance->upstream;
+	return upstream->methods->get_frame_count(upstream);
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_Timestamp, SharedHandle_get_duration)(Vs_ActiveFilter filter)
+{
+	Vs_ActiveFilter upstream = ((struct SharedHandle *)filter)->instance->upstream;
+	return upstream->methods->get_duration(upstream);
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_FrameNumber, SharedHandle_frame_at_timestamp)(Vs_ActiveFilter filter, Vs_Timestamp t)
+{
+	Vs_ActiveFilter upstream = ((struct SharedHandle *)filter)->instance->upstream;
+	if (upstream->methods->frame_at_timestamp != NULL)
+		return upstream->methods->frame_at_timestamp(upstream, t);
+	return Seek_SearchFrames(upstream, t);
+}
+
+struct TAG_Vs_ActiveFilterVirtual SharedHandle_vtable = {
+	SharedHandle_destroy,
+	SharedHandle_get_frame,
+	SharedHandle_get_frame_count,
+	SharedHandle_get_duration,
+	SharedHandle_get_frame_async,
+	SharedHandle_frame_at_timestamp
+};
+
+/// For filters without get_frame_async
+struct TAG_Vs_ActiveFilterVirtual SharedHandle_sync_vtable = {
+	SharedHandle_destroy,
+	SharedHandle_get_frame,
+	SharedHandle_get_frame_count,
+	SharedHandle_get_duration,
+	NULL,
+	SharedHandle_frame_at_timestamp
+};
+
+/// Make a handle to a shared instance, the caller has counted it
+static Vs_ActiveFilter NewHandle(struct ShareTable *table, struct SharedInstance *si, Vs_Filter filter)
+{
+	struct SharedHandle *sh = (struct SharedHandle *)malloc(sizeof(struct SharedHandle));
+
+	if (sh == NULL)
+		return NULL;
+	sh->base.methods = si->upstream->methods->get_frame_async != NULL ? &SharedHandle_vtable : &SharedHandle_sync_vtable;
+	sh->base.filter = filter;
+	filter->methods->addref(filter);
+	sh->table = table;
+	sh->instance = si;
+	return &sh->base;
+}
+
+
+/*
+	Sharing
+*/
+
+struct ShareTable *ShareTable_Create(void)
+{
+	struct ShareTable *table = (struct ShareTable *)calloc(1, sizeof(struct ShareTable));
+
+	VsMutex_Init(&table->lock);
+	table->usable = VsTls_Init(&table->tls);
+	table->enabled = 1;
+	table->slot_count = INITIAL_SLOTS;
+	table->slots = (struct SharedInstance **)calloc(table->slot_count, sizeof(struct SharedInstance *));
+	return table;
+}
+
+void ShareTable_Destroy(struct ShareTable *table)
+{
+	// every handle must have been destroyed, which empties the table
+	if (table->usable)
+		VsTls_Destroy(&table->tls);
+	VsMutex_Destroy(&table->lock);
+	free(table->slots);
+	free(table);
+}
+
+void ShareTable_SetEnabled(struct ShareTable *table, int enabled)
+{
+	VsMutex_Lock(&table->lock);
+	table->enabled = enabled;
+	VsMutex_Unlock(&table->lock);
+}
+
+void ShareTable_Enter(struct ShareTable *table)
+{
+	struct ShareScope *scope;
+
+	if (!table->usable)
+		return;
+	scope = (struct ShareScope *)VsTls_Get(&table->tls);
+	if (scope == NULL)
+	{
+		scope = (struct ShareScope *)calloc(1, sizeof(struct ShareScope));
+		if (scope == NULL)
+			return;
+		scope->slot_count = INITIAL_SLOTS;
+		scope->slots = (struct HashedFilter *)calloc(scope->slot_count, sizeof(struct HashedFilter));
+		if (scope->slots == NULL)
+		{
+			free(scope);
+			return;
+		}
+		VsTls_Set(&table->tls, scope);
+	}
+	scope->depth++;
+}
+
+void ShareTable_Leave(struct ShareTable *table)
+{
+	struct ShareScope *scope;
+	size_t i;
+
+	if (!table->usable || (scope = (struct ShareScope *)VsTls_Get(&table->tls)) == NULL)
+		return;
+	if (--scope->depth > 0)
+		return;
+	for (i = 0; i < scope->slot_count; i++)
+	{
+		if (scope->slots[i].filter != NULL)
+			scope->slots[i].filter->methods->unref(scope->slots[i].filter);
+	}
+	free(scope->slots);
+	free(scope);
+	VsTls_Set(&table->tls, NULL);
+}
+
+int ShareTable_MakeKey(struct ShareTable *table, Vs_Library vsynth, Vs_Filter filter, Vs_FrameTypeDescription **frametypes, struct ShareKey *key)
+{
+	struct ShareScope *scope;
+	struct KeyBuffer buf = { NULL, 0, 0, 0 };
+
+	key->data = NULL;
+	key->len = 0;
+	if (!table->enabled || !table->usable || (scope = (struct ShareScope *)VsTls_Get(&table->tls)) == NULL)
+		return 0;
+	if (!HashSubgraph(scope, vsynth, filter))
+		return 0;
+
+	Key_Write(&buf, &Scope_Find(scope, filter)->hash, sizeof(unsigned long long));
+	Key_WriteFrameTypes(&buf, frametypes);
+	if (buf.failed)
+	{
+		free(buf.data);
+		return 0;
+	}
+	key->data = buf.data;
+	key->len = buf.len;
+	key->hash = HashBytes(buf.data, buf.len);
+	return 1;
+}
+
+/// Find the shared instance of a key, table must be locked
+static struct SharedInstance *FindInstance(struct ShareTable *table, const struct ShareKey *key)
+{
+	struct SharedInstance *si;
+
+	for (si = table->slots[key->hash & (table->slot_count - 1)]; si != NULL; si = si->next)
+	{
+		if (si->hash == key->hash && si->key_len == key->len && memcmp(si->key, key->data, key->len) == 0)
+			return si;
+	}
+	return NULL;
+}
+
+Vs_ActiveFilter ShareTable_Find(struct ShareTable *table, Vs_Filter filter, const struct ShareKey *key, Vs_FrameTypeDescription **frametypes)
+{
+	struct Vs_StandardFrameTypeDescription *sfd;
+	struct SharedInstance *si;
+	enum Vs_StdframePixelFormat *pixfmts;
+	Vs_ActiveFilter handle;
+	size_t i;
+
+	VsMutex_Lock(&table->lock);
+	si = FindInstance(table, key);
+	if (si != NULL)
+		si->handles++;
+	VsMutex_Unlock(&table->lock);
+	if (si == NULL)
+		return NULL;
+
+	handle = NewHandle(table, si, filter);
+	if (handle == NULL)
+	{
+		// can't be the last handle, the caller of Find has none yet
+		VsMutex_Lock(&table->lock);
+		si->handles--;
+		VsMutex_Unlock(&table->lock);
+		return NULL;
+	}
+	// the callee's answers, the caller keeps its own pixfmts array
+	for (i = 0; i < si->frametype_count; i++)
+	{
+		sfd = Vs_Stdframe_CheckFTD(frametypes[i]);
+		pixfmts = sfd->pixfmts;
+		*sfd = si->frametypes[i];
+		sfd->pixfmts = pixfmts;
+	}
+	return handle;
+}
+
+/// Double the number of hash slots, table must be locked
+static void GrowTable(struct ShareTable *table)
+{
+	struct SharedInstance **slots, *si, *next;
+	size_t count = table->slot_count * 2, i;
+
+	slots = (struct SharedInstance **)calloc(count, sizeof(struct SharedInstance *));
+	// chains just get longer without memory
+	if (slots == NULL)
+		return;
+	for (i = 0; i < table->slot_count; i++)
+	{
+		for (si = table->slots[i]; si != NULL; si = next)
+		{
+			next = si->next;
+			si->next = slots[si->hash & (count - 1)];
+			slots[si->hash & (count - 1)] = si;
+		}
+	}
+	free(table->slots);
+	table->slots = slots;
+	table->slot_count = count;
+}
+
+Vs_ActiveFilter ShareTable_Add(struct ShareTable *table, Vs_Filter filter, struct ShareKey *key, Vs_FrameTypeDescription **frametypes, Vs_ActiveFilter active)
+{
+	struct SharedInstance *si = (struct SharedInstance *)malloc(sizeof(struct SharedInstance));
+	Vs_ActiveFilter handle;
+	size_t i, count;
+
+	for (count = 0; frametypes[count] != NULL; count++)
+		;
+	if (si != NULL)
+	{
+		si->frametypes = (struct Vs_StandardFrameTypeDescription *)malloc((count ? count : 1) * sizeof(struct Vs_StandardFrameTypeDescription));
+		si->upstream = active;
+		handle = si->frametypes != NULL ? NewHandle(table, si, filter) : NULL;
+	}
+	// sharing is only an improvement, without memory the filter is used on its own
+	if (si == NULL || handle == NULL)
+	{
+		if (si != NULL)
+			free(si->frametypes);
+		free(si);
+		free(key->data);
+		return active;
+	}
+
+	// the key was checked to hold only stdframe types
+	for (i = 0; i < count; i++)
+		si->frametypes[i] = *Vs_Stdframe_CheckFTD(frametypes[i]);
+	si->frametype_count = count;
+	si->hash = key->hash;
+	si->key = key->data;
+	si->key_len = key->len;
+	si->handles = 1;
+
+	VsMutex_Lock(&table->lock);
+	if ((table->count + 1) > table->slot_count)
+		GrowTable(table);
+	si->next = table->slots[si->hash & (table->slot_count - 1)];
+	table->slots[si->hash & (table->slot_count - 1)] = si;
+	table->count++;
+	VsMutex_Unlock(&table->lock);
+
+	return handle;
+}
@@ -0,0 +1,211 @@
+#include <stdlib.h>
+#include <string.h>
+#include <vsynth/vsynth.h>
+#include <vsynth/platform.h>
+#include "core.h"
+
+
+/*
+
+Strings are a single block holding a reference count, the public Vs_String
+header and the characters. Strings are immutable once shared, so copying one
+just adds a reference.
+
+The intern table keeps one reference to each string in it, and hands out
+further references to strings with equal contents.
+
+*/
+
+
+struct StringBlock {
+	Vs_AtomicCount refcount;
+	/// Hash of the contents, only set for interned strings
+	unsigned int hash;
+	/// Next string in the same intern table chain
+	struct StringBlock *next;
+	struct TAG_Vs_String pub;
+	// characters follow
+};
+
+INLINE static struct StringBlock *GetBlock(Vs_String str)
+{
+	return (struct StringBlock *)( ((char *)str) - offsetof(struct StringBlock, pub) );
+}
+
+
+INLINE VSYNTH_IMPLEMENT_METHOD(Vs_String, AllocString)(size_t len)
+{
+	struct StringBlock *block = (struct StringBlock *)malloc(sizeof(struct StringBlock) + len + 1);
+	char *chars;
+
+	if (block == NULL)
+		return NULL;
+	chars = (char *)(block + 1);
+	chars[len] = 0;
+
+	block->refcount = 1;
+	block->hash = 0;
+	block->next = NULL;
+	block->pub.len = len;
+	block->pub.str = len > 0 ? chars : NULL;
+	return &block->pub;
+}
+
+INLINE VSYNTH_IMPLEMENT_METHOD(Vs_String, MakeStringN)(const char *str, size_t len)
+{
+	Vs_String result = AllocString(len);
+	if (result != NULL && len > 0)
+	{
+		memcpy(result->str, str, len);
+	}
+	return result;
+}
+
+INLINE VSYNTH_IMPLEMENT_METHOD(Vs_String, MakeString)(const char *str)
+{
+	return MakeStringN(str, strlen(str));
+}
+
+INLINE VSYNTH_IMPLEMENT_METHOD(Vs_String, CopyString)(const Vs_String str)
+{
+	Vs_AtomicIncrement(&GetBlock(str)->refcount);
+	return str;
+}
+
+INLINE VSYNTH_IMPLEMENT_METHOD(void, FreeString)(Vs_String str)
+{
+	struct StringBlock *block;
+
+	if (str == NULL)
+		return;
+	block = GetBlock(str);
+	if (Vs_AtomicDecrement(&block->refcount) == 0)
+		free(block);
+}
+
+
+#define INTERN_INITIAL_SLOTS 256
+
+struct StringTable {
+	VsMutex lock;
+	struct StringBlock **slots;
+	size_t slot_count;
+	size_t count;
+};
+
+/// FNV-1a hash of a byte string
+INLINE static unsigned int HashChars(const char *str, size_t len)
+{
+	unsigned int hash = 2166136261u;
+	size_t i;
+	for (i = 0; i < len; i++)
+	{
+		hash ^= (unsigned char)str[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+struct StringTable *StringTable_Create(void)
+{
+	struct StringTable *table = (struct StringTable *)malloc(sizeof(struct StringTable));
+	VsMutex_Init(&table->lock);
+	table->slot_count = INTERN_INITIAL_SLOTS;
+	table->count = 0;
+	table->slots = (struct StringBlock **)calloc(table->slot_count, sizeof(struct StringBlock *));
+	return table;
+}
+
+void StringTable_Destroy(struct StringTable *table)
+{
+	struct StringBlock *block, *next;
+	size_t i;
+
+	// strings still referenced elsewhere stay alive
+	for (i = 0; i < table->slot_count; i++)
+	{
+		for (block = table->slots[i]; block != NULL; block = next)
+		{
+			next = block->next;
+			FreeString(&block->pub);
+		}
+	}
+	free(table->slots);
+	VsMutex_Destroy(&table->lock);
+	free(table);
+}
+
+static void StringTable_Grow(struct StringTable *table)
+{
+	size_t slot_count = table->slot_count * 2;
+	struct StringBlock **slots = (struct StringBlock **)calloc(slot_count, sizeof(struct StringBlock *));
+	struct StringBlock *block, *next;
+	size_t i, slot;
+
+	// a failure to grow only costs speed
+	if (slots == NULL)
+		return;
+
+	for (i = 0; i < table->slot_count; i++)
+	{
+		for (block = table->slots[i]; block != NULL; block = next)
+		{
+			next = block->next;
+			slot = block->hash & (slot_count - 1);
+			block->next = slots[slot];
+			slots[slot] = block;
+		}
+	}
+
+	free(table->slots);
+	table->slots = slots;
+	table->slot_count = slot_count;
+}
+
+VSYNTH_IMPLEMENT_METHOD(Vs_String, InternString)(Vs_Library vsynth, const char *str, size_t len)
+{
+	struct StringTable *table = getlib(vsynth)->string_table;
+	unsigned int hash = HashChars(str, len);
+	struct StringBlock *block;
+	Vs_String result;
+	size_t slot;
+
+	VsMutex_Lock(&table->lock);
+
+	slot = hash & (table->slot_count - 1);
+	for (block = table->slots[slot]; block != NULL; block = block->next)
+	{
+		if (block->hash == hash && block->pub.len == len && memcmp(block->pub.str, str, len) == 0)
+		{
+			result = CopyString(&block->pub);
+			VsMutex_Unlock(&table->lock);
+			return result;
+		}
+	}
+
+	result = MakeStringN(str, len);
+	if (result != NULL)
+	{
+		block = GetBlock(result);
+		block->hash = hash;
+		block->next = table->slots[slot];
+		table->slots[slot] = block;
+		table->count++;
+		if (table->count > table->slot_count)
+			StringTable_Grow(table);
+		// one reference for the table, one for the caller
+		CopyString(result);
+	}
+
+	VsMutex_Unlock(&table->lock);
+	return result;
+}
+
+struct TAG_Vs_StringAPI StringAPI = {
+	AllocString,
+	MakeString,
+	MakeStringN,
+	CopyString,
+	FreeString,
+	InternString
+};
@@ -0,0 +1,304 @@
+#include <stdlib.h>
+#include <vsynth/vsynth.h>
+#include <vsynth/platform.h>
+#include "core.h"
+
+
+/*
+
+A plain FIFO work queue served by a fixed number of worker threads.
+
+Threads waiting for queued work to finish should not just block, they should
+call ThreadPool_RunPending to help with the queue while waiting. That keeps
+nested waits (a task waiting for other tasks) from deadlocking when all the
+workers are busy waiting, and keeps the waiting thread's core busy.
+
+*/
+
+
+struct PoolTask {
+	VsTaskFunc func;
+	void *arg;
+	struct PoolTask *next;
+};
+
+struct ThreadPool {
+	VsMutex lock;
+	VsCond wakeup;
+	struct PoolTask *head;
+	struct PoolTask *tail;
+	int shutdown;
+	unsigned int thread_count;
+	VsThread *threads;
+};
+
+
+/// Take the first task off the queue, pool must be locked
+INLINE static struct PoolTask *PopTask(struct ThreadPool *pool)
+{
+	struct PoolTask *task = pool->head;
+	if (task != NULL)
+	{
+		pool->head = task->next;
+		if (pool->head == NULL)
+			pool->tail = NULL;
+	}
+	return task;
+}
+
+static void WorkerMain(void *arg)
+{
+	struct ThreadPool *pool = (struct ThreadPool *)arg;
+	struct PoolTask *task;
+
+	VsMutex_Lock(&pool->lock);
+	for (;;)
+	{
+		task = PopTask(pool);
+		if (task != NULL)
+		{
+			VsMutex_Unlock(&pool->lock);
+			task->func(task->arg);
+			free(task);
+			VsMutex_Lock(&pool->lock);
+		}
+		else if (pool->shutdown)
+		{
+			break;
+		}
+		else
+		{
+			VsCond_Wait(&pool->wakeup, &pool->lock);
+		}
+	}
+	VsMutex_Unlock(&pool->lock);
+}
+
+
+struct ThreadPool *ThreadPool_Create(unsigned int threads)
+{
+	struct ThreadPool *pool = (struct ThreadPool *)malloc(sizeof(struct ThreadPool));
+	unsigned int i;
+
+	if (threads == 0)
+		threads = VsThread_CpuCount();
+
+	VsMutex_Init(&pool->lock);
+	VsCond_Init(&pool->wakeup);
+	pool->head = NULL;
+	pool->tail = NULL;
+	pool->shutdown = 0;
+	pool->thread_count = 0;
+	pool->threads = (VsThread *)malloc(threads * sizeof(VsThread));
+
+	for (i = 0; i < threads; i++)
+	{
+		if (!VsThread_Start(&pool->threads[i], WorkerMain, pool))
+			break;
+		pool->thread_count++;
+	}
+
+	return pool;
+}
+
+void ThreadPool_Destroy(struct ThreadPool *pool)
+{
+	unsigned int i;
+
+	// workers finish off the queue before they exit
+	VsMutex_Lock(&pool->lock);
+	pool->shutdown = 1;
+	VsCond_Broadcast(&pool->wakeup);
+	VsMutex_Unlock(&pool->lock);
+
+	for (i = 0; i < pool->thread_count; i++)
+		VsThread_Join(&pool->threads[i]);
+
+	// in case no worker could be started at all
+	while (ThreadPool_RunPending(pool))
+		;
+
+	free(pool->threads);
+	VsCond_Destroy(&pool->wakeup);
+	VsMutex_Destroy(&pool->lock);
+	free(pool);
+}
+
+void ThreadPool_Submit(struct ThreadPool *pool, VsTaskFunc func, void *arg)
+{
+	struct PoolTask *task = (struct PoolTask *)malloc(sizeof(struct PoolTask));
+
+	// without workers or memory to queue it, just do the work here
+	if (task == NULL || pool->thread_count == 0)
+	{
+		free(task);
+		func(arg);
+		return;
+	}
+
+	task->func = func;
+	task->arg = arg;
+	task->next = NULL;
+
+	VsMutex_Lock(&pool->lock);
+	if (pool->tail != NULL)
+		pool->tail->next = task;
+	else
+		pool->head = task;
+	pool->tail = task;
+	VsCond_Signal(&pool->wakeup);
+	VsMutex_Unlock(&pool->lock);
+}
+
+int ThreadPool_RunPending(struct ThreadPool *pool)
+{
+	struct PoolTask *task;
+
+	VsMutex_Lock(&pool->lock);
+	task = PopTask(pool);
+	VsMutex_Unlock(&pool->lock);
+
+	if (task == NULL)
+		return 0;
+
+	task->func(task->arg);
+	free(task);
+	return 1;
+}
+
+unsigned int ThreadPool_Size(struct ThreadPool *pool)
+{
+	return pool->thread_count;
+}
+
+
+struct ThreadPool *GetThreadPool(struct LibraryInstance *v)
+{
+	struct ThreadPool *pool;
+
+	VsMutex_Lock(&v->lock);
+	if (v->thread_pool == NULL)
+		v->thread_pool = ThreadPool_Create(v->thread_count);
+	pool = v->thread_pool;
+	VsMutex_Unlock(&v->lock);
+
+	return pool;
+}
+
+
+VSYNTH_IMPLEMENT_METHOD(void, ThreadPool_SetThreadCount)(Vs_Library vsynth, unsigned int threads)
+{
+	struct LibraryInstance *v = getlib(vsynth);
+
+	VsMutex_Lock(&v->lock);
+	v->thread_count = threads;
+	VsMutex_Unlock(&v->lock);
+}
+
+VSYNTH_IMPLEMENT_METHOD(unsigned int, ThreadPool_GetThreadCount)(Vs_Library vsynth)
+{
+	struct LibraryInstance *v = getlib(vsynth);
+	unsigned int threads;
+
+	VsMutex_Lock(&v->lock);
+	if (v->thread_pool != NULL)
+		threads = v->thread_pool->thread_count;
+	else if (v->thread_count != 0)
+		threads = v->thread_count;
+	else
+		threads = VsThread_CpuCount();
+	VsMutex_Unlock(&v->lock);
+
+	return threads;
+}
+
+
+/// State of one ThreadPool::Run call, lives on the caller's stack
+struct ParallelRun {
+	Vs_ParallelFunc func;
+	void *userdata;
+	long count;
+	/// Next index to hand out
+	Vs_AtomicCount next;
+	VsMutex lock;
+	/// Signalled when the last helper finishes
+	VsCond done;
+	/// Helper tasks not finished yet, protected by lock
+	unsigned int helpers;
+};
+
+/// Take indices until there are none left
+static void RunIndices(struct ParallelRun *run)
+{
+	long i;
+
+	while ((i = Vs_AtomicIncrement(&run->next) - 1) < run->count)
+		run->func((size_t)i, run->userdata);
+}
+
+static void RunHelper(void *arg)
+{
+	struct ParallelRun *run = (struct ParallelRun *)arg;
+
+	RunIndices(run);
+
+	VsMutex_Lock(&run->lock);
+	if (--run->helpers == 0)
+		VsCond_Broadcast(&run->done);
+	VsMutex_Unlock(&run->lock);
+}
+
+VSYNTH_IMPLEMENT_METHOD(void, ThreadPool_Run)(Vs_Library vsynth, size_t count, Vs_ParallelFunc func, void *userdata)
+{
+	struct ThreadPool *pool;
+	struct ParallelRun run;
+	unsigned int helpers, i;
+	int ran;
+
+	if (count == 0)
+		return;
+	if (count == 1)
+	{
+		func(0, userdata);
+		return;
+	}
+
+	pool = GetThreadPool(getlib(vsynth));
+	run.func = func;
+	run.userdata = userdata;
+	run.count = (long)count;
+	run.next = 0;
+	VsMutex_Init(&run.lock);
+	VsCond_Init(&run.done);
+
+	// the caller takes a share too, so one helper less than there is work
+	helpers = ThreadPool_Size(pool);
+	if (helpers > count - 1)
+		helpers = (unsigned int)(count - 1);
+	run.helpers = helpers;
+	for (i = 0; i < helpers; i++)
+		ThreadPool_Submit(pool, RunHelper, &run);
+
+	RunIndices(&run);
+
+	// helpers still queued find nothing left to do, but run must outlive them
+	VsMutex_Lock(&run.lock);
+	while (run.helpers > 0)
+	{
+		VsMutex_Unlock(&run.lock);
+		ran = ThreadPool_RunPending(pool);
+		VsMutex_Lock(&run.lock);
+		if (!ran && run.helpers > 0)
+			VsCond_Wait(&run.done, &run.lock);
+	}
+	VsMutex_Unlock(&run.lock);
+
+	VsCond_Destroy(&run.done);
+	VsMutex_Destroy(&run.lock);
+}
+
+struct TAG_Vs_ThreadPoolAPI ThreadPoolAPI = {
+	ThreadPool_SetThreadCount,
+	ThreadPool_GetThreadCount,
+	ThreadPool_Run
+};
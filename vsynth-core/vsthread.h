@@ -0,0 +1,326 @@
+#pragma once
+
+/*
+
+Internal threading primitives for the core library.
+
+Thin wrappers around the Win32 and POSIX threading APIs, so the rest of the
+core can be written without caring about the platform.
+
+*/
+
+#include <stdlib.h>
+
+#ifdef _WIN32
+# define WIN32_LEAN_AND_MEAN
+# include <Windows.h>
+# include <process.h>
+#else
+# include <pthread.h>
+# include <unistd.h>
+# include <time.h>
+#endif
+
+
+#ifdef _MSC_VER
+# define INLINE __inline
+#elif defined(__GNUC__)
+# define INLINE __inline__
+#else
+# define INLINE
+#endif
+
+
+/// A non-recursive mutual exclusion lock
+typedef struct {
+#ifdef _WIN32
+	CRITICAL_SECTION cs;
+#else
+	pthread_mutex_t m;
+#endif
+} VsMutex;
+
+INLINE static void VsMutex_Init(VsMutex *mutex)
+{
+#ifdef _WIN32
+	InitializeCriticalSection(&mutex->cs);
+#else
+	pthread_mutex_init(&mutex->m, NULL);
+#endif
+}
+
+INLINE static void VsMutex_Destroy(VsMutex *mutex)
+{
+#ifdef _WIN32
+	DeleteCriticalSection(&mutex->cs);
+#else
+	pthread_mutex_destroy(&mutex->m);
+#endif
+}
+
+INLINE static void VsMutex_Lock(VsMutex *mutex)
+{
+#ifdef _WIN32
+	EnterCriticalSection(&mutex->cs);
+#else
+	pthread_mutex_lock(&mutex->m);
+#endif
+}
+
+INLINE static void VsMutex_Unlock(VsMutex *mutex)
+{
+#ifdef _WIN32
+	LeaveCriticalSection(&mutex->cs);
+#else
+	pthread_mutex_unlock(&mutex->m);
+#endif
+}
+
+
+/// A condition variable, used together with a VsMutex
+typedef struct {
+#ifdef _WIN32
+	CONDITION_VARIABLE cv;
+#else
+	pthread_cond_t c;
+#endif
+} VsCond;
+
+INLINE static void VsCond_Init(VsCond *cond)
+{
+#ifdef _WIN32
+	InitializeConditionVariable(&cond->cv);
+#else
+	pthread_cond_init(&cond->c, NULL);
+#endif
+}
+
+INLINE static void VsCond_Destroy(VsCond *cond)
+{
+#ifdef _WIN32
+	// nothing to do
+	(void)cond;
+#else
+	pthread_cond_destroy(&cond->c);
+#endif
+}
+
+/// Atomically unlock the mutex and wait for the condition to be signalled
+///
+/// May wake up spuriously, callers must re-check their condition.
+INLINE static void VsCond_Wait(VsCond *cond, VsMutex *mutex)
+{
+#ifdef _WIN32
+	SleepConditionVariableCS(&cond->cv, &mutex->cs, INFINITE);
+#else
+	pthread_cond_wait(&cond->c, &mutex->m);
+#endif
+}
+
+INLINE static void VsCond_Signal(VsCond *cond)
+{
+#ifdef _WIN32
+	WakeConditionVariable(&cond->cv);
+#else
+	pthread_cond_signal(&cond->c);
+#endif
+}
+
+INLINE static void VsCond_Broadcast(VsCond *cond)
+{
+#ifdef _WIN32
+	WakeAllConditionVariable(&cond->cv);
+#else
+	pthread_cond_broadcast(&cond->c);
+#endif
+}
+
+
+/// Handle for a running thread
+typedef struct {
+#ifdef _WIN32
+	HANDLE h;
+#else
+	pthread_t t;
+#endif
+} VsThread;
+
+/// Entry point for threads started with VsThread_Start
+typedef void (*VsThreadFunc)(void *arg);
+
+struct VsThreadStart {
+	VsThreadFunc func;
+	void *arg;
+};
+
+#ifdef _WIN32
+INLINE static unsigned __stdcall VsThread_Trampoline(void *p)
+#else
+INLINE static void *VsThread_Trampoline(void *p)
+#endif
+{
+	struct VsThreadStart start = *(struct VsThreadStart *)p;
+	free(p);
+	start.func(start.arg);
+	return 0;
+}
+
+/// Start a new thread running func(arg), returns non-zero on success
+INLINE static int VsThread_Start(VsThread *thread, VsThreadFunc func, void *arg)
+{
+	struct VsThreadStart *start = (struct VsThreadStart *)malloc(sizeof(struct VsThreadStart));
+	if (start == NULL)
+		return 0;
+	start->func = func;
+	start->arg = arg;
+#ifdef _WIN32
+	thread->h = (HANDLE)_beginthreadex(NULL, 0, VsThread_Trampoline, start, 0, NULL);
+	if (thread->h == NULL)
+#else
+	if (pthread_create(&thread->t, NULL, VsThread_Trampoline, start) != 0)
+#endif
+	{
+		free(start);
+		return 0;
+	}
+	return 1;
+}
+
+/// Wait for a thread to finish and release its handle
+INLINE static void VsThread_Join(VsThread *thread)
+{
+#ifdef _WIN32
+	WaitForSingleObject(thread->h, INFINITE);
+	CloseHandle(thread->h);
+#else
+	pthread_join(thread->t, NULL);
+#endif
+}
+
+/// Number of logical processors available to the process
+INLINE static unsigned int VsThread_CpuCount(void)
+{
+#ifdef _WIN32
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	return si.dwNumberOfProcessors > 0 ? (unsigned int)si.dwNumberOfProcessors : 1;
+#else
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? (unsigned int)n : 1;
+#endif
+}
+
+
+/// A thread local pointer, NULL on every thread until set
+typedef struct {
+#ifdef _WIN32
+	DWORD index;
+#else
+	pthread_key_t key;
+#endif
+} VsTls;
+
+/// Allocate a thread local slot, returns non-zero on success
+INLINE static int VsTls_Init(VsTls *tls)
+{
+#ifdef _WIN32
+	tls->index = TlsAlloc();
+	return tls->index != TLS_OUT_OF_INDEXES;
+#else
+	return pthread_key_create(&tls->key, NULL) == 0;
+#endif
+}
+
+/// Free a thread local slot, the values stored in it are not touched
+INLINE static void VsTls_Destroy(VsTls *tls)
+{
+#ifdef _WIN32
+	TlsFree(tls->index);
+#else
+	pthread_key_delete(tls->key);
+#endif
+}
+
+INLINE static void *VsTls_Get(VsTls *tls)
+{
+#ifdef _WIN32
+	return TlsGetValue(tls->index);
+#else
+	return pthread_getspecific(tls->key);
+#endif
+}
+
+INLINE static void VsTls_Set(VsTls *tls, void *value)
+{
+#ifdef _WIN32
+	TlsSetValue(tls->index, value);
+#else
+	pthread_setspecific(tls->key, value);
+#endif
+}
+
+
+/// Monotonic clock in nanoseconds, only meaningful for measuring intervals
+INLINE static unsigned long long VsTime_Now(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER count, freq;
+	QueryPerformanceCounter(&count);
+	QueryPerformanceFrequency(&freq);
+	// split to avoid overflowing the multiplication
+	return (unsigned long long)(count.QuadPart / freq.QuadPart) * 1000000000ULL
+		+ (unsigned long long)(count.QuadPart % freq.QuadPart) * 1000000000ULL / (unsigned long long)freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+#endif
+}
+
+
+/// Read a pointer published by VsAtomic_StorePtr on another thread
+///
+/// Everything written before the pointer was stored is visible through it.
+INLINE static void *VsAtomic_LoadPtr(void *const volatile *ptr)
+{
+#ifdef _MSC_VER
+	return InterlockedCompareExchangePointer((void *volatile *)ptr, NULL, NULL);
+#else
+	return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+#endif
+}
+
+/// Publish a pointer to other threads, after everything written before
+INLINE static void VsAtomic_StorePtr(void *volatile *ptr, void *value)
+{
+#ifdef _MSC_VER
+	InterlockedExchangePointer(ptr, value);
+#else
+	__atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+#endif
+}
+
+
+/// Read a 64 bit counter another thread may be writing, never torn, without ordering
+INLINE static unsigned long long VsAtomic_Load64(const volatile unsigned long long *ptr)
+{
+#if defined(_MSC_VER) && !defined(_WIN64)
+	return (unsigned long long)InterlockedCompareExchange64((volatile LONGLONG *)ptr, 0, 0);
+#elif defined(_MSC_VER)
+	return *ptr;
+#else
+	return __atomic_load_n(ptr, __ATOMIC_RELAXED);
+#endif
+}
+
+/// Write a 64 bit counter read by VsAtomic_Load64 on other threads, without ordering
+INLINE static void VsAtomic_Store64(volatile unsigned long long *ptr, unsigned long long value)
+{
+#if defined(_MSC_VER) && !defined(_WIN64)
+	InterlockedExchange64((volatile LONGLONG *)ptr, (LONGLONG)value);
+#elif defined(_MSC_VER)
+	*ptr = value;
+#else
+	__atomic_store_n(ptr, value, __ATOMIC_RELAXED);
+#endif
+}
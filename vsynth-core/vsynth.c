@@ -2,125 +2,157 @@
 #include <string.h>
 #include <stddef.h>
 #include <vsynth/vsynth.h>
+#include "core.h"
 
 
-#ifdef _MSC_VER
-# define INLINE __inline
-#else
-# define INLINE
-#endif
+/*
 
+The filter registry keeps the factories in an array in registration order,
+with a chained hash table on the identifiers for lookups. Chains are index
+links into the array, and new entries go at the head of their chain, so
+lookups find the most recently registered factory for an identifier first.
 
-struct FactoryList;
-struct LibraryInstance {
-	struct FactoryList *factory_list;
-	struct TAG_Vs_Library public_interface;
-};
-
-INLINE static struct LibraryInstance *getlib(Vs_Library vsynth)
-{
-	return (struct LibraryInstance *)( ((volatile char *)vsynth) - offsetof(struct LibraryInstance,public_interface) );
-}
+*/
 
+#define REGISTRY_INITIAL_SLOTS 64
 
+struct FactoryEntry {
+	Vs_FilterFactory *factory;
+	unsigned int hash;
+	/// Index of the next entry in the same hash chain, -1 at the end
+	ptrdiff_t next;
+};
 
-INLINE VSYNTH_IMPLEMENT_METHOD(Vs_String, AllocString)(size_t len)
-{
-	Vs_String result = (Vs_String)malloc(sizeof(struct TAG_Vs_String));
-	result->len = len;
-	if (len > 0)
-	{
-		result->str = (char *)malloc(len);
-	}
-	else
-	{
-		result->str = NULL;
-	}
-	return result;
-}
+struct FactoryList {
+	struct FactoryEntry *entries;
+	size_t count;
+	size_t capacity;
+	/// Index of the first entry of each hash chain, -1 if empty
+	ptrdiff_t *slots;
+	size_t slot_count;
+};
 
-INLINE VSYNTH_IMPLEMENT_METHOD(Vs_String, MakeStringN)(const char *str, size_t len)
+/// FNV-1a hash of an identifier
+INLINE static unsigned int HashIdentifier(const char *identifier)
 {
-	Vs_String result = AllocString(len);
-	if (len > 0)
+	unsigned int hash = 2166136261u;
+	while (*identifier)
 	{
-		memcpy(result->str, str, len);
+		hash ^= (unsigned char)*identifier++;
+		hash *= 16777619u;
 	}
-	return result;
+	return hash;
 }
 
-INLINE VSYNTH_IMPLEMENT_METHOD(Vs_String, MakeString)(const char *str)
+static struct FactoryList *FactoryList_Create(void)
 {
-	return MakeStringN(str, strlen(str));
+	struct FactoryList *list = (struct FactoryList *)malloc(sizeof(struct FactoryList));
+	size_t i;
+
+	list->entries = NULL;
+	list->count = 0;
+	list->capacity = 0;
+	list->slot_count = REGISTRY_INITIAL_SLOTS;
+	list->slots = (ptrdiff_t *)malloc(list->slot_count * sizeof(ptrdiff_t));
+	for (i = 0; i < list->slot_count; i++)
+		list->slots[i] = -1;
+
+	return list;
 }
 
-INLINE VSYNTH_IMPLEMENT_METHOD(Vs_String, CopyString)(const Vs_String str)
+static void FactoryList_Destroy(struct FactoryList *list)
 {
-	return MakeStringN(str->str, str->len);
+	free(list->entries);
+	free(list->slots);
+	free(list);
 }
 
-INLINE VSYNTH_IMPLEMENT_METHOD(void, FreeString)(Vs_String str)
+/// Double the number of hash slots and rechain all entries
+static int FactoryList_Grow(struct FactoryList *list)
 {
-	free(str->str);
-	free(str);
-}
-
-static struct TAG_Vs_StringAPI StringAPI = {
-	AllocString,
-	MakeString,
-	MakeStringN,
-	CopyString,
-	FreeString
-};
+	size_t slot_count = list->slot_count * 2;
+	ptrdiff_t *slots = (ptrdiff_t *)malloc(slot_count * sizeof(ptrdiff_t));
+	size_t i, slot;
 
+	if (slots == NULL)
+		return 0;
+	for (i = 0; i < slot_count; i++)
+		slots[i] = -1;
 
+	// in registration order, so newer entries still end up in front
+	for (i = 0; i < list->count; i++)
+	{
+		slot = list->entries[i].hash & (slot_count - 1);
+		list->entries[i].next = slots[slot];
+		slots[slot] = (ptrdiff_t)i;
+	}
 
-struct FactoryList {
-	Vs_FilterFactory *factory;
-	struct FactoryList *next;
-};
+	free(list->slots);
+	list->slots = slots;
+	list->slot_count = slot_count;
+	return 1;
+}
 
 VSYNTH_IMPLEMENT_METHOD(void, RegisterFilter)(Vs_Library vsynth, Vs_FilterFactory *factory)
 {
-	struct FactoryList *cur;
-	struct FactoryList *new_head;
-	struct LibraryInstance *v = getlib(vsynth);
+	struct FactoryList *list = getlib(vsynth)->factory_list;
+	struct FactoryEntry *entries;
+	unsigned int hash = HashIdentifier(factory->identifier);
+	size_t slot = hash & (list->slot_count - 1);
+	ptrdiff_t cur;
+
+	// check it isn't already registered, a factory always hashes to the same chain
+	for (cur = list->slots[slot]; cur >= 0; cur = list->entries[cur].next)
+	{
+		if (list->entries[cur].factory == factory)
+			return;
+	}
 
-	// check it isn't already registered
-	for (cur = v->factory_list; cur != NULL; cur = cur->next)
+	if (list->count == list->capacity)
 	{
-		if (cur->factory == factory)
+		size_t capacity = list->capacity ? list->capacity * 2 : 32;
+		entries = (struct FactoryEntry *)realloc(list->entries, capacity * sizeof(struct FactoryEntry));
+		if (entries == NULL)
 			return;
+		list->entries = entries;
+		list->capacity = capacity;
 	}
 
 	// add it
-	new_head = (struct FactoryList *)malloc(sizeof(struct FactoryList));
-	new_head->factory = factory;
-	new_head->next = v->factory_list;
-	v->factory_list = new_head;
+	list->entries[list->count].factory = factory;
+	list->entries[list->count].hash = hash;
+	list->entries[list->count].next = list->slots[slot];
+	list->slots[slot] = (ptrdiff_t)list->count;
+	list->count++;
+
+	// keep the chains short, a failure to grow only costs speed
+	if (list->count > list->slot_count - list->slot_count / 4)
+		FactoryList_Grow(list);
 }
 
 VSYNTH_IMPLEMENT_METHOD(Vs_FilterFactory *, FindFilter)(Vs_Library vsynth, const char *name)
 {
-	struct FactoryList *cur;
-	struct LibraryInstance *v = getlib(vsynth);
-	
-	for (cur = v->factory_list; cur != NULL; cur = cur->next)
+	struct FactoryList *list = getlib(vsynth)->factory_list;
+	unsigned int hash = HashIdentifier(name);
+	ptrdiff_t cur;
+
+	for (cur = list->slots[hash & (list->slot_count - 1)]; cur >= 0; cur = list->entries[cur].next)
 	{
-		if (strcmp(name, cur->factory->identifier) == 0)
-			return cur->factory;
+		if (list->entries[cur].hash == hash && strcmp(name, list->entries[cur].factory->identifier) == 0)
+			return list->entries[cur].factory;
 	}
 	return NULL;
 }
 
 VSYNTH_IMPLEMENT_METHOD(void, EnumerateFilters)(Vs_Library vsynth, Vs_EnumFiltersFunc callback, void *userdata)
 {
-	struct FactoryList *cur;
-	struct LibraryInstance *v = getlib(vsynth);
-	
-	for (cur = v->factory_list; cur != NULL; cur = cur->next)
+	struct FactoryList *list = getlib(vsynth)->factory_list;
+	size_t i;
+
+	// most recently registered first
+	for (i = list->count; i > 0; i--)
 	{
-		callback(cur->factory, userdata);
+		callback(list->entries[i - 1].factory, userdata);
 	}
 }
 
@@ -136,25 +168,45 @@ VSYNTH_API(Vs_Library) Vs_InitLibrary(void)
 {
 	struct LibraryInstance *v = (struct LibraryInstance *)malloc(sizeof(struct LibraryInstance));
 
-	v->factory_list = NULL;
+	v->factory_list = FactoryList_Create();
+	v->frame_pool = FramePool_Create();
+	v->frame_cache = FrameCache_Create(&v->public_interface);
+	VsMutex_Init(&v->lock);
+	v->thread_count = 0;
+	v->thread_pool = NULL;
+	v->property_cache = PropertyCache_Create();
+	v->string_table = StringTable_Create();
+	v->profiler = Profiler_Create();
+	v->share_table = ShareTable_Create();
 	v->public_interface.FilterRegistry = &FilterRegistry;
 	v->public_interface.String = &StringAPI;
+	v->public_interface.FramePool = &FramePoolAPI;
+	v->public_interface.Cache = &CacheAPI;
+	v->public_interface.ThreadPool = &ThreadPoolAPI;
+	v->public_interface.FrameServer = &FrameServerAPI;
+	v->public_interface.Async = &AsyncAPI;
+	v->public_interface.Property = &PropertyAPI;
+	v->public_interface.Graph = &GraphAPI;
+	v->public_interface.Profile = &ProfileAPI;
+	v->public_interface.Seek = &SeekAPI;
 
 	return &(v->public_interface);
 }
 
 VSYNTH_API(void) Vs_FreeLibrary(Vs_Library vsynth)
 {
-	struct FactoryList *cur, *next;
 	struct LibraryInstance *v = getlib(vsynth);
 
-	cur = v->factory_list;
-	while (cur != NULL)
-	{
-		next = cur->next;
-		free(cur);
-		cur = next;
-	}
+	if (v->thread_pool != NULL)
+		ThreadPool_Destroy(v->thread_pool);
+	PropertyCache_Destroy(v->property_cache);
+	StringTable_Destroy(v->string_table);
+	ShareTable_Destroy(v->share_table);
+	Profiler_Destroy(v->profiler);
+	VsMutex_Destroy(&v->lock);
+	FrameCache_Destroy(v->frame_cache);
+	FramePool_Destroy(v->frame_pool);
+	FactoryList_Destroy(v->factory_list);
 
 	free(v);
 }
@@ -1,5 +1,7 @@
+#ifdef _MSC_VER
 #pragma comment(lib,"vsynth-core")
 #pragma comment(lib,"vsynth-stdlib")
+#endif
 
 
 #ifdef _WIN32
@@ -0,0 +1,101 @@
+#pragma once
+
+/*
+
+Threading and timing for the writer thread of the stdsink.
+
+The stdlib is written against the public API only, so it can't use the core
+library's threading primitives. The sink needs just one thread of its own,
+a lock and a condition to hand buffers over, and a clock for its counters,
+so these are thin wrappers around the Win32 and POSIX APIs.
+
+*/
+
+#include <vsynth/platform.h>
+
+#ifdef _WIN32
+# define WIN32_LEAN_AND_MEAN
+# include <Windows.h>
+# include <process.h>
+#else
+# include <pthread.h>
+# include <time.h>
+#endif
+
+
+#ifdef _WIN32
+
+typedef CRITICAL_SECTION SinkMutex;
+typedef CONDITION_VARIABLE SinkCond;
+typedef HANDLE SinkThread;
+/// Declares the entry point of a thread taking void *arg, which must return 0
+# define SINKTHREAD_ENTRY(name) unsigned __stdcall name(void *arg)
+
+static VSYNTH_INLINE void SinkMutex_Init(SinkMutex *mutex) { InitializeCriticalSection(mutex); }
+static VSYNTH_INLINE void SinkMutex_Destroy(SinkMutex *mutex) { DeleteCriticalSection(mutex); }
+static VSYNTH_INLINE void SinkMutex_Lock(SinkMutex *mutex) { EnterCriticalSection(mutex); }
+static VSYNTH_INLINE void SinkMutex_Unlock(SinkMutex *mutex) { LeaveCriticalSection(mutex); }
+
+static VSYNTH_INLINE void SinkCond_Init(SinkCond *cond) { InitializeConditionVariable(cond); }
+static VSYNTH_INLINE void SinkCond_Destroy(SinkCond *cond) { (void)cond; }
+static VSYNTH_INLINE void SinkCond_Wait(SinkCond *cond, SinkMutex *mutex) { SleepConditionVariableCS(cond, mutex, INFINITE); }
+static VSYNTH_INLINE void SinkCond_Broadcast(SinkCond *cond) { WakeAllConditionVariable(cond); }
+
+/// Start a thread, returns non-zero on success
+static VSYNTH_INLINE int SinkThread_Start(SinkThread *thread, unsigned (__stdcall *entry)(void *), void *arg)
+{
+	*thread = (HANDLE)_beginthreadex(NULL, 0, entry, arg, 0, NULL);
+	return *thread != NULL;
+}
+
+static VSYNTH_INLINE void SinkThread_Join(SinkThread *thread)
+{
+	WaitForSingleObject(*thread, INFINITE);
+	CloseHandle(*thread);
+}
+
+/// Monotonic clock in nanoseconds
+static VSYNTH_INLINE unsigned long long SinkTime_Now(void)
+{
+	LARGE_INTEGER count, freq;
+	QueryPerformanceCounter(&count);
+	QueryPerformanceFrequency(&freq);
+	return (unsigned long long)(count.QuadPart / freq.QuadPart) * 1000000000ULL
+		+ (unsigned long long)(count.QuadPart % freq.QuadPart) * 1000000000ULL / (unsigned long long)freq.QuadPart;
+}
+
+#else
+
+typedef pthread_mutex_t SinkMutex;
+typedef pthread_cond_t SinkCond;
+typedef pthread_t SinkThread;
+# define SINKTHREAD_ENTRY(name) void *name(void *arg)
+
+static VSYNTH_INLINE void SinkMutex_Init(SinkMutex *mutex) { pthread_mutex_init(mutex, NULL); }
+static VSYNTH_INLINE void SinkMutex_Destroy(SinkMutex *mutex) { pthread_mutex_destroy(mutex); }
+static VSYNTH_INLINE void SinkMutex_Lock(SinkMutex *mutex) { pthread_mutex_lock(mutex); }
+static VSYNTH_INLINE void SinkMutex_Unlock(SinkMutex *mutex) { pthread_mutex_unlock(mutex); }
+
+static VSYNTH_INLINE void SinkCond_Init(SinkCond *cond) { pthread_cond_init(cond, NULL); }
+static VSYNTH_INLINE void SinkCond_Destroy(SinkCond *cond) { pthread_cond_destroy(cond); }
+static VSYNTH_INLINE void SinkCond_Wait(SinkCond *cond, SinkMutex *mutex) { pthread_cond_wait(cond, mutex); }
+static VSYNTH_INLINE void SinkCond_Broadcast(SinkCond *cond) { pthread_cond_broadcast(cond); }
+
+static VSYNTH_INLINE int SinkThread_Start(SinkThread *thread, void *(*entry)(void *), void *arg)
+{
+	return pthread_create(thread, NULL, entry, arg) == 0;
+}
+
+static VSYNTH_INLINE void SinkThread_Join(SinkThread *thread)
+{
+	pthread_join(*thread, NULL);
+}
+
+static VSYNTH_INLINE unsigned long long SinkTime_Now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+#endif
@@ -1,7 +1,12 @@
 #include <vsynth/stdframe.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <assert.h>
+#if VSYNTH_SSE2
+# include <emmintrin.h>
+#endif
 
 
 #ifdef _MSC_VER
@@ -11,156 +16,120 @@
 #endif
 
 
-static INLINE size_t STDPIXFMT_pixelsize(enum Vs_StdframePixelFormat pixfmt)
-{
-	switch (pixfmt)
-	{
-	case STDPIXFMT_MONO8:
-	case STDPIXFMT_YCrCb8_444:
-	case STDPIXFMT_YCrCbA8_444:
-	case STDPIXFMT_YCrCb8_422:
-	case STDPIXFMT_YCrCbA8_422:
-	case STDPIXFMT_YCrCb8_420:
-	case STDPIXFMT_YCrCbA8_420:
-		return 1;
-	case STDPIXFMT_MONO16:
-	case STDPIXFMT_YCrCb16_444:
-	case STDPIXFMT_YCrCbA16_444:
-	case STDPIXFMT_YCrCb16_422:
-	case STDPIXFMT_YCrCbA16_422:
-	case STDPIXFMT_YCrCb16_420:
-	case STDPIXFMT_YCrCbA16_420:
-		return 2;
-	case STDPIXFMT_XRGB8:
-	case STDPIXFMT_ARGB8:
-		return 4;
-	case STDPIXFMT_XRGB16:
-	case STDPIXFMT_ARGB16:
-		return 8;
-	default:
-		return 0;
-	}
-}
+#define STDFRAME_4CID "StdF"
+
+/// Round a byte count up to the stdframe alignment
+#define STDFRAME_ALIGN(x) (((x) + VS_STDFRAME_ALIGNMENT-1) & ~(size_t)(VS_STDFRAME_ALIGNMENT-1))
+/// Bytes reserved for the frame header in front of the pixel data
+#define STDFRAME_HEADER_SIZE STDFRAME_ALIGN(sizeof(struct Vs_StandardFrame))
 
-static INLINE size_t STDPIXFMT_planecount(enum Vs_StdframePixelFormat pixfmt)
+
+VSYNTH_IMPLEMENT_METHOD(void, Stdframe_addref)(Vs_Frame frame)
 {
-	switch (pixfmt)
-	{
-	case STDPIXFMT_MONO8:
-	case STDPIXFMT_MONO16:
-	case STDPIXFMT_XRGB8:
-	case STDPIXFMT_ARGB8:
-	case STDPIXFMT_XRGB16:
-	case STDPIXFMT_ARGB16:
-		return 1;
-	case STDPIXFMT_YCrCb8_444:
-	case STDPIXFMT_YCrCb8_422:
-	case STDPIXFMT_YCrCb8_420:
-	case STDPIXFMT_YCrCb16_444:
-	case STDPIXFMT_YCrCb16_422:
-	case STDPIXFMT_YCrCb16_420:
-		return 3;
-	case STDPIXFMT_YCrCbA8_444:
-	case STDPIXFMT_YCrCbA8_422:
-	case STDPIXFMT_YCrCbA8_420:
-	case STDPIXFMT_YCrCbA16_444:
-	case STDPIXFMT_YCrCbA16_422:
-	case STDPIXFMT_YCrCbA16_420:
-		return 4;
-	default:
-		return 0;
-	}
+	Vs_StandardFrame sf = Vs_Stdframe_Get(frame);
+	assert(sf != NULL);
+
+	Vs_AtomicIncrement(&sf->refcount);
 }
 
-static INLINE size_t STDPIXFMT_planewidthscale(enum Vs_StdframePixelFormat pixfmt, size_t plane)
+VSYNTH_IMPLEMENT_METHOD(void, Stdframe_unref)(Vs_Frame frame)
 {
-	switch (pixfmt)
+	Vs_StandardFrame sf = Vs_Stdframe_Get(frame);
+	assert(sf != NULL);
+	assert(Vs_AtomicRead(&sf->refcount) > 0);
+
+	if (Vs_AtomicDecrement(&sf->refcount) == 0)
 	{
-	case STDPIXFMT_MONO8:
-	case STDPIXFMT_MONO16:
-	case STDPIXFMT_XRGB8:
-	case STDPIXFMT_ARGB8:
-	case STDPIXFMT_XRGB16:
-	case STDPIXFMT_ARGB16:
-	case STDPIXFMT_YCrCb8_444:
-	case STDPIXFMT_YCrCb16_444:
-	case STDPIXFMT_YCrCbA8_444:
-	case STDPIXFMT_YCrCbA16_444:
-		return 1;
-	case STDPIXFMT_YCrCb8_422:
-	case STDPIXFMT_YCrCb8_420:
-	case STDPIXFMT_YCrCb16_422:
-	case STDPIXFMT_YCrCb16_420:
-	case STDPIXFMT_YCrCbA8_422:
-	case STDPIXFMT_YCrCbA8_420:
-	case STDPIXFMT_YCrCbA16_422:
-	case STDPIXFMT_YCrCbA16_420:
-		if (plane == 0 || plane == 3)
-			return 1;
+		// views only own their header
+		if (sf->parent != NULL)
+		{
+			Stdframe_unref(&sf->parent->base);
+			free(sf);
+		}
+		// so do wrapped frames, the owner gets its memory back
+		else if (sf->data_baseptr == NULL)
+		{
+			if (sf->release != NULL)
+				sf->release(sf->release_userdata);
+			free(sf);
+		}
+		// header and pixel data are a single allocation
+		else if (sf->pool != NULL)
+			sf->pool->FramePool->Release(sf->pool, sf);
 		else
-			return 2;
-	default:
-		return 0;
+			Vs_AlignedFree(sf);
 	}
 }
 
-static INLINE size_t STDPIXFMT_planeheightscale(enum Vs_StdframePixelFormat pixfmt, size_t plane)
+VSYNTH_IMPLEMENT_METHOD(Vs_Frame, Stdframe_clone)(Vs_Frame frame)
 {
-	switch (pixfmt)
-	{
-	case STDPIXFMT_MONO8:
-	case STDPIXFMT_MONO16:
-	case STDPIXFMT_XRGB8:
-	case STDPIXFMT_ARGB8:
-	case STDPIXFMT_XRGB16:
-	case STDPIXFMT_ARGB16:
-	case STDPIXFMT_YCrCb8_444:
-	case STDPIXFMT_YCrCb16_444:
-	case STDPIXFMT_YCrCbA8_444:
-	case STDPIXFMT_YCrCbA16_444:
-	case STDPIXFMT_YCrCb8_422:
-	case STDPIXFMT_YCrCb16_422:
-	case STDPIXFMT_YCrCbA8_422:
-	case STDPIXFMT_YCrCbA16_422:
-		return 1;
-	case STDPIXFMT_YCrCb8_420:
-	case STDPIXFMT_YCrCb16_420:
-	case STDPIXFMT_YCrCbA8_420:
-	case STDPIXFMT_YCrCbA16_420:
-		if (plane == 0 || plane == 3)
-			return 1;
-		else
-			return 2;
-	default:
-		return 0;
-	}
-}
+	Vs_StandardFrame sf = Vs_Stdframe_Get(frame);
+	Vs_StandardFrame result = NULL;
+
+	assert(sf != NULL);
+
+	result = Vs_Stdframe_NewPadded(sf->pool, sf->pixfmt, sf->width, sf->height, sf->padding_right, sf->padding_bottom);
+	if (result == NULL)
+		return NULL;
 
+	// only the visible area, the frame may have been cropped
+	Vs_Stdframe_CopyRegion(result, 0, 0, sf, 0, 0, sf->width, sf->height);
+	result->base.timestamp = sf->base.timestamp;
+	
+	return (Vs_Frame)result;
+}
 
-VSYNTH_IMPLEMENT_METHOD(void, Stdframe_destroy)(Vs_Frame frame)
+VSYNTH_IMPLEMENT_METHOD(Vs_Frame, Stdframe_view)(Vs_Frame frame)
 {
 	Vs_StandardFrame sf = Vs_Stdframe_Get(frame);
+	Vs_StandardFrame view;
+
 	assert(sf != NULL);
 
-	free(sf->data_baseptr);
-	free(sf);
+	view = (Vs_StandardFrame)malloc(sizeof(struct Vs_StandardFrame));
+	if (view == NULL)
+		return NULL;
+
+	// same geometry and plane pointers, so crops carry over; the reference
+	// count is left out, other threads may be changing it
+	memcpy(view, sf, offsetof(struct Vs_StandardFrame, refcount));
+	view->refcount = 1;
+	view->pool = sf->pool;
+	view->release = sf->release;
+	view->release_userdata = sf->release_userdata;
+	// always refer to the owner directly, so views of views don't chain up
+	view->parent = sf->parent != NULL ? sf->parent : sf;
+	Stdframe_addref(&view->parent->base);
+
+	return &view->base;
 }
 
-VSYNTH_IMPLEMENT_METHOD(Vs_Frame, Stdframe_clone)(Vs_Frame frame)
+VSYNTH_IMPLEMENT_METHOD(Vs_Frame, Stdframe_make_writable)(Vs_Frame frame)
 {
 	Vs_StandardFrame sf = Vs_Stdframe_Get(frame);
-	Vs_StandardFrame result = NULL;
+	Vs_Frame result;
 
 	assert(sf != NULL);
 
-	result = Vs_Stdframe_New(sf->pixfmt, sf->width, sf->height);
-	if (result == NULL)
-		return NULL;
-	// fixme? check whether new frame has sama datasize as old? really should do scanline-by-scanline copy
+	// sole owner, nobody else can observe changes, and the memory is ours
+	if (Vs_AtomicRead(&sf->refcount) == 1 && sf->parent == NULL && sf->data_baseptr != NULL)
+		return frame;
 
-	memcpy(result->data_baseptr, sf->data_baseptr, sf->data_rawsize);
-	
-	return (Vs_Frame)result;
+	// shared, copy-on-write
+	result = Stdframe_clone(frame);
+	Stdframe_unref(frame);
+	return result;
+}
+
+VSYNTH_IMPLEMENT_METHOD(size_t, Stdframe_memory_size)(Vs_Frame frame)
+{
+	Vs_StandardFrame sf = Vs_Stdframe_Get(frame);
+	assert(sf != NULL);
+
+	// the data of a view is accounted to its owner, wrapped data to nobody
+	if (sf->parent != NULL || sf->data_baseptr == NULL)
+		return sizeof(struct Vs_StandardFrame);
+	return STDFRAME_HEADER_SIZE + sf->data_rawsize;
 }
 
 VSYNTH_IMPLEMENT_METHOD(void, Stdframe_crop)(Vs_StandardFrame frame, size_t left, size_t top, size_t width, size_t height)
@@ -182,139 +151,320 @@ VSYNTH_IMPLEMENT_METHOD(void, Stdframe_crop)(Vs_StandardFrame frame, size_t left
 	for (i = 0; i < planes; i++)
 	{
 		frame->data[i] = (void*)( (char*)frame->data[i] +
-			left * pixelsize / STDPIXFMT_planewidthscale(frame->pixfmt, i) +
-			top * frame->stride[i] / STDPIXFMT_planeheightscale(frame->pixfmt, i)
+			left / STDPIXFMT_planewidthscale(frame->pixfmt, i) * pixelsize +
+			(ptrdiff_t)(top / STDPIXFMT_planeheightscale(frame->pixfmt, i)) * frame->stride[i]
 		);
 	}
 }
 
 struct Vs_StandardFrameVirtual Vs_stdframe_vtable = {
 	{
-		Stdframe_destroy,
-		Stdframe_clone
+		Stdframe_addref,
+		Stdframe_unref,
+		Stdframe_clone,
+		Stdframe_view,
+		Stdframe_make_writable,
+		Stdframe_memory_size
 	},
 	Stdframe_crop,
 };
 
 
 VSYNTH_API(Vs_StandardFrame) Vs_Stdframe_New(enum Vs_StdframePixelFormat pixfmt, size_t width, size_t height)
+{
+	return Vs_Stdframe_NewPadded(NULL, pixfmt, width, height, 0, 0);
+}
+
+VSYNTH_API(Vs_StandardFrame) Vs_Stdframe_NewPooled(Vs_Library vsynth, enum Vs_StdframePixelFormat pixfmt, size_t width, size_t height)
+{
+	return Vs_Stdframe_NewPadded(vsynth, pixfmt, width, height, 0, 0);
+}
+
+VSYNTH_API(Vs_StandardFrame) Vs_Stdframe_NewPadded(Vs_Library vsynth, enum Vs_StdframePixelFormat pixfmt, size_t width, size_t height, size_t pad_right, size_t pad_bottom)
 {
 	Vs_StandardFrame frame;
+	Vs_FramePoolKey key;
 
 	size_t memreq = 0;
 	ptrdiff_t stride[4] = {0};
-	int planeheight[4] = {0};
-	int pixelsize = 0;
+	size_t planeheight[4] = {0};
+	size_t pixelsize = STDPIXFMT_pixelsize(pixfmt);
+	size_t planes = STDPIXFMT_planecount(pixfmt);
+	size_t wscale, hscale;
 
-	int i;
+	size_t i;
 
-	switch (pixfmt)
+	if (pixelsize == 0 || planes == 0)
 	{
-		// mono formats
-
-	case STDPIXFMT_MONO8:
-		pixelsize = 1;
-		stride[0] = width;
-		planeheight[0] = height;
-		break;
-
-	case STDPIXFMT_MONO16:
-		pixelsize = 2;
-		stride[0] = width*pixelsize;
-		planeheight[0] = height;
-		break;
-
-		// rgb formats
-
-	case STDPIXFMT_XRGB8:
-	case STDPIXFMT_ARGB8:
-		pixelsize = 4;
-		stride[0] = width*pixelsize;
-		planeheight[0] = height;
-		break;
-
-	case STDPIXFMT_XRGB16:
-	case STDPIXFMT_ARGB16:
-		pixelsize = 8;
-		stride[0] = width*pixelsize;
-		planeheight[0] = height;
-		break;
-
-		// 4:4:4 formats
-
-	case STDPIXFMT_YCrCb8_444:
-	case STDPIXFMT_YCrCbA8_444:
-	case STDPIXFMT_YCrCb16_444:
-	case STDPIXFMT_YCrCbA16_444:
-		pixelsize = 1;
-		if (pixfmt == STDPIXFMT_YCrCb16_444 || pixfmt == STDPIXFMT_YCrCbA16_444)
-			pixelsize = 2;
-		stride[0] = stride[1] = stride[2] = stride[3] = width * pixelsize;
-		planeheight[0] = planeheight[1] = planeheight[2] = height;
-		if (pixfmt == STDPIXFMT_YCrCbA8_444 || pixfmt == STDPIXFMT_YCrCbA16_444)
-			planeheight[3] = height;
-		break;
-
-		// 4:2:2 formats
-
-	case STDPIXFMT_YCrCb8_422:
-	case STDPIXFMT_YCrCbA8_422:
-	case STDPIXFMT_YCrCb16_422:
-	case STDPIXFMT_YCrCbA16_422:
-		pixelsize = 1;
-		if (pixfmt == STDPIXFMT_YCrCb16_422 || pixfmt == STDPIXFMT_YCrCbA16_422)
-			pixelsize = 2;
-		stride[0] = stride[3] = width * pixelsize;
-		stride[1] = stride[2] = (width+1)/2 * pixelsize;
-		planeheight[0] = planeheight[1] = planeheight[2] = height;
-		if (pixfmt == STDPIXFMT_YCrCbA8_422 || pixfmt == STDPIXFMT_YCrCbA16_422)
-			planeheight[3] = height;
-		break;
-
-		// 4:2:0 formats
-
-	case STDPIXFMT_YCrCb8_420:
-	case STDPIXFMT_YCrCbA8_420:
-	case STDPIXFMT_YCrCb16_420:
-	case STDPIXFMT_YCrCbA16_420:
-		pixelsize = 1;
-		if (pixfmt == STDPIXFMT_YCrCb16_420 || pixfmt == STDPIXFMT_YCrCbA16_420)
-			pixelsize = 2;
-		stride[0] = stride[3] = width * pixelsize;
-		stride[1] = stride[2] = (width+1)/2 * pixelsize;
-		planeheight[0] = height;
-		planeheight[1] = planeheight[2] = (height+1)/2;
-		if (pixfmt == STDPIXFMT_YCrCbA8_420 || pixfmt == STDPIXFMT_YCrCbA16_420)
-			planeheight[3] = height;
-		break;
-
-	default:
 		// whoops, invalid!
 		return NULL;
 	}
 
-	frame = (Vs_StandardFrame)malloc(sizeof(struct Vs_StandardFrame));
+	// Every plane gets its stride rounded up to the alignment, and planes
+	// follow each other directly, so with an aligned base every plane and
+	// every scanline starts aligned. Padding is rounded up to whole
+	// subsampled pixels on chroma planes.
+	for (i = 0; i < planes; i++)
+	{
+		wscale = STDPIXFMT_planewidthscale(pixfmt, i);
+		hscale = STDPIXFMT_planeheightscale(pixfmt, i);
+		stride[i] = STDFRAME_ALIGN(((width + wscale-1)/wscale + (pad_right + wscale-1)/wscale) * pixelsize);
+		planeheight[i] = (height + hscale-1)/hscale + (pad_bottom + hscale-1)/hscale;
+	}
+
+	// calculate memory needed
+	for (i = 0; i < planes; i++)
+		memreq += stride[i] * planeheight[i];
+
+	// allocate header and pixel data in one aligned block
+	if (vsynth != NULL)
+	{
+		Vs_Set4CID(key.frame_type, STDFRAME_4CID);
+		key.format = pixfmt;
+		key.width = width;
+		key.height = height;
+		frame = (Vs_StandardFrame)vsynth->FramePool->Alloc(vsynth, &key, STDFRAME_HEADER_SIZE + memreq);
+	}
+	else
+	{
+		frame = (Vs_StandardFrame)Vs_AlignedAlloc(STDFRAME_HEADER_SIZE + memreq, VS_STDFRAME_ALIGNMENT);
+	}
+	if (frame == NULL)
+		return NULL;
+
+	frame->base.methods = &Vs_stdframe_vtable.base;
+	frame->base.timestamp = 0;
+	frame->refcount = 1;
+	frame->pool = vsynth;
+	frame->parent = NULL;
+	frame->release = NULL;
+	frame->release_userdata = NULL;
 	frame->pixfmt = pixfmt;
 	frame->width = width;
 	frame->height = height;
+	frame->padding_right = pad_right;
+	frame->padding_bottom = pad_bottom;
 
-	// calculate memory needed
-	for (i = 0; i < 4; i++)
-		memreq += stride[i] * planeheight[i];
-	// allocate
-	frame->data_baseptr = malloc(memreq);
+	frame->data_baseptr = (char *)frame + STDFRAME_HEADER_SIZE;
 	frame->data_rawsize = memreq;
-	// store strides
+	// store strides and calculate plane locations
 	for (i = 0; i < 4; i++)
+	{
 		frame->stride[i] = stride[i];
-	// calculate and store plane locations
+		frame->data[i] = NULL;
+	}
 	frame->data[0] = frame->data_baseptr;
-	for (i = 1; i < 4; i++)
+	for (i = 1; i < planes; i++)
 		frame->data[i] = (void*)(((char*)frame->data[i-1]) + stride[i-1]*planeheight[i-1]);
 
 	return frame;
 }
 
+VSYNTH_API(Vs_StandardFrame) Vs_Stdframe_Wrap(Vs_Library vsynth, enum Vs_StdframePixelFormat pixfmt, size_t width, size_t height, void *const data[4], const ptrdiff_t stride[4], Vs_StdframeReleaseFunc release, void *userdata)
+{
+	size_t planes = STDPIXFMT_planecount(pixfmt);
+	Vs_StandardFrame frame;
+	size_t i;
+
+	if (planes == 0)
+		return NULL;
+
+	// only the header is allocated
+	frame = (Vs_StandardFrame)malloc(sizeof(struct Vs_StandardFrame));
+	if (frame == NULL)
+		return NULL;
+
+	frame->base.methods = &Vs_stdframe_vtable.base;
+	frame->base.timestamp = 0;
+	frame->refcount = 1;
+	frame->pool = vsynth;
+	frame->parent = NULL;
+	frame->release = release;
+	frame->release_userdata = userdata;
+	frame->pixfmt = pixfmt;
+	frame->width = width;
+	frame->height = height;
+	frame->padding_right = 0;
+	frame->padding_bottom = 0;
+	frame->data_baseptr = NULL;
+	frame->data_rawsize = 0;
+	for (i = 0; i < 4; i++)
+	{
+		frame->data[i] = i < planes ? data[i] : NULL;
+		frame->stride[i] = i < planes ? stride[i] : 0;
+	}
+
+	return frame;
+}
+
+/// Fill a scanline with a repeating 16 byte pattern
+///
+/// The pattern must consist of whole pixels, so it can be stored in 16 byte
+/// blocks starting at any pixel boundary.
+static INLINE void FillLine(char *line, size_t bytes, const char *pattern)
+{
+	size_t x = 0;
+#if VSYNTH_SSE2
+	__m128i p = _mm_loadu_si128((const __m128i *)pattern);
+	for (; x + 64 <= bytes; x += 64)
+	{
+		_mm_storeu_si128((__m128i *)(line + x), p);
+		_mm_storeu_si128((__m128i *)(line + x + 16), p);
+		_mm_storeu_si128((__m128i *)(line + x + 32), p);
+		_mm_storeu_si128((__m128i *)(line + x + 48), p);
+	}
+	for (; x + 16 <= bytes; x += 16)
+		_mm_storeu_si128((__m128i *)(line + x), p);
+#else
+	for (; x + 16 <= bytes; x += 16)
+		memcpy(line + x, pattern, 16);
+#endif
+	if (x < bytes)
+		memcpy(line + x, pattern, bytes - x);
+}
+
+VSYNTH_API(void) Vs_Stdframe_FillPlane(Vs_StandardFrame frame, size_t plane, const void *pixel)
+{
+	size_t pixelsize = STDPIXFMT_pixelsize(frame->pixfmt);
+	size_t wscale, hscale, bytes, lines, y, i;
+	char pattern[16];
+	char *line;
+
+	if (plane >= STDPIXFMT_planecount(frame->pixfmt))
+		return;
+	wscale = STDPIXFMT_planewidthscale(frame->pixfmt, plane);
+	hscale = STDPIXFMT_planeheightscale(frame->pixfmt, plane);
+	bytes = (frame->width + wscale-1) / wscale * pixelsize;
+	lines = (frame->height + hscale-1) / hscale;
+
+	// pixel sizes are all powers of two up to 8, so they divide 16
+	for (i = 0; i < sizeof(pattern); i += pixelsize)
+		memcpy(pattern + i, pixel, pixelsize);
+
+	line = (char *)frame->data[plane];
+	for (y = 0; y < lines; y++)
+	{
+		FillLine(line, bytes, pattern);
+		line += frame->stride[plane];
+	}
+}
+
+/// Copies larger than this bypass the cache with non-temporal stores
+///
+/// A copy this large would evict most of the cache anyway, and the
+/// destination is usually not read again until much later.
+#define STREAM_THRESHOLD (4 * 1024 * 1024)
+
+/// Copy a scanline using normal stores
+static INLINE void CopyLine(char *dst, const char *src, size_t bytes)
+{
+	size_t x = 0;
+#if VSYNTH_SSE2
+	for (; x + 64 <= bytes; x += 64)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i *)(src + x));
+		__m128i b = _mm_loadu_si128((const __m128i *)(src + x + 16));
+		__m128i c = _mm_loadu_si128((const __m128i *)(src + x + 32));
+		__m128i d = _mm_loadu_si128((const __m128i *)(src + x + 48));
+		_mm_storeu_si128((__m128i *)(dst + x), a);
+		_mm_storeu_si128((__m128i *)(dst + x + 16), b);
+		_mm_storeu_si128((__m128i *)(dst + x + 32), c);
+		_mm_storeu_si128((__m128i *)(dst + x + 48), d);
+	}
+#endif
+	memcpy(dst + x, src + x, bytes - x);
+}
+
+/// Copy a scanline using non-temporal stores where possible
+///
+/// Falls back on normal stores without SSE2. The caller must issue a store
+/// fence after the last line.
+static INLINE void StreamLine(char *dst, const char *src, size_t bytes)
+{
+#if VSYNTH_SSE2
+	size_t x = 0;
+	// non-temporal stores must be aligned, do the head normally
+	size_t head = (16 - ((uintptr_t)dst & 15)) & 15;
+	if (head > bytes)
+		head = bytes;
+	memcpy(dst, src, head);
+	for (x = head; x + 64 <= bytes; x += 64)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i *)(src + x));
+		__m128i b = _mm_loadu_si128((const __m128i *)(src + x + 16));
+		__m128i c = _mm_loadu_si128((const __m128i *)(src + x + 32));
+		__m128i d = _mm_loadu_si128((const __m128i *)(src + x + 48));
+		_mm_stream_si128((__m128i *)(dst + x), a);
+		_mm_stream_si128((__m128i *)(dst + x + 16), b);
+		_mm_stream_si128((__m128i *)(dst + x + 32), c);
+		_mm_stream_si128((__m128i *)(dst + x + 48), d);
+	}
+	for (; x + 16 <= bytes; x += 16)
+		_mm_stream_si128((__m128i *)(dst + x), _mm_loadu_si128((const __m128i *)(src + x)));
+	memcpy(dst + x, src + x, bytes - x);
+#else
+	CopyLine(dst, src, bytes);
+#endif
+}
+
+VSYNTH_API(int) Vs_Stdframe_CopyRegion(Vs_StandardFrame dst, size_t dst_x, size_t dst_y, Vs_StandardFrame src, size_t src_x, size_t src_y, size_t width, size_t height)
+{
+	size_t pixelsize = STDPIXFMT_pixelsize(src->pixfmt);
+	size_t planes = STDPIXFMT_planecount(src->pixfmt);
+	size_t wscale, hscale, bytes, lines, total = 0;
+	size_t i, y;
+	const char *sline;
+	char *dline;
+	int stream;
+
+	if (dst->pixfmt != src->pixfmt || pixelsize == 0)
+		return 0;
+	if (src_x > src->width || width > src->width - src_x || src_y > src->height || height > src->height - src_y)
+		return 0;
+	if (dst_x > dst->width || width > dst->width - dst_x || dst_y > dst->height || height > dst->height - dst_y)
+		return 0;
+	if (width == 0 || height == 0)
+		return 1;
+
+	for (i = 0; i < planes; i++)
+	{
+		hscale = STDPIXFMT_planeheightscale(src->pixfmt, i);
+		wscale = STDPIXFMT_planewidthscale(src->pixfmt, i);
+		total += (width + wscale-1) / wscale * pixelsize * ((height + hscale-1) / hscale);
+	}
+	stream = total >= STREAM_THRESHOLD;
+
+	for (i = 0; i < planes; i++)
+	{
+		wscale = STDPIXFMT_planewidthscale(src->pixfmt, i);
+		hscale = STDPIXFMT_planeheightscale(src->pixfmt, i);
+		// a subsampled pixel is copied if any of the pixels it covers is
+		bytes = ((src_x + width + wscale-1) / wscale - src_x / wscale) * pixelsize;
+		lines = (src_y + height + hscale-1) / hscale - src_y / hscale;
+
+		sline = (const char *)src->data[i] + src_x / wscale * pixelsize + (ptrdiff_t)(src_y / hscale) * src->stride[i];
+		dline = (char *)dst->data[i] + dst_x / wscale * pixelsize + (ptrdiff_t)(dst_y / hscale) * dst->stride[i];
+
+		// strides may be negative or include padding, so go line by line
+		for (y = 0; y < lines; y++)
+		{
+			if (stream)
+				StreamLine(dline, sline, bytes);
+			else
+				CopyLine(dline, sline, bytes);
+			sline += src->stride[i];
+			dline += dst->stride[i];
+		}
+	}
+
+#if VSYNTH_SSE2
+	if (stream)
+		_mm_sfence();
+#endif
+
+	return 1;
+}
+
 INLINE VSYNTH_API(Vs_StandardFrame) Vs_Stdframe_Get(Vs_Frame frame)
 {
 	if (frame->methods == &Vs_stdframe_vtable.base)
@@ -328,7 +478,189 @@ INLINE VSYNTH_API(Vs_StandardFrame) Vs_Stdframe_Get(Vs_Frame frame)
 }
 
 
-#define STDFRAME_4CID "StdF"
+/// Slices shorter than this aren't worth the scheduling
+#define MIN_SLICE_HEIGHT 16
+
+struct SliceRun {
+	Vs_StandardFrame frame;
+	size_t count;
+	/// Slice boundaries are multiples of this
+	size_t align;
+	Vs_StdframeSliceFunc func;
+	void *userdata;
+};
+
+VSYNTH_IMPLEMENT_METHOD(void, RunSlice)(size_t index, void *userdata)
+{
+	struct SliceRun *run = (struct SliceRun *)userdata;
+	Vs_StandardFrame frame = run->frame;
+	struct Vs_StdframeSlice slice;
+	size_t planes = STDPIXFMT_planecount(frame->pixfmt);
+	size_t bottom, hscale, i;
+
+	slice.index = index;
+	slice.top = frame->height * index / run->count / run->align * run->align;
+	bottom = frame->height;
+	if (index + 1 < run->count)
+		bottom = frame->height * (index + 1) / run->count / run->align * run->align;
+	if (bottom <= slice.top)
+		return;
+	slice.height = bottom - slice.top;
+
+	for (i = 0; i < 4; i++)
+	{
+		slice.plane_top[i] = 0;
+		slice.plane_height[i] = 0;
+		if (i >= planes)
+			continue;
+		// top is a multiple of every plane's scale, only the last slice can end mid-line
+		hscale = STDPIXFMT_planeheightscale(frame->pixfmt, i);
+		slice.plane_top[i] = slice.top / hscale;
+		slice.plane_height[i] = (bottom + hscale-1) / hscale - slice.plane_top[i];
+	}
+
+	run->func(frame, &slice, run->userdata);
+}
+
+VSYNTH_API(void) Vs_Stdframe_RunSlices(Vs_Library vsynth, Vs_StandardFrame frame, size_t granularity, Vs_StdframeSliceFunc func, void *userdata)
+{
+	struct SliceRun run;
+	size_t planes = STDPIXFMT_planecount(frame->pixfmt);
+	size_t hscale, minheight, i;
+
+	run.frame = frame;
+	run.func = func;
+	run.userdata = userdata;
+
+	// line up with every plane's subsampling as well as the caller's groups
+	run.align = granularity > 1 ? granularity : 1;
+	for (i = 0; i < planes; i++)
+	{
+		hscale = STDPIXFMT_planeheightscale(frame->pixfmt, i);
+		if (run.align % hscale != 0)
+			run.align *= hscale;
+	}
+
+	// as many slices as threads to run them, counting the caller
+	run.count = 1;
+	if (vsynth != NULL)
+		run.count = vsynth->ThreadPool->GetThreadCount(vsynth) + 1;
+	minheight = run.align > MIN_SLICE_HEIGHT ? run.align : MIN_SLICE_HEIGHT;
+	if (run.count > frame->height / minheight)
+		run.count = frame->height / minheight;
+	if (run.count <= 1)
+	{
+		run.count = 1;
+		RunSlice(0, &run);
+		return;
+	}
+
+	vsynth->ThreadPool->Run(vsynth, run.count, RunSlice, &run);
+}
+
+
+/// Cost of a matrix, transfer curve or chroma resampling step
+#define STEP_COST 8
+/// Cost of losing information, more than any lossless conversion
+#define LOSS_COST 1024
+
+/// Bytes per pixel over all planes, in quarter bytes
+static unsigned int QuarterBytes(enum Vs_StdframePixelFormat pixfmt)
+{
+	size_t planes = STDPIXFMT_planecount(pixfmt);
+	size_t plane, total = 0;
+
+	for (plane = 0; plane < planes; plane++)
+		total += 4 * STDPIXFMT_pixelsize(pixfmt) / (STDPIXFMT_planewidthscale(pixfmt, plane) * STDPIXFMT_planeheightscale(pixfmt, plane));
+	return (unsigned int)total;
+}
+
+static int IsRGB(enum Vs_StdframePixelFormat pixfmt)
+{
+	return pixfmt >= STDPIXFMT_XRGB8 && pixfmt <= STDPIXFMT_ARGB16;
+}
+
+static int IsMono(enum Vs_StdframePixelFormat pixfmt)
+{
+	return pixfmt == STDPIXFMT_MONO8 || pixfmt == STDPIXFMT_MONO16;
+}
+
+static int HasAlpha(enum Vs_StdframePixelFormat pixfmt)
+{
+	return pixfmt == STDPIXFMT_ARGB8 || pixfmt == STDPIXFMT_ARGB16 || STDPIXFMT_planecount(pixfmt) == 4;
+}
+
+/// The 16 bit mono and RGB pixfmts have linear gamma
+static int IsLinear(enum Vs_StdframePixelFormat pixfmt)
+{
+	return pixfmt == STDPIXFMT_MONO16 || pixfmt == STDPIXFMT_XRGB16 || pixfmt == STDPIXFMT_ARGB16;
+}
+
+/// Bytes per sample of one channel
+static size_t SampleSize(enum Vs_StdframePixelFormat pixfmt)
+{
+	// the RGB pixfmts pack four channels into a pixel
+	return IsRGB(pixfmt) ? STDPIXFMT_pixelsize(pixfmt) / 4 : STDPIXFMT_pixelsize(pixfmt);
+}
+
+/// Chroma samples per pixel in quarters, 0 for mono
+static unsigned int ChromaQuarters(enum Vs_StdframePixelFormat pixfmt)
+{
+	if (IsMono(pixfmt))
+		return 0;
+	return (unsigned int)(4 / (STDPIXFMT_planewidthscale(pixfmt, 1) * STDPIXFMT_planeheightscale(pixfmt, 1)));
+}
+
+VSYNTH_API(unsigned int) Vs_Stdframe_ConversionCost(enum Vs_StdframePixelFormat from, enum Vs_StdframePixelFormat to)
+{
+	unsigned int cost;
+
+	if (from == to)
+		return 0;
+	cost = QuarterBytes(from) + QuarterBytes(to);
+	if (!IsMono(from) && !IsMono(to) && IsRGB(from) != IsRGB(to))
+		cost += STEP_COST;
+	if (IsLinear(from) != IsLinear(to))
+		cost += STEP_COST;
+	if (ChromaQuarters(from) != 0 && ChromaQuarters(to) != 0 && ChromaQuarters(from) != ChromaQuarters(to))
+		cost += STEP_COST;
+
+	// whatever the target can hold but the source lacks is lost
+	if (ChromaQuarters(from) < ChromaQuarters(to))
+		cost += LOSS_COST;
+	if (HasAlpha(to) && !HasAlpha(from))
+		cost += LOSS_COST;
+	if (SampleSize(from) < SampleSize(to))
+		cost += LOSS_COST;
+	return cost;
+}
+
+VSYNTH_API(size_t) Vs_Stdframe_RankPixfmts(enum Vs_StdframePixelFormat target, const enum Vs_StdframePixelFormat *accepted, enum Vs_StdframePixelFormat *out)
+{
+	unsigned int costs[STDPIXFMT_MAX];
+	enum Vs_StdframePixelFormat pixfmt;
+	unsigned int cost;
+	size_t count, j;
+
+	// insertion sort, stable and the lists are short
+	for (count = 0; count < STDPIXFMT_MAX; count++)
+	{
+		pixfmt = accepted != NULL ? accepted[count] : (enum Vs_StdframePixelFormat)count;
+		if (pixfmt == STDPIXFMT_MAX)
+			break;
+		cost = Vs_Stdframe_ConversionCost(pixfmt, target);
+		for (j = count; j > 0 && costs[j - 1] > cost; j--)
+		{
+			costs[j] = costs[j - 1];
+			out[j] = out[j - 1];
+		}
+		costs[j] = cost;
+		out[j] = pixfmt;
+	}
+	out[count] = STDPIXFMT_MAX;
+	return count;
+}
+
 
 VSYNTH_API(void) Vs_Stdframe_InitFTD(struct Vs_StandardFrameTypeDescription *ftd)
 {
@@ -346,6 +678,10 @@ VSYNTH_API(void) Vs_Stdframe_InitFTD(struct Vs_StandardFrameTypeDescription *ftd
 	ftd->height_modulo = 0;
 	ftd->minheight = 0;
 	ftd->maxheight = SIZE_MAX;
+
+	ftd->alignment = 0;
+	ftd->padding_right = 0;
+	ftd->padding_bottom = 0;
 }
 
 VSYNTH_API(struct Vs_StandardFrameTypeDescription *) Vs_Stdframe_CheckFTD(Vs_FrameTypeDescription *ftd)
@@ -354,5 +690,6 @@ VSYNTH_API(struct Vs_StandardFrameTypeDescription *) Vs_Stdframe_CheckFTD(Vs_Fra
 	{
 		return (struct Vs_StandardFrameTypeDescription *)ftd;
 	}
+	return NULL;
 }
 
@@ -0,0 +1,507 @@
+#ifdef __linux__
+# define _GNU_SOURCE // for O_DIRECT
+#endif
+#ifndef _WIN32
+# define _FILE_OFFSET_BITS 64
+#endif
+
+#include <vsynth/stdsink.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "sinkthread.h"
+
+#ifndef _WIN32
+# include <sys/types.h>
+# include <sys/stat.h>
+# include <fcntl.h>
+# include <errno.h>
+# include <unistd.h>
+#endif
+
+
+#define DEFAULT_BUFFER_SIZE (4 << 20)
+#define DEFAULT_TIMESCALE 90000
+/// Alignment of buffers, sizes and file offsets for direct I/O
+///
+/// A page is a multiple of every common sector size.
+#define DIRECT_ALIGNMENT 4096
+
+
+/*
+	Output file
+*/
+
+/// A file written at explicit offsets, so writes need no seeking
+struct SinkFile {
+#ifdef _WIN32
+	HANDLE h;
+#else
+	int fd;
+#endif
+	const char *path;
+	/// Non-zero while the file bypasses the cache
+	int direct;
+};
+
+/// Create or truncate the file, returns non-zero on success
+static int File_Open(struct SinkFile *file, const char *path, int direct)
+{
+	file->path = path;
+	file->direct = 0;
+#ifdef _WIN32
+	file->h = INVALID_HANDLE_VALUE;
+	if (direct)
+	{
+		file->h = CreateFileA(path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_NO_BUFFERING, NULL);
+		file->direct = file->h != INVALID_HANDLE_VALUE;
+	}
+	if (file->h == INVALID_HANDLE_VALUE)
+		file->h = CreateFileA(path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	return file->h != INVALID_HANDLE_VALUE;
+#else
+	file->fd = -1;
+# ifdef O_DIRECT
+	if (direct)
+	{
+		// file systems without direct I/O refuse the flag here or on the first write
+		file->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0666);
+		file->direct = file->fd >= 0;
+	}
+# endif
+	if (file->fd < 0)
+		file->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	return file->fd >= 0;
+#endif
+}
+
+/// Go back to cached writes, for a write of unaligned size
+static int File_DropDirect(struct SinkFile *file)
+{
+	if (!file->direct)
+		return 1;
+	file->direct = 0;
+#ifdef _WIN32
+	// the flag can't be changed on an open handle
+	CloseHandle(file->h);
+	file->h = CreateFileA(file->path, GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	return file->h != INVALID_HANDLE_VALUE;
+#else
+	return fcntl(file->fd, F_SETFL, fcntl(file->fd, F_GETFL) & ~O_DIRECT) == 0;
+#endif
+}
+
+/// Write all of data at a file offset, returns non-zero on success
+static int File_WriteAt(struct SinkFile *file, const unsigned char *data, size_t size, unsigned long long offset)
+{
+#ifdef _WIN32
+	OVERLAPPED ov;
+	DWORD chunk, written;
+
+	while (size > 0)
+	{
+		chunk = size > 0x40000000 ? 0x40000000 : (DWORD)size;
+		memset(&ov, 0, sizeof(ov));
+		ov.Offset = (DWORD)offset;
+		ov.OffsetHigh = (DWORD)(offset >> 32);
+		if (!WriteFile(file->h, data, chunk, &written, &ov) || written == 0)
+			return 0;
+		data += written;
+		size -= written;
+		offset += written;
+	}
+	return 1;
+#else
+	ssize_t written;
+
+	while (size > 0)
+	{
+		written = pwrite(file->fd, data, size, (off_t)offset);
+		if (written < 0 && errno == EINTR)
+			continue;
+		if (written <= 0)
+			return 0;
+		data += written;
+		size -= (size_t)written;
+		offset += (unsigned long long)written;
+	}
+	return 1;
+#endif
+}
+
+static void File_Close(struct SinkFile *file)
+{
+#ifdef _WIN32
+	if (file->h != INVALID_HANDLE_VALUE)
+		CloseHandle(file->h);
+#else
+	if (file->fd >= 0)
+		close(file->fd);
+#endif
+}
+
+
+/*
+	Double buffered writer
+*/
+
+struct Sink {
+	struct SinkFile file;
+	SinkMutex mutex;
+	SinkCond cond;
+	SinkThread thread;
+	unsigned char *buffers[2];
+	size_t buffer_size;
+	/// Bytes of each buffer waiting to be written, 0 if the buffer is free
+	size_t pending[2];
+	/// Buffer being filled, and the bytes in it
+	int current;
+	size_t used;
+	/// Set when the serialiser has handed over its last buffer
+	int stop;
+	/// Set by the writer when a write failed, later buffers are discarded
+	int failed;
+	unsigned long long bytes;
+	unsigned long long write_wait_ns;
+	/// Frame rate for the Y4M header
+	unsigned long long rate_num, rate_den;
+};
+
+/// Writer thread, writes the buffers out in the order they are handed over
+static SINKTHREAD_ENTRY(Sink_WriterMain)
+{
+	struct Sink *sink = (struct Sink *)arg;
+	unsigned long long offset = 0;
+	size_t size;
+	int ok, b = 0;
+
+	for (;;)
+	{
+		SinkMutex_Lock(&sink->mutex);
+		while (sink->pending[b] == 0 && !sink->stop)
+			SinkCond_Wait(&sink->cond, &sink->mutex);
+		size = sink->pending[b];
+		ok = !sink->failed;
+		SinkMutex_Unlock(&sink->mutex);
+		if (size == 0)
+			break;
+
+		if (ok)
+		{
+			// only the last buffer can be partly full
+			if (sink->file.direct && size % DIRECT_ALIGNMENT != 0)
+				ok = File_DropDirect(&sink->file);
+			if (ok && !File_WriteAt(&sink->file, sink->buffers[b], size, offset))
+				ok = sink->file.direct && File_DropDirect(&sink->file) && File_WriteAt(&sink->file, sink->buffers[b], size, offset);
+			offset += size;
+		}
+
+		SinkMutex_Lock(&sink->mutex);
+		sink->pending[b] = 0;
+		if (!ok)
+			sink->failed = 1;
+		SinkCond_Broadcast(&sink->cond);
+		SinkMutex_Unlock(&sink->mutex);
+		b ^= 1;
+	}
+	return 0;
+}
+
+/// Hand the current buffer to the writer and wait for the other one to be free
+static int Sink_Submit(struct Sink *sink)
+{
+	unsigned long long start;
+	int ok;
+
+	if (sink->used == 0)
+		return 1;
+	SinkMutex_Lock(&sink->mutex);
+	sink->pending[sink->current] = sink->used;
+	SinkCond_Broadcast(&sink->cond);
+	sink->current ^= 1;
+	start = SinkTime_Now();
+	while (sink->pending[sink->current] != 0)
+		SinkCond_Wait(&sink->cond, &sink->mutex);
+	sink->write_wait_ns += SinkTime_Now() - start;
+	ok = !sink->failed;
+	SinkMutex_Unlock(&sink->mutex);
+	sink->used = 0;
+	return ok;
+}
+
+/// Append bytes to the output, returns zero if writing has failed
+static int Sink_Put(struct Sink *sink, const void *data, size_t size)
+{
+	const unsigned char *src = (const unsigned char *)data;
+	size_t chunk;
+
+	sink->bytes += size;
+	while (size > 0)
+	{
+		chunk = sink->buffer_size - sink->used;
+		if (chunk > size)
+			chunk = size;
+		memcpy(sink->buffers[sink->current] + sink->used, src, chunk);
+		sink->used += chunk;
+		src += chunk;
+		size -= chunk;
+		if (sink->used == sink->buffer_size && !Sink_Submit(sink))
+			return 0;
+	}
+	return 1;
+}
+
+
+/*
+	Serialisation
+*/
+
+static int LittleEndian(void)
+{
+	const uint16_t one = 1;
+	return *(const unsigned char *)&one == 1;
+}
+
+/// Y4M colourspace tag of a pixfmt, NULL if Y4M can't store it
+static const char *Y4mColorspace(enum Vs_StdframePixelFormat pixfmt)
+{
+	switch (pixfmt)
+	{
+	case STDPIXFMT_MONO8: return "mono";
+	case STDPIXFMT_MONO16: return "mono16";
+	case STDPIXFMT_YCrCb8_444: return "444";
+	case STDPIXFMT_YCrCbA8_444: return "444alpha";
+	case STDPIXFMT_YCrCb16_444: return "444p16";
+	case STDPIXFMT_YCrCb8_422: return "422";
+	case STDPIXFMT_YCrCb16_422: return "422p16";
+	case STDPIXFMT_YCrCb8_420: return "420jpeg";
+	case STDPIXFMT_YCrCb16_420: return "420p16";
+	default: return NULL;
+	}
+}
+
+static unsigned long long Gcd(unsigned long long a, unsigned long long b)
+{
+	unsigned long long t;
+	while (b != 0)
+	{
+		t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+/// Find the frame rate for the Y4M header, returns zero if it can't be derived
+static int Y4mRate(Vs_ActiveFilter filter, const struct Vs_StdsinkOptions *options, unsigned long long *num, unsigned long long *den)
+{
+	unsigned long long timescale = options->timescale ? options->timescale : DEFAULT_TIMESCALE;
+	Vs_FrameNumber count;
+	Vs_Timestamp duration;
+
+	if (options->rate_num != 0 && options->rate_den != 0)
+	{
+		*num = options->rate_num;
+		*den = options->rate_den;
+		return 1;
+	}
+
+	// the average rate over the stream, exact unless frame timestamps were rounded
+	count = filter->methods->get_frame_count(filter);
+	duration = filter->methods->get_duration(filter);
+	if (count == FRAMECOUNT_UNKNOWN || duration == DURATION_UNKNOWN)
+		return 0;
+	if (count == 0 || duration == 0 || (unsigned long long)count > ~0ULL / timescale)
+		return 0;
+	*num = (unsigned long long)count * timescale;
+	*den = (unsigned long long)duration;
+	return 1;
+}
+
+/// Write the Y4M stream header, returns an error message or NULL
+static const char *PutY4mHeader(struct Sink *sink, Vs_StandardFrame frame)
+{
+	const char *colorspace = Y4mColorspace(frame->pixfmt);
+	unsigned long long num = sink->rate_num, den = sink->rate_den, g;
+	char header[256];
+	int len;
+
+	if (colorspace == NULL)
+		return "The pixfmt can't be stored in Y4M";
+	g = Gcd(num, den);
+	len = snprintf(header, sizeof(header), "YUV4MPEG2 W%lu H%lu F%llu:%llu Ip A1:1 C%s\n",
+		(unsigned long)frame->width, (unsigned long)frame->height, num / g, den / g, colorspace);
+	if (!Sink_Put(sink, header, (size_t)len))
+		return "Writing the file failed";
+	return NULL;
+}
+
+/// Write the planes of a frame, returns zero if writing has failed
+static int PutFrame(struct Sink *sink, Vs_StandardFrame frame)
+{
+	// file order is Y, Cb, Cr, A, stdframe order is Y, Cr, Cb, A
+	static const size_t file_order[4] = { 0, 2, 1, 3 };
+	size_t planes = STDPIXFMT_planecount(frame->pixfmt);
+	size_t pixelsize = STDPIXFMT_pixelsize(frame->pixfmt);
+	int swap = (pixelsize == 2 || pixelsize == 8) && !LittleEndian();
+	unsigned char line[2048];
+	uint16_t v;
+	const unsigned char *row;
+	size_t i, p, y, x, k, chunk, rows, row_bytes, wscale, hscale;
+
+	for (i = 0; i < planes; i++)
+	{
+		p = planes == 1 ? 0 : file_order[i];
+		wscale = STDPIXFMT_planewidthscale(frame->pixfmt, p);
+		hscale = STDPIXFMT_planeheightscale(frame->pixfmt, p);
+		row_bytes = (frame->width + wscale-1) / wscale * pixelsize;
+		rows = (frame->height + hscale-1) / hscale;
+		for (y = 0; y < rows; y++)
+		{
+			row = (const unsigned char *)frame->data[p] + (ptrdiff_t)y * frame->stride[p];
+			if (!swap)
+			{
+				if (!Sink_Put(sink, row, row_bytes))
+					return 0;
+				continue;
+			}
+			// files hold 16 bit samples little endian
+			for (x = 0; x < row_bytes; x += chunk)
+			{
+				chunk = row_bytes - x < sizeof(line) ? row_bytes - x : sizeof(line);
+				for (k = 0; k < chunk / 2; k++)
+				{
+					memcpy(&v, row + x + 2*k, 2);
+					line[2*k] = (unsigned char)(v & 0xFF);
+					line[2*k + 1] = (unsigned char)(v >> 8);
+				}
+				if (!Sink_Put(sink, line, chunk))
+					return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+
+/// Serialise frames into the buffers while the writer thread writes them out
+///
+/// Returns an error message or NULL.
+static const char *Sink_Run(struct Sink *sink, Vs_Library vsynth, Vs_ActiveFilter filter, const struct Vs_StdsinkOptions *options, struct Vs_StdsinkStats *counters)
+{
+	Vs_FrameServer server;
+	Vs_Frame frame;
+	Vs_StandardFrame sf;
+	enum Vs_StdframePixelFormat pixfmt = STDPIXFMT_MAX;
+	size_t width = 0, height = 0;
+	unsigned long long start;
+	const char *msg = NULL;
+
+	SinkMutex_Init(&sink->mutex);
+	SinkCond_Init(&sink->cond);
+	if (!SinkThread_Start(&sink->thread, Sink_WriterMain, sink))
+	{
+		SinkCond_Destroy(&sink->cond);
+		SinkMutex_Destroy(&sink->mutex);
+		return "Cannot start the writer thread";
+	}
+
+	server = vsynth->FrameServer->Create(vsynth, filter, options->start, options->lookahead);
+	while (msg == NULL && (options->count == 0 || counters->frames < options->count))
+	{
+		start = SinkTime_Now();
+		frame = vsynth->FrameServer->Next(server, NULL);
+		counters->frame_wait_ns += SinkTime_Now() - start;
+		if (frame == NULL)
+			break;
+
+		sf = Vs_Stdframe_Get(frame);
+		if (sf == NULL)
+			msg = "The filter produced a frame that is not a stdframe";
+		else if (counters->frames == 0)
+		{
+			pixfmt = sf->pixfmt;
+			width = sf->width;
+			height = sf->height;
+			if (options->format == STDSINK_Y4M)
+				msg = PutY4mHeader(sink, sf);
+		}
+		else if (sf->pixfmt != pixfmt || sf->width != width || sf->height != height)
+			msg = "The pixfmt or size of the frames changed";
+
+		if (msg == NULL && options->format == STDSINK_Y4M && !Sink_Put(sink, "FRAME\n", 6))
+			msg = "Writing the file failed";
+		if (msg == NULL && !PutFrame(sink, sf))
+			msg = "Writing the file failed";
+		frame->methods->unref(frame);
+		if (msg == NULL)
+			counters->frames++;
+	}
+	vsynth->FrameServer->Destroy(server);
+
+	if (msg == NULL && !Sink_Submit(sink))
+		msg = "Writing the file failed";
+	SinkMutex_Lock(&sink->mutex);
+	sink->stop = 1;
+	SinkCond_Broadcast(&sink->cond);
+	SinkMutex_Unlock(&sink->mutex);
+	SinkThread_Join(&sink->thread);
+	if (msg == NULL && sink->failed)
+		msg = "Writing the file failed";
+
+	SinkCond_Destroy(&sink->cond);
+	SinkMutex_Destroy(&sink->mutex);
+	return msg;
+}
+
+
+/*
+	Sink
+*/
+
+VSYNTH_API(int) Vs_Stdsink_Write(Vs_Library vsynth, Vs_ActiveFilter filter, const char *path, const struct Vs_StdsinkOptions *options, struct Vs_StdsinkStats *stats, Vs_String *error)
+{
+	static const struct Vs_StdsinkOptions defaults;
+	struct Vs_StdsinkStats counters;
+	struct Sink sink;
+	unsigned long long begin;
+	const char *msg;
+
+	if (options == NULL)
+		options = &defaults;
+	memset(&counters, 0, sizeof(counters));
+	memset(&sink, 0, sizeof(sink));
+	begin = SinkTime_Now();
+
+	sink.buffer_size = options->buffer_size ? options->buffer_size : DEFAULT_BUFFER_SIZE;
+	sink.buffer_size = (sink.buffer_size + DIRECT_ALIGNMENT-1) / DIRECT_ALIGNMENT * DIRECT_ALIGNMENT;
+	sink.buffers[0] = (unsigned char *)Vs_AlignedAlloc(sink.buffer_size, DIRECT_ALIGNMENT);
+	sink.buffers[1] = (unsigned char *)Vs_AlignedAlloc(sink.buffer_size, DIRECT_ALIGNMENT);
+	// checked up front, so no file is created with a made up rate
+	if (options->format == STDSINK_Y4M && !Y4mRate(filter, options, &sink.rate_num, &sink.rate_den))
+		msg = "Cannot derive a frame rate from a stream of unknown length or duration, set rate_num and rate_den";
+	else if (sink.buffers[0] == NULL || sink.buffers[1] == NULL)
+		msg = "Out of memory";
+	else if (!File_Open(&sink.file, path, options->direct))
+		msg = "Cannot create the file";
+	else
+	{
+		msg = Sink_Run(&sink, vsynth, filter, options, &counters);
+		File_Close(&sink.file);
+	}
+	Vs_AlignedFree(sink.buffers[0]);
+	Vs_AlignedFree(sink.buffers[1]);
+
+	counters.bytes = sink.bytes;
+	counters.write_wait_ns = sink.write_wait_ns;
+	counters.elapsed_ns = SinkTime_Now() - begin;
+	if (stats != NULL)
+		*stats = counters;
+	if (msg != NULL)
+	{
+		*error = vsynth->String->Make(msg);
+		return 0;
+	}
+	return 1;
+}